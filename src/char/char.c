@@ -38,6 +38,7 @@
 char char_txt[1024] = "save/athena.txt";
 char friends_txt[1024] = "save/friends.txt";
 char hotkeys_txt[1024] = "save/hotkeys.txt";
+char char_journal_txt[1024] = "save/athena_journal.txt";
 char char_log_filename[1024] = "log/char.log";
 
 // show loading/saving messages
@@ -55,6 +56,7 @@ struct mmo_map_server {
 	uint32 ip;
 	uint16 port;
 	int users;
+	unsigned int cpu; // cpu usage of the last load report (permille)
 	unsigned short map[MAX_MAP_PER_SERVER];
 } server[MAX_MAP_SERVERS];
 
@@ -117,6 +119,8 @@ int char_num, char_max;
 int max_connect_user = 0;
 int gm_allow_level = 99;
 int autosave_interval = DEFAULT_AUTOSAVE_INTERVAL;
+int char_journal_flush_interval = 1000; // how often the journal is written to disk (ms)
+int char_journal_compact = 10000; // journal records that trigger a rewrite of the characters files
 int start_zeny = 0;
 int start_weapon = 1201;
 int start_armor = 2301;
@@ -145,6 +149,9 @@ int online_gm_display_min_level = 20; // minimum GM level to display 'GM' when w
 
 int console = 0;
 
+int map_assign_servers = 0; // number of map-servers sharing the maps with 'map_assign: yes' (0 = off)
+char map_assign_txt[1024] = "save/map_assign.txt";
+
 //-----------------------------------------------------
 // Auth database
 //-----------------------------------------------------
@@ -173,6 +180,7 @@ struct online_char_data {
 	int fd;
 	int waiting_disconnect;
 	short server; // -2: unknown server, -1: not connected, 0+: id of server
+	int save_seq; // sequence of the last save (0 for full saves), -1 if the delta saves (0x2b2a) can't be applied
 };
 
 static DBMap* online_char_db; // int account_id -> struct online_char_data*
@@ -186,6 +194,7 @@ static void* create_online_char_data(DBKey key, va_list args)
 	character->char_id = -1;
   	character->server = -1;
 	character->fd = -1;
+	character->save_seq = -1;
 	character->waiting_disconnect = INVALID_TIMER;
 	return character;
 }
@@ -232,6 +241,8 @@ void set_char_online(int map_id, int char_id, int account_id)
 	}
 
 	//Update state data
+	if( character->char_id != char_id )
+		character->save_seq = -1;
 	character->char_id = char_id;
 	character->server = map_id;
 
@@ -273,6 +284,7 @@ void set_char_offline(int char_id, int account_id)
 		{
 			character->char_id = -1;
 			character->server = -1;
+			character->save_seq = -1;
 		}
 
 		//FIXME? Why Kevin free'd the online information when the char was effectively in the map-server?
@@ -815,30 +827,6 @@ int mmo_char_fromstr(char *str, struct mmo_charstatus *p, struct global_reg *reg
 	p->delete_date = tmp_ulong[0];
 	p->robe = tmp_int[47];
 
-#ifndef TXT_SQL_CONVERT
-	// Some checks
-	for(i = 0; i < char_num; i++) {
-		if (char_dat[i].status.char_id == p->char_id) {
-			ShowError(CL_RED"mmmo_auth_init: a character has an identical id to another.\n");
-			ShowError("               character id #%d -> new character not readed.\n", p->char_id);
-			ShowError("               Character saved in log file."CL_RESET"\n");
-			return -1;
-		} else if (strcmp(char_dat[i].status.name, p->name) == 0) {
-			ShowError(CL_RED"mmmo_auth_init: a character name already exists.\n");
-			ShowError("               character name '%s' -> new character not read.\n", p->name);
-			ShowError("               Character saved in log file."CL_RESET"\n");
-			return -2;
-		}
-	}
-
-	if (strcmpi(wisp_server_name, p->name) == 0) {
-		ShowWarning("mmo_auth_init: ******WARNING: character name has wisp server name.\n");
-		ShowWarning("               Character name '%s' = wisp server name '%s'.\n", p->name, wisp_server_name);
-		ShowWarning("               Character readed. Suggestion: change the wisp server name.\n");
-		char_log("mmo_auth_init: ******WARNING: character name has wisp server name: Character name '%s' = wisp server name '%s'.\n",
-		          p->name, wisp_server_name);
-	}
-#endif //TXT_SQL_CONVERT
 	if (str[next] == '\n' || str[next] == '\r')
 		return 1;	// VKf[^
 
@@ -946,13 +934,57 @@ int mmo_char_fromstr(char *str, struct mmo_charstatus *p, struct global_reg *reg
 }
 
 //---------------------------------
-// Function to read friend list
+// Function to read a friend list line
 //---------------------------------
-int parse_friend_txt(struct mmo_charstatus *p)
+int mmo_friends_fromstr(char *line, struct mmo_charstatus *p)
 {
-	char line[1024], temp[1024];
+	char temp[1024];
 	int pos = 0, count = 0, next;
 	int i,len;
+
+	if (sscanf(line, "%d%n",&i, &pos) < 1)
+		return -1;
+	//Read friends
+	len = strlen(line);
+	next = pos;
+	for (count = 0; next < len && count < MAX_FRIENDS; count++)
+	{ //Read friends.
+		if (sscanf(line+next, ",%d,%d,%23[^,^\n]%n",&p->friends[count].account_id,&p->friends[count].char_id, p->friends[count].name, &pos) < 3)
+		{	//Invalid friend?
+			memset(&p->friends[count], 0, sizeof(p->friends[count]));
+			break;
+		}
+		next+=pos;
+		//What IF the name contains a comma? while the next field is not a 
+		//number, we assume it belongs to the current name. [Skotlex]
+		//NOTE: Of course, this will fail if someone sets their name to something like
+		//Bob,2005 but... meh, it's the problem of parsing a text file (encasing it in "
+		//won't do as quotes are also valid name chars!)
+		while(next < len && sscanf(line+next, ",%23[^,^\n]%n", temp, &pos) > 0)
+		{
+			if (atoi(temp)) //We read the next friend, just continue.
+				break;
+			//Append the name.
+			next+=pos;
+			i = strlen(p->friends[count].name);
+			if (i + strlen(temp) +1 < NAME_LENGTH)
+			{
+				p->friends[count].name[i] = ',';
+				strcpy(p->friends[count].name+i+1, temp);
+			}
+		} //End Guess Block
+	} //Friend's for.
+	return count;
+}
+
+//---------------------------------
+// Function to read friend list
+//---------------------------------
+int parse_friend_txt(struct mmo_charstatus *p)
+{
+	char line[1024];
+	int count = 0;
+	int i;
 	FILE *fp;
 
 	// Open the file and look for the ID
@@ -965,38 +997,9 @@ int parse_friend_txt(struct mmo_charstatus *p)
 	{
 		if(line[0] == '/' && line[1] == '/')
 			continue;
-		if (sscanf(line, "%d%n",&i, &pos) < 1 || i != p->char_id)
+		if (sscanf(line, "%d",&i) < 1 || i != p->char_id)
 			continue; //Not this line...
-		//Read friends
-		len = strlen(line);
-		next = pos;
-		for (count = 0; next < len && count < MAX_FRIENDS; count++)
-		{ //Read friends.
-			if (sscanf(line+next, ",%d,%d,%23[^,^\n]%n",&p->friends[count].account_id,&p->friends[count].char_id, p->friends[count].name, &pos) < 3)
-			{	//Invalid friend?
-				memset(&p->friends[count], 0, sizeof(p->friends[count]));
-				break;
-			}
-			next+=pos;
-			//What IF the name contains a comma? while the next field is not a 
-			//number, we assume it belongs to the current name. [Skotlex]
-			//NOTE: Of course, this will fail if someone sets their name to something like
-			//Bob,2005 but... meh, it's the problem of parsing a text file (encasing it in "
-			//won't do as quotes are also valid name chars!)
-			while(next < len && sscanf(line+next, ",%23[^,^\n]%n", temp, &pos) > 0)
-			{
-				if (atoi(temp)) //We read the next friend, just continue.
-					break;
-				//Append the name.
-				next+=pos;
-				i = strlen(p->friends[count].name);
-				if (i + strlen(temp) +1 < NAME_LENGTH)
-				{
-					p->friends[count].name[i] = ',';
-					strcpy(p->friends[count].name+i+1, temp);
-				}
-			} //End Guess Block
-		} //Friend's for.
+		count = mmo_friends_fromstr(line, p);
 		break; //Found friends.
 	}
 	fclose(fp);
@@ -1004,15 +1007,45 @@ int parse_friend_txt(struct mmo_charstatus *p)
 }
 
 //---------------------------------
-// Function to read hotkey list
+// Function to read a hotkey list line
 //---------------------------------
-int parse_hotkey_txt(struct mmo_charstatus *p)
+int mmo_hotkeys_fromstr(char *line, struct mmo_charstatus *p)
 {
 #ifdef HOTKEY_SAVING
-	char line[1024];
 	int pos = 0, count = 0, next;
 	int i,len;
 	int type, id, lv;
+
+	if (sscanf(line, "%d%n",&i, &pos) < 1)
+		return -1;
+	//Read hotkeys 
+	len = strlen(line);
+	next = pos;
+	for (count = 0; next < len && count < MAX_HOTKEYS; count++)
+	{
+		if (sscanf(line+next, ",%d,%d,%d%n",&type,&id,&lv, &pos) < 3)
+			//Invalid entry?
+			break;
+		p->hotkeys[count].type = type;
+		p->hotkeys[count].id = id;
+		p->hotkeys[count].lv = lv;
+		next+=pos;
+	}
+	return count;
+#else
+	return 0;
+#endif
+}
+
+//---------------------------------
+// Function to read hotkey list
+//---------------------------------
+int parse_hotkey_txt(struct mmo_charstatus *p)
+{
+#ifdef HOTKEY_SAVING
+	char line[1024];
+	int count = 0;
+	int i;
 	FILE *fp;
 
 	// Open the file and look for the ID
@@ -1024,21 +1057,9 @@ int parse_hotkey_txt(struct mmo_charstatus *p)
 	{
 		if(line[0] == '/' && line[1] == '/')
 			continue;
-		if (sscanf(line, "%d%n",&i, &pos) < 1 || i != p->char_id)
+		if (sscanf(line, "%d",&i) < 1 || i != p->char_id)
 			continue; //Not this line...
-		//Read hotkeys 
-		len = strlen(line);
-		next = pos;
-		for (count = 0; next < len && count < MAX_HOTKEYS; count++)
-		{
-			if (sscanf(line+next, ",%d,%d,%d%n",&type,&id,&lv, &pos) < 3)
-				//Invalid entry?
-				break;
-			p->hotkeys[count].type = type;
-			p->hotkeys[count].id = id;
-			p->hotkeys[count].lv = lv;
-			next+=pos;
-		}
+		count = mmo_hotkeys_fromstr(line, p);
 		break; //Found hotkeys.
 	}
 	fclose(fp);
@@ -1051,6 +1072,336 @@ int parse_hotkey_txt(struct mmo_charstatus *p)
 
 
 #ifndef TXT_SQL_CONVERT
+//---------------------------------------------------------
+// Character journal
+// Modified characters are appended to the journal instead of rewriting
+// the characters files. The files are rewritten (compacted) in the
+// background once the journal grows past char_journal_compact records.
+// Record types (one line each):
+//   C<tab><character line>  full character (see mmo_char_tostr)
+//   F<tab><friends line>    friends of the last character record
+//   H<tab><hotkeys line>    hotkeys of the last character record
+//   D<tab><char_id>         deleted character
+// When a compaction starts, the journal is renamed to <char_journal_txt>.old
+// and a new one is started. The old journal is removed once the new
+// characters files are complete. On startup both journals are replayed
+// on top of the characters files.
+//---------------------------------------------------------
+
+/// Time spent rewriting the characters files per main loop iteration, in ms.
+#define CHAR_SYNC_SLICE 10
+
+static FILE* journal_fp = NULL;
+static int journal_records = 0; // records written since the last compaction
+static bool journal_unsynced = false; // records not yet written to disk
+static int* journal_dirty = NULL; // indexes of the modified characters, -1 if deleted
+static int journal_dirty_num = 0;
+static int journal_dirty_max = 0;
+
+/// Incremental rewrite of the characters files.
+static struct {
+	bool running;
+	int* order; // char_dat indexes sorted by account and slot, -1 if deleted
+	int* pos; // position of each char_dat index in order, -1 if none
+	int num; // number of characters when the rewrite started
+	int next; // next position of order to write
+	FILE* fp[3]; // characters, friends, hotkeys
+	int lock[3];
+	unsigned int tick; // start of the rewrite
+	int tid;
+} char_sync = { false, NULL, NULL, 0, 0, { NULL, NULL, NULL }, { 0, 0, 0 }, 0, INVALID_TIMER };
+
+static const char* char_journal_oldtxt(void)
+{
+	static char oldtxt[sizeof(char_journal_txt)+4];
+	sprintf(oldtxt, "%s.old", char_journal_txt);
+	return oldtxt;
+}
+
+/// Appends the record of char_dat[index] to the journal.
+static void char_journal_write(int index)
+{
+	char line[65536];
+	struct character_data* cd = &char_dat[index];
+
+	mmo_char_tostr(line, &cd->status, cd->global, cd->global_num);
+	fprintf(journal_fp, "C\t%s\n", line);
+	mmo_friends_list_data_str(line, &cd->status);
+	fprintf(journal_fp, "F\t%s\n", line);
+#ifdef HOTKEY_SAVING
+	mmo_hotkeys_tostr(line, &cd->status);
+	fprintf(journal_fp, "H\t%s\n", line);
+#endif
+	journal_records++;
+}
+
+/// Writes the modified characters to the journal and syncs it to disk.
+static void char_journal_flush(void)
+{
+	int i;
+
+	if( journal_fp == NULL )
+		return;
+
+	for( i = 0; i < journal_dirty_num; i++ )
+	{
+		int index = journal_dirty[i];
+		if( index < 0 )
+			continue; // deleted
+		char_journal_write(index);
+		char_dat[index].journal_pos = 0;
+	}
+
+	if( journal_dirty_num > 0 || journal_unsynced )
+	{
+		journal_dirty_num = 0;
+		journal_unsynced = false;
+		if( lock_fsync(journal_fp) != 0 )
+		{
+			ShowError("char_journal_flush: failed to write the journal '%s'.\n", char_journal_txt);
+			char_log("ERROR: failed to write the journal '%s'.\n", char_journal_txt);
+		}
+	}
+}
+
+static int char_journal_flush_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	char_journal_flush();
+	return 0;
+}
+
+/// Marks a character of char_dat as modified.
+static void char_journal_mark(struct mmo_charstatus* cs)
+{
+	struct character_data* cd = (struct character_data*)cs; // status is the first member
+
+	if( journal_fp == NULL || cd->journal_pos )
+		return;
+
+	if( journal_dirty_num == journal_dirty_max )
+	{
+		journal_dirty_max += 256;
+		RECREATE(journal_dirty, int, journal_dirty_max);
+	}
+	journal_dirty[journal_dirty_num++] = (int)(cd - char_dat);
+	cd->journal_pos = journal_dirty_num;
+
+	if( char_journal_flush_interval == 0 )
+		char_journal_flush();
+}
+
+/// Records the deletion of char_dat[index].
+/// Must be called before the last character of char_dat is moved to index.
+static void char_journal_remove(int index)
+{
+	struct character_data* cd = &char_dat[index];
+	int last = char_num - 1;
+
+	if( journal_fp != NULL )
+	{
+		fprintf(journal_fp, "D\t%d\n", cd->status.char_id);
+		journal_unsynced = true;
+		journal_records++;
+	}
+
+	// update the list of modified characters
+	if( cd->journal_pos )
+		journal_dirty[cd->journal_pos-1] = -1;
+	cd->journal_pos = 0;
+	if( index != last && char_dat[last].journal_pos )
+	{
+		cd->journal_pos = char_dat[last].journal_pos;
+		journal_dirty[cd->journal_pos-1] = index;
+		char_dat[last].journal_pos = 0;
+	}
+
+	// update the running rewrite
+	if( char_sync.running && index < char_sync.num )
+	{
+		if( char_sync.pos[index] >= 0 )
+			char_sync.order[char_sync.pos[index]] = -1;
+		char_sync.pos[index] = -1;
+		if( index != last && last < char_sync.num )
+		{
+			char_sync.pos[index] = char_sync.pos[last];
+			if( char_sync.pos[index] >= 0 )
+				char_sync.order[char_sync.pos[index]] = index;
+			char_sync.pos[last] = -1;
+		}
+	}
+}
+
+/// Applies the records of a journal to char_dat.
+/// ids maps the char_id of each character to its index+1.
+/// Returns the number of records applied.
+static int char_journal_replay(const char* filename, DBMap* ids)
+{
+	char line[65536];
+	struct character_data* tmp;
+	int index = -1; // character of the last 'C' record
+	int line_count = 0;
+	int count = 0;
+	FILE* fp;
+
+	fp = fopen(filename, "r");
+	if( fp == NULL )
+		return 0;
+
+	CREATE(tmp, struct character_data, 1);
+	while( fgets(line, sizeof(line), fp) )
+	{
+		size_t len = strlen(line);
+		int char_id;
+
+		line_count++;
+		if( line[len-1] != '\n' )
+		{// the server stopped while writing this record
+			ShowWarning("char_journal_replay: incomplete record at the end of '%s', ignored.\n", filename);
+			break;
+		}
+		if( line[0] == '/' && line[1] == '/' )
+			continue;
+		if( line[1] != '\t' )
+		{
+			ShowWarning("char_journal_replay: invalid record in '%s', line #%d.\n", filename, line_count);
+			continue;
+		}
+
+		switch( line[0] )
+		{
+		case 'C':
+			memset(tmp, 0, sizeof(struct character_data));
+			if( mmo_char_fromstr(line+2, &tmp->status, tmp->global, &tmp->global_num) <= 0 )
+			{
+				ShowError("char_journal_replay: unable to read the character in '%s', line #%d.\n", filename, line_count);
+				char_log("Unable to read the character of the next journal line:\n%s", line+2);
+				index = -1;
+				break;
+			}
+			index = (int)(intptr_t)idb_get(ids, tmp->status.char_id) - 1;
+			if( index < 0 )
+			{// created character
+				if( char_num >= char_max )
+				{
+					char_max += 256;
+					RECREATE(char_dat, struct character_data, char_max);
+				}
+				index = char_num++;
+				idb_put(ids, tmp->status.char_id, (void*)(intptr_t)(index+1));
+			}
+			else
+			{// keep the lists in case their records are missing
+				memcpy(tmp->status.friends, char_dat[index].status.friends, sizeof(tmp->status.friends));
+				memcpy(tmp->status.hotkeys, char_dat[index].status.hotkeys, sizeof(tmp->status.hotkeys));
+			}
+			memcpy(&char_dat[index], tmp, sizeof(struct character_data));
+			char_dat[index].journal_pos = 0;
+			if( tmp->status.char_id >= char_id_count )
+				char_id_count = tmp->status.char_id + 1;
+			count++;
+			break;
+		case 'F':
+			if( index >= 0 && atoi(line+2) == char_dat[index].status.char_id )
+			{
+				memset(char_dat[index].status.friends, 0, sizeof(char_dat[index].status.friends));
+				mmo_friends_fromstr(line+2, &char_dat[index].status);
+			}
+			break;
+		case 'H':
+			if( index >= 0 && atoi(line+2) == char_dat[index].status.char_id )
+			{
+				memset(char_dat[index].status.hotkeys, 0, sizeof(char_dat[index].status.hotkeys));
+				mmo_hotkeys_fromstr(line+2, &char_dat[index].status);
+			}
+			break;
+		case 'D':
+			index = -1;
+			char_id = atoi(line+2);
+			if( (index = (int)(intptr_t)idb_remove(ids, char_id) - 1) >= 0 )
+			{
+				if( index != --char_num )
+				{
+					memcpy(&char_dat[index], &char_dat[char_num], sizeof(struct character_data));
+					idb_put(ids, char_dat[index].status.char_id, (void*)(intptr_t)(index+1));
+				}
+				count++;
+			}
+			index = -1;
+			break;
+		default:
+			ShowWarning("char_journal_replay: invalid record in '%s', line #%d.\n", filename, line_count);
+			break;
+		}
+	}
+	aFree(tmp);
+	fclose(fp);
+
+	return count;
+}
+
+//---------------------------------
+// Function to check a character read from the characters file
+// ids maps char_id to index+1, names holds the names
+//---------------------------------
+static int mmo_char_check(struct mmo_charstatus *p, DBMap* ids, DBMap* names)
+{
+	if (idb_exists(ids, p->char_id)) {
+		ShowError(CL_RED"mmmo_auth_init: a character has an identical id to another.\n");
+		ShowError("               character id #%d -> new character not readed.\n", p->char_id);
+		ShowError("               Character saved in log file."CL_RESET"\n");
+		return -1;
+	} else if (strdb_exists(names, p->name)) {
+		ShowError(CL_RED"mmmo_auth_init: a character name already exists.\n");
+		ShowError("               character name '%s' -> new character not read.\n", p->name);
+		ShowError("               Character saved in log file."CL_RESET"\n");
+		return -2;
+	}
+
+	if (strcmpi(wisp_server_name, p->name) == 0) {
+		ShowWarning("mmo_auth_init: ******WARNING: character name has wisp server name.\n");
+		ShowWarning("               Character name '%s' = wisp server name '%s'.\n", p->name, wisp_server_name);
+		ShowWarning("               Character readed. Suggestion: change the wisp server name.\n");
+		char_log("mmo_auth_init: ******WARNING: character name has wisp server name: Character name '%s' = wisp server name '%s'.\n",
+		          p->name, wisp_server_name);
+	}
+	return 1;
+}
+
+//---------------------------------
+// Function to read the friends and hotkeys files
+// ids maps char_id to index+1
+//---------------------------------
+static void mmo_char_init_lists(DBMap* ids)
+{
+	char line[1024];
+	int index;
+	FILE* fp;
+
+	fp = fopen(friends_txt, "r");
+	if (fp != NULL) {
+		while(fgets(line, sizeof(line), fp)) {
+			if (line[0] == '/' && line[1] == '/')
+				continue;
+			if ((index = (int)(intptr_t)idb_get(ids, atoi(line)) - 1) >= 0)
+				mmo_friends_fromstr(line, &char_dat[index].status);
+		}
+		fclose(fp);
+	}
+
+#ifdef HOTKEY_SAVING
+	fp = fopen(hotkeys_txt, "r");
+	if (fp != NULL) {
+		while(fgets(line, sizeof(line), fp)) {
+			if (line[0] == '/' && line[1] == '/')
+				continue;
+			if ((index = (int)(intptr_t)idb_get(ids, atoi(line)) - 1) >= 0)
+				mmo_hotkeys_fromstr(line, &char_dat[index].status);
+		}
+		fclose(fp);
+	}
+#endif
+}
+
 //---------------------------------
 // Function to read characters file
 //---------------------------------
@@ -1059,90 +1410,96 @@ int mmo_char_init(void)
 	char line[65536];
 	int ret, line_count;
 	FILE* fp;
+	DBMap* ids; // char_id -> index+1
+	DBMap* names;
 
 	char_num = 0;
 	char_max = 0;
 	char_dat = NULL;
 
+	ids = idb_alloc(DB_OPT_FLAT);
+	names = strdb_alloc(DB_OPT_DUP_KEY, NAME_LENGTH);
+
 	fp = fopen(char_txt, "r");
 
 	if (fp == NULL) {
 		ShowError("Characters file not found: %s.\n", char_txt);
 		char_log("Characters file not found: %s.\n", char_txt);
-		char_log("Id for the next created character: %d.\n", char_id_count);
-		return 0;
-	}
-
-	line_count = 0;
-	while(fgets(line, sizeof(line), fp))
-	{
-		int i, j;
-		line_count++;
-
-		if (line[0] == '/' && line[1] == '/')
-			continue;
+	} else {
+		line_count = 0;
+		while(fgets(line, sizeof(line), fp))
+		{
+			int i, j;
+			line_count++;
 
-		j = 0;
-		if (sscanf(line, "%d\t%%newid%%%n", &i, &j) == 1 && j > 0) {
-			if (char_id_count < i)
-				char_id_count = i;
-			continue;
-		}
+			if (line[0] == '/' && line[1] == '/')
+				continue;
 
-		if (char_num >= char_max) {
-			char_max += 256;
-			char_dat = (struct character_data*)aRealloc(char_dat, sizeof(struct character_data) * char_max);
-			if (!char_dat) {
-				ShowFatalError("Out of memory: mmo_char_init (realloc of char_dat).\n");
-				char_log("Out of memory: mmo_char_init (realloc of char_dat).\n");
-				exit(EXIT_FAILURE);
+			j = 0;
+			if (sscanf(line, "%d\t%%newid%%%n", &i, &j) == 1 && j > 0) {
+				if (char_id_count < i)
+					char_id_count = i;
+				continue;
 			}
-		}
 
-		ret = mmo_char_fromstr(line, &char_dat[char_num].status, char_dat[char_num].global, &char_dat[char_num].global_num);
+			if (char_num >= char_max) {
+				char_max += 256;
+				char_dat = (struct character_data*)aRealloc(char_dat, sizeof(struct character_data) * char_max);
+				if (!char_dat) {
+					ShowFatalError("Out of memory: mmo_char_init (realloc of char_dat).\n");
+					char_log("Out of memory: mmo_char_init (realloc of char_dat).\n");
+					exit(EXIT_FAILURE);
+				}
+			}
 
-		// Initialize friends list
-		parse_friend_txt(&char_dat[char_num].status);  // Grab friends for the character
-		// Initialize hotkey list
-		parse_hotkey_txt(&char_dat[char_num].status);  // Grab hotkeys for the character
-		
-		if (ret > 0) { // negative value or zero for errors
-			if (char_dat[char_num].status.char_id >= char_id_count)
-				char_id_count = char_dat[char_num].status.char_id + 1;
-			char_num++;
-		} else {
-			ShowError("mmo_char_init: in characters file, unable to read the line #%d.\n", line_count);
-			ShowError("               -> Character saved in log file.\n");
-			switch (ret) {
-			case -1:
-				char_log("Duplicate character id in the next character line (character not readed):\n");
-				break;
-			case -2:
-				char_log("Duplicate character name in the next character line (character not readed):\n");
-				break;
-			case -3:
-				char_log("Invalid memo point structure in the next character line (character not readed):\n");
-				break;
-			case -4:
-				char_log("Invalid inventory item structure in the next character line (character not readed):\n");
-				break;
-			case -5:
-				char_log("Invalid cart item structure in the next character line (character not readed):\n");
-				break;
-			case -6:
-				char_log("Invalid skill structure in the next character line (character not readed):\n");
-				break;
-			case -7:
-				char_log("Invalid register structure in the next character line (character not readed):\n");
-				break;
-			default: // 0
-				char_log("Unabled to get a character in the next line - Basic structure of line (before inventory) is incorrect (character not readed):\n");
-				break;
+			ret = mmo_char_fromstr(line, &char_dat[char_num].status, char_dat[char_num].global, &char_dat[char_num].global_num);
+			if (ret > 0)
+				ret = mmo_char_check(&char_dat[char_num].status, ids, names);
+
+			if (ret > 0) { // negative value or zero for errors
+				char_dat[char_num].journal_pos = 0;
+				idb_put(ids, char_dat[char_num].status.char_id, (void*)(intptr_t)(char_num+1));
+				strdb_put(names, char_dat[char_num].status.name, (void*)1);
+				if (char_dat[char_num].status.char_id >= char_id_count)
+					char_id_count = char_dat[char_num].status.char_id + 1;
+				char_num++;
+			} else {
+				ShowError("mmo_char_init: in characters file, unable to read the line #%d.\n", line_count);
+				ShowError("               -> Character saved in log file.\n");
+				switch (ret) {
+				case -1:
+					char_log("Duplicate character id in the next character line (character not readed):\n");
+					break;
+				case -2:
+					char_log("Duplicate character name in the next character line (character not readed):\n");
+					break;
+				case -3:
+					char_log("Invalid memo point structure in the next character line (character not readed):\n");
+					break;
+				case -4:
+					char_log("Invalid inventory item structure in the next character line (character not readed):\n");
+					break;
+				case -5:
+					char_log("Invalid cart item structure in the next character line (character not readed):\n");
+					break;
+				case -6:
+					char_log("Invalid skill structure in the next character line (character not readed):\n");
+					break;
+				case -7:
+					char_log("Invalid register structure in the next character line (character not readed):\n");
+					break;
+				default: // 0
+					char_log("Unabled to get a character in the next line - Basic structure of line (before inventory) is incorrect (character not readed):\n");
+					break;
+				}
+				char_log("%s", line);
 			}
-			char_log("%s", line);
 		}
+		fclose(fp);
+
+		// Initialize friends and hotkey lists
+		mmo_char_init_lists(ids);
 	}
-	fclose(fp);
 
 	if (char_num == 0) {
 		ShowNotice("mmo_char_init: No character found in %s.\n", char_txt);
@@ -1155,75 +1512,219 @@ int mmo_char_init(void)
 		char_log("mmo_char_init: %d characters read in %s.\n", char_num, char_txt);
 	}
 
+	// Recover the changes that were not written to the characters file
+	if (char_journal_txt[0] != '\0') {
+		ret = char_journal_replay(char_journal_oldtxt(), ids) + char_journal_replay(char_journal_txt, ids);
+		if (ret > 0) {
+			ShowStatus("mmo_char_init: %d records recovered from the journal, %d characters.\n", ret, char_num);
+			char_log("mmo_char_init: %d records recovered from the journal, %d characters.\n", ret, char_num);
+		}
+	}
+
+	db_destroy(ids);
+	db_destroy(names);
+
 	char_log("Id for the next created character: %d.\n", char_id_count);
 
 	return 0;
 }
 
+static int mmo_char_sync_cmp(const void* a, const void* b)
+{
+	const struct mmo_charstatus* p1 = &char_dat[*(const int*)a].status;
+	const struct mmo_charstatus* p2 = &char_dat[*(const int*)b].status;
+
+	// sort by account id, then by slot
+	if (p1->account_id != p2->account_id)
+		return (p1->account_id < p2->account_id) ? -1 : 1;
+	return (int)p1->slot - (int)p2->slot;
+}
+
 //---------------------------------------------------------
-// Function to save characters in files (speed up by [Yor])
+// Starts rewriting the characters files
 //---------------------------------------------------------
-void mmo_char_sync(void)
+static bool mmo_char_sync_start(void)
 {
-	char line[65536],f_line[1024];
-	int i, j, k;
-	int lock;
-	FILE *fp,*f_fp;
-	CREATE_BUFFER(id, int, char_num);
+	int i;
 
-	// Sorting before save (by [Yor])
-	for(i = 0; i < char_num; i++) {
-		id[i] = i;
-		for(j = 0; j < i; j++) {
-			if ((char_dat[i].status.account_id < char_dat[id[j]].status.account_id) ||
-			    // if same account id, we sort by slot.
-			    (char_dat[i].status.account_id == char_dat[id[j]].status.account_id &&
-			     char_dat[i].status.slot < char_dat[id[j]].status.slot)) {
-				for(k = i; k > j; k--)
-					id[k] = id[k-1];
-				id[j] = i; // id[i]
-				break;
-			}
-		}
-	}
+	if (char_sync.running)
+		return true;
 
-	// Data save
-	fp = lock_fopen(char_txt, &lock);
-	if (fp == NULL) {
+	char_sync.fp[0] = lock_fopen(char_txt, &char_sync.lock[0]);
+	if (char_sync.fp[0] == NULL) {
 		ShowWarning("Server cannot save characters.\n");
 		char_log("WARNING: Server cannot save characters.\n");
-	} else {
-		for(i = 0; i < char_num; i++) {
-			mmo_char_tostr(line, &char_dat[id[i]].status, char_dat[id[i]].global, char_dat[id[i]].global_num); // use of sorted index
-			fprintf(fp, "%s\n", line);
-		}
-		fprintf(fp, "%d\t%%newid%%\n", char_id_count);
-		lock_fclose(fp, char_txt, &lock);
+		return false;
 	}
+	char_sync.fp[1] = lock_fopen(friends_txt, &char_sync.lock[1]);
+#ifdef HOTKEY_SAVING
+	char_sync.fp[2] = lock_fopen(hotkeys_txt, &char_sync.lock[2]);
+#endif
 
-	// Friends List data save (davidsiaw)
-	f_fp = lock_fopen(friends_txt, &lock);
-	for(i = 0; i < char_num; i++) {
-		mmo_friends_list_data_str(f_line, &char_dat[id[i]].status);
-		fprintf(f_fp, "%s\n", f_line);
+	if (char_journal_txt[0] != '\0') {
+		// Start a new journal. The old one is kept until the rewrite is complete.
+		// If the old one still exists, the previous rewrite didn't complete and
+		// the current journal holds all the changes since then, so it is kept.
+		bool reopen = (journal_fp != NULL);
+		if (reopen) {
+			char_journal_flush();
+			fclose(journal_fp);
+			journal_fp = NULL;
+		}
+		if (!exists(char_journal_oldtxt()) && exists(char_journal_txt)) {
+			if (rename(char_journal_txt, char_journal_oldtxt()) == 0)
+				journal_records = 0;
+			else
+				ShowError("mmo_char_sync: failed to rename the journal '%s'.\n", char_journal_txt);
+		}
+		if (reopen && (journal_fp = fopen(char_journal_txt, "a")) == NULL) {
+			ShowError("mmo_char_sync: failed to open the journal '%s', characters are now only saved by rewriting the characters files.\n", char_journal_txt);
+			char_log("ERROR: failed to open the journal '%s'.\n", char_journal_txt);
+		}
 	}
 
-	lock_fclose(f_fp, friends_txt, &lock);
+	char_sync.num = char_num;
+	CREATE(char_sync.order, int, char_num+1);
+	CREATE(char_sync.pos, int, char_num+1);
+	for (i = 0; i < char_num; i++)
+		char_sync.order[i] = i;
+	qsort(char_sync.order, char_num, sizeof(int), mmo_char_sync_cmp);
+	for (i = 0; i < char_num; i++)
+		char_sync.pos[char_sync.order[i]] = i;
+	char_sync.next = 0;
+	char_sync.tick = gettick_nocache();
+	char_sync.running = true;
+
+	return true;
+}
+
+//---------------------------------------------------------
+// Writes the next characters to the characters files
+// Stops after budget ms (0: no limit), returns true when complete.
+//---------------------------------------------------------
+static bool mmo_char_sync_step(unsigned int budget)
+{
+	char line[65536];
+	unsigned int tick = gettick_nocache();
+	int n = 0;
+	int i;
 
+	while (char_sync.next < char_sync.num) {
+		if ((i = char_sync.order[char_sync.next++]) < 0)
+			continue; // deleted
+		mmo_char_tostr(line, &char_dat[i].status, char_dat[i].global, char_dat[i].global_num);
+		fprintf(char_sync.fp[0], "%s\n", line);
+		// Friends List data save (davidsiaw)
+		if (char_sync.fp[1]) {
+			mmo_friends_list_data_str(line, &char_dat[i].status);
+			fprintf(char_sync.fp[1], "%s\n", line);
+		}
 #ifdef HOTKEY_SAVING
-	// Hotkey List data save (Skotlex)
-	f_fp = lock_fopen(hotkeys_txt, &lock);
-	for(i = 0; i < char_num; i++) {
-		mmo_hotkeys_tostr(f_line, &char_dat[id[i]].status);
-		fprintf(f_fp, "%s\n", f_line);
+		// Hotkey List data save (Skotlex)
+		if (char_sync.fp[2]) {
+			mmo_hotkeys_tostr(line, &char_dat[i].status);
+			fprintf(char_sync.fp[2], "%s\n", line);
+		}
+#endif
+		if (budget && (++n&63) == 0 && DIFF_TICK(gettick_nocache(), tick) >= (int)budget)
+			return false;
+	}
+
+	fprintf(char_sync.fp[0], "%d\t%%newid%%\n", char_id_count);
+	lock_fclose(char_sync.fp[0], char_txt, &char_sync.lock[0]);
+	if (char_sync.fp[1])
+		lock_fclose(char_sync.fp[1], friends_txt, &char_sync.lock[1]);
+#ifdef HOTKEY_SAVING
+	if (char_sync.fp[2])
+		lock_fclose(char_sync.fp[2], hotkeys_txt, &char_sync.lock[2]);
+#endif
+	memset(char_sync.fp, 0, sizeof(char_sync.fp));
+
+	// the characters files now hold everything the old journal had
+	if (char_journal_txt[0] != '\0') {
+		remove(char_journal_oldtxt());
+		if (journal_fp == NULL)
+			remove(char_journal_txt); // not in use (startup/shutdown)
+	}
+
+	aFree(char_sync.order);
+	aFree(char_sync.pos);
+	char_sync.order = NULL;
+	char_sync.pos = NULL;
+	char_sync.running = false;
+
+	if (save_log)
+		ShowInfo("Saved %d characters in %u ms.\n", char_num, DIFF_TICK(gettick_nocache(), char_sync.tick));
+	return true;
+}
+
+static int mmo_char_sync_step_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	if (tid != char_sync.tid)
+		return 0;
+	char_sync.tid = INVALID_TIMER;
+	if (!mmo_char_sync_step(CHAR_SYNC_SLICE))
+		char_sync.tid = add_timer(gettick()+1, mmo_char_sync_step_timer, 0, 0);
+	return 0;
+}
+
+//---------------------------------------------------------
+// Function to save characters in files (speed up by [Yor])
+// Rewrites the characters files at once.
+//---------------------------------------------------------
+void mmo_char_sync(void)
+{
+	if (char_sync.running) {
+		// complete the running rewrite, it releases the old journal
+		if (char_sync.tid != INVALID_TIMER) {
+			delete_timer(char_sync.tid, mmo_char_sync_step_timer);
+			char_sync.tid = INVALID_TIMER;
+		}
+		mmo_char_sync_step(0);
 	}
+	if (mmo_char_sync_start())
+		mmo_char_sync_step(0);
+}
+
+//---------------------------------------------------------
+// Opens the journal
+//---------------------------------------------------------
+static void char_journal_init(void)
+{
+	if (char_journal_txt[0] == '\0')
+		return; // disabled
+
+	// start from up-to-date characters files
+	if (exists(char_journal_oldtxt()) || exists(char_journal_txt))
+		mmo_char_sync();
 
-	lock_fclose(f_fp, hotkeys_txt, &lock);
-#endif
+	journal_fp = fopen(char_journal_txt, "a");
+	if (journal_fp == NULL) {
+		ShowError("char_journal_init: failed to open the journal '%s', characters are only saved by rewriting the characters files.\n", char_journal_txt);
+		char_log("ERROR: failed to open the journal '%s'.\n", char_journal_txt);
+		return;
+	}
+	journal_records = 0;
 
-	DELETE_BUFFER(id);
+	add_timer_func_list(char_journal_flush_timer, "char_journal_flush_timer");
+	if (char_journal_flush_interval > 0)
+		add_timer_interval(gettick() + char_journal_flush_interval, char_journal_flush_timer, 0, 0, char_journal_flush_interval);
+}
 
-	return;
+//---------------------------------------------------------
+// Closes the journal, the characters files must be up-to-date
+//---------------------------------------------------------
+static void char_journal_final(void)
+{
+	if (journal_fp != NULL) {
+		fclose(journal_fp);
+		journal_fp = NULL;
+		remove(char_journal_txt);
+	}
+	if (journal_dirty)
+		aFree(journal_dirty);
+	journal_dirty = NULL;
+	journal_dirty_num = journal_dirty_max = 0;
 }
 
 //----------------------------------------------------
@@ -1233,7 +1734,13 @@ int mmo_char_sync_timer(int tid, unsigned int tick, int id, intptr_t data)
 {
 	if (save_log)
 		ShowInfo("Saving all files...\n");
-	mmo_char_sync();
+	if (journal_fp == NULL)
+		mmo_char_sync();
+	else if (!char_sync.running && journal_records >= char_journal_compact) {
+		// rewrite the characters files in the background
+		if (mmo_char_sync_start())
+			char_sync.tid = add_timer(gettick()+1, mmo_char_sync_step_timer, 0, 0);
+	}
 	inter_save();
 	return 0;
 }
@@ -1381,7 +1888,11 @@ int make_new_char(struct char_session_data* sd, char* name_, int str, int agi, i
 	char_num++;
 
 	ShowInfo("Created char: account: %d, char: %d, slot: %d, name: %s\n", sd->account_id, i, slot, name);
-	mmo_char_sync();
+	if (journal_fp != NULL) {
+		char_journal_mark(&char_dat[i].status);
+		char_journal_flush();
+	} else
+		mmo_char_sync();
 	return i;
 }
 
@@ -1913,6 +2424,8 @@ int char_divorce(struct mmo_charstatus *cs)
 			if (char_dat[i].status.char_id == cs->partner_id && char_dat[i].status.partner_id == cs->char_id) {
 				cs->partner_id = 0;
 				char_dat[i].status.partner_id = 0;
+				char_journal_mark(cs);
+				char_journal_mark(&char_dat[i].status);
 				for(j = 0; j < MAX_INVENTORY; j++)
 				{
 					if (char_dat[i].status.inventory[j].nameid == WEDDING_RING_M || char_dat[i].status.inventory[j].nameid == WEDDING_RING_F)
@@ -2317,6 +2830,7 @@ int parse_fromlogin(int fd)
 
 					if (char_dat[i].status.guild_id)	//If there is a guild, update the guild_member data [Skotlex]
 						inter_guild_sex_changed(char_dat[i].status.guild_id, acc, char_dat[i].status.char_id, sex);
+					char_journal_mark(&char_dat[i].status);
 				}
 				// disconnect player if online on char-server
 				disconnect_player(acc);
@@ -2514,6 +3028,7 @@ int char_parse_Registry(int account_id, int char_id, unsigned char *buf, int buf
 		p +=len+1;
 	}
 	char_dat[i].global_num = j;
+	char_journal_mark(&char_dat[i].status);
 	return 0;
 }
 
@@ -2593,146 +3108,837 @@ void char_read_fame_list(void)
 			fame_item.fame = char_dat[id[i]].status.fame;
 			safestrncpy(fame_item.name, char_dat[id[i]].status.name, NAME_LENGTH);
 
-			memcpy(&chemist_fame_list[j],&fame_item,sizeof(struct fame_list));
+			memcpy(&chemist_fame_list[j],&fame_item,sizeof(struct fame_list));
+
+			j++;
+		}
+	}
+	// Build Taekwon ranking list
+	for (i = 0, j = 0; i < char_num && j < fame_list_size_taekwon; i++) {
+		if (char_dat[id[i]].status.fame &&
+			char_dat[id[i]].status.class_ == JOB_TAEKWON)
+		{
+			fame_item.id = char_dat[id[i]].status.char_id;
+			fame_item.fame = char_dat[id[i]].status.fame;
+			safestrncpy(fame_item.name, char_dat[id[i]].status.name, NAME_LENGTH);
+
+			memcpy(&taekwon_fame_list[j],&fame_item,sizeof(struct fame_list));
+
+			j++;
+		}
+	}
+	DELETE_BUFFER(id);
+}
+
+// Send map-servers the fame ranking lists
+int char_send_fame_list(int fd)
+{
+	int i, len = 8;
+	unsigned char buf[32000];
+	
+	WBUFW(buf,0) = 0x2b1b;
+
+	for(i = 0; i < fame_list_size_smith && smith_fame_list[i].id; i++) {
+		memcpy(WBUFP(buf, len), &smith_fame_list[i], sizeof(struct fame_list));
+		len += sizeof(struct fame_list);
+	}
+	// add blacksmith's block length
+	WBUFW(buf, 6) = len;
+
+	for(i = 0; i < fame_list_size_chemist && chemist_fame_list[i].id; i++) {
+		memcpy(WBUFP(buf, len), &chemist_fame_list[i], sizeof(struct fame_list));
+		len += sizeof(struct fame_list);
+	}
+	// add alchemist's block length
+	WBUFW(buf, 4) = len;
+
+	for(i = 0; i < fame_list_size_taekwon && taekwon_fame_list[i].id; i++) {
+		memcpy(WBUFP(buf, len), &taekwon_fame_list[i], sizeof(struct fame_list));
+		len += sizeof(struct fame_list);
+	}
+	// add total packet length
+	WBUFW(buf, 2) = len;
+
+	if (fd != -1)
+		mapif_send(fd, buf, len);
+	else
+		mapif_sendall(buf, len);
+
+	return 0;
+}
+
+void char_update_fame_list(int type, int index, int fame)
+{
+	unsigned char buf[8];
+	WBUFW(buf,0) = 0x2b22;
+	WBUFB(buf,2) = type;
+	WBUFB(buf,3) = index;
+	WBUFL(buf,4) = fame;
+	mapif_sendall(buf, 8);
+}
+
+//Loads a character's name and stores it in the buffer given (must be NAME_LENGTH in size)
+//Returns 1 on found, 0 on not found (buffer is filled with Unknown char name)
+int char_loadName(int char_id, char* name)
+{
+	int j;
+
+	ARR_FIND( 0, char_num, j, char_dat[j].status.char_id == char_id );
+	if( j < char_num )
+	{
+		safestrncpy(name, char_dat[j].status.name, NAME_LENGTH);
+		return 1;
+	}
+	else
+	{
+		safestrncpy(name, unknown_char_name, NAME_LENGTH);
+	}
+	return 0;
+}
+
+int search_mapserver(unsigned short map, uint32 ip, uint16 port);
+
+
+/// Initializes a server structure.
+void mapif_server_init(int id)
+{
+	memset(&server[id], 0, sizeof(server[id]));
+	server[id].fd = -1;
+}
+
+
+/// Destroys a server structure.
+void mapif_server_destroy(int id)
+{
+	if( server[id].fd == -1 )
+	{
+		do_close(server[id].fd);
+		server[id].fd = -1;
+	}
+}
+
+
+/// Resets all the data related to a server.
+void mapif_server_reset(int id)
+{
+	int i,j;
+	unsigned char buf[16384];
+	int fd = server[id].fd;
+	//Notify other map servers that this one is gone. [Skotlex]
+	WBUFW(buf,0) = 0x2b20;
+	WBUFL(buf,4) = htonl(server[id].ip);
+	WBUFW(buf,8) = htons(server[id].port);
+	j = 0;
+	for(i = 0; i < MAX_MAP_PER_SERVER; i++)
+		if (server[id].map[i])
+			WBUFW(buf,10+(j++)*4) = server[id].map[i];
+	if (j > 0) {
+		WBUFW(buf,2) = j * 4 + 10;
+		mapif_sendallwos(fd, buf, WBUFW(buf,2));
+	}
+	online_char_db->foreach(online_char_db,char_db_setoffline,id); //Tag relevant chars as 'in disconnected' server.
+	create_online_files();
+	mapif_server_destroy(id);
+	mapif_server_init(id);
+}
+
+
+/// Called when the connection to a Map Server is disconnected.
+void mapif_on_disconnect(int id)
+{
+	ShowStatus("Map-server #%d has disconnected.\n", id);
+	mapif_server_reset(id);
+}
+
+
+/// Asks the map-server for the whole status of a character, a delta save couldn't be applied.
+static void mapif_save_resync(int fd, int account_id, int char_id, uint8 flag)
+{
+	WFIFOHEAD(fd,11);
+	WFIFOW(fd,0) = 0x2b2b;
+	WFIFOL(fd,2) = account_id;
+	WFIFOL(fd,6) = char_id;
+	WFIFOB(fd,10) = flag;
+	WFIFOSET(fd,11);
+}
+
+/// Applies a delta save (0x2b2a) to the status of a character.
+/// The data is a list of <offset>.W <len>.W <data>.?B, the parts of the status that changed.
+static bool char_apply_delta(struct mmo_charstatus* cd, const uint8* buf, int len)
+{
+	while( len > 0 )
+	{
+		int offset, size;
+
+		if( len < 4 )
+			return false;
+		offset = RBUFW(buf,0);
+		size = RBUFW(buf,2);
+		if( len < 4 + size || offset + size > (int)sizeof(struct mmo_charstatus) )
+			return false;
+		memcpy((uint8*)cd + offset, buf + 4, size);
+		buf += 4 + size;
+		len -= 4 + size;
+	}
+	return true;
+}
+
+//-----------------------------------------------------
+// Map assignment
+// Map-servers with 'map_assign: yes' list the same maps and, before
+// loading them, ask which ones to load (0x2b2c). The maps are spread
+// among map_assign_servers slots by the load the map-servers report
+// (0x2b2e), and each slot is bound to the ip:port of the first
+// map-server that asks for it.
+// The plan is kept in map_assign_txt. It is rebalanced at startup,
+// when no map-server is connected yet, or with the 'mapassign rebalance'
+// console command; the moved maps change server when they restart.
+// 'mapassign move' moves a single map without a restart: the source
+// map-server hands off its state (0x2b2f/0x2b30), the target takes it
+// over (0x2b31/0x2b32) and the players follow the map (0x2b33/0x2b34).
+// A move that times out (or that the source gives up, 0x2b38) leaves the
+// map on the source; a target that took it over puts it back on standby
+// (0x2b37).
+//-----------------------------------------------------
+#define MAPLOAD_USER_COST 10 // a player costs as much as this many monsters (monsters only move near players)
+
+struct map_assign {
+	unsigned short mapindex;
+	int slot; // slot the map is assigned to, -1 if none
+	unsigned int weight; // load of the map in the previous runs
+	uint64 load_sum; // load reported during this run
+	unsigned int load_samples;
+};
+
+struct map_assign_slot {
+	uint32 ip; // map-server bound to the slot (0 if none)
+	uint16 port;
+};
+
+static DBMap* map_assign_db = NULL; // unsigned short mapindex -> struct map_assign*
+static struct map_assign_slot map_assign_slots[MAX_MAP_SERVERS];
+
+/// Returns the map assignment data of the map, creating it if needed.
+static struct map_assign* map_assign_get(unsigned short mapindex)
+{
+	struct map_assign* ma = (struct map_assign*)idb_get(map_assign_db, mapindex);
+	if( ma == NULL )
+	{
+		CREATE(ma, struct map_assign, 1);
+		ma->mapindex = mapindex;
+		ma->slot = -1;
+		idb_put(map_assign_db, mapindex, ma);
+	}
+	return ma;
+}
+
+/// Current weight of the map, the average load of this run when there is one.
+static unsigned int map_assign_weight(const struct map_assign* ma)
+{
+	if( ma->load_samples == 0 )
+		return ma->weight;
+	return (unsigned int)(ma->load_sum / ma->load_samples);
+}
+
+/// Returns the map-server bound to the slot, or -1 if it isn't connected.
+static int map_assign_slot2server(int slot)
+{
+	int i;
+	if( map_assign_slots[slot].ip == 0 )
+		return -1;
+	ARR_FIND(0, ARRAYLENGTH(server), i, server[i].fd > 0 && server[i].ip == map_assign_slots[slot].ip && server[i].port == map_assign_slots[slot].port);
+	return ( i < ARRAYLENGTH(server) ) ? i : -1;
+}
+
+/// Sums the weight of the maps of each slot. Every map costs at least 1.
+static void map_assign_loads(uint64* loads)
+{
+	DBIterator* iter = map_assign_db->iterator(map_assign_db);
+	struct map_assign* ma;
+
+	memset(loads, 0, MAX_MAP_SERVERS*sizeof(uint64));
+	for( ma = (struct map_assign*)iter->first(iter,NULL); iter->exists(iter); ma = (struct map_assign*)iter->next(iter,NULL) )
+		if( ma->slot >= 0 && ma->slot < map_assign_servers )
+			loads[ma->slot] += map_assign_weight(ma) + 1;
+	iter->destroy(iter);
+}
+
+/// Returns the slot with the smallest load.
+static int map_assign_leastloaded(const uint64* loads)
+{
+	int i, slot = 0;
+	for( i = 1; i < map_assign_servers; ++i )
+		if( loads[i] < loads[slot] )
+			slot = i;
+	return slot;
+}
+
+/// qsort callback, heaviest maps first.
+static int map_assign_cmp(const void* a, const void* b)
+{
+	const struct map_assign* ma = *(const struct map_assign**)a;
+	const struct map_assign* mb = *(const struct map_assign**)b;
+	unsigned int wa = map_assign_weight(ma), wb = map_assign_weight(mb);
+	if( wa != wb )
+		return ( wa > wb ) ? -1 : 1;
+	return (int)ma->mapindex - (int)mb->mapindex;
+}
+
+/// Places the maps on the slots. The maps keep their slot and the new ones go
+/// to the least loaded slot, heaviest first. Then maps are moved from the most
+/// to the least loaded slot while it narrows the gap between them.
+/// Only the given maps are moved, the others keep their slot.
+static void map_assign_place(struct map_assign** list, int count)
+{
+	uint64 loads[MAX_MAP_SERVERS];
+	int i;
+
+	if( count == 0 )
+		return;
+	qsort(list, count, sizeof(struct map_assign*), map_assign_cmp);
+	for( i = 0; i < count; ++i )
+		if( list[i]->slot >= map_assign_servers )
+			list[i]->slot = -1;
+	map_assign_loads(loads);
+	for( i = 0; i < count; ++i )
+	{
+		if( list[i]->slot < 0 )
+		{
+			int slot = map_assign_leastloaded(loads);
+			list[i]->slot = slot;
+			loads[slot] += map_assign_weight(list[i]) + 1;
+		}
+	}
+
+	for( ;; )
+	{
+		int hi = 0, lo = 0;
+		uint64 cost;
+
+		for( i = 1; i < map_assign_servers; ++i )
+		{
+			if( loads[i] > loads[hi] ) hi = i;
+			if( loads[i] < loads[lo] ) lo = i;
+		}
+		// heaviest map of the most loaded slot that narrows the gap
+		ARR_FIND(0, count, i, list[i]->slot == hi && map_assign_weight(list[i]) + 1 < loads[hi] - loads[lo]);
+		if( i == count )
+			break;
+		cost = map_assign_weight(list[i]) + 1;
+		list[i]->slot = lo;
+		loads[hi] -= cost;
+		loads[lo] += cost;
+	}
+}
+
+/// Writes the plan to map_assign_txt.
+static void map_assign_write(void)
+{
+	DBIterator* iter;
+	struct map_assign* ma;
+	FILE* fp;
+	int i;
+
+	if( map_assign_db == NULL || map_assign_servers == 0 )
+		return;
+	if( (fp = fopen(map_assign_txt, "w")) == NULL )
+	{
+		ShowError("map_assign_write: Cannot open file %s!\n", map_assign_txt);
+		return;
+	}
+
+	fprintf(fp, "// Map assignment of the map-servers, see map_assign_servers in conf/char_athena.conf\n");
+	fprintf(fp, "// slot: <slot> <ip>:<port>\n");
+	fprintf(fp, "// map: <map name> <slot> <weight>\n");
+	for( i = 0; i < map_assign_servers; ++i )
+		if( map_assign_slots[i].ip != 0 )
+			fprintf(fp, "slot: %d %u.%u.%u.%u:%u\n", i, CONVIP(map_assign_slots[i].ip), map_assign_slots[i].port);
+	iter = map_assign_db->iterator(map_assign_db);
+	for( ma = (struct map_assign*)iter->first(iter,NULL); iter->exists(iter); ma = (struct map_assign*)iter->next(iter,NULL) )
+		fprintf(fp, "map: %s %d %u\n", mapindex_id2name(ma->mapindex), ma->slot, map_assign_weight(ma));
+	iter->destroy(iter);
+	fclose(fp);
+}
+
+/// Reads the plan from map_assign_txt.
+static void map_assign_read(void)
+{
+	char line[1024], w1[1024], w2[1024];
+	unsigned int a, b, c, d, port, weight;
+	int slot, count = 0;
+	FILE* fp;
+
+	if( (fp = fopen(map_assign_txt, "r")) == NULL )
+		return; // no plan yet
+
+	while( fgets(line, sizeof(line), fp) )
+	{
+		if( line[0] == '/' && line[1] == '/' )
+			continue;
+		if( sscanf(line, "slot: %d %u.%u.%u.%u:%u", &slot, &a, &b, &c, &d, &port) == 6 )
+		{
+			if( slot < 0 || slot >= MAX_MAP_SERVERS )
+				continue;
+			map_assign_slots[slot].ip = (a<<24)|(b<<16)|(c<<8)|d;
+			map_assign_slots[slot].port = (uint16)port;
+		}
+		else if( sscanf(line, "map: %1023s %d %u", w1, &slot, &weight) == 3 )
+		{
+			unsigned short mapindex = mapindex_name2id(w1);
+			struct map_assign* ma;
+			if( mapindex == 0 )
+				continue;
+			ma = map_assign_get(mapindex);
+			ma->slot = ( slot < map_assign_servers ) ? slot : -1;
+			ma->weight = weight;
+			count++;
+		}
+		else if( sscanf(line, "%1023s", w2) == 1 )
+			ShowWarning("map_assign_read: Invalid line in %s: %s", map_assign_txt, line);
+	}
+	fclose(fp);
+
+	ShowStatus("Done reading '"CL_WHITE"%s"CL_RESET"' ("CL_WHITE"%d"CL_RESET" maps).\n", map_assign_txt, count);
+}
+
+/// Recomputes the plan from the weight of all the maps.
+static void map_assign_rebalance(void)
+{
+	DBIterator* iter;
+	struct map_assign** list;
+	struct map_assign* ma;
+	int count = 0, moved = 0, i;
+	int* slots;
+
+	if( map_assign_servers == 0 || map_assign_db->size(map_assign_db) == 0 )
+		return;
+
+	CREATE(list, struct map_assign*, map_assign_db->size(map_assign_db));
+	CREATE(slots, int, map_assign_db->size(map_assign_db));
+	iter = map_assign_db->iterator(map_assign_db);
+	for( ma = (struct map_assign*)iter->first(iter,NULL); iter->exists(iter); ma = (struct map_assign*)iter->next(iter,NULL) )
+		list[count++] = ma;
+	iter->destroy(iter);
+
+	qsort(list, count, sizeof(struct map_assign*), map_assign_cmp); // same order as map_assign_place
+	for( i = 0; i < count; ++i )
+		slots[i] = list[i]->slot;
+	map_assign_place(list, count);
+	for( i = 0; i < count; ++i )
+		if( slots[i] != list[i]->slot )
+			moved++;
+	aFree(slots);
+	aFree(list);
+
+	map_assign_write();
+	ShowStatus("Map assignment rebalanced ("CL_WHITE"%d"CL_RESET" maps moved).\n", moved);
+}
+
+/// Shows the plan: the load of each slot and the maps of each slot.
+static void map_assign_show(void)
+{
+	uint64 loads[MAX_MAP_SERVERS];
+	DBIterator* iter;
+	struct map_assign* ma;
+	int i, maps[MAX_MAP_SERVERS];
+
+	if( map_assign_servers == 0 )
+	{
+		ShowInfo("Map assignment is off (map_assign_servers: 0).\n");
+		return;
+	}
+
+	memset(maps, 0, sizeof(maps));
+	map_assign_loads(loads);
+	iter = map_assign_db->iterator(map_assign_db);
+	for( ma = (struct map_assign*)iter->first(iter,NULL); iter->exists(iter); ma = (struct map_assign*)iter->next(iter,NULL) )
+		if( ma->slot >= 0 && ma->slot < map_assign_servers )
+			maps[ma->slot]++;
+	iter->destroy(iter);
+
+	ShowInfo("Map assignment (%d slots):\n", map_assign_servers);
+	for( i = 0; i < map_assign_servers; ++i )
+	{
+		int id = map_assign_slot2server(i);
+		ShowInfo("  slot %d: %u.%u.%u.%u:%u %s, %d maps, load %"PRIu64", cpu %u.%u%%\n", i,
+			CONVIP(map_assign_slots[i].ip), map_assign_slots[i].port, ( id >= 0 ) ? "online" : "offline",
+			maps[i], loads[i], ( id >= 0 ) ? server[id].cpu/10 : 0, ( id >= 0 ) ? server[id].cpu%10 : 0);
+	}
+}
+
+/// Binds a slot to the map-server, returns -1 if all the slots are in use.
+/// Slots of map-servers that aren't connected can be taken over.
+static int map_assign_bind(uint32 ip, uint16 port)
+{
+	int i;
 
-			j++;
-		}
+	ARR_FIND(0, map_assign_servers, i, map_assign_slots[i].ip == ip && map_assign_slots[i].port == port);
+	if( i == map_assign_servers )
+		ARR_FIND(0, map_assign_servers, i, map_assign_slots[i].ip == 0);
+	if( i == map_assign_servers )
+		ARR_FIND(0, map_assign_servers, i, map_assign_slot2server(i) < 0);
+	if( i == map_assign_servers )
+		return -1;
+
+	if( map_assign_slots[i].ip != ip || map_assign_slots[i].port != port )
+	{
+		ShowStatus("Map assignment: slot %d bound to map-server %u.%u.%u.%u:%u.\n", i, CONVIP(ip), port);
+		map_assign_slots[i].ip = ip;
+		map_assign_slots[i].port = port;
 	}
-	// Build Taekwon ranking list
-	for (i = 0, j = 0; i < char_num && j < fame_list_size_taekwon; i++) {
-		if (char_dat[id[i]].status.fame &&
-			char_dat[id[i]].status.class_ == JOB_TAEKWON)
-		{
-			fame_item.id = char_dat[id[i]].status.char_id;
-			fame_item.fame = char_dat[id[i]].status.fame;
-			safestrncpy(fame_item.name, char_dat[id[i]].status.name, NAME_LENGTH);
+	return i;
+}
 
-			memcpy(&taekwon_fame_list[j],&fame_item,sizeof(struct fame_list));
+/// Answers which maps a map-server has to load.
+/// 0x2b2c <len>.W <userid>.24B <passwd>.24B <ip>.L <port>.W {<mapindex>.W}*
+/// 0x2b2d <len>.W <result>.B {<mapindex>.W}*
+/// result: 0 = ok, 1 = refused, 2 = map assignment off, 3 = all the slots are in use
+static void char_assignmaps(int fd)
+{
+	char* l_user = (char*)RFIFOP(fd,4);
+	char* l_pass = (char*)RFIFOP(fd,28);
+	uint32 ip = ntohl(RFIFOL(fd,52));
+	uint16 port = ntohs(RFIFOW(fd,56));
+	int count = (RFIFOW(fd,2) - 58) / 2;
+	struct map_assign** placed;
+	int i, slot, num = 0, placed_num = 0;
+
+	l_user[23] = '\0';
+	l_pass[23] = '\0';
+	if( runflag != CHARSERVER_ST_RUNNING || strcmp(l_user, userid) != 0 || strcmp(l_pass, passwd) != 0 )
+	{
+		ShowWarning("Map assignment: refused the request of %u.%u.%u.%u:%u (wrong userid/password or not running).\n", CONVIP(ip), port);
+		WFIFOHEAD(fd,5);
+		WFIFOW(fd,0) = 0x2b2d;
+		WFIFOW(fd,2) = 5;
+		WFIFOB(fd,4) = 1;
+		WFIFOSET(fd,5);
+		return;
+	}
+	if( map_assign_servers == 0 || (slot = map_assign_bind(ip, port)) < 0 )
+	{// its maps are served by the others, loading them too would serve them twice
+		if( map_assign_servers != 0 )
+			ShowWarning("Map assignment: all %d slots are in use, %u.%u.%u.%u:%u gets no maps.\n", map_assign_servers, CONVIP(ip), port);
+		WFIFOHEAD(fd,5);
+		WFIFOW(fd,0) = 0x2b2d;
+		WFIFOW(fd,2) = 5;
+		WFIFOB(fd,4) = ( map_assign_servers == 0 ? 2 : 3 );
+		WFIFOSET(fd,5);
+		return;
+	}
 
-			j++;
+	WFIFOHEAD(fd,5+count*2);
+	CREATE(placed, struct map_assign*, count+1);
+	for( i = 0; i < count; ++i )
+	{
+		unsigned short mapindex = RFIFOW(fd,58+i*2);
+		struct map_assign* ma;
+		int id;
+
+		if( mapindex == 0 || mapindex >= MAX_MAPINDEX )
+			continue;
+		id = search_mapserver(mapindex, -1, -1);
+		if( id >= 0 && (server[id].ip != ip || server[id].port != port) )
+			continue; // already served by another map-server
+
+		ma = map_assign_get(mapindex);
+		if( ma->slot == slot )
+			WFIFOW(fd,5+(num++)*2) = mapindex;
+		else if( ma->slot < 0 || ma->slot >= map_assign_servers )
+			placed[placed_num++] = ma; // new map
+		else if( map_assign_slot2server(ma->slot) >= 0 )
+		{// the map-server of its slot doesn't serve it, take it over
+			ma->slot = slot;
+			WFIFOW(fd,5+(num++)*2) = mapindex;
 		}
+		// else left for the map-server of its slot
 	}
-	DELETE_BUFFER(id);
+	map_assign_place(placed, placed_num);
+	for( i = 0; i < placed_num; ++i )
+		if( placed[i]->slot == slot )
+			WFIFOW(fd,5+(num++)*2) = placed[i]->mapindex;
+	aFree(placed);
+
+	WFIFOW(fd,0) = 0x2b2d;
+	WFIFOW(fd,2) = 5+num*2;
+	WFIFOB(fd,4) = 0;
+	WFIFOSET(fd,5+num*2);
+
+	map_assign_write();
+	ShowStatus("Map assignment: map-server %u.%u.%u.%u:%u (slot %d) loads "CL_WHITE"%d"CL_RESET" of %d maps.\n", CONVIP(ip), port, slot, num, count);
 }
 
-// Send map-servers the fame ranking lists
-int char_send_fame_list(int fd)
+/// Receives the load of the maps of a map-server.
+/// 0x2b2e <len>.W <cpu permille>.W {<mapindex>.W <users>.W <mobs>.W}*
+static void mapif_parse_mapload(int fd, int id)
 {
-	int i, len = 8;
-	unsigned char buf[32000];
-	
-	WBUFW(buf,0) = 0x2b1b;
+	int i, count = (RFIFOW(fd,2) - 6) / 6;
 
-	for(i = 0; i < fame_list_size_smith && smith_fame_list[i].id; i++) {
-		memcpy(WBUFP(buf, len), &smith_fame_list[i], sizeof(struct fame_list));
-		len += sizeof(struct fame_list);
-	}
-	// add blacksmith's block length
-	WBUFW(buf, 6) = len;
+	server[id].cpu = RFIFOW(fd,4);
+	if( map_assign_db == NULL )
+		return;
+	for( i = 0; i < count; ++i )
+	{
+		unsigned short mapindex = RFIFOW(fd,6+i*6);
+		unsigned int users = RFIFOW(fd,8+i*6);
+		unsigned int mobs = RFIFOW(fd,10+i*6);
+		struct map_assign* ma;
 
-	for(i = 0; i < fame_list_size_chemist && chemist_fame_list[i].id; i++) {
-		memcpy(WBUFP(buf, len), &chemist_fame_list[i], sizeof(struct fame_list));
-		len += sizeof(struct fame_list);
+		if( mapindex == 0 || mapindex >= MAX_MAPINDEX )
+			continue;
+		ma = map_assign_get(mapindex);
+		ma->load_sum += users*MAPLOAD_USER_COST + ( users ? mobs : 0 );
+		ma->load_samples++;
 	}
-	// add alchemist's block length
-	WBUFW(buf, 4) = len;
+}
 
-	for(i = 0; i < fame_list_size_taekwon && taekwon_fame_list[i].id; i++) {
-		memcpy(WBUFP(buf, len), &taekwon_fame_list[i], sizeof(struct fame_list));
-		len += sizeof(struct fame_list);
-	}
-	// add total packet length
-	WBUFW(buf, 2) = len;
+#define MAP_MOVE_TIMEOUT 20000 // how long a map move can take (ms), less than the source map-server waits (HANDOFF_TIMEOUT in map/chrif.c)
 
-	if (fd != -1)
-		mapif_send(fd, buf, len);
-	else
-		mapif_sendall(buf, len);
+/// Map being moved from a map-server to another (console command 'mapassign move').
+static struct {
+	unsigned short mapindex; // 0 if none
+	int src, dst; // map-servers
+	int slot; // slot of the target map-server
+	bool relayed; // the state was sent to the target map-server
+	int timer;
+} map_move = { 0, -1, -1, -1, false, INVALID_TIMER };
 
-	return 0;
+static int map_move_timeout(int tid, unsigned int tick, int id, intptr_t data);
+
+/// Forgets the map being moved.
+static void map_move_clear(void)
+{
+	if( map_move.timer != INVALID_TIMER )
+		delete_timer(map_move.timer, map_move_timeout);
+	map_move.mapindex = 0;
+	map_move.relayed = false;
+	map_move.timer = INVALID_TIMER;
 }
 
-void char_update_fame_list(int type, int index, int fame)
+/// Tells map-server id to put a map it took over back on standby, the map stays on map-server src (-1 if none).
+/// 0x2b37 <mapindex>.W <ip>.L <port>.W
+static void map_move_revert(int id, unsigned short mapindex, int src)
 {
-	unsigned char buf[8];
-	WBUFW(buf,0) = 0x2b22;
-	WBUFB(buf,2) = type;
-	WBUFB(buf,3) = index;
-	WBUFL(buf,4) = fame;
-	mapif_sendall(buf, 8);
+	int fd = server[id].fd;
+
+	if( fd <= 0 )
+		return;
+	WFIFOHEAD(fd,10);
+	WFIFOW(fd,0) = 0x2b37;
+	WFIFOW(fd,2) = mapindex;
+	WFIFOL(fd,4) = ( src >= 0 ) ? htonl(server[src].ip) : 0;
+	WFIFOW(fd,8) = ( src >= 0 ) ? htons(server[src].port) : 0;
+	WFIFOSET(fd,10);
+	ShowWarning("Map assignment: map-server %d puts map '%s' back on standby.\n", id, mapindex_id2name(mapindex));
 }
 
-//Loads a character's name and stores it in the buffer given (must be NAME_LENGTH in size)
-//Returns 1 on found, 0 on not found (buffer is filled with Unknown char name)
-int char_loadName(int char_id, char* name)
+/// Ends the move of a map and tells the result to the source map-server.
+/// 0x2b33 <mapindex>.W <result>.B
+/// result: 0 = moved, 1 = target offline, 2 = invalid state, 3 = timed out, else failed
+static void map_move_end(uint8 result)
 {
-	int j;
+	if( map_move.mapindex == 0 )
+		return;
+	if( server[map_move.src].fd > 0 )
+	{
+		int fd = server[map_move.src].fd;
+		WFIFOHEAD(fd,5);
+		WFIFOW(fd,0) = 0x2b33;
+		WFIFOW(fd,2) = map_move.mapindex;
+		WFIFOB(fd,4) = result;
+		WFIFOSET(fd,5);
+	}
+	if( result != 0 )
+		ShowWarning("Map assignment: map '%s' didn't move (result %d).\n", mapindex_id2name(map_move.mapindex), result);
+	map_move_clear();
+}
 
-	ARR_FIND( 0, char_num, j, char_dat[j].status.char_id == char_id );
-	if( j < char_num )
+/// The map move took too long. The source map-server keeps the map, and the target puts it back on
+/// standby if it got the state. Happens before the source gives up on its own, so both agree.
+static int map_move_timeout(int tid, unsigned int tick, int id, intptr_t data)
+{
+	if( map_move.timer != tid )
+		return 0;
+	map_move.timer = INVALID_TIMER;
+	ShowWarning("Map assignment: the move of map '%s' timed out.\n", mapindex_id2name(map_move.mapindex));
+	if( map_move.relayed )
+		map_move_revert(map_move.dst, map_move.mapindex, map_move.src);
+	map_move_end(3);
+	return 0;
+}
+
+/// Starts moving a map to the map-server of a slot, without a restart.
+/// The target map-server must have the map on standby (map_assign_standby in conf/map_athena.conf).
+/// 0x2b2f <mapindex>.W <ip>.L <port>.W
+static void map_move_start(const char* mapname, int slot)
+{
+	unsigned short mapindex = mapindex_name2id(mapname);
+	int src, dst, fd;
+
+	if( map_assign_servers == 0 )
 	{
-		safestrncpy(name, char_dat[j].status.name, NAME_LENGTH);
-		return 1;
+		ShowInfo("Map assignment is off (map_assign_servers: 0).\n");
+		return;
 	}
-	else
+	if( map_move.mapindex != 0 )
 	{
-		safestrncpy(name, unknown_char_name, NAME_LENGTH);
+		ShowInfo("Map '%s' is being moved, try again later.\n", mapindex_id2name(map_move.mapindex));
+		return;
+	}
+	if( mapindex == 0 || (src = search_mapserver(mapindex, -1, -1)) < 0 )
+	{
+		ShowInfo("Map '%s' isn't served by any map-server.\n", mapname);
+		return;
+	}
+	if( slot < 0 || slot >= map_assign_servers || (dst = map_assign_slot2server(slot)) < 0 )
+	{
+		ShowInfo("Slot %d has no map-server online.\n", slot);
+		return;
+	}
+	if( src == dst )
+	{
+		ShowInfo("Map '%s' is already served by the map-server of slot %d.\n", mapname, slot);
+		return;
 	}
-	return 0;
-}
 
-int search_mapserver(unsigned short map, uint32 ip, uint16 port);
+	map_move.mapindex = mapindex;
+	map_move.src = src;
+	map_move.dst = dst;
+	map_move.slot = slot;
+	map_move.relayed = false;
+	map_move.timer = add_timer(gettick() + MAP_MOVE_TIMEOUT, map_move_timeout, 0, 0);
 
+	fd = server[src].fd;
+	WFIFOHEAD(fd,10);
+	WFIFOW(fd,0) = 0x2b2f;
+	WFIFOW(fd,2) = mapindex;
+	WFIFOL(fd,4) = htonl(server[dst].ip);
+	WFIFOW(fd,8) = htons(server[dst].port);
+	WFIFOSET(fd,10);
+	ShowStatus("Map assignment: moving map '"CL_WHITE"%s"CL_RESET"' to slot %d.\n", mapindex_id2name(mapindex), slot);
+}
 
-/// Initializes a server structure.
-void mapif_server_init(int id)
+/// Relays the state of the map handed off by the source map-server to the target map-server.
+/// 0x2b30 <len>.W <mapindex>.W <result>.B <state>.?B
+/// 0x2b31 <len>.W <mapindex>.W <result>.B <state>.?B
+static void mapif_parse_handoff(int fd, int id)
 {
-	memset(&server[id], 0, sizeof(server[id]));
-	server[id].fd = -1;
+	int len = RFIFOW(fd,2), dfd;
+
+	if( map_move.mapindex == 0 || map_move.mapindex != RFIFOW(fd,4) || map_move.src != id )
+		return;
+	if( RFIFOB(fd,6) != 0 )
+	{// the source map-server can't hand it off, it keeps it
+		ShowWarning("Map assignment: map-server %d can't hand off map '%s' (result %d).\n", id, mapindex_id2name(map_move.mapindex), RFIFOB(fd,6));
+		map_move_clear();
+		return;
+	}
+	if( (dfd = server[map_move.dst].fd) <= 0 )
+	{
+		map_move_end(1);
+		return;
+	}
+	WFIFOHEAD(dfd,len);
+	memcpy(WFIFOP(dfd,0), RFIFOP(fd,0), len);
+	WFIFOW(dfd,0) = 0x2b31;
+	WFIFOSET(dfd,len);
+	map_move.relayed = true;
 }
 
+/// The source map-server gave up the handoff, it keeps the map.
+/// 0x2b38 <mapindex>.W
+static void mapif_parse_handoff_abort(int fd, int id)
+{
+	if( map_move.mapindex == 0 || map_move.mapindex != RFIFOW(fd,2) || map_move.src != id )
+		return;
+	ShowWarning("Map assignment: map-server %d gave up the handoff of map '%s'.\n", id, mapindex_id2name(map_move.mapindex));
+	if( map_move.relayed )
+		map_move_revert(map_move.dst, map_move.mapindex, map_move.src);
+	map_move_clear();
+}
 
-/// Destroys a server structure.
-void mapif_server_destroy(int id)
+/// The target map-server took over the map (or not).
+/// Moves the map to the target map-server in the map lists and the plan, and tells all the map-servers.
+/// A takeover that comes after the move ended is undone (0x2b37), the map stays where it is.
+/// 0x2b32 <mapindex>.W <result>.B
+/// 0x2b34 <mapindex>.W <ip>.L <port>.W
+static void mapif_parse_takeover(int fd, int id)
 {
-	if( server[id].fd == -1 )
+	unsigned short mapindex = RFIFOW(fd,2);
+	unsigned char buf[10];
+	int i, j;
+
+	if( map_move.mapindex == 0 || map_move.mapindex != mapindex || map_move.dst != id )
 	{
-		do_close(server[id].fd);
-		server[id].fd = -1;
+		if( RFIFOB(fd,4) == 0 && (i = search_mapserver(mapindex, -1, -1)) != id )
+		{
+			ShowWarning("Map assignment: map-server %d took over map '%s' too late.\n", id, mapindex_id2name(mapindex));
+			map_move_revert(id, mapindex, i);
+		}
+		return;
+	}
+	if( RFIFOB(fd,4) != 0 )
+	{
+		map_move_end(RFIFOB(fd,4));
+		return;
 	}
-}
 
+	// map lists
+	ARR_FIND(0, MAX_MAP_PER_SERVER, i, server[map_move.src].map[i] == mapindex);
+	if( i < MAX_MAP_PER_SERVER )
+	{
+		for( j = i + 1; j < MAX_MAP_PER_SERVER && server[map_move.src].map[j]; ++j )
+			server[map_move.src].map[j-1] = server[map_move.src].map[j];
+		server[map_move.src].map[j-1] = 0;
+	}
+	ARR_FIND(0, MAX_MAP_PER_SERVER-1, i, server[id].map[i] == 0);
+	if( i < MAX_MAP_PER_SERVER-1 )
+		server[id].map[i] = mapindex;
 
-/// Resets all the data related to a server.
-void mapif_server_reset(int id)
-{
-	int i,j;
-	unsigned char buf[16384];
-	int fd = server[id].fd;
-	//Notify other map servers that this one is gone. [Skotlex]
-	WBUFW(buf,0) = 0x2b20;
+	// plan
+	map_assign_get(mapindex)->slot = map_move.slot;
+	map_assign_write();
+
+	WBUFW(buf,0) = 0x2b34;
+	WBUFW(buf,2) = mapindex;
 	WBUFL(buf,4) = htonl(server[id].ip);
 	WBUFW(buf,8) = htons(server[id].port);
-	j = 0;
-	for(i = 0; i < MAX_MAP_PER_SERVER; i++)
-		if (server[id].map[i])
-			WBUFW(buf,10+(j++)*4) = server[id].map[i];
-	if (j > 0) {
-		WBUFW(buf,2) = j * 4 + 10;
-		mapif_sendallwos(fd, buf, WBUFW(buf,2));
-	}
-	online_char_db->foreach(online_char_db,char_db_setoffline,id); //Tag relevant chars as 'in disconnected' server.
-	create_online_files();
-	mapif_server_destroy(id);
-	mapif_server_init(id);
+	mapif_sendall(buf, 10);
+
+	ShowStatus("Map assignment: map '"CL_WHITE"%s"CL_RESET"' moved from map-server %d to map-server %d (slot %d).\n", mapindex_id2name(mapindex), map_move.src, id, map_move.slot);
+	map_move_end(0);
 }
 
+/// A map-server disconnected, stops the map move it takes part in.
+static void map_move_disconnect(int id)
+{
+	if( map_move.mapindex == 0 )
+		return;
+	if( map_move.src == id )
+		map_move_clear(); // it loses the map anyway
+	else if( map_move.dst == id )
+		map_move_end(1);
+}
 
-/// Called when the connection to a Map Server is disconnected.
-void mapif_on_disconnect(int id)
+/// Initializes the map assignment.
+static void map_assign_init(void)
 {
-	ShowStatus("Map-server #%d has disconnected.\n", id);
-	mapif_server_reset(id);
+	if( map_assign_servers == 0 )
+		return;
+	map_assign_db = idb_alloc(DB_OPT_RELEASE_DATA);
+	add_timer_func_list(map_move_timeout, "map_move_timeout");
+	map_assign_read();
+	map_assign_rebalance(); // no map-server is connected yet
+}
+
+/// Finalizes the map assignment.
+static void map_assign_final(void)
+{
+	if( map_assign_db == NULL )
+		return;
+	map_assign_write();
+	map_assign_db->destroy(map_assign_db, NULL);
+	map_assign_db = NULL;
 }
 
 
@@ -2752,6 +3958,7 @@ int parse_frommap(int fd)
 	{
 		do_close(fd);
 		server[id].fd = -1;
+		map_move_disconnect(id);
 		mapif_on_disconnect(id);
 		return 0;
 	}
@@ -2895,6 +4102,7 @@ int parse_frommap(int fd)
 		{
 			int aid = RFIFOL(fd,4), cid = RFIFOL(fd,8), size = RFIFOW(fd,2);
 			struct mmo_charstatus* cs;
+			struct online_char_data* character;
 
 			if (size - 13 != sizeof(struct mmo_charstatus))
 			{
@@ -2906,6 +4114,9 @@ int parse_frommap(int fd)
 			{
 				memcpy(cs, RFIFOP(fd,13), sizeof(struct mmo_charstatus));
 				storage_save(cs->account_id, &cs->storage);
+				char_journal_mark(cs);
+				if( (character = (struct online_char_data*)idb_get(online_char_db, aid)) != NULL && character->char_id == cid )
+					character->save_seq = 0; // the next delta saves are made against this one
 			}
 
 			if (RFIFOB(fd,12))
@@ -2921,6 +4132,92 @@ int parse_frommap(int fd)
 		}
 		break;
 
+		case 0x2b2a: // Receive the changes of the character data since the previous save from map-server
+			if (RFIFOREST(fd) < 4 || RFIFOREST(fd) < RFIFOW(fd,2))
+				return 0;
+		{
+			int aid = RFIFOL(fd,4), cid = RFIFOL(fd,8), size = RFIFOW(fd,2);
+			uint8 flag = RFIFOB(fd,12);
+			struct online_char_data* character = (struct online_char_data*)idb_get(online_char_db, aid);
+			struct mmo_charstatus* cs = search_character(aid, cid);
+			struct mmo_charstatus char_dat;
+
+			if( size < 21 || character == NULL || character->char_id != cid || character->server != id ||
+				character->save_seq != (int)RFIFOL(fd,13) || cs == NULL )
+			{// not the save this delta was made against, ask for the whole status
+				mapif_save_resync(fd, aid, cid, flag);
+				RFIFOSKIP(fd,size);
+				break;
+			}
+			memcpy(&char_dat, cs, sizeof(struct mmo_charstatus));
+			if( !char_apply_delta(&char_dat, RFIFOP(fd,21), size - 21) || char_dat.account_id != aid || char_dat.char_id != cid )
+			{
+				ShowError("parse_from_map (save-char): Invalid delta save for character %d:%d.\n", aid, cid);
+				character->save_seq = -1;
+				mapif_save_resync(fd, aid, cid, flag);
+				RFIFOSKIP(fd,size);
+				break;
+			}
+			memcpy(cs, &char_dat, sizeof(struct mmo_charstatus));
+			storage_save(cs->account_id, &cs->storage);
+			char_journal_mark(cs);
+			character->save_seq = (int)RFIFOL(fd,17);
+
+			if (flag)
+			{	//Flag, set character offline after saving.
+				set_char_offline(cid, aid);
+				WFIFOHEAD(fd,10);
+				WFIFOW(fd,0) = 0x2b21;
+				WFIFOL(fd,2) = aid;
+				WFIFOL(fd,6) = cid;
+				WFIFOSET(fd,10);
+			}
+			RFIFOSKIP(fd,size);
+		}
+		break;
+
+		case 0x2b2e: // Receive the load of the maps from map-server
+			if (RFIFOREST(fd) < 4 || RFIFOREST(fd) < RFIFOW(fd,2))
+				return 0;
+			mapif_parse_mapload(fd, id);
+			RFIFOSKIP(fd,RFIFOW(fd,2));
+		break;
+
+		case 0x2b30: // Receive the state of a map handed off by the map-server
+			if (RFIFOREST(fd) < 4 || RFIFOREST(fd) < RFIFOW(fd,2))
+				return 0;
+			mapif_parse_handoff(fd, id);
+			RFIFOSKIP(fd,RFIFOW(fd,2));
+		break;
+
+		case 0x2b32: // The map-server took over a map
+			if (RFIFOREST(fd) < 5)
+				return 0;
+			mapif_parse_takeover(fd, id);
+			RFIFOSKIP(fd,5);
+		break;
+
+		case 0x2b38: // The map-server gave up the handoff of a map
+			if (RFIFOREST(fd) < 4)
+				return 0;
+			mapif_parse_handoff_abort(fd, id);
+			RFIFOSKIP(fd,4);
+		break;
+
+		case 0x2b35: // A permanent global variable changed in a map group, send it to all the map-servers (sender included, for the order)
+			if (RFIFOREST(fd) < 4 || RFIFOREST(fd) < RFIFOW(fd,2))
+				return 0;
+		{
+			int len = RFIFOW(fd,2);
+			if( len >= 22 )
+			{
+				RFIFOW(fd,0) = 0x2b36;
+				mapif_sendall((unsigned char*)RFIFOP(fd,0), len);
+			}
+			RFIFOSKIP(fd,len);
+		}
+		break;
+
 		case 0x2b02: // req char selection
 			if( RFIFOREST(fd) < 18 )
 				return 0;
@@ -2992,6 +4289,7 @@ int parse_frommap(int fd)
 				char_data->last_point.x = RFIFOW(fd,20);
 				char_data->last_point.y = RFIFOW(fd,22);
 				char_data->sex = RFIFOB(fd,30);
+				char_journal_mark(char_data);
 
 				// create temporary auth entry
 				CREATE(node, struct auth_node, 1);
@@ -3332,6 +4630,19 @@ int parse_frommap(int fd)
 			RFIFOSKIP(fd,6);
 		break;
 
+		case SERVERLINK_COMPRESSED: // unpack it in the buffer and parse the packet it contains
+		{
+			int r = RFIFOUNCOMPRESS(fd);
+			if( r == 0 )
+				return 0;
+			if( r < 0 )
+			{
+				set_eof(fd);
+				return 0;
+			}
+		}
+		break;
+
 		default:
 		{
 			// inter server - packet
@@ -3496,6 +4807,7 @@ static void char_delete2_req(int fd, struct char_session_data* sd)
 
 	// success
 	cs->delete_date = time(NULL)+char_del_delay;
+	char_journal_mark(cs);
 
 	char_delete2_ack(fd, char_id, 1, cs->delete_date);
 }
@@ -3550,6 +4862,7 @@ static void char_delete2_accept(int fd, struct char_session_data* sd)
 
 	// success
 	char_delete(cs);
+	char_journal_remove(sd->found_char[i]);
 
 	// drop character entry
 	if( --char_num > 0 && sd->found_char[i] != char_num )
@@ -3585,6 +4898,7 @@ static void char_delete2_accept(int fd, struct char_session_data* sd)
 
 	// refresh character list cache
 	char_find_characters(sd);
+	char_journal_flush();
 
 	char_delete2_accept_ack(fd, char_id, 1);
 }
@@ -3607,6 +4921,7 @@ static void char_delete2_cancel(int fd, struct char_session_data* sd)
 	// queued for deletion, as the client prints an error message by
 	// itself, if it was not the case (@see char_delete2_cancel_ack)
 	cs->delete_date = 0;
+	char_journal_mark(cs);
 
 	char_delete2_cancel_ack(fd, char_id, 1);
 }
@@ -3808,6 +5123,7 @@ int parse_char(int fd)
 				}
 				ShowWarning("Unable to find map-server for '%s', sending to major city '%s'.\n", mapindex_id2name(cd->last_point.map), mapindex_id2name(j));
 				cd->last_point.map = j;
+				char_journal_mark(cd);
 			}
 
 			//Send NEW auth packet [Kevin]
@@ -3986,6 +5302,7 @@ int parse_char(int fd)
 			}
 
 			char_delete(cs);
+			char_journal_remove(sd->found_char[i]);
 			if (sd->found_char[i] != char_num - 1) {
 				int j, k;
 				struct char_session_data *sd2;
@@ -4005,6 +5322,7 @@ int parse_char(int fd)
 				}
 			}
 			char_num--;
+			char_journal_flush();
 
 			// remove char from list and compact it
 			for(ch = i; ch < MAX_CHARS-1; ch++)
@@ -4093,6 +5411,23 @@ int parse_char(int fd)
 			RFIFOSKIP(fd,6);
 		break;
 
+		// map-server asking which maps to load
+		case 0x2b2c:
+			if (RFIFOREST(fd) < 4)
+				return 0;
+			if (RFIFOW(fd,2) < 58 || RFIFOW(fd,2) > FIFOSIZE_SERVERLINK)
+			{
+				set_eof(fd);
+				return 0;
+			}
+			if (RFIFOW(fd,2) > session[fd]->max_rdata)
+				realloc_fifo(fd, FIFOSIZE_SERVERLINK, FIFOSIZE_SERVERLINK);
+			if (RFIFOREST(fd) < RFIFOW(fd,2))
+				return 0;
+			char_assignmaps(fd);
+			RFIFOSKIP(fd,RFIFOW(fd,2));
+		break;
+
 		// login as map-server
 		case 0x2af8:
 			if (RFIFOREST(fd) < 60)
@@ -4113,6 +5448,13 @@ int parse_char(int fd)
 				WFIFOB(fd,2) = 3;
 				WFIFOSET(fd,3);
 			} else {
+				if( RFIFOL(fd,50) != 0 )
+				{// the map-server knows about link features, tell it ours before it starts sending
+					WFIFOHEAD(fd,6);
+					WFIFOW(fd,0) = 0x2b29;
+					WFIFOL(fd,2) = SERVERLINK_FEATURE_COMPRESS|SERVERLINK_FEATURE_DELTASAVE|SERVERLINK_FEATURE_MAPLOAD;
+					WFIFOSET(fd,6);
+				}
 				WFIFOHEAD(fd,3);
 				WFIFOW(fd,0) = 0x2af9;
 				WFIFOB(fd,2) = 0;
@@ -4122,10 +5464,13 @@ int parse_char(int fd)
 				server[i].ip = ntohl(RFIFOL(fd,54));
 				server[i].port = ntohs(RFIFOW(fd,58));
 				server[i].users = 0;
+				server[i].cpu = 0;
 				memset(server[i].map, 0, sizeof(server[i].map));
 				session[fd]->func_parse = parse_frommap;
 				session[fd]->flag.server = 1;
 				realloc_fifo(fd, FIFOSIZE_SERVERLINK, FIFOSIZE_SERVERLINK);
+				if( RFIFOL(fd,50)&SERVERLINK_FEATURE_COMPRESS )
+					socket_compress(fd); // map-server accepts compressed packets
 				char_mapif_init(fd);
 			}
 
@@ -4154,12 +5499,35 @@ int parse_console(const char* command)
 		runflag = 0;
 	else if( strcmpi("alive", command) == 0 || strcmpi("status", command) == 0 )
 		ShowInfo(CL_CYAN"Console: "CL_BOLD"I'm Alive."CL_RESET"\n");
+	else if( strcmpi("linkstats", command) == 0 )
+		socket_linkstats_show();
+	else if( strcmpi("linkstats reset", command) == 0 )
+		socket_linkstats_reset();
+	else if( strcmpi("mapassign", command) == 0 )
+		map_assign_show();
+	else if( strcmpi("mapassign rebalance", command) == 0 )
+		map_assign_rebalance();
+	else if( strncmpi("mapassign move ", command, 15) == 0 )
+	{
+		char mapname[MAP_NAME_LENGTH_EXT];
+		int slot;
+		if( sscanf(command + 15, "%15s %d", mapname, &slot) == 2 )
+			map_move_start(mapname, slot);
+		else
+			ShowInfo("Usage: mapassign move <map name> <slot>\n");
+	}
 	else if( strcmpi("help", command) == 0 )
 	{
 		ShowInfo("To shutdown the server:\n");
 		ShowInfo("  'shutdown|exit|quit|end'\n");
 		ShowInfo("To know if server is alive:\n");
 		ShowInfo("  'alive|status'\n");
+		ShowInfo("To show the server link traffic per packet type:\n");
+		ShowInfo("  'linkstats [reset]'\n");
+		ShowInfo("To show or rebalance the map assignment of the map-servers:\n");
+		ShowInfo("  'mapassign [rebalance]'\n");
+		ShowInfo("To move a map to the map-server of a slot, without a restart:\n");
+		ShowInfo("  'mapassign move <map name> <slot>'\n");
 	}
 
 	return 0;
@@ -4499,6 +5867,11 @@ int char_config_read(const char *cfgName)
 			safestrncpy(friends_txt, w2, sizeof(friends_txt));
 		} else if (strcmpi(w1, "hotkeys_txt") == 0) { //By davidsiaw
 			safestrncpy(hotkeys_txt, w2, sizeof(hotkeys_txt));
+		} else if (strcmpi(w1, "char_journal_txt") == 0) {
+			if (strcmpi(w2, "none") == 0)
+				char_journal_txt[0] = '\0';
+			else
+				safestrncpy(char_journal_txt, w2, sizeof(char_journal_txt));
 #ifndef TXT_SQL_CONVERT
 		} else if (strcmpi(w1, "max_connect_user") == 0) {
 			max_connect_user = atoi(w2);
@@ -4514,6 +5887,10 @@ int char_config_read(const char *cfgName)
 				autosave_interval = DEFAULT_AUTOSAVE_INTERVAL;
 		} else if (strcmpi(w1, "save_log") == 0) {
 			save_log = config_switch(w2);
+		} else if (strcmpi(w1, "char_journal_flush") == 0) {
+			char_journal_flush_interval = max(atoi(w2), 0);
+		} else if (strcmpi(w1, "char_journal_compact") == 0) {
+			char_journal_compact = max(atoi(w2), 0);
 		} else if (strcmpi(w1, "start_point") == 0) {
 			char map[MAP_NAME_LENGTH_EXT];
 			int x, y;
@@ -4576,6 +5953,10 @@ int char_config_read(const char *cfgName)
 			safestrncpy(db_path, w2, sizeof(db_path));
 		} else if (strcmpi(w1, "console") == 0) {
 			console = config_switch(w2);
+		} else if (strcmpi(w1, "map_assign_servers") == 0) {
+			map_assign_servers = cap_value(atoi(w2), 0, MAX_MAP_SERVERS);
+		} else if (strcmpi(w1, "map_assign_txt") == 0) {
+			safestrncpy(map_assign_txt, w2, sizeof(map_assign_txt));
 		} else if (strcmpi(w1, "fame_list_alchemist") == 0) {
 			fame_list_size_chemist = atoi(w2);
 			if (fame_list_size_chemist > MAX_FAME_LIST) {
@@ -4613,12 +5994,14 @@ void do_final(void)
 	ShowStatus("Terminating...\n");
 
 	mmo_char_sync();
+	char_journal_final();
 	inter_save();
 	set_all_offline(-1);
 	flush_fifos();
 	
 	do_final_mapif();
 	do_final_loginif();
+	map_assign_final();
 
 	// write online players files with no player
 	online_char_db->clear(online_char_db, NULL);
@@ -4702,6 +6085,7 @@ int do_init(int argc, char **argv)
 	auth_db = idb_alloc(DB_OPT_RELEASE_DATA);
 	online_char_db = idb_alloc(DB_OPT_RELEASE_DATA);
 	mmo_char_init();
+	char_journal_init();
 	char_read_fame_list(); //Read fame lists.
 #ifdef ENABLE_SC_SAVING
 	status_init();
@@ -4730,6 +6114,7 @@ int do_init(int argc, char **argv)
 
 	do_init_loginif();
 	do_init_mapif();
+	map_assign_init();
 
 	// periodically update the overall user count on all mapservers + login server
 	add_timer_func_list(broadcast_user_count, "broadcast_user_count");
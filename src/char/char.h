@@ -24,6 +24,7 @@ struct character_data {
 	struct mmo_charstatus status;
 	int global_num;
 	struct global_reg global[GLOBAL_REG_NUM];
+	int journal_pos; // position in the journal's list of modified characters, 0 if none
 };
 
 struct mmo_charstatus* search_character(int aid, int cid);
@@ -81,6 +81,7 @@ struct mmo_map_server {
 	uint32 ip;
 	uint16 port;
 	int users;
+	unsigned int cpu; // cpu usage of the last load report (permille)
 	unsigned short map[MAX_MAP_PER_SERVER];
 } server[MAX_MAP_SERVERS];
 
@@ -163,6 +164,9 @@ struct point start_point = { 0, 53, 111 };
 
 int console = 0;
 
+int map_assign_servers = 0; // number of map-servers sharing the maps with 'map_assign: yes' (0 = off)
+char map_assign_txt[1024] = "save/map_assign.txt";
+
 //-----------------------------------------------------
 // Auth database
 //-----------------------------------------------------
@@ -181,6 +185,154 @@ struct auth_node {
 
 static DBMap* auth_db; // int account_id -> struct auth_node*
 
+//-----------------------------------------------------
+// Character cache
+//-----------------------------------------------------
+// Keeps the per-table data (memo, inventory, cart, skills, friends, hotkeys)
+// of characters that went offline recently, so a relog doesn't read it again.
+// The `char` row, storage and mercenary data are always read from sql,
+// since they are changed elsewhere while the character is offline.
+
+struct char_cache_entry {
+	int char_id;
+	unsigned int tick; // when the character went offline
+	struct point memo_point[MAX_MEMOPOINTS];
+	struct item inventory[MAX_INVENTORY];
+	struct item cart[MAX_CART];
+	struct s_skill skill[MAX_SKILL];
+	struct s_friend friends[MAX_FRIENDS];
+#ifdef HOTKEY_SAVING
+	struct hotkey hotkeys[MAX_HOTKEYS];
+#endif
+	struct char_cache_entry* prev; // newer entry
+	struct char_cache_entry* next; // older entry
+};
+
+static DBMap* char_cache_db; // int char_id -> struct char_cache_entry*
+static struct char_cache_entry* char_cache_first = NULL; // newest entry
+static struct char_cache_entry* char_cache_last = NULL; // oldest entry
+static int char_cache_count = 0;
+static unsigned int char_cache_hits = 0;
+static unsigned int char_cache_misses = 0;
+
+int char_cache_size = 500; // maximum number of cached characters (0 = disabled)
+int char_cache_time = 600; // seconds a character stays cached after going offline
+
+/// Removes a character from the cache.
+static void char_cache_remove(int char_id)
+{
+	struct char_cache_entry* entry = (struct char_cache_entry*)idb_get(char_cache_db, char_id);
+
+	if( entry == NULL )
+		return;
+
+	if( entry->prev != NULL )
+		entry->prev->next = entry->next;
+	else
+		char_cache_first = entry->next;
+	if( entry->next != NULL )
+		entry->next->prev = entry->prev;
+	else
+		char_cache_last = entry->prev;
+	--char_cache_count;
+
+	idb_remove(char_cache_db, char_id);
+}
+
+/// Empties the cache.
+/// Used when an operation changes data that other characters have cached (friend names).
+static void char_cache_clear(void)
+{
+	char_cache_db->clear(char_cache_db, NULL);
+	char_cache_first = char_cache_last = NULL;
+	char_cache_count = 0;
+}
+
+/// Caches the data of a character that is going offline.
+/// 'cp' is the last saved state, which is stored the way it would be read back from sql.
+static void char_cache_put(const struct mmo_charstatus* cp)
+{
+	struct char_cache_entry* entry;
+	unsigned int tick = gettick();
+	int i, n;
+
+	char_cache_remove(cp->char_id);
+	if( char_cache_size <= 0 )
+		return;
+
+	// entries are ordered by age, so expired ones are at the end
+	while( char_cache_last != NULL && (char_cache_count >= char_cache_size || DIFF_TICK(tick, char_cache_last->tick) >= char_cache_time*1000) )
+		char_cache_remove(char_cache_last->char_id);
+
+	CREATE(entry, struct char_cache_entry, 1);
+	entry->char_id = cp->char_id;
+	entry->tick = tick;
+
+	for( i = 0, n = 0; i < MAX_MEMOPOINTS; ++i )
+		if( cp->memo_point[i].map )
+			memcpy(&entry->memo_point[n++], &cp->memo_point[i], sizeof(struct point));
+	for( i = 0, n = 0; i < MAX_INVENTORY; ++i )
+		if( cp->inventory[i].nameid )
+			memcpy(&entry->inventory[n++], &cp->inventory[i], sizeof(struct item));
+	for( i = 0, n = 0; i < MAX_CART; ++i )
+		if( cp->cart[i].nameid )
+			memcpy(&entry->cart[n++], &cp->cart[i], sizeof(struct item));
+	for( i = 0; i < MAX_SKILL; ++i )
+	{// same rules as the skill saving in mmo_char_tosql
+		const struct s_skill* skill = &cp->skill[i];
+		int lv;
+
+		if( skill->id == 0 || skill->id >= MAX_SKILL || skill->flag == SKILL_FLAG_TEMPORARY )
+			continue;
+		lv = ( skill->flag == SKILL_FLAG_PERMANENT ) ? skill->lv : skill->flag - SKILL_FLAG_REPLACED_LV_0;
+		entry->skill[skill->id].id = skill->id;
+		entry->skill[skill->id].lv = max(lv, 0);
+		entry->skill[skill->id].flag = SKILL_FLAG_PERMANENT;
+	}
+	for( i = 0, n = 0; i < MAX_FRIENDS; ++i )
+		if( cp->friends[i].char_id > 0 )
+			memcpy(&entry->friends[n++], &cp->friends[i], sizeof(struct s_friend));
+#ifdef HOTKEY_SAVING
+	memcpy(entry->hotkeys, cp->hotkeys, sizeof(entry->hotkeys));
+#endif
+
+	entry->next = char_cache_first;
+	if( char_cache_first != NULL )
+		char_cache_first->prev = entry;
+	else
+		char_cache_last = entry;
+	char_cache_first = entry;
+	++char_cache_count;
+
+	idb_put(char_cache_db, entry->char_id, entry);
+}
+
+/// Fills the per-table data of 'p' from the cache and drops the entry.
+/// Returns true if the character was cached.
+static bool char_cache_load(int char_id, struct mmo_charstatus* p)
+{
+	struct char_cache_entry* entry = (struct char_cache_entry*)idb_get(char_cache_db, char_id);
+
+	if( entry == NULL || DIFF_TICK(gettick(), entry->tick) >= char_cache_time*1000 )
+	{
+		char_cache_remove(char_id);
+		++char_cache_misses;
+		return false;
+	}
+
+	memcpy(p->memo_point, entry->memo_point, sizeof(p->memo_point));
+	memcpy(p->inventory, entry->inventory, sizeof(p->inventory));
+	memcpy(p->cart, entry->cart, sizeof(p->cart));
+	memcpy(p->skill, entry->skill, sizeof(p->skill));
+	memcpy(p->friends, entry->friends, sizeof(p->friends));
+#ifdef HOTKEY_SAVING
+	memcpy(p->hotkeys, entry->hotkeys, sizeof(p->hotkeys));
+#endif
+	char_cache_remove(char_id);
+	++char_cache_hits;
+	return true;
+}
+
 //-----------------------------------------------------
 // Online User Database
 //-----------------------------------------------------
@@ -191,6 +343,7 @@ struct online_char_data {
 	int fd;
 	int waiting_disconnect;
 	short server; // -2: unknown server, -1: not connected, 0+: id of server
+	int save_seq; // sequence of the last save (0 for full saves), -1 if the delta saves (0x2b2a) can't be applied
 };
 
 static DBMap* online_char_db; // int account_id -> struct online_char_data*
@@ -204,6 +357,7 @@ static void* create_online_char_data(DBKey key, va_list args)
 	character->char_id = -1;
   	character->server = -1;
 	character->fd = -1;
+	character->save_seq = -1;
 	character->waiting_disconnect = INVALID_TIMER;
 	return character;
 }
@@ -255,6 +409,8 @@ void set_char_online(int map_id, int char_id, int account_id)
 	}
 
 	//Update state data
+	if( character->char_id != char_id )
+		character->save_seq = -1;
 	character->char_id = char_id;
 	character->server = map_id;
 
@@ -295,7 +451,10 @@ void set_char_offline(int char_id, int account_id)
 		struct mmo_charstatus* cp = (struct mmo_charstatus*)idb_get(char_db_,char_id);
 		inter_guild_CharOffline(char_id, cp?cp->guild_id:-1);
 		if (cp)
+		{
+			char_cache_put(cp);
 			idb_remove(char_db_,char_id);
+		}
 
 		if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `online`='0' WHERE `char_id`='%d'", char_db, char_id) )
 			Sql_ShowDebug(sql_handle);
@@ -316,6 +475,7 @@ void set_char_offline(int char_id, int account_id)
 		{
 			character->char_id = -1;
 			character->server = -1;
+			character->save_seq = -1;
 		}
 
 		//FIXME? Why Kevin free'd the online information when the char was effectively in the map-server?
@@ -415,6 +575,7 @@ int mmo_char_tosql(int char_id, struct mmo_charstatus* p)
 	if (char_id!=p->char_id) return 0;
 
 #ifndef TXT_SQL_CONVERT
+	char_cache_remove(char_id); // saved while offline, the cached copy is outdated
 	cp = (struct mmo_charstatus*)idb_ensure(char_db_, char_id, create_charstatus);
 #else
 	cp = (struct mmo_charstatus*)aCalloc(1, sizeof(struct mmo_charstatus));
@@ -697,6 +858,8 @@ int mmo_char_tosql(int char_id, struct mmo_charstatus* p)
 #ifndef TXT_SQL_CONVERT
 	if (!errors)
 		memcpy(cp, p, sizeof(struct mmo_charstatus));
+	else // the saved state is unknown, next load/save has to go through sql
+		idb_remove(char_db_, char_id);
 #else
 	aFree(cp);
 #endif
@@ -943,25 +1106,182 @@ int mmo_chars_fromsql(struct char_session_data* sd, uint8* buf)
 	return j;
 }
 
+//=====================================================================================================
+/// Appends 'count' zero columns to a query, to give the rows of a UNION the same width.
+static void mmo_char_sql_pad(StringBuf* buf, int count)
+{
+	while( count-- > 0 )
+		StringBuf_AppendStr(buf, ",0");
+}
+
+/// Reads a numeric column of the current row.
+static int mmo_char_sql_int(int col)
+{
+	char* data;
+
+	if( SQL_SUCCESS != Sql_GetData(sql_handle, col, &data, NULL) || data == NULL )
+		return 0;
+	return atoi(data);
+}
+
+/// Reads an item row (inventory or cart) of the table query.
+static void mmo_char_sql_item(struct item* item)
+{
+	char* data;
+	int i;
+
+	item->id = mmo_char_sql_int(3);
+	item->nameid = mmo_char_sql_int(4);
+	item->amount = mmo_char_sql_int(5);
+	item->equip = mmo_char_sql_int(6);
+	item->identify = mmo_char_sql_int(7);
+	item->refine = mmo_char_sql_int(8);
+	item->attribute = mmo_char_sql_int(9);
+	Sql_GetData(sql_handle, 10, &data, NULL); item->expire_time = ( data != NULL ) ? (unsigned int)strtoul(data, NULL, 10) : 0;
+	for( i = 0; i < MAX_SLOTS; ++i )
+		item->card[i] = mmo_char_sql_int(11+i);
+}
+
+/// Reads memo, inventory, cart, skills, friends and hotkeys of a character.
+/// Instead of a query per table, this is a single UNION ALL query where the
+/// first column tells which table the row came from:
+/// `t`, `o` (sort order), `s` (string column), followed by numeric columns.
+static bool mmo_char_fromsql_tables(int char_id, struct mmo_charstatus* p)
+{
+	enum { TBL_MEMO, TBL_INVENTORY, TBL_CART, TBL_SKILL, TBL_FRIEND, TBL_HOTKEY };
+	const int cols = 8 + MAX_SLOTS; // numeric columns of an item row, the widest one
+	const char* tables[2];
+	int limits[2];
+	int memo = 0, inventory = 0, cart = 0, friends = 0;
+	StringBuf buf;
+	char* data;
+	int i, j;
+
+	StringBuf_Init(&buf);
+
+	//`memo` (`memo_id`,`char_id`,`map`,`x`,`y`)
+	StringBuf_Printf(&buf, "(SELECT %d AS `t`, `memo_id` AS `o`, `map` AS `s`, `x`, `y`", TBL_MEMO);
+	mmo_char_sql_pad(&buf, cols - 2);
+	StringBuf_Printf(&buf, " FROM `%s` WHERE `char_id`='%d' ORDER BY `memo_id` LIMIT %d)", memo_db, char_id, MAX_MEMOPOINTS);
+
+	//`inventory`/`cart_inventory` (`id`,`char_id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `card0`, `card1`, `card2`, `card3`)
+	tables[0] = inventory_db; limits[0] = MAX_INVENTORY;
+	tables[1] = cart_db;      limits[1] = MAX_CART;
+	for( i = 0; i < 2; ++i )
+	{
+		StringBuf_Printf(&buf, " UNION ALL (SELECT %d, 0, '', `id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`", i == 0 ? TBL_INVENTORY : TBL_CART);
+		for( j = 0; j < MAX_SLOTS; ++j )
+			StringBuf_Printf(&buf, ", `card%d`", j);
+		StringBuf_Printf(&buf, " FROM `%s` WHERE `char_id`='%d' LIMIT %d)", tables[i], char_id, limits[i]);
+	}
+
+	//`skill` (`char_id`, `id`, `lv`)
+	StringBuf_Printf(&buf, " UNION ALL (SELECT %d, 0, '', `id`, `lv`", TBL_SKILL);
+	mmo_char_sql_pad(&buf, cols - 2);
+	StringBuf_Printf(&buf, " FROM `%s` WHERE `char_id`='%d' LIMIT %d)", skill_db, char_id, MAX_SKILL);
+
+	//`friends` (`char_id`, `friend_account`, `friend_id`)
+	StringBuf_Printf(&buf, " UNION ALL (SELECT %d, 0, c.`name`, c.`account_id`, c.`char_id`", TBL_FRIEND);
+	mmo_char_sql_pad(&buf, cols - 2);
+	StringBuf_Printf(&buf, " FROM `%s` c LEFT JOIN `%s` f ON f.`friend_account` = c.`account_id` AND f.`friend_id` = c.`char_id` WHERE f.`char_id`='%d' LIMIT %d)", char_db, friend_db, char_id, MAX_FRIENDS);
+
+#ifdef HOTKEY_SAVING
+	//`hotkey` (`char_id`, `hotkey`, `type`, `itemskill_id`, `skill_lvl`
+	StringBuf_Printf(&buf, " UNION ALL (SELECT %d, 0, '', `hotkey`, `type`, `itemskill_id`, `skill_lvl`", TBL_HOTKEY);
+	mmo_char_sql_pad(&buf, cols - 4);
+	StringBuf_Printf(&buf, " FROM `%s` WHERE `char_id`='%d')", hotkey_db, char_id);
+#endif
+
+	StringBuf_AppendStr(&buf, " ORDER BY `t`, `o`");
+
+	if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) )
+	{
+		Sql_ShowDebug(sql_handle);
+		StringBuf_Destroy(&buf);
+		return false;
+	}
+	StringBuf_Destroy(&buf);
+
+	while( SQL_SUCCESS == Sql_NextRow(sql_handle) )
+	{
+		switch( mmo_char_sql_int(0) )
+		{
+		case TBL_MEMO:
+			if( memo >= MAX_MEMOPOINTS )
+				break;
+			Sql_GetData(sql_handle, 2, &data, NULL);
+			p->memo_point[memo].map = mapindex_name2id(data);
+			p->memo_point[memo].x = mmo_char_sql_int(3);
+			p->memo_point[memo].y = mmo_char_sql_int(4);
+			++memo;
+			break;
+
+		case TBL_INVENTORY:
+			if( inventory < MAX_INVENTORY )
+				mmo_char_sql_item(&p->inventory[inventory++]);
+			break;
+
+		case TBL_CART:
+			if( cart < MAX_CART )
+				mmo_char_sql_item(&p->cart[cart++]);
+			break;
+
+		case TBL_SKILL:
+		{
+			int id = mmo_char_sql_int(3);
+			int lv = mmo_char_sql_int(4);
+
+			if( id >= 0 && id < ARRAYLENGTH(p->skill) )
+			{
+				p->skill[id].id = id;
+				p->skill[id].lv = lv;
+				p->skill[id].flag = SKILL_FLAG_PERMANENT;
+			}
+			else
+				ShowWarning("mmo_char_fromsql: ignoring invalid skill (id=%d,lv=%d) of character %s (AID=%d,CID=%d)\n", id, lv, p->name, p->account_id, p->char_id);
+			break;
+		}
+
+		case TBL_FRIEND:
+			if( friends >= MAX_FRIENDS )
+				break;
+			p->friends[friends].account_id = mmo_char_sql_int(3);
+			p->friends[friends].char_id = mmo_char_sql_int(4);
+			Sql_GetData(sql_handle, 2, &data, NULL);
+			safestrncpy(p->friends[friends].name, data, sizeof(p->friends[friends].name));
+			++friends;
+			break;
+
+#ifdef HOTKEY_SAVING
+		case TBL_HOTKEY:
+		{
+			int hotkey_num = mmo_char_sql_int(3);
+
+			if( hotkey_num >= 0 && hotkey_num < MAX_HOTKEYS )
+			{
+				p->hotkeys[hotkey_num].type = mmo_char_sql_int(4);
+				Sql_GetData(sql_handle, 5, &data, NULL); p->hotkeys[hotkey_num].id = ( data != NULL ) ? (unsigned int)strtoul(data, NULL, 10) : 0;
+				p->hotkeys[hotkey_num].lv = mmo_char_sql_int(6);
+			}
+			else
+				ShowWarning("mmo_char_fromsql: ignoring invalid hotkey (hotkey=%d) of character %s (AID=%d,CID=%d)\n", hotkey_num, p->name, p->account_id, p->char_id);
+			break;
+		}
+#endif
+		}
+	}
+	Sql_FreeResult(sql_handle);
+	return true;
+}
+
 //=====================================================================================================
 int mmo_char_fromsql(int char_id, struct mmo_charstatus* p, bool load_everything)
 {
-	int i,j;
 	char t_msg[128] = "";
 	struct mmo_charstatus* cp;
-	StringBuf buf;
 	SqlStmt* stmt;
 	char last_map[MAP_NAME_LENGTH_EXT];
 	char save_map[MAP_NAME_LENGTH_EXT];
-	char point_map[MAP_NAME_LENGTH_EXT];
-	struct point tmp_point;
-	struct item tmp_item;
-	struct s_skill tmp_skill;
-	struct s_friend tmp_friend;
-#ifdef HOTKEY_SAVING
-	struct hotkey tmp_hotkey;
-	int hotkey_num;
-#endif
 
 	memset(p, 0, sizeof(struct mmo_charstatus));
 	
@@ -1052,153 +1372,27 @@ int mmo_char_fromsql(int char_id, struct mmo_charstatus* p, bool load_everything
 
 	strcat(t_msg, " status");
 
+	SqlStmt_Free(stmt);
+
 	if (!load_everything) // For quick selection of data when displaying the char menu
-	{
-		SqlStmt_Free(stmt);
 		return 1;
-	}
-
-	//read memo data
-	//`memo` (`memo_id`,`char_id`,`map`,`x`,`y`)
-	if( SQL_ERROR == SqlStmt_Prepare(stmt, "SELECT `map`,`x`,`y` FROM `%s` WHERE `char_id`=? ORDER by `memo_id` LIMIT %d", memo_db, MAX_MEMOPOINTS)
-	||	SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &char_id, 0)
-	||	SQL_ERROR == SqlStmt_Execute(stmt)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 0, SQLDT_STRING, &point_map, sizeof(point_map), NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 1, SQLDT_SHORT,  &tmp_point.x, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 2, SQLDT_SHORT,  &tmp_point.y, 0, NULL, NULL) )
-		SqlStmt_ShowDebug(stmt);
-
-	for( i = 0; i < MAX_MEMOPOINTS && SQL_SUCCESS == SqlStmt_NextRow(stmt); ++i )
-	{
-		tmp_point.map = mapindex_name2id(point_map);
-		memcpy(&p->memo_point[i], &tmp_point, sizeof(tmp_point));
-	}
-	strcat(t_msg, " memo");
 
-	//read inventory
-	//`inventory` (`id`,`char_id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `card0`, `card1`, `card2`, `card3`)
-	StringBuf_Init(&buf);
-	StringBuf_AppendStr(&buf, "SELECT `id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`");
-	for( i = 0; i < MAX_SLOTS; ++i )
-		StringBuf_Printf(&buf, ", `card%d`", i);
-	StringBuf_Printf(&buf, " FROM `%s` WHERE `char_id`=? LIMIT %d", inventory_db, MAX_INVENTORY);
-
-	if( SQL_ERROR == SqlStmt_PrepareStr(stmt, StringBuf_Value(&buf))
-	||	SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &char_id, 0)
-	||	SQL_ERROR == SqlStmt_Execute(stmt)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 0, SQLDT_INT,       &tmp_item.id, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 1, SQLDT_SHORT,     &tmp_item.nameid, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 2, SQLDT_SHORT,     &tmp_item.amount, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 3, SQLDT_USHORT,    &tmp_item.equip, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 4, SQLDT_CHAR,      &tmp_item.identify, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 5, SQLDT_CHAR,      &tmp_item.refine, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 6, SQLDT_CHAR,      &tmp_item.attribute, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 7, SQLDT_UINT,      &tmp_item.expire_time, 0, NULL, NULL) )
-		SqlStmt_ShowDebug(stmt);
-	for( i = 0; i < MAX_SLOTS; ++i )
-		if( SQL_ERROR == SqlStmt_BindColumn(stmt, 8+i, SQLDT_SHORT, &tmp_item.card[i], 0, NULL, NULL) )
-			SqlStmt_ShowDebug(stmt);
-
-	for( i = 0; i < MAX_INVENTORY && SQL_SUCCESS == SqlStmt_NextRow(stmt); ++i )
-		memcpy(&p->inventory[i], &tmp_item, sizeof(tmp_item));
-
-	strcat(t_msg, " inventory");
-
-	//read cart
-	//`cart_inventory` (`id`,`char_id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `card0`, `card1`, `card2`, `card3`)
-	StringBuf_Clear(&buf);
-	StringBuf_AppendStr(&buf, "SELECT `id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`");
-	for( j = 0; j < MAX_SLOTS; ++j )
-		StringBuf_Printf(&buf, ", `card%d`", j);
-	StringBuf_Printf(&buf, " FROM `%s` WHERE `char_id`=? LIMIT %d", cart_db, MAX_CART);
-
-	if( SQL_ERROR == SqlStmt_PrepareStr(stmt, StringBuf_Value(&buf))
-	||	SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &char_id, 0)
-	||	SQL_ERROR == SqlStmt_Execute(stmt)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 0, SQLDT_INT,         &tmp_item.id, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 1, SQLDT_SHORT,       &tmp_item.nameid, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 2, SQLDT_SHORT,       &tmp_item.amount, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 3, SQLDT_USHORT,      &tmp_item.equip, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 4, SQLDT_CHAR,        &tmp_item.identify, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 5, SQLDT_CHAR,        &tmp_item.refine, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 6, SQLDT_CHAR,        &tmp_item.attribute, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 7, SQLDT_UINT,        &tmp_item.expire_time, 0, NULL, NULL) )
-		SqlStmt_ShowDebug(stmt);
-	for( i = 0; i < MAX_SLOTS; ++i )
-		if( SQL_ERROR == SqlStmt_BindColumn(stmt, 8+i, SQLDT_SHORT, &tmp_item.card[i], 0, NULL, NULL) )
-			SqlStmt_ShowDebug(stmt);
-
-	for( i = 0; i < MAX_CART && SQL_SUCCESS == SqlStmt_NextRow(stmt); ++i )
-		memcpy(&p->cart[i], &tmp_item, sizeof(tmp_item));
-	strcat(t_msg, " cart");
+	//read memo, inventory, cart, skills, friends and hotkeys
+	if( char_cache_load(char_id, p) )
+		strcat(t_msg, " cached");
+	else if( mmo_char_fromsql_tables(char_id, p) )
+		strcat(t_msg, " memo inventory cart skills friends hotkeys");
 
 	//read storage
 	storage_fromsql(p->account_id, &p->storage);
 	strcat(t_msg, " storage");
 
-	//read skill
-	//`skill` (`char_id`, `id`, `lv`)
-	if( SQL_ERROR == SqlStmt_Prepare(stmt, "SELECT `id`, `lv` FROM `%s` WHERE `char_id`=? LIMIT %d", skill_db, MAX_SKILL)
-	||	SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &char_id, 0)
-	||	SQL_ERROR == SqlStmt_Execute(stmt)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 0, SQLDT_USHORT, &tmp_skill.id, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 1, SQLDT_USHORT, &tmp_skill.lv, 0, NULL, NULL) )
-		SqlStmt_ShowDebug(stmt);
-	tmp_skill.flag = SKILL_FLAG_PERMANENT;
-
-	for( i = 0; i < MAX_SKILL && SQL_SUCCESS == SqlStmt_NextRow(stmt); ++i )
-	{
-		if( tmp_skill.id < ARRAYLENGTH(p->skill) )
-			memcpy(&p->skill[tmp_skill.id], &tmp_skill, sizeof(tmp_skill));
-		else
-			ShowWarning("mmo_char_fromsql: ignoring invalid skill (id=%u,lv=%u) of character %s (AID=%d,CID=%d)\n", tmp_skill.id, tmp_skill.lv, p->name, p->account_id, p->char_id);
-	}
-	strcat(t_msg, " skills");
-
-	//read friends
-	//`friends` (`char_id`, `friend_account`, `friend_id`)
-	if( SQL_ERROR == SqlStmt_Prepare(stmt, "SELECT c.`account_id`, c.`char_id`, c.`name` FROM `%s` c LEFT JOIN `%s` f ON f.`friend_account` = c.`account_id` AND f.`friend_id` = c.`char_id` WHERE f.`char_id`=? LIMIT %d", char_db, friend_db, MAX_FRIENDS)
-	||	SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &char_id, 0)
-	||	SQL_ERROR == SqlStmt_Execute(stmt)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 0, SQLDT_INT,    &tmp_friend.account_id, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 1, SQLDT_INT,    &tmp_friend.char_id, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 2, SQLDT_STRING, &tmp_friend.name, sizeof(tmp_friend.name), NULL, NULL) )
-		SqlStmt_ShowDebug(stmt);
-
-	for( i = 0; i < MAX_FRIENDS && SQL_SUCCESS == SqlStmt_NextRow(stmt); ++i )
-		memcpy(&p->friends[i], &tmp_friend, sizeof(tmp_friend));
-	strcat(t_msg, " friends");
-
-#ifdef HOTKEY_SAVING
-	//read hotkeys
-	//`hotkey` (`char_id`, `hotkey`, `type`, `itemskill_id`, `skill_lvl`
-	if( SQL_ERROR == SqlStmt_Prepare(stmt, "SELECT `hotkey`, `type`, `itemskill_id`, `skill_lvl` FROM `%s` WHERE `char_id`=?", hotkey_db)
-	||	SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_INT, &char_id, 0)
-	||	SQL_ERROR == SqlStmt_Execute(stmt)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 0, SQLDT_INT,    &hotkey_num, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 1, SQLDT_UCHAR,  &tmp_hotkey.type, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 2, SQLDT_UINT,   &tmp_hotkey.id, 0, NULL, NULL)
-	||	SQL_ERROR == SqlStmt_BindColumn(stmt, 3, SQLDT_USHORT, &tmp_hotkey.lv, 0, NULL, NULL) )
-		SqlStmt_ShowDebug(stmt);
-
-	while( SQL_SUCCESS == SqlStmt_NextRow(stmt) )
-	{
-		if( hotkey_num >= 0 && hotkey_num < MAX_HOTKEYS )
-			memcpy(&p->hotkeys[hotkey_num], &tmp_hotkey, sizeof(tmp_hotkey));
-		else
-			ShowWarning("mmo_char_fromsql: ignoring invalid hotkey (hotkey=%d,type=%u,id=%u,lv=%u) of character %s (AID=%d,CID=%d)\n", hotkey_num, tmp_hotkey.type, tmp_hotkey.id, tmp_hotkey.lv, p->name, p->account_id, p->char_id);
-	}
-	strcat(t_msg, " hotkeys");
-#endif
-
 	/* Mercenary Owner DataBase */
 	mercenary_owner_fromsql(char_id, p);
 	strcat(t_msg, " mercenary");
 
 
 	if (save_log) ShowInfo("Loaded char (%d - %s): %s\n", char_id, p->name, t_msg);	//ok. all data load successfuly!
-	SqlStmt_Free(stmt);
-	StringBuf_Destroy(&buf);
 
 	cp = (struct mmo_charstatus*)idb_ensure(char_db_, char_id, create_charstatus);
 	memcpy(cp, p, sizeof(struct mmo_charstatus));
@@ -1210,6 +1404,7 @@ int mmo_char_sql_init(void)
 {
 	ShowInfo("Begin Initializing.......\n");
 	char_db_= idb_alloc(DB_OPT_RELEASE_DATA);
+	char_cache_db = idb_alloc(DB_OPT_RELEASE_DATA);
 
 	if(char_per_account == 0){
 	  ShowStatus("Chars per Account: 'Unlimited'.......\n");
@@ -1267,6 +1462,8 @@ int rename_char_sql(struct char_session_data *sd, int char_id)
 	if( char_dat.guild_id )
 		inter_guild_charname_changed(char_dat.guild_id, sd->account_id, char_id, sd->new_name);
 
+	char_cache_clear(); // cached friend lists may contain the old name
+
 	safestrncpy(char_dat.name, sd->new_name, NAME_LENGTH);
 	memset(sd->new_name,0,sizeof(sd->new_name));
 
@@ -1408,6 +1605,8 @@ int divorce_char_sql(int partner_id1, int partner_id2)
 		Sql_ShowDebug(sql_handle);
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE (`nameid`='%d' OR `nameid`='%d') AND (`char_id`='%d' OR `char_id`='%d')", inventory_db, WEDDING_RING_M, WEDDING_RING_F, partner_id1, partner_id2) )
 		Sql_ShowDebug(sql_handle);
+	char_cache_remove(partner_id1);
+	char_cache_remove(partner_id2);
 
 	WBUFW(buf,0) = 0x2b12;
 	WBUFL(buf,2) = partner_id1;
@@ -1476,6 +1675,8 @@ int delete_char_sql(int char_id)
 			Sql_ShowDebug(sql_handle);
 		if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `id` = '410'AND (`char_id`='%d' OR `char_id`='%d')", skill_db, father_id, mother_id) )
 			Sql_ShowDebug(sql_handle);
+		char_cache_remove(father_id);
+		char_cache_remove(mother_id);
 
 		WBUFW(buf,0) = 0x2b25;
 		WBUFL(buf,2) = father_id;
@@ -1514,6 +1715,7 @@ int delete_char_sql(int char_id)
 	//NOTE: Won't this cause problems for people who are already online? [Skotlex]
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `friend_id` = '%d'", friend_db, char_id) )
 		Sql_ShowDebug(sql_handle);
+	char_cache_clear(); // cached friend lists may contain this char
 
 #ifdef HOTKEY_SAVING
 	/* delete hotkeys */
@@ -2067,6 +2269,7 @@ int parse_fromlogin(int fd)
 					// to avoid any problem with equipment and invalid sex, equipment is unequiped.
 					if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `equip` = '0' WHERE `char_id` = '%d'", inventory_db, char_id[i]) )
 						Sql_ShowDebug(sql_handle);
+					char_cache_remove(char_id[i]);
 					if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `class`='%d', `weapon`='0', `shield`='0', `head_top`='0', `head_mid`='0', `head_bottom`='0' WHERE `char_id`='%d'", char_db, class_[i], char_id[i]) )
 						Sql_ShowDebug(sql_handle);
 
@@ -2435,6 +2638,697 @@ void mapif_on_disconnect(int id)
 }
 
 
+/// Asks the map-server for the whole status of a character, a delta save couldn't be applied.
+static void mapif_save_resync(int fd, int account_id, int char_id, uint8 flag)
+{
+	WFIFOHEAD(fd,11);
+	WFIFOW(fd,0) = 0x2b2b;
+	WFIFOL(fd,2) = account_id;
+	WFIFOL(fd,6) = char_id;
+	WFIFOB(fd,10) = flag;
+	WFIFOSET(fd,11);
+}
+
+/// Applies a delta save (0x2b2a) to the status of a character.
+/// The data is a list of <offset>.W <len>.W <data>.?B, the parts of the status that changed.
+static bool char_apply_delta(struct mmo_charstatus* cd, const uint8* buf, int len)
+{
+	while( len > 0 )
+	{
+		int offset, size;
+
+		if( len < 4 )
+			return false;
+		offset = RBUFW(buf,0);
+		size = RBUFW(buf,2);
+		if( len < 4 + size || offset + size > (int)sizeof(struct mmo_charstatus) )
+			return false;
+		memcpy((uint8*)cd + offset, buf + 4, size);
+		buf += 4 + size;
+		len -= 4 + size;
+	}
+	return true;
+}
+
+//-----------------------------------------------------
+// Map assignment
+// Map-servers with 'map_assign: yes' list the same maps and, before
+// loading them, ask which ones to load (0x2b2c). The maps are spread
+// among map_assign_servers slots by the load the map-servers report
+// (0x2b2e), and each slot is bound to the ip:port of the first
+// map-server that asks for it.
+// The plan is kept in map_assign_txt. It is rebalanced at startup,
+// when no map-server is connected yet, or with the 'mapassign rebalance'
+// console command; the moved maps change server when they restart.
+// 'mapassign move' moves a single map without a restart: the source
+// map-server hands off its state (0x2b2f/0x2b30), the target takes it
+// over (0x2b31/0x2b32) and the players follow the map (0x2b33/0x2b34).
+// A move that times out (or that the source gives up, 0x2b38) leaves the
+// map on the source; a target that took it over puts it back on standby
+// (0x2b37).
+//-----------------------------------------------------
+#define MAPLOAD_USER_COST 10 // a player costs as much as this many monsters (monsters only move near players)
+
+struct map_assign {
+	unsigned short mapindex;
+	int slot; // slot the map is assigned to, -1 if none
+	unsigned int weight; // load of the map in the previous runs
+	uint64 load_sum; // load reported during this run
+	unsigned int load_samples;
+};
+
+struct map_assign_slot {
+	uint32 ip; // map-server bound to the slot (0 if none)
+	uint16 port;
+};
+
+static DBMap* map_assign_db = NULL; // unsigned short mapindex -> struct map_assign*
+static struct map_assign_slot map_assign_slots[MAX_MAP_SERVERS];
+
+/// Returns the map assignment data of the map, creating it if needed.
+static struct map_assign* map_assign_get(unsigned short mapindex)
+{
+	struct map_assign* ma = (struct map_assign*)idb_get(map_assign_db, mapindex);
+	if( ma == NULL )
+	{
+		CREATE(ma, struct map_assign, 1);
+		ma->mapindex = mapindex;
+		ma->slot = -1;
+		idb_put(map_assign_db, mapindex, ma);
+	}
+	return ma;
+}
+
+/// Current weight of the map, the average load of this run when there is one.
+static unsigned int map_assign_weight(const struct map_assign* ma)
+{
+	if( ma->load_samples == 0 )
+		return ma->weight;
+	return (unsigned int)(ma->load_sum / ma->load_samples);
+}
+
+/// Returns the map-server bound to the slot, or -1 if it isn't connected.
+static int map_assign_slot2server(int slot)
+{
+	int i;
+	if( map_assign_slots[slot].ip == 0 )
+		return -1;
+	ARR_FIND(0, ARRAYLENGTH(server), i, server[i].fd > 0 && server[i].ip == map_assign_slots[slot].ip && server[i].port == map_assign_slots[slot].port);
+	return ( i < ARRAYLENGTH(server) ) ? i : -1;
+}
+
+/// Sums the weight of the maps of each slot. Every map costs at least 1.
+static void map_assign_loads(uint64* loads)
+{
+	DBIterator* iter = map_assign_db->iterator(map_assign_db);
+	struct map_assign* ma;
+
+	memset(loads, 0, MAX_MAP_SERVERS*sizeof(uint64));
+	for( ma = (struct map_assign*)iter->first(iter,NULL); iter->exists(iter); ma = (struct map_assign*)iter->next(iter,NULL) )
+		if( ma->slot >= 0 && ma->slot < map_assign_servers )
+			loads[ma->slot] += map_assign_weight(ma) + 1;
+	iter->destroy(iter);
+}
+
+/// Returns the slot with the smallest load.
+static int map_assign_leastloaded(const uint64* loads)
+{
+	int i, slot = 0;
+	for( i = 1; i < map_assign_servers; ++i )
+		if( loads[i] < loads[slot] )
+			slot = i;
+	return slot;
+}
+
+/// qsort callback, heaviest maps first.
+static int map_assign_cmp(const void* a, const void* b)
+{
+	const struct map_assign* ma = *(const struct map_assign**)a;
+	const struct map_assign* mb = *(const struct map_assign**)b;
+	unsigned int wa = map_assign_weight(ma), wb = map_assign_weight(mb);
+	if( wa != wb )
+		return ( wa > wb ) ? -1 : 1;
+	return (int)ma->mapindex - (int)mb->mapindex;
+}
+
+/// Places the maps on the slots. The maps keep their slot and the new ones go
+/// to the least loaded slot, heaviest first. Then maps are moved from the most
+/// to the least loaded slot while it narrows the gap between them.
+/// Only the given maps are moved, the others keep their slot.
+static void map_assign_place(struct map_assign** list, int count)
+{
+	uint64 loads[MAX_MAP_SERVERS];
+	int i;
+
+	if( count == 0 )
+		return;
+	qsort(list, count, sizeof(struct map_assign*), map_assign_cmp);
+	for( i = 0; i < count; ++i )
+		if( list[i]->slot >= map_assign_servers )
+			list[i]->slot = -1;
+	map_assign_loads(loads);
+	for( i = 0; i < count; ++i )
+	{
+		if( list[i]->slot < 0 )
+		{
+			int slot = map_assign_leastloaded(loads);
+			list[i]->slot = slot;
+			loads[slot] += map_assign_weight(list[i]) + 1;
+		}
+	}
+
+	for( ;; )
+	{
+		int hi = 0, lo = 0;
+		uint64 cost;
+
+		for( i = 1; i < map_assign_servers; ++i )
+		{
+			if( loads[i] > loads[hi] ) hi = i;
+			if( loads[i] < loads[lo] ) lo = i;
+		}
+		// heaviest map of the most loaded slot that narrows the gap
+		ARR_FIND(0, count, i, list[i]->slot == hi && map_assign_weight(list[i]) + 1 < loads[hi] - loads[lo]);
+		if( i == count )
+			break;
+		cost = map_assign_weight(list[i]) + 1;
+		list[i]->slot = lo;
+		loads[hi] -= cost;
+		loads[lo] += cost;
+	}
+}
+
+/// Writes the plan to map_assign_txt.
+static void map_assign_write(void)
+{
+	DBIterator* iter;
+	struct map_assign* ma;
+	FILE* fp;
+	int i;
+
+	if( map_assign_db == NULL || map_assign_servers == 0 )
+		return;
+	if( (fp = fopen(map_assign_txt, "w")) == NULL )
+	{
+		ShowError("map_assign_write: Cannot open file %s!\n", map_assign_txt);
+		return;
+	}
+
+	fprintf(fp, "// Map assignment of the map-servers, see map_assign_servers in conf/char_athena.conf\n");
+	fprintf(fp, "// slot: <slot> <ip>:<port>\n");
+	fprintf(fp, "// map: <map name> <slot> <weight>\n");
+	for( i = 0; i < map_assign_servers; ++i )
+		if( map_assign_slots[i].ip != 0 )
+			fprintf(fp, "slot: %d %u.%u.%u.%u:%u\n", i, CONVIP(map_assign_slots[i].ip), map_assign_slots[i].port);
+	iter = map_assign_db->iterator(map_assign_db);
+	for( ma = (struct map_assign*)iter->first(iter,NULL); iter->exists(iter); ma = (struct map_assign*)iter->next(iter,NULL) )
+		fprintf(fp, "map: %s %d %u\n", mapindex_id2name(ma->mapindex), ma->slot, map_assign_weight(ma));
+	iter->destroy(iter);
+	fclose(fp);
+}
+
+/// Reads the plan from map_assign_txt.
+static void map_assign_read(void)
+{
+	char line[1024], w1[1024], w2[1024];
+	unsigned int a, b, c, d, port, weight;
+	int slot, count = 0;
+	FILE* fp;
+
+	if( (fp = fopen(map_assign_txt, "r")) == NULL )
+		return; // no plan yet
+
+	while( fgets(line, sizeof(line), fp) )
+	{
+		if( line[0] == '/' && line[1] == '/' )
+			continue;
+		if( sscanf(line, "slot: %d %u.%u.%u.%u:%u", &slot, &a, &b, &c, &d, &port) == 6 )
+		{
+			if( slot < 0 || slot >= MAX_MAP_SERVERS )
+				continue;
+			map_assign_slots[slot].ip = (a<<24)|(b<<16)|(c<<8)|d;
+			map_assign_slots[slot].port = (uint16)port;
+		}
+		else if( sscanf(line, "map: %1023s %d %u", w1, &slot, &weight) == 3 )
+		{
+			unsigned short mapindex = mapindex_name2id(w1);
+			struct map_assign* ma;
+			if( mapindex == 0 )
+				continue;
+			ma = map_assign_get(mapindex);
+			ma->slot = ( slot < map_assign_servers ) ? slot : -1;
+			ma->weight = weight;
+			count++;
+		}
+		else if( sscanf(line, "%1023s", w2) == 1 )
+			ShowWarning("map_assign_read: Invalid line in %s: %s", map_assign_txt, line);
+	}
+	fclose(fp);
+
+	ShowStatus("Done reading '"CL_WHITE"%s"CL_RESET"' ("CL_WHITE"%d"CL_RESET" maps).\n", map_assign_txt, count);
+}
+
+/// Recomputes the plan from the weight of all the maps.
+static void map_assign_rebalance(void)
+{
+	DBIterator* iter;
+	struct map_assign** list;
+	struct map_assign* ma;
+	int count = 0, moved = 0, i;
+	int* slots;
+
+	if( map_assign_servers == 0 || map_assign_db->size(map_assign_db) == 0 )
+		return;
+
+	CREATE(list, struct map_assign*, map_assign_db->size(map_assign_db));
+	CREATE(slots, int, map_assign_db->size(map_assign_db));
+	iter = map_assign_db->iterator(map_assign_db);
+	for( ma = (struct map_assign*)iter->first(iter,NULL); iter->exists(iter); ma = (struct map_assign*)iter->next(iter,NULL) )
+		list[count++] = ma;
+	iter->destroy(iter);
+
+	qsort(list, count, sizeof(struct map_assign*), map_assign_cmp); // same order as map_assign_place
+	for( i = 0; i < count; ++i )
+		slots[i] = list[i]->slot;
+	map_assign_place(list, count);
+	for( i = 0; i < count; ++i )
+		if( slots[i] != list[i]->slot )
+			moved++;
+	aFree(slots);
+	aFree(list);
+
+	map_assign_write();
+	ShowStatus("Map assignment rebalanced ("CL_WHITE"%d"CL_RESET" maps moved).\n", moved);
+}
+
+/// Shows the plan: the load of each slot and the maps of each slot.
+static void map_assign_show(void)
+{
+	uint64 loads[MAX_MAP_SERVERS];
+	DBIterator* iter;
+	struct map_assign* ma;
+	int i, maps[MAX_MAP_SERVERS];
+
+	if( map_assign_servers == 0 )
+	{
+		ShowInfo("Map assignment is off (map_assign_servers: 0).\n");
+		return;
+	}
+
+	memset(maps, 0, sizeof(maps));
+	map_assign_loads(loads);
+	iter = map_assign_db->iterator(map_assign_db);
+	for( ma = (struct map_assign*)iter->first(iter,NULL); iter->exists(iter); ma = (struct map_assign*)iter->next(iter,NULL) )
+		if( ma->slot >= 0 && ma->slot < map_assign_servers )
+			maps[ma->slot]++;
+	iter->destroy(iter);
+
+	ShowInfo("Map assignment (%d slots):\n", map_assign_servers);
+	for( i = 0; i < map_assign_servers; ++i )
+	{
+		int id = map_assign_slot2server(i);
+		ShowInfo("  slot %d: %u.%u.%u.%u:%u %s, %d maps, load %"PRIu64", cpu %u.%u%%\n", i,
+			CONVIP(map_assign_slots[i].ip), map_assign_slots[i].port, ( id >= 0 ) ? "online" : "offline",
+			maps[i], loads[i], ( id >= 0 ) ? server[id].cpu/10 : 0, ( id >= 0 ) ? server[id].cpu%10 : 0);
+	}
+}
+
+/// Binds a slot to the map-server, returns -1 if all the slots are in use.
+/// Slots of map-servers that aren't connected can be taken over.
+static int map_assign_bind(uint32 ip, uint16 port)
+{
+	int i;
+
+	ARR_FIND(0, map_assign_servers, i, map_assign_slots[i].ip == ip && map_assign_slots[i].port == port);
+	if( i == map_assign_servers )
+		ARR_FIND(0, map_assign_servers, i, map_assign_slots[i].ip == 0);
+	if( i == map_assign_servers )
+		ARR_FIND(0, map_assign_servers, i, map_assign_slot2server(i) < 0);
+	if( i == map_assign_servers )
+		return -1;
+
+	if( map_assign_slots[i].ip != ip || map_assign_slots[i].port != port )
+	{
+		ShowStatus("Map assignment: slot %d bound to map-server %u.%u.%u.%u:%u.\n", i, CONVIP(ip), port);
+		map_assign_slots[i].ip = ip;
+		map_assign_slots[i].port = port;
+	}
+	return i;
+}
+
+/// Answers which maps a map-server has to load.
+/// 0x2b2c <len>.W <userid>.24B <passwd>.24B <ip>.L <port>.W {<mapindex>.W}*
+/// 0x2b2d <len>.W <result>.B {<mapindex>.W}*
+/// result: 0 = ok, 1 = refused, 2 = map assignment off, 3 = all the slots are in use
+static void char_assignmaps(int fd)
+{
+	char* l_user = (char*)RFIFOP(fd,4);
+	char* l_pass = (char*)RFIFOP(fd,28);
+	uint32 ip = ntohl(RFIFOL(fd,52));
+	uint16 port = ntohs(RFIFOW(fd,56));
+	int count = (RFIFOW(fd,2) - 58) / 2;
+	struct map_assign** placed;
+	int i, slot, num = 0, placed_num = 0;
+
+	l_user[23] = '\0';
+	l_pass[23] = '\0';
+	if( runflag != CHARSERVER_ST_RUNNING || strcmp(l_user, userid) != 0 || strcmp(l_pass, passwd) != 0 )
+	{
+		ShowWarning("Map assignment: refused the request of %u.%u.%u.%u:%u (wrong userid/password or not running).\n", CONVIP(ip), port);
+		WFIFOHEAD(fd,5);
+		WFIFOW(fd,0) = 0x2b2d;
+		WFIFOW(fd,2) = 5;
+		WFIFOB(fd,4) = 1;
+		WFIFOSET(fd,5);
+		return;
+	}
+	if( map_assign_servers == 0 || (slot = map_assign_bind(ip, port)) < 0 )
+	{// its maps are served by the others, loading them too would serve them twice
+		if( map_assign_servers != 0 )
+			ShowWarning("Map assignment: all %d slots are in use, %u.%u.%u.%u:%u gets no maps.\n", map_assign_servers, CONVIP(ip), port);
+		WFIFOHEAD(fd,5);
+		WFIFOW(fd,0) = 0x2b2d;
+		WFIFOW(fd,2) = 5;
+		WFIFOB(fd,4) = ( map_assign_servers == 0 ? 2 : 3 );
+		WFIFOSET(fd,5);
+		return;
+	}
+
+	WFIFOHEAD(fd,5+count*2);
+	CREATE(placed, struct map_assign*, count+1);
+	for( i = 0; i < count; ++i )
+	{
+		unsigned short mapindex = RFIFOW(fd,58+i*2);
+		struct map_assign* ma;
+		int id;
+
+		if( mapindex == 0 || mapindex >= MAX_MAPINDEX )
+			continue;
+		id = search_mapserver(mapindex, -1, -1);
+		if( id >= 0 && (server[id].ip != ip || server[id].port != port) )
+			continue; // already served by another map-server
+
+		ma = map_assign_get(mapindex);
+		if( ma->slot == slot )
+			WFIFOW(fd,5+(num++)*2) = mapindex;
+		else if( ma->slot < 0 || ma->slot >= map_assign_servers )
+			placed[placed_num++] = ma; // new map
+		else if( map_assign_slot2server(ma->slot) >= 0 )
+		{// the map-server of its slot doesn't serve it, take it over
+			ma->slot = slot;
+			WFIFOW(fd,5+(num++)*2) = mapindex;
+		}
+		// else left for the map-server of its slot
+	}
+	map_assign_place(placed, placed_num);
+	for( i = 0; i < placed_num; ++i )
+		if( placed[i]->slot == slot )
+			WFIFOW(fd,5+(num++)*2) = placed[i]->mapindex;
+	aFree(placed);
+
+	WFIFOW(fd,0) = 0x2b2d;
+	WFIFOW(fd,2) = 5+num*2;
+	WFIFOB(fd,4) = 0;
+	WFIFOSET(fd,5+num*2);
+
+	map_assign_write();
+	ShowStatus("Map assignment: map-server %u.%u.%u.%u:%u (slot %d) loads "CL_WHITE"%d"CL_RESET" of %d maps.\n", CONVIP(ip), port, slot, num, count);
+}
+
+/// Receives the load of the maps of a map-server.
+/// 0x2b2e <len>.W <cpu permille>.W {<mapindex>.W <users>.W <mobs>.W}*
+static void mapif_parse_mapload(int fd, int id)
+{
+	int i, count = (RFIFOW(fd,2) - 6) / 6;
+
+	server[id].cpu = RFIFOW(fd,4);
+	if( map_assign_db == NULL )
+		return;
+	for( i = 0; i < count; ++i )
+	{
+		unsigned short mapindex = RFIFOW(fd,6+i*6);
+		unsigned int users = RFIFOW(fd,8+i*6);
+		unsigned int mobs = RFIFOW(fd,10+i*6);
+		struct map_assign* ma;
+
+		if( mapindex == 0 || mapindex >= MAX_MAPINDEX )
+			continue;
+		ma = map_assign_get(mapindex);
+		ma->load_sum += users*MAPLOAD_USER_COST + ( users ? mobs : 0 );
+		ma->load_samples++;
+	}
+}
+
+#define MAP_MOVE_TIMEOUT 20000 // how long a map move can take (ms), less than the source map-server waits (HANDOFF_TIMEOUT in map/chrif.c)
+
+/// Map being moved from a map-server to another (console command 'mapassign move').
+static struct {
+	unsigned short mapindex; // 0 if none
+	int src, dst; // map-servers
+	int slot; // slot of the target map-server
+	bool relayed; // the state was sent to the target map-server
+	int timer;
+} map_move = { 0, -1, -1, -1, false, INVALID_TIMER };
+
+static int map_move_timeout(int tid, unsigned int tick, int id, intptr_t data);
+
+/// Forgets the map being moved.
+static void map_move_clear(void)
+{
+	if( map_move.timer != INVALID_TIMER )
+		delete_timer(map_move.timer, map_move_timeout);
+	map_move.mapindex = 0;
+	map_move.relayed = false;
+	map_move.timer = INVALID_TIMER;
+}
+
+/// Tells map-server id to put a map it took over back on standby, the map stays on map-server src (-1 if none).
+/// 0x2b37 <mapindex>.W <ip>.L <port>.W
+static void map_move_revert(int id, unsigned short mapindex, int src)
+{
+	int fd = server[id].fd;
+
+	if( fd <= 0 )
+		return;
+	WFIFOHEAD(fd,10);
+	WFIFOW(fd,0) = 0x2b37;
+	WFIFOW(fd,2) = mapindex;
+	WFIFOL(fd,4) = ( src >= 0 ) ? htonl(server[src].ip) : 0;
+	WFIFOW(fd,8) = ( src >= 0 ) ? htons(server[src].port) : 0;
+	WFIFOSET(fd,10);
+	ShowWarning("Map assignment: map-server %d puts map '%s' back on standby.\n", id, mapindex_id2name(mapindex));
+}
+
+/// Ends the move of a map and tells the result to the source map-server.
+/// 0x2b33 <mapindex>.W <result>.B
+/// result: 0 = moved, 1 = target offline, 2 = invalid state, 3 = timed out, else failed
+static void map_move_end(uint8 result)
+{
+	if( map_move.mapindex == 0 )
+		return;
+	if( server[map_move.src].fd > 0 )
+	{
+		int fd = server[map_move.src].fd;
+		WFIFOHEAD(fd,5);
+		WFIFOW(fd,0) = 0x2b33;
+		WFIFOW(fd,2) = map_move.mapindex;
+		WFIFOB(fd,4) = result;
+		WFIFOSET(fd,5);
+	}
+	if( result != 0 )
+		ShowWarning("Map assignment: map '%s' didn't move (result %d).\n", mapindex_id2name(map_move.mapindex), result);
+	map_move_clear();
+}
+
+/// The map move took too long. The source map-server keeps the map, and the target puts it back on
+/// standby if it got the state. Happens before the source gives up on its own, so both agree.
+static int map_move_timeout(int tid, unsigned int tick, int id, intptr_t data)
+{
+	if( map_move.timer != tid )
+		return 0;
+	map_move.timer = INVALID_TIMER;
+	ShowWarning("Map assignment: the move of map '%s' timed out.\n", mapindex_id2name(map_move.mapindex));
+	if( map_move.relayed )
+		map_move_revert(map_move.dst, map_move.mapindex, map_move.src);
+	map_move_end(3);
+	return 0;
+}
+
+/// Starts moving a map to the map-server of a slot, without a restart.
+/// The target map-server must have the map on standby (map_assign_standby in conf/map_athena.conf).
+/// 0x2b2f <mapindex>.W <ip>.L <port>.W
+static void map_move_start(const char* mapname, int slot)
+{
+	unsigned short mapindex = mapindex_name2id(mapname);
+	int src, dst, fd;
+
+	if( map_assign_servers == 0 )
+	{
+		ShowInfo("Map assignment is off (map_assign_servers: 0).\n");
+		return;
+	}
+	if( map_move.mapindex != 0 )
+	{
+		ShowInfo("Map '%s' is being moved, try again later.\n", mapindex_id2name(map_move.mapindex));
+		return;
+	}
+	if( mapindex == 0 || (src = search_mapserver(mapindex, -1, -1)) < 0 )
+	{
+		ShowInfo("Map '%s' isn't served by any map-server.\n", mapname);
+		return;
+	}
+	if( slot < 0 || slot >= map_assign_servers || (dst = map_assign_slot2server(slot)) < 0 )
+	{
+		ShowInfo("Slot %d has no map-server online.\n", slot);
+		return;
+	}
+	if( src == dst )
+	{
+		ShowInfo("Map '%s' is already served by the map-server of slot %d.\n", mapname, slot);
+		return;
+	}
+
+	map_move.mapindex = mapindex;
+	map_move.src = src;
+	map_move.dst = dst;
+	map_move.slot = slot;
+	map_move.relayed = false;
+	map_move.timer = add_timer(gettick() + MAP_MOVE_TIMEOUT, map_move_timeout, 0, 0);
+
+	fd = server[src].fd;
+	WFIFOHEAD(fd,10);
+	WFIFOW(fd,0) = 0x2b2f;
+	WFIFOW(fd,2) = mapindex;
+	WFIFOL(fd,4) = htonl(server[dst].ip);
+	WFIFOW(fd,8) = htons(server[dst].port);
+	WFIFOSET(fd,10);
+	ShowStatus("Map assignment: moving map '"CL_WHITE"%s"CL_RESET"' to slot %d.\n", mapindex_id2name(mapindex), slot);
+}
+
+/// Relays the state of the map handed off by the source map-server to the target map-server.
+/// 0x2b30 <len>.W <mapindex>.W <result>.B <state>.?B
+/// 0x2b31 <len>.W <mapindex>.W <result>.B <state>.?B
+static void mapif_parse_handoff(int fd, int id)
+{
+	int len = RFIFOW(fd,2), dfd;
+
+	if( map_move.mapindex == 0 || map_move.mapindex != RFIFOW(fd,4) || map_move.src != id )
+		return;
+	if( RFIFOB(fd,6) != 0 )
+	{// the source map-server can't hand it off, it keeps it
+		ShowWarning("Map assignment: map-server %d can't hand off map '%s' (result %d).\n", id, mapindex_id2name(map_move.mapindex), RFIFOB(fd,6));
+		map_move_clear();
+		return;
+	}
+	if( (dfd = server[map_move.dst].fd) <= 0 )
+	{
+		map_move_end(1);
+		return;
+	}
+	WFIFOHEAD(dfd,len);
+	memcpy(WFIFOP(dfd,0), RFIFOP(fd,0), len);
+	WFIFOW(dfd,0) = 0x2b31;
+	WFIFOSET(dfd,len);
+	map_move.relayed = true;
+}
+
+/// The source map-server gave up the handoff, it keeps the map.
+/// 0x2b38 <mapindex>.W
+static void mapif_parse_handoff_abort(int fd, int id)
+{
+	if( map_move.mapindex == 0 || map_move.mapindex != RFIFOW(fd,2) || map_move.src != id )
+		return;
+	ShowWarning("Map assignment: map-server %d gave up the handoff of map '%s'.\n", id, mapindex_id2name(map_move.mapindex));
+	if( map_move.relayed )
+		map_move_revert(map_move.dst, map_move.mapindex, map_move.src);
+	map_move_clear();
+}
+
+/// The target map-server took over the map (or not).
+/// Moves the map to the target map-server in the map lists and the plan, and tells all the map-servers.
+/// A takeover that comes after the move ended is undone (0x2b37), the map stays where it is.
+/// 0x2b32 <mapindex>.W <result>.B
+/// 0x2b34 <mapindex>.W <ip>.L <port>.W
+static void mapif_parse_takeover(int fd, int id)
+{
+	unsigned short mapindex = RFIFOW(fd,2);
+	unsigned char buf[10];
+	int i, j;
+
+	if( map_move.mapindex == 0 || map_move.mapindex != mapindex || map_move.dst != id )
+	{
+		if( RFIFOB(fd,4) == 0 && (i = search_mapserver(mapindex, -1, -1)) != id )
+		{
+			ShowWarning("Map assignment: map-server %d took over map '%s' too late.\n", id, mapindex_id2name(mapindex));
+			map_move_revert(id, mapindex, i);
+		}
+		return;
+	}
+	if( RFIFOB(fd,4) != 0 )
+	{
+		map_move_end(RFIFOB(fd,4));
+		return;
+	}
+
+	// map lists
+	ARR_FIND(0, MAX_MAP_PER_SERVER, i, server[map_move.src].map[i] == mapindex);
+	if( i < MAX_MAP_PER_SERVER )
+	{
+		for( j = i + 1; j < MAX_MAP_PER_SERVER && server[map_move.src].map[j]; ++j )
+			server[map_move.src].map[j-1] = server[map_move.src].map[j];
+		server[map_move.src].map[j-1] = 0;
+	}
+	ARR_FIND(0, MAX_MAP_PER_SERVER-1, i, server[id].map[i] == 0);
+	if( i < MAX_MAP_PER_SERVER-1 )
+		server[id].map[i] = mapindex;
+
+	// plan
+	map_assign_get(mapindex)->slot = map_move.slot;
+	map_assign_write();
+
+	WBUFW(buf,0) = 0x2b34;
+	WBUFW(buf,2) = mapindex;
+	WBUFL(buf,4) = htonl(server[id].ip);
+	WBUFW(buf,8) = htons(server[id].port);
+	mapif_sendall(buf, 10);
+
+	ShowStatus("Map assignment: map '"CL_WHITE"%s"CL_RESET"' moved from map-server %d to map-server %d (slot %d).\n", mapindex_id2name(mapindex), map_move.src, id, map_move.slot);
+	map_move_end(0);
+}
+
+/// A map-server disconnected, stops the map move it takes part in.
+static void map_move_disconnect(int id)
+{
+	if( map_move.mapindex == 0 )
+		return;
+	if( map_move.src == id )
+		map_move_clear(); // it loses the map anyway
+	else if( map_move.dst == id )
+		map_move_end(1);
+}
+
+/// Initializes the map assignment.
+static void map_assign_init(void)
+{
+	if( map_assign_servers == 0 )
+		return;
+	map_assign_db = idb_alloc(DB_OPT_RELEASE_DATA);
+	add_timer_func_list(map_move_timeout, "map_move_timeout");
+	map_assign_read();
+	map_assign_rebalance(); // no map-server is connected yet
+}
+
+/// Finalizes the map assignment.
+static void map_assign_final(void)
+{
+	if( map_assign_db == NULL )
+		return;
+	map_assign_write();
+	map_assign_db->destroy(map_assign_db, NULL);
+	map_assign_db = NULL;
+}
+
+
 int parse_frommap(int fd)
 {
 	int i, j;
@@ -2451,6 +3345,7 @@ int parse_frommap(int fd)
 	{
 		do_close(fd);
 		server[id].fd = -1;
+		map_move_disconnect(id);
 		mapif_on_disconnect(id);
 		return 0;
 	}
@@ -2631,6 +3526,8 @@ int parse_frommap(int fd)
 				struct mmo_charstatus char_dat;
 				memcpy(&char_dat, RFIFOP(fd,13), sizeof(struct mmo_charstatus));
 				mmo_char_tosql(cid, &char_dat);
+				if( (character = (struct online_char_data*)idb_get(online_char_db, aid)) != NULL && character->char_id == cid )
+					character->save_seq = 0; // the next delta saves are made against this one
 			} else {	//This may be valid on char-server reconnection, when re-sending characters that already logged off.
 				ShowError("parse_from_map (save-char): Received data for non-existant/offline character (%d:%d).\n", aid, cid);
 				set_char_online(id, cid, aid);
@@ -2649,6 +3546,91 @@ int parse_frommap(int fd)
 		}
 		break;
 
+		case 0x2b2a: // Receive the changes of the character data since the previous save from map-server
+			if (RFIFOREST(fd) < 4 || RFIFOREST(fd) < RFIFOW(fd,2))
+				return 0;
+		{
+			int aid = RFIFOL(fd,4), cid = RFIFOL(fd,8), size = RFIFOW(fd,2);
+			uint8 flag = RFIFOB(fd,12);
+			struct online_char_data* character = (struct online_char_data*)idb_get(online_char_db, aid);
+			struct mmo_charstatus* cp = (struct mmo_charstatus*)idb_get(char_db_, cid);
+			struct mmo_charstatus char_dat;
+
+			// the delta is made against the previous save, which is what char_db_ has after a save without errors
+			if( size < 21 || character == NULL || character->char_id != cid || character->server != id ||
+				character->save_seq != (int)RFIFOL(fd,13) || cp == NULL )
+			{// not the save this delta was made against, ask for the whole status
+				mapif_save_resync(fd, aid, cid, flag);
+				RFIFOSKIP(fd,size);
+				break;
+			}
+			memcpy(&char_dat, cp, sizeof(struct mmo_charstatus));
+			if( !char_apply_delta(&char_dat, RFIFOP(fd,21), size - 21) || char_dat.account_id != aid || char_dat.char_id != cid )
+			{
+				ShowError("parse_from_map (save-char): Invalid delta save for character %d:%d.\n", aid, cid);
+				character->save_seq = -1;
+				mapif_save_resync(fd, aid, cid, flag);
+				RFIFOSKIP(fd,size);
+				break;
+			}
+			mmo_char_tosql(cid, &char_dat);
+			character->save_seq = (int)RFIFOL(fd,17);
+
+			if (flag)
+			{	//Flag, set character offline after saving.
+				set_char_offline(cid, aid);
+				WFIFOHEAD(fd,10);
+				WFIFOW(fd,0) = 0x2b21;
+				WFIFOL(fd,2) = aid;
+				WFIFOL(fd,6) = cid;
+				WFIFOSET(fd,10);
+			}
+			RFIFOSKIP(fd,size);
+		}
+		break;
+
+		case 0x2b2e: // Receive the load of the maps from map-server
+			if (RFIFOREST(fd) < 4 || RFIFOREST(fd) < RFIFOW(fd,2))
+				return 0;
+			mapif_parse_mapload(fd, id);
+			RFIFOSKIP(fd,RFIFOW(fd,2));
+		break;
+
+		case 0x2b30: // Receive the state of a map handed off by the map-server
+			if (RFIFOREST(fd) < 4 || RFIFOREST(fd) < RFIFOW(fd,2))
+				return 0;
+			mapif_parse_handoff(fd, id);
+			RFIFOSKIP(fd,RFIFOW(fd,2));
+		break;
+
+		case 0x2b32: // The map-server took over a map
+			if (RFIFOREST(fd) < 5)
+				return 0;
+			mapif_parse_takeover(fd, id);
+			RFIFOSKIP(fd,5);
+		break;
+
+		case 0x2b38: // The map-server gave up the handoff of a map
+			if (RFIFOREST(fd) < 4)
+				return 0;
+			mapif_parse_handoff_abort(fd, id);
+			RFIFOSKIP(fd,4);
+		break;
+
+		case 0x2b35: // A permanent global variable changed in a map group, send it to all the map-servers (sender included, for the order)
+			if (RFIFOREST(fd) < 4 || RFIFOREST(fd) < RFIFOW(fd,2))
+				return 0;
+		{
+			int len = RFIFOW(fd,2);
+			if( len >= 22 )
+			{
+				RFIFOW(fd,0) = 0x2b36;
+				mapif_sendall((unsigned char*)RFIFOP(fd,0), len);
+			}
+			RFIFOSKIP(fd,len);
+		}
+		break;
+
 		case 0x2b02: // req char selection
 			if( RFIFOREST(fd) < 18 )
 				return 0;
@@ -3108,6 +4090,19 @@ int parse_frommap(int fd)
 			RFIFOSKIP(fd,6);
 		break;
 
+		case SERVERLINK_COMPRESSED: // unpack it in the buffer and parse the packet it contains
+		{
+			int r = RFIFOUNCOMPRESS(fd);
+			if( r == 0 )
+				return 0;
+			if( r < 0 )
+			{
+				set_eof(fd);
+				return 0;
+			}
+		}
+		break;
+
 		default:
 		{
 			// inter server - packet
@@ -3869,6 +4864,23 @@ int parse_char(int fd)
 			RFIFOSKIP(fd,6);
 		break;
 
+		// map-server asking which maps to load
+		case 0x2b2c:
+			if (RFIFOREST(fd) < 4)
+				return 0;
+			if (RFIFOW(fd,2) < 58 || RFIFOW(fd,2) > FIFOSIZE_SERVERLINK)
+			{
+				set_eof(fd);
+				return 0;
+			}
+			if (RFIFOW(fd,2) > session[fd]->max_rdata)
+				realloc_fifo(fd, FIFOSIZE_SERVERLINK, FIFOSIZE_SERVERLINK);
+			if (RFIFOREST(fd) < RFIFOW(fd,2))
+				return 0;
+			char_assignmaps(fd);
+			RFIFOSKIP(fd,RFIFOW(fd,2));
+		break;
+
 		// login as map-server
 		case 0x2af8:
 			if (RFIFOREST(fd) < 60)
@@ -3889,6 +4901,13 @@ int parse_char(int fd)
 				WFIFOB(fd,2) = 3;
 				WFIFOSET(fd,3);
 			} else {
+				if( RFIFOL(fd,50) != 0 )
+				{// the map-server knows about link features, tell it ours before it starts sending
+					WFIFOHEAD(fd,6);
+					WFIFOW(fd,0) = 0x2b29;
+					WFIFOL(fd,2) = SERVERLINK_FEATURE_COMPRESS|SERVERLINK_FEATURE_DELTASAVE|SERVERLINK_FEATURE_MAPLOAD;
+					WFIFOSET(fd,6);
+				}
 				WFIFOHEAD(fd,3);
 				WFIFOW(fd,0) = 0x2af9;
 				WFIFOB(fd,2) = 0;
@@ -3898,10 +4917,13 @@ int parse_char(int fd)
 				server[i].ip = ntohl(RFIFOL(fd,54));
 				server[i].port = ntohs(RFIFOW(fd,58));
 				server[i].users = 0;
+				server[i].cpu = 0;
 				memset(server[i].map, 0, sizeof(server[i].map));
 				session[fd]->func_parse = parse_frommap;
 				session[fd]->flag.server = 1;
 				realloc_fifo(fd, FIFOSIZE_SERVERLINK, FIFOSIZE_SERVERLINK);
+				if( RFIFOL(fd,50)&SERVERLINK_FEATURE_COMPRESS )
+					socket_compress(fd); // map-server accepts compressed packets
 				char_mapif_init(fd);
 			}
 
@@ -3930,12 +4952,41 @@ int parse_console(const char* command)
 		runflag = 0;
 	else if( strcmpi("alive", command) == 0 || strcmpi("status", command) == 0 )
 		ShowInfo(CL_CYAN"Console: "CL_BOLD"I'm Alive."CL_RESET"\n");
+	else if( strcmpi("linkstats", command) == 0 )
+		socket_linkstats_show();
+	else if( strcmpi("linkstats reset", command) == 0 )
+		socket_linkstats_reset();
+	else if( strcmpi("mapassign", command) == 0 )
+		map_assign_show();
+	else if( strcmpi("mapassign rebalance", command) == 0 )
+		map_assign_rebalance();
+	else if( strncmpi("mapassign move ", command, 15) == 0 )
+	{
+		char mapname[MAP_NAME_LENGTH_EXT];
+		int slot;
+		if( sscanf(command + 15, "%15s %d", mapname, &slot) == 2 )
+			map_move_start(mapname, slot);
+		else
+			ShowInfo("Usage: mapassign move <map name> <slot>\n");
+	}
 	else if( strcmpi("help", command) == 0 )
 	{
 		ShowInfo("To shutdown the server:\n");
 		ShowInfo("  'shutdown|exit|quit|end'\n");
 		ShowInfo("To know if server is alive:\n");
 		ShowInfo("  'alive|status'\n");
+		ShowInfo("To show the server link traffic per packet type:\n");
+		ShowInfo("  'linkstats [reset]'\n");
+		ShowInfo("To show or rebalance the map assignment of the map-servers:\n");
+		ShowInfo("  'mapassign [rebalance]'\n");
+		ShowInfo("To move a map to the map-server of a slot, without a restart:\n");
+		ShowInfo("  'mapassign move <map name> <slot>'\n");
+		ShowInfo("To show the character cache statistics:\n");
+		ShowInfo("  'charcache'\n");
+	}
+	else if( strcmpi("charcache", command) == 0 )
+	{
+		ShowInfo("Character cache: %d/%d characters, %u hits, %u misses.\n", char_cache_count, char_cache_size, char_cache_hits, char_cache_misses);
 	}
 
 	return 0;
@@ -4392,10 +5443,18 @@ int char_config_read(const char* cfgName)
 			char_del_level = atoi(w2);
 		} else if (strcmpi(w1, "char_del_delay") == 0) {
 			char_del_delay = atoi(w2);
+		} else if (strcmpi(w1, "char_cache_size") == 0) {
+			char_cache_size = atoi(w2);
+		} else if (strcmpi(w1, "char_cache_time") == 0) {
+			char_cache_time = atoi(w2);
 		} else if(strcmpi(w1,"db_path")==0) {
 			safestrncpy(db_path, w2, sizeof(db_path));
 		} else if (strcmpi(w1, "console") == 0) {
 			console = config_switch(w2);
+		} else if (strcmpi(w1, "map_assign_servers") == 0) {
+			map_assign_servers = cap_value(atoi(w2), 0, MAX_MAP_SERVERS);
+		} else if (strcmpi(w1, "map_assign_txt") == 0) {
+			safestrncpy(map_assign_txt, w2, sizeof(map_assign_txt));
 		} else if (strcmpi(w1, "fame_list_alchemist") == 0) {
 			fame_list_size_chemist = atoi(w2);
 			if (fame_list_size_chemist > MAX_FAME_LIST) {
@@ -4439,11 +5498,13 @@ void do_final(void)
 	
 	do_final_mapif();
 	do_final_loginif();
+	map_assign_final();
 
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `ragsrvinfo`") )
 		Sql_ShowDebug(sql_handle);
 
 	char_db_->destroy(char_db_, NULL);
+	char_cache_db->destroy(char_cache_db, NULL);
 	online_char_db->destroy(online_char_db, NULL);
 	auth_db->destroy(auth_db, NULL);
 
@@ -4540,6 +5601,7 @@ int do_init(int argc, char **argv)
 
 	do_init_loginif();
 	do_init_mapif();
+	map_assign_init();
 
 	// periodically update the overall user count on all mapservers + login server
 	add_timer_func_list(broadcast_user_count, "broadcast_user_count");
@@ -7,9 +7,12 @@
  *  (2) Private functions
  *  (3) Protected functions used internally
  *  (4) Protected functions used in the interface of the database
+ *  (4b) Protected functions used in the interface of flat databases
  *  (5) Public functions
  *
  *  The databases are structured as a hashtable of RED-BLACK trees.
+ *  Numeric databases created with DB_OPT_FLAT are structured as a single
+ *  open-addressing table instead (see section (4b)).
  *
  *  <B>Properties of the RED-BLACK trees being used:</B>
  *  1. The value of any node is greater than the value of its left child and
@@ -48,6 +51,7 @@
  *  - create a db that organizes itself by splaying
  *
  *  HISTORY:
+ *    2026/10/16 - Added flat open-addressing databases (DB_OPT_FLAT).
  *    2008/02/19 - Fixed db_obj_get not handling deleted entries correctly.
  *    2007/11/09 - Added an iterator to the database.
  *    2006/12/21 - Added 1-node cache to the database.
@@ -67,6 +71,7 @@
 \*****************************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "db.h"
 #include "../common/mmo.h"
@@ -84,6 +89,10 @@
  *  DBNode          - Structure of a node in RED-BLACK trees.                *
  *  struct db_free  - Structure that holds a deleted node to be freed.       *
  *  DBMap_impl      - Struture of the database.                              *
+ *  DBFLAT_MIN_SIZE - Define with the minimum size of a flat table.          *
+ *  DBFlatState     - Enumeration of states of the slots of a flat table.    *
+ *  struct dbflat_slot - Structure of a slot in a flat table.                *
+ *  DBMap_flat      - Structure of a flat database.                          *
  *  stats           - Statistics about the database system.                  *
 \*****************************************************************************/
 
@@ -99,6 +108,15 @@
  */
 //#define DB_ENABLE_STATS
 
+/**
+ * If defined, a benchmark comparing the RED-BLACK tree databases with the
+ * flat databases is run and displayed when initializing the database system.
+ * @private
+ * @see #db_benchmark(void)
+ * @see #db_init(void)
+ */
+//#define DB_ENABLE_BENCHMARK
+
 /**
  * Size of the hashtable in the database.
  * @private
@@ -219,6 +237,98 @@ typedef struct DBIterator_impl {
 	DBNode node;
 } DBIterator_impl;
 
+/**
+ * Minimum size of the table of a flat database.
+ * Must be a power of two.
+ * @private
+ * @see DBMap_flat#slots
+ */
+#define DBFLAT_MIN_SIZE 16
+
+/**
+ * State of the individual slots of a flat database.
+ * Deleted slots keep the probe sequences intact until the table is rebuilt.
+ * @private
+ * @see struct dbflat_slot
+ */
+typedef enum dbflat_state {
+	DBFLAT_EMPTY = 0,
+	DBFLAT_USED,
+	DBFLAT_DELETED
+} DBFlatState;
+
+/**
+ * A slot in the table of a flat database.
+ * @param key Key of this database entry
+ * @param data Data of this database entry
+ * @param state State of the slot
+ * @private
+ * @see DBMap_flat#slots
+ */
+struct dbflat_slot {
+	DBKey key;
+	void *data;
+	DBFlatState state;
+};
+
+/**
+ * Complete flat database structure.
+ * Entries are kept in a single power-of-two table with linear probing.
+ * Removed entries are marked as deleted and the table is only rebuilt when
+ * the database is not locked, so iterators never see entries move.
+ * @param vtable Interface of the database
+ * @param alloc_file File where the database was allocated
+ * @param alloc_line Line in the file where the database was allocated
+ * @param slots Table of entries
+ * @param size Number of slots in the table (power of two)
+ * @param bits Number of bits used to index the table
+ * @param item_count Number of items in the database
+ * @param deleted_count Number of deleted slots in the table
+ * @param free_lock Lock for rebuilding the table
+ * @param release Releaser of the database
+ * @param type Type of the database
+ * @param options Options of the database
+ * @param global_lock Global lock of the database
+ * @private
+ * @see #db_alloc(const char*,int,DBType,DBOptions,unsigned short)
+ */
+typedef struct DBMap_flat {
+	// Database interface
+	struct DBMap vtable;
+	// File and line of allocation
+	const char *alloc_file;
+	int alloc_line;
+	// Table
+	struct dbflat_slot *slots;
+	uint32 size;
+	uint32 bits;
+	uint32 item_count;
+	uint32 deleted_count;
+	// Lock system
+	unsigned int free_lock;
+	// Other
+	DBReleaser release;
+	DBType type;
+	DBOptions options;
+	unsigned global_lock : 1;
+} DBMap_flat;
+
+/**
+ * Complete flat iterator structure.
+ * @param vtable Interface of the iterator
+ * @param db Parent database
+ * @param index Current slot of the table (-1 before the first entry)
+ * @private
+ * @see #DBIterator
+ * @see #DBMap_flat
+ */
+typedef struct DBIterator_flat {
+	// Iterator interface
+	struct DBIterator vtable;
+	DBMap_flat* db;
+	int64 index;
+} DBIterator_flat;
+
 #if defined(DB_ENABLE_STATS)
 /**
  * Structure with what is counted when the database estatistics are enabled.
@@ -2215,181 +2325,1142 @@ static DBOptions db_obj_options(DBMap* self)
 }
 
 /*****************************************************************************\
- *  (5) Section with public functions.
- *  db_fix_options     - Apply database type restrictions to the options.
- *  db_default_cmp     - Get the default comparator for a type of database.
- *  db_default_hash    - Get the default hasher for a type of database.
- *  db_default_release - Get the default releaser for a type of database with the specified options.
- *  db_custom_release  - Get a releaser that behaves a certains way.
- *  db_alloc           - Allocate a new database.
- *  db_i2key           - Manual cast from 'int' to 'DBKey'.
- *  db_ui2key          - Manual cast from 'unsigned int' to 'DBKey'.
- *  db_str2key         - Manual cast from 'unsigned char *' to 'DBKey'.
- *  db_init            - Initializes the database system.
- *  db_final           - Finalizes the database system.
+ *  (4b) Section with protected functions used in the interface of flat      *
+ *  databases and their iterators.                                           *
+ *  dbflat_hash       - Index of the first slot probed for a key.            *
+ *  dbflat_find       - Find the slot of an entry.                           *
+ *  dbflat_resize     - Rebuild the table with a new size.                   *
+ *  dbflat_reserve    - Make room for a new entry.                           *
+ *  dbflat_insert     - Put a new entry in the table.                        *
+ *  dbflat_erase      - Mark a slot as deleted.                              *
+ *  dbflat_lock       - Increment the free_lock of a database.               *
+ *  dbflat_unlock     - Decrement the free_lock of a database.               *
+ *         If it was the last lock, compacts the table.                      *
+ *  dbitflat_obj_*    - Interface of the iterator of flat databases.         *
+ *  dbflat_obj_*      - Interface of flat databases.                         *
 \*****************************************************************************/
 
 /**
- * Returns the fixed options according to the database type.
- * Sets required options and unsets unsupported options.
- * For numeric databases DB_OPT_DUP_KEY and DB_OPT_RELEASE_KEY are unset.
- * @param type Type of the database
- * @param options Original options of the database
- * @return Fixed options of the database
+ * Returns the index of the first slot probed for the key.
+ * Uses fibonacci hashing so sequential ids are spread over the table.
+ * @param db Target database
+ * @param key Key of the entry
+ * @return Index of the slot
  * @private
- * @see #db_default_release(DBType,DBOptions)
- * @see #db_alloc(const char *,int,DBType,DBOptions,unsigned short)
  */
-DBOptions db_fix_options(DBType type, DBOptions options)
+static inline uint32 dbflat_hash(DBMap_flat* db, DBKey key)
 {
-	DB_COUNTSTAT(db_fix_options);
-	switch (type) {
-		case DB_INT:
-		case DB_UINT: // Numeric database, do nothing with the keys
-			return (DBOptions)(options&~(DB_OPT_DUP_KEY|DB_OPT_RELEASE_KEY));
+	return (uint32)(key.ui*0x9E3779B9U) >> (32 - db->bits);
+}
 
-		default:
-			ShowError("db_fix_options: Unknown database type %u with options %x\n", type, options);
-		case DB_STRING:
-		case DB_ISTRING: // String databases, no fix required
-			return options;
+/**
+ * Returns the index of the slot that holds the key or -1 if not found.
+ * @param db Target database
+ * @param key Key of the entry
+ * @return Index of the slot or -1
+ * @private
+ */
+static int64 dbflat_find(DBMap_flat* db, DBKey key)
+{
+	uint32 mask = db->size - 1;
+	uint32 i = dbflat_hash(db, key);
+
+	for(;;)
+	{
+		struct dbflat_slot* slot = &db->slots[i];
+		if( slot->state == DBFLAT_EMPTY )
+			return -1;
+		if( slot->state == DBFLAT_USED && slot->key.ui == key.ui )
+			return i;
+		i = (i + 1)&mask;
 	}
 }
 
 /**
- * Returns the default comparator for the specified type of database.
- * @param type Type of database
- * @return Comparator for the type of database or NULL if unknown database
- * @public
- * @see #db_int_cmp(DBKey,DBKey,unsigned short)
- * @see #db_uint_cmp(DBKey,DBKey,unsigned short)
- * @see #db_string_cmp(DBKey,DBKey,unsigned short)
- * @see #db_istring_cmp(DBKey,DBKey,unsigned short)
+ * Rebuilds the table so it has room for at least <code>count</code> entries
+ * while staying at most half full. Deleted slots are dropped.
+ * NOTE: moves entries, so it must not run while iterators exist unless the
+ * table is full.
+ * @param db Target database
+ * @param count Number of entries the table must hold
+ * @private
  */
-DBComparator db_default_cmp(DBType type)
+static void dbflat_resize(DBMap_flat* db, uint32 count)
 {
-	DB_COUNTSTAT(db_default_cmp);
-	switch (type) {
-		case DB_INT:     return &db_int_cmp;
-		case DB_UINT:    return &db_uint_cmp;
-		case DB_STRING:  return &db_string_cmp;
-		case DB_ISTRING: return &db_istring_cmp;
-		default:
-			ShowError("db_default_cmp: Unknown database type %u\n", type);
-			return NULL;
+	struct dbflat_slot* old_slots = db->slots;
+	uint32 old_size = db->size;
+	uint32 size = DBFLAT_MIN_SIZE;
+	uint32 bits = 4;
+	uint32 i;
+
+	while( size/2 < count )
+	{
+		size <<= 1;
+		++bits;
+	}
+
+	CREATE(db->slots, struct dbflat_slot, size);
+	db->size = size;
+	db->bits = bits;
+	db->deleted_count = 0;
+	for( i = 0; i < old_size; ++i )
+	{
+		uint32 j;
+		if( old_slots[i].state != DBFLAT_USED )
+			continue;
+		j = dbflat_hash(db, old_slots[i].key);
+		while( db->slots[j].state != DBFLAT_EMPTY )
+			j = (j + 1)&(size - 1);
+		db->slots[j] = old_slots[i];
 	}
+	aFree(old_slots);
 }
 
 /**
- * Returns the default hasher for the specified type of database.
- * @param type Type of database
- * @return Hasher of the type of database or NULL if unknown database
- * @public
- * @see #db_int_hash(DBKey,unsigned short)
- * @see #db_uint_hash(DBKey,unsigned short)
- * @see #db_string_hash(DBKey,unsigned short)
- * @see #db_istring_hash(DBKey,unsigned short)
+ * Makes sure there is room for one more entry.
+ * The table is kept at most 3/4 full. While the database is locked the
+ * table is only rebuilt when no empty slots would be left, so iterators
+ * don't skip or repeat entries.
+ * @param db Target database
+ * @private
  */
-DBHasher db_default_hash(DBType type)
+static void dbflat_reserve(DBMap_flat* db)
 {
-	DB_COUNTSTAT(db_default_hash);
-	switch (type) {
-		case DB_INT:     return &db_int_hash;
-		case DB_UINT:    return &db_uint_hash;
-		case DB_STRING:  return &db_string_hash;
-		case DB_ISTRING: return &db_istring_hash;
-		default:
-			ShowError("db_default_hash: Unknown database type %u\n", type);
-			return NULL;
-	}
+	uint32 used = db->item_count + db->deleted_count + 1;
+
+	if( used*4 <= db->size*3 )
+		return;// enough room
+	if( db->free_lock && used < db->size )
+		return;// postponed until unlocked
+	if( db->free_lock )
+		ShowWarning("dbflat_reserve: Table is full while locked, iterators may repeat or skip entries.\n"
+				"Database allocated at %s:%d\n",
+				db->alloc_file, db->alloc_line);
+	dbflat_resize(db, db->item_count + 1);
 }
 
 /**
- * Returns the default releaser for the specified type of database with the 
- * specified options.
- * NOTE: the options are fixed with {@link #db_fix_options(DBType,DBOptions)}
- * before choosing the releaser.
- * @param type Type of database
- * @param options Options of the database
- * @return Default releaser for the type of database with the specified options
- * @public
- * @see #db_release_nothing(DBKey,void *,DBRelease)
- * @see #db_release_key(DBKey,void *,DBRelease)
- * @see #db_release_data(DBKey,void *,DBRelease)
- * @see #db_release_both(DBKey,void *,DBRelease)
- * @see #db_custom_release(DBRelease)
+ * Puts a new entry in the table.
+ * The key must not exist in the database.
+ * @param db Target database
+ * @param key Key of the entry
+ * @param data Data of the entry
+ * @return Index of the slot
+ * @private
  */
-DBReleaser db_default_release(DBType type, DBOptions options)
+static uint32 dbflat_insert(DBMap_flat* db, DBKey key, void* data)
+{
+	uint32 mask;
+	uint32 i;
+
+	dbflat_reserve(db);
+	mask = db->size - 1;
+	i = dbflat_hash(db, key);
+	while( db->slots[i].state == DBFLAT_USED )
+		i = (i + 1)&mask;
+	if( db->slots[i].state == DBFLAT_DELETED )
+		db->deleted_count--;
+	db->slots[i].key = key;
+	db->slots[i].data = data;
+	db->slots[i].state = DBFLAT_USED;
+	db->item_count++;
+	return i;
+}
+
+/**
+ * Marks the slot as deleted.
+ * If the next slot is empty, the trailing deleted slots are emptied since
+ * no probe sequence goes through them anymore.
+ * @param db Target database
+ * @param i Index of the slot
+ * @private
+ */
+static void dbflat_erase(DBMap_flat* db, uint32 i)
 {
-	DB_COUNTSTAT(db_default_release);
-	options = db_fix_options(type, options);
-	if (options&DB_OPT_RELEASE_DATA) { // Release data, what about the key?
-		if (options&(DB_OPT_DUP_KEY|DB_OPT_RELEASE_KEY))
-			return &db_release_both; // Release both key and data
-		return &db_release_data; // Only release data
+	uint32 mask = db->size - 1;
+
+	db->slots[i].state = DBFLAT_DELETED;
+	db->slots[i].data = NULL;
+	db->item_count--;
+	db->deleted_count++;
+	if( db->slots[(i + 1)&mask].state != DBFLAT_EMPTY )
+		return;
+	while( db->slots[i].state == DBFLAT_DELETED )
+	{
+		db->slots[i].state = DBFLAT_EMPTY;
+		db->deleted_count--;
+		i = (i - 1)&mask;
 	}
-	if (options&(DB_OPT_DUP_KEY|DB_OPT_RELEASE_KEY))
-		return &db_release_key; // Only release key
-	return &db_release_nothing; // Release nothing
 }
 
 /**
- * Returns the releaser that releases the specified release options.
- * @param which Options that specified what the releaser releases
- * @return Releaser for the specified release options
- * @public
- * @see #db_release_nothing(DBKey,void *,DBRelease)
- * @see #db_release_key(DBKey,void *,DBRelease)
- * @see #db_release_data(DBKey,void *,DBRelease)
- * @see #db_release_both(DBKey,void *,DBRelease)
- * @see #db_default_release(DBType,DBOptions)
+ * Increment the free_lock of the database.
+ * @param db Target database
+ * @private
  */
-DBReleaser db_custom_release(DBRelease which)
+static void dbflat_lock(DBMap_flat* db)
 {
-	DB_COUNTSTAT(db_custom_release);
-	switch (which) {
-		case DB_RELEASE_NOTHING: return &db_release_nothing;
-		case DB_RELEASE_KEY:     return &db_release_key;
-		case DB_RELEASE_DATA:    return &db_release_data;
-		case DB_RELEASE_BOTH:    return &db_release_both;
-		default:
-			ShowError("db_custom_release: Unknown release options %u\n", which);
-			return NULL;
+	if( db->free_lock == (unsigned int)~0 )
+	{
+		ShowFatalError("dbflat_lock: free_lock overflow\n"
+				"Database allocated at %s:%d\n",
+				db->alloc_file, db->alloc_line);
+		exit(EXIT_FAILURE);
 	}
+	db->free_lock++;
 }
 
 /**
- * Allocate a new database of the specified type.
- * NOTE: the options are fixed by {@link #db_fix_options(DBType,DBOptions)}
- * before creating the database.
- * @param file File where the database is being allocated
- * @param line Line of the file where the database is being allocated
- * @param type Type of database
- * @param options Options of the database
- * @param maxlen Maximum length of the string to be used as key in string 
- *          databases. If 0, the maximum number of maxlen is used (64K).
- * @return The interface of the database
- * @public
- * @see #DBMap_impl
- * @see #db_fix_options(DBType,DBOptions)
+ * Decrement the free_lock of the database.
+ * If it was the last lock, rebuilds the table when it has too many deleted
+ * slots or grew past the load limit while locked.
+ * @param db Target database
+ * @private
  */
-DBMap* db_alloc(const char *file, int line, DBType type, DBOptions options, unsigned short maxlen)
+static void dbflat_unlock(DBMap_flat* db)
 {
-	DBMap_impl* db;
-	unsigned int i;
+	if( db->free_lock == 0 )
+		ShowWarning("dbflat_unlock: free_lock was already 0\n"
+				"Database allocated at %s:%d\n",
+				db->alloc_file, db->alloc_line);
+	else
+		db->free_lock--;
+	if( db->free_lock )
+		return;// Not last lock
 
-#ifdef DB_ENABLE_STATS
-	DB_COUNTSTAT(db_alloc);
-	switch (type) {
-		case DB_INT: DB_COUNTSTAT(db_int_alloc); break;
-		case DB_UINT: DB_COUNTSTAT(db_uint_alloc); break;
-		case DB_STRING: DB_COUNTSTAT(db_string_alloc); break;
-		case DB_ISTRING: DB_COUNTSTAT(db_istring_alloc); break;
+	if( db->deleted_count*4 > db->size || (db->item_count + db->deleted_count)*4 > db->size*3 )
+		dbflat_resize(db, db->item_count);
+}
+
+/**
+ * Fetches the next entry in the database.
+ * @param self Iterator
+ * @param out_key Key of the entry
+ * @return Data of the entry
+ * @protected
+ * @see DBIterator#next
+ */
+static void* dbitflat_obj_next(DBIterator* self, DBKey* out_key)
+{
+	DBIterator_flat* it = (DBIterator_flat*)self;
+	DBMap_flat* db = it->db;
+
+	if( it->index < 0 )
+		it->index = -1;
+	for( ++it->index; it->index < (int64)db->size; ++it->index )
+	{
+		struct dbflat_slot* slot = &db->slots[it->index];
+		if( slot->state == DBFLAT_USED )
+		{
+			if( out_key )
+				memcpy(out_key, &slot->key, sizeof(DBKey));
+			return slot->data;
+		}
 	}
-#endif /* DB_ENABLE_STATS */
-	CREATE(db, struct DBMap_impl, 1);
+	it->index = db->size;
+	return NULL;// not found
+}
+
+/**
+ * Fetches the previous entry in the database.
+ * @param self Iterator
+ * @param out_key Key of the entry
+ * @return Data of the entry
+ * @protected
+ * @see DBIterator#prev
+ */
+static void* dbitflat_obj_prev(DBIterator* self, DBKey* out_key)
+{
+	DBIterator_flat* it = (DBIterator_flat*)self;
+	DBMap_flat* db = it->db;
+
+	if( it->index > (int64)db->size )
+		it->index = db->size;
+	for( --it->index; it->index >= 0; --it->index )
+	{
+		struct dbflat_slot* slot = &db->slots[it->index];
+		if( slot->state == DBFLAT_USED )
+		{
+			if( out_key )
+				memcpy(out_key, &slot->key, sizeof(DBKey));
+			return slot->data;
+		}
+	}
+	it->index = -1;
+	return NULL;// not found
+}
+
+/**
+ * Fetches the first entry in the database.
+ * @param self Iterator
+ * @param out_key Key of the entry
+ * @return Data of the entry
+ * @protected
+ * @see DBIterator#first
+ */
+static void* dbitflat_obj_first(DBIterator* self, DBKey* out_key)
+{
+	DBIterator_flat* it = (DBIterator_flat*)self;
+
+	it->index = -1;// position before the first entry
+	return self->next(self, out_key);
+}
+
+/**
+ * Fetches the last entry in the database.
+ * @param self Iterator
+ * @param out_key Key of the entry
+ * @return Data of the entry
+ * @protected
+ * @see DBIterator#last
+ */
+static void* dbitflat_obj_last(DBIterator* self, DBKey* out_key)
+{
+	DBIterator_flat* it = (DBIterator_flat*)self;
+
+	it->index = it->db->size;// position after the last entry
+	return self->prev(self, out_key);
+}
+
+/**
+ * Returns true if the fetched entry exists.
+ * @param self Iterator
+ * @return true is the entry exists
+ * @protected
+ * @see DBIterator#exists
+ */
+static bool dbitflat_obj_exists(DBIterator* self)
+{
+	DBIterator_flat* it = (DBIterator_flat*)self;
+
+	return ( it->index >= 0 && it->index < (int64)it->db->size && it->db->slots[it->index].state == DBFLAT_USED );
+}
+
+/**
+ * Removes the current entry from the database.
+ * @param self Iterator
+ * @return The data of the entry or NULL if not found
+ * @protected
+ * @see DBIterator#remove
+ */
+static void* dbitflat_obj_remove(DBIterator* self)
+{
+	DBIterator_flat* it = (DBIterator_flat*)self;
+	DBMap_flat* db = it->db;
+	void* data;
+
+	if( !self->exists(self) )
+		return NULL;
+	data = db->slots[it->index].data;
+	db->release(db->slots[it->index].key, data, DB_RELEASE_DATA);
+	dbflat_erase(db, (uint32)it->index);
+	return data;
+}
+
+/**
+ * Destroys this iterator and unlocks the database.
+ * @param self Iterator
+ * @protected
+ */
+static void dbitflat_obj_destroy(DBIterator* self)
+{
+	DBIterator_flat* it = (DBIterator_flat*)self;
+
+	dbflat_unlock(it->db);
+	aFree(self);
+}
+
+/**
+ * Returns a new iterator for this database.
+ * @param self Database
+ * @return New iterator
+ * @protected
+ * @see DBMap#iterator
+ */
+static DBIterator* dbflat_obj_iterator(DBMap* self)
+{
+	DBMap_flat* db = (DBMap_flat*)self;
+	DBIterator_flat* it;
+
+	CREATE(it, struct DBIterator_flat, 1);
+	/* Interface of the iterator **/
+	it->vtable.first   = dbitflat_obj_first;
+	it->vtable.last    = dbitflat_obj_last;
+	it->vtable.next    = dbitflat_obj_next;
+	it->vtable.prev    = dbitflat_obj_prev;
+	it->vtable.exists  = dbitflat_obj_exists;
+	it->vtable.remove  = dbitflat_obj_remove;
+	it->vtable.destroy = dbitflat_obj_destroy;
+	/* Initial state (before the first entry) */
+	it->db = db;
+	it->index = -1;
+	/* Lock the database */
+	dbflat_lock(db);
+	return &it->vtable;
+}
+
+/**
+ * Returns true if the entry exists.
+ * @param self Interface of the database
+ * @param key Key that identifies the entry
+ * @return true is the entry exists
+ * @protected
+ * @see DBMap#exists
+ */
+static bool dbflat_obj_exists(DBMap* self, DBKey key)
+{
+	DBMap_flat* db = (DBMap_flat*)self;
+
+	if (db == NULL) return false; // nullpo candidate
+	return ( dbflat_find(db, key) >= 0 );
+}
+
+/**
+ * Get the data of the entry identifid by the key.
+ * @param self Interface of the database
+ * @param key Key that identifies the entry
+ * @return Data of the entry or NULL if not found
+ * @protected
+ * @see DBMap#get
+ */
+static void* dbflat_obj_get(DBMap* self, DBKey key)
+{
+	DBMap_flat* db = (DBMap_flat*)self;
+	int64 i;
+
+	if (db == NULL) return NULL; // nullpo candidate
+	i = dbflat_find(db, key);
+	return ( i >= 0 ) ? db->slots[i].data : NULL;
+}
+
+/**
+ * Get the data of the entries matched by <code>match</code>.
+ * @param self Interface of the database
+ * @param buf Buffer to put the data of the matched entries
+ * @param max Maximum number of data entries to be put into buf
+ * @param match Function that matches the database entries
+ * @param args Extra arguments for match
+ * @return The number of entries that matched
+ * @protected
+ * @see DBMap#vgetall
+ */
+static unsigned int dbflat_obj_vgetall(DBMap* self, void **buf, unsigned int max, DBMatcher match, va_list args)
+{
+	DBMap_flat* db = (DBMap_flat*)self;
+	unsigned int ret = 0;
+	uint32 i;
+
+	if (db == NULL) return 0; // nullpo candidate
+	if (match == NULL) return 0; // nullpo candidate
+
+	dbflat_lock(db);
+	for( i = 0; i < db->size; ++i )
+	{
+		va_list argscopy;
+		if( db->slots[i].state != DBFLAT_USED )
+			continue;
+		va_copy(argscopy, args);
+		if( match(db->slots[i].key, db->slots[i].data, argscopy) == 0 )
+		{
+			if( buf && ret < max )
+				buf[ret] = db->slots[i].data;
+			ret++;
+		}
+		va_end(argscopy);
+	}
+	dbflat_unlock(db);
+	return ret;
+}
+
+/**
+ * Just calls {@link DBMap#vgetall}.
+ * @param self Interface of the database
+ * @param buf Buffer to put the data of the matched entries
+ * @param max Maximum number of data entries to be put into buf
+ * @param match Function that matches the database entries
+ * @param ... Extra arguments for match
+ * @return The number of entries that matched
+ * @protected
+ * @see DBMap#getall
+ */
+static unsigned int dbflat_obj_getall(DBMap* self, void **buf, unsigned int max, DBMatcher match, ...)
+{
+	va_list args;
+	unsigned int ret;
+
+	if (self == NULL) return 0; // nullpo candidate
+
+	va_start(args, match);
+	ret = self->vgetall(self, buf, max, match, args);
+	va_end(args);
+	return ret;
+}
+
+/**
+ * Get the data of the entry identified by the key, creating it with
+ * <code>create</code> if it doesn't exist.
+ * @param self Interface of the database
+ * @param key Key that identifies the entry
+ * @param create Function used to create the data if the entry doesn't exist
+ * @param args Extra arguments for create
+ * @return Data of the entry
+ * @protected
+ * @see DBMap#vensure
+ */
+static void *dbflat_obj_vensure(DBMap* self, DBKey key, DBCreateData create, va_list args)
+{
+	DBMap_flat* db = (DBMap_flat*)self;
+	va_list argscopy;
+	void* data;
+	int64 i;
+
+	if (db == NULL) return NULL; // nullpo candidate
+	if (create == NULL) {
+		ShowError("db_ensure: Create function is NULL for db allocated at %s:%d\n",db->alloc_file, db->alloc_line);
+		return NULL; // nullpo candidate
+	}
+
+	i = dbflat_find(db, key);
+	if( i >= 0 )
+		return db->slots[i].data;
+
+	if (db->item_count == UINT32_MAX) {
+		ShowError("db_vensure: item_count overflow, aborting item insertion.\n"
+				"Database allocated at %s:%d",
+				db->alloc_file, db->alloc_line);
+		return NULL;
+	}
+	va_copy(argscopy, args);
+	data = create(key, argscopy);
+	va_end(argscopy);
+	dbflat_insert(db, key, data);
+	return data;
+}
+
+/**
+ * Just calls {@link DBMap#vensure}.
+ * @param self Interface of the database
+ * @param key Key that identifies the entry
+ * @param create Function used to create the data if the entry doesn't exist
+ * @param ... Extra arguments for create
+ * @return Data of the entry
+ * @protected
+ * @see DBMap#ensure
+ */
+static void *dbflat_obj_ensure(DBMap* self, DBKey key, DBCreateData create, ...)
+{
+	va_list args;
+	void *ret;
+
+	if (self == NULL) return 0; // nullpo candidate
+
+	va_start(args, create);
+	ret = self->vensure(self, key, create, args);
+	va_end(args);
+	return ret;
+}
+
+/**
+ * Put the data identified by the key in the database.
+ * Returns the previous data if the entry exists or NULL.
+ * @param self Interface of the database
+ * @param key Key that identifies the data
+ * @param data Data to be put in the database
+ * @return The previous data if the entry exists or NULL
+ * @protected
+ * @see DBMap#put
+ */
+static void *dbflat_obj_put(DBMap* self, DBKey key, void *data)
+{
+	DBMap_flat* db = (DBMap_flat*)self;
+	void* old_data = NULL;
+	int64 i;
+
+	if (db == NULL) return NULL; // nullpo candidate
+	if (db->global_lock) {
+		ShowError("db_put: Database is being destroyed, aborting entry insertion.\n"
+				"Database allocated at %s:%d\n",
+				db->alloc_file, db->alloc_line);
+		return NULL; // nullpo candidate
+	}
+	if (!(data || db->options&DB_OPT_ALLOW_NULL_DATA)) {
+		ShowError("db_put: Attempted to use non-allowed NULL data for db allocated at %s:%d\n",db->alloc_file, db->alloc_line);
+		return NULL; // nullpo candidate
+	}
+
+	i = dbflat_find(db, key);
+	if( i >= 0 )
+	{// equal entry, replace
+		old_data = db->slots[i].data;
+		db->release(db->slots[i].key, old_data, DB_RELEASE_BOTH);
+		db->slots[i].key = key;
+		db->slots[i].data = data;
+		return old_data;
+	}
+
+	if (db->item_count == UINT32_MAX) {
+		ShowError("db_put: item_count overflow, aborting item insertion.\n"
+				"Database allocated at %s:%d",
+				db->alloc_file, db->alloc_line);
+		return NULL;
+	}
+	dbflat_insert(db, key, data);
+	return NULL;
+}
+
+/**
+ * Remove an entry from the database.
+ * Returns the data of the entry.
+ * @param self Interface of the database
+ * @param key Key that identifies the entry
+ * @return The data of the entry or NULL if not found
+ * @protected
+ * @see DBMap#remove
+ */
+static void *dbflat_obj_remove(DBMap* self, DBKey key)
+{
+	DBMap_flat* db = (DBMap_flat*)self;
+	void* data;
+	int64 i;
+
+	if (db == NULL) return NULL; // nullpo candidate
+	if (db->global_lock) {
+		ShowError("db_remove: Database is being destroyed. Aborting entry deletion.\n"
+				"Database allocated at %s:%d\n",
+				db->alloc_file, db->alloc_line);
+		return NULL; // nullpo candidate
+	}
+
+	i = dbflat_find(db, key);
+	if( i < 0 )
+		return NULL;// not found
+	data = db->slots[i].data;
+	db->release(db->slots[i].key, data, DB_RELEASE_DATA);
+	dbflat_erase(db, (uint32)i);
+	if( db->free_lock == 0 && db->size > DBFLAT_MIN_SIZE && db->item_count*8 < db->size )
+		dbflat_resize(db, db->item_count);// shrink
+	return data;
+}
+
+/**
+ * Apply <code>func</code> to every entry in the database.
+ * Returns the sum of values returned by func.
+ * @param self Interface of the database
+ * @param func Function to be applyed
+ * @param args Extra arguments for func
+ * @return Sum of the values returned by func
+ * @protected
+ * @see DBMap#vforeach
+ */
+static int dbflat_obj_vforeach(DBMap* self, DBApply func, va_list args)
+{
+	DBMap_flat* db = (DBMap_flat*)self;
+	int sum = 0;
+	uint32 i;
+
+	if (db == NULL) return 0; // nullpo candidate
+	if (func == NULL) {
+		ShowError("db_foreach: Passed function is NULL for db allocated at %s:%d\n",db->alloc_file, db->alloc_line);
+		return 0; // nullpo candidate
+	}
+
+	dbflat_lock(db);
+	for( i = 0; i < db->size; ++i )
+	{
+		va_list argscopy;
+		if( db->slots[i].state != DBFLAT_USED )
+			continue;
+		va_copy(argscopy, args);
+		sum += func(db->slots[i].key, db->slots[i].data, argscopy);
+		va_end(argscopy);
+	}
+	dbflat_unlock(db);
+	return sum;
+}
+
+/**
+ * Just calls {@link DBMap#vforeach}.
+ * @param self Interface of the database
+ * @param func Function to be applyed
+ * @param ... Extra arguments for func
+ * @return Sum of the values returned by func
+ * @protected
+ * @see DBMap#foreach
+ */
+static int dbflat_obj_foreach(DBMap* self, DBApply func, ...)
+{
+	va_list args;
+	int ret;
+
+	if (self == NULL) return 0; // nullpo candidate
+
+	va_start(args, func);
+	ret = self->vforeach(self, func, args);
+	va_end(args);
+	return ret;
+}
+
+/**
+ * Removes all entries from the database.
+ * Before deleting an entry, func is applyed to it.
+ * Releases the key and the data.
+ * Returns the sum of values returned by func, if it exists.
+ * @param self Interface of the database
+ * @param func Function to be applyed to every entry before deleting
+ * @param args Extra arguments for func
+ * @return Sum of values returned by func
+ * @protected
+ * @see DBMap#vclear
+ */
+static int dbflat_obj_vclear(DBMap* self, DBApply func, va_list args)
+{
+	DBMap_flat* db = (DBMap_flat*)self;
+	int sum = 0;
+	uint32 i;
+
+	if (db == NULL) return 0; // nullpo candidate
+
+	dbflat_lock(db);
+	for( i = 0; i < db->size; ++i )
+	{
+		struct dbflat_slot* slot = &db->slots[i];
+		if( slot->state == DBFLAT_USED )
+		{
+			if( func )
+			{
+				va_list argscopy;
+				va_copy(argscopy, args);
+				sum += func(slot->key, slot->data, argscopy);
+				va_end(argscopy);
+			}
+			db->release(slot->key, slot->data, DB_RELEASE_BOTH);
+		}
+		slot->state = DBFLAT_EMPTY;
+		slot->data = NULL;
+	}
+	db->item_count = 0;
+	db->deleted_count = 0;
+	dbflat_unlock(db);
+	return sum;
+}
+
+/**
+ * Just calls {@link DBMap#vclear}.
+ * @param self Interface of the database
+ * @param func Function to be applyed to every entry before deleting
+ * @param ... Extra arguments for func
+ * @return Sum of values returned by func
+ * @protected
+ * @see DBMap#clear
+ */
+static int dbflat_obj_clear(DBMap* self, DBApply func, ...)
+{
+	va_list args;
+	int ret;
+
+	if (self == NULL) return 0; // nullpo candidate
+
+	va_start(args, func);
+	ret = self->vclear(self, func, args);
+	va_end(args);
+	return ret;
+}
+
+/**
+ * Finalize the database, feeing all the memory it uses.
+ * Before deleting an entry, func is applyed to it.
+ * Returns the sum of values returned by func, if it exists.
+ * @param self Interface of the database
+ * @param func Function to be applyed to every entry before deleting
+ * @param args Extra arguments for func
+ * @return Sum of values returned by func
+ * @protected
+ * @see DBMap#vdestroy
+ */
+static int dbflat_obj_vdestroy(DBMap* self, DBApply func, va_list args)
+{
+	DBMap_flat* db = (DBMap_flat*)self;
+	int sum;
+
+	if (db == NULL) return 0; // nullpo candidate
+	if (db->global_lock) {
+		ShowError("db_vdestroy: Database is already locked for destruction. Aborting second database destruction.\n"
+				"Database allocated at %s:%d\n",
+				db->alloc_file, db->alloc_line);
+		return 0;
+	}
+	if (db->free_lock)
+		ShowWarning("db_vdestroy: Database is still in use, %u lock(s) left. Continuing database destruction.\n"
+				"Database allocated at %s:%d\n",
+				db->free_lock, db->alloc_file, db->alloc_line);
+
+	db->global_lock = 1;
+	sum = self->vclear(self, func, args);
+	aFree(db->slots);
+	aFree(db);
+	return sum;
+}
+
+/**
+ * Just calls {@link DBMap#vdestroy}.
+ * @param self Database
+ * @param func Function to be applyed to every entry before deleting
+ * @param ... Extra arguments for func
+ * @return Sum of values returned by func
+ * @protected
+ * @see DBMap#destroy
+ */
+static int dbflat_obj_destroy(DBMap* self, DBApply func, ...)
+{
+	va_list args;
+	int ret;
+
+	if (self == NULL) return 0; // nullpo candidate
+
+	va_start(args, func);
+	ret = self->vdestroy(self, func, args);
+	va_end(args);
+	return ret;
+}
+
+/**
+ * Return the size of the database (number of items in the database).
+ * @param self Interface of the database
+ * @return Size of the database
+ * @protected
+ * @see DBMap#size
+ */
+static unsigned int dbflat_obj_size(DBMap* self)
+{
+	DBMap_flat* db = (DBMap_flat*)self;
+
+	if (db == NULL) return 0; // nullpo candidate
+	return db->item_count;
+}
+
+/**
+ * Return the type of database.
+ * @param self Interface of the database
+ * @return Type of the database
+ * @protected
+ * @see DBMap#type
+ */
+static DBType dbflat_obj_type(DBMap* self)
+{
+	DBMap_flat* db = (DBMap_flat*)self;
+
+	if (db == NULL) return (DBType)-1; // nullpo candidate
+	return db->type;
+}
+
+/**
+ * Return the options of the database.
+ * @param self Interface of the database
+ * @return Options of the database
+ * @protected
+ * @see DBMap#options
+ */
+static DBOptions dbflat_obj_options(DBMap* self)
+{
+	DBMap_flat* db = (DBMap_flat*)self;
+
+	if (db == NULL) return DB_OPT_BASE; // nullpo candidate
+	return db->options;
+}
+
+/**
+ * Allocate a new flat database.
+ * @param file File where the database is being allocated
+ * @param line Line of the file where the database is being allocated
+ * @param type Type of database (DB_INT or DB_UINT)
+ * @param options Fixed options of the database
+ * @return The interface of the database
+ * @private
+ * @see #db_alloc(const char *,int,DBType,DBOptions,unsigned short)
+ */
+static DBMap* dbflat_alloc(const char *file, int line, DBType type, DBOptions options)
+{
+	DBMap_flat* db;
+
+	CREATE(db, struct DBMap_flat, 1);
+	/* Interface of the database */
+	db->vtable.iterator = dbflat_obj_iterator;
+	db->vtable.exists   = dbflat_obj_exists;
+	db->vtable.get      = dbflat_obj_get;
+	db->vtable.getall   = dbflat_obj_getall;
+	db->vtable.vgetall  = dbflat_obj_vgetall;
+	db->vtable.ensure   = dbflat_obj_ensure;
+	db->vtable.vensure  = dbflat_obj_vensure;
+	db->vtable.put      = dbflat_obj_put;
+	db->vtable.remove   = dbflat_obj_remove;
+	db->vtable.foreach  = dbflat_obj_foreach;
+	db->vtable.vforeach = dbflat_obj_vforeach;
+	db->vtable.clear    = dbflat_obj_clear;
+	db->vtable.vclear   = dbflat_obj_vclear;
+	db->vtable.destroy  = dbflat_obj_destroy;
+	db->vtable.vdestroy = dbflat_obj_vdestroy;
+	db->vtable.size     = dbflat_obj_size;
+	db->vtable.type     = dbflat_obj_type;
+	db->vtable.options  = dbflat_obj_options;
+	/* File and line of allocation */
+	db->alloc_file = file;
+	db->alloc_line = line;
+	/* Table */
+	CREATE(db->slots, struct dbflat_slot, DBFLAT_MIN_SIZE);
+	db->size = DBFLAT_MIN_SIZE;
+	db->bits = 4;
+	db->item_count = 0;
+	db->deleted_count = 0;
+	/* Other */
+	db->free_lock = 0;
+	db->release = db_default_release(type, options);
+	db->type = type;
+	db->options = options;
+	db->global_lock = 0;
+
+	return &db->vtable;
+}
+
+#if defined(DB_ENABLE_BENCHMARK)
+/**
+ * Times get/put/remove/iterate on a database with <code>count</code> keys.
+ * @param name Name displayed in the report
+ * @param options Options used to allocate the database
+ * @param count Number of entries
+ * @private
+ * @see #DB_ENABLE_BENCHMARK
+ */
+static void db_benchmark_run(const char* name, DBOptions options, int count)
+{
+	DBMap* db = idb_alloc(options);
+	DBIterator* iter;
+	clock_t t[6];
+	int i, sum = 0;
+
+	t[0] = clock();
+	for( i = 0; i < count; ++i )
+		idb_put(db, 2000000 + i*7, (void*)db);
+	t[1] = clock();
+	for( i = 0; i < count; ++i )
+		sum += ( idb_get(db, 2000000 + ((i*31)%count)*7) != NULL );
+	t[2] = clock();
+	for( i = 0; i < count; ++i )
+		sum += ( idb_get(db, 1000000 + i) != NULL );// misses
+	t[3] = clock();
+	iter = db_iterator(db);
+	for( dbi_first(iter); dbi_exists(iter); dbi_next(iter) )
+		++sum;
+	dbi_destroy(iter);
+	t[4] = clock();
+	for( i = 0; i < count; ++i )
+		idb_remove(db, 2000000 + i*7);
+	t[5] = clock();
+	db_destroy(db);
+
+#define DB_BENCH_MS(a,b) ((unsigned int)((t[b] - t[a])*1000/CLOCKS_PER_SEC))
+	ShowInfo("db_benchmark: %-5s %d keys: put %ums, get %ums, miss %ums, iterate %ums, remove %ums (%d)\n",
+			name, count, DB_BENCH_MS(0,1), DB_BENCH_MS(1,2), DB_BENCH_MS(2,3), DB_BENCH_MS(3,4), DB_BENCH_MS(4,5), sum);
+#undef DB_BENCH_MS
+}
+
+/**
+ * Compares the RED-BLACK tree databases with the flat databases.
+ * @private
+ * @see #DB_ENABLE_BENCHMARK
+ * @see #db_init(void)
+ */
+static void db_benchmark(void)
+{
+	int count;
+
+	for( count = 1000; count <= 1000000; count *= 10 )
+	{
+		db_benchmark_run("tree", DB_OPT_BASE, count);
+		db_benchmark_run("flat", DB_OPT_FLAT, count);
+	}
+}
+#endif /* DB_ENABLE_BENCHMARK */
+
+/*****************************************************************************\
+ *  (5) Section with public functions.
+ *  db_fix_options     - Apply database type restrictions to the options.
+ *  db_default_cmp     - Get the default comparator for a type of database.
+ *  db_default_hash    - Get the default hasher for a type of database.
+ *  db_default_release - Get the default releaser for a type of database with the specified options.
+ *  db_custom_release  - Get a releaser that behaves a certains way.
+ *  db_alloc           - Allocate a new database.
+ *  db_i2key           - Manual cast from 'int' to 'DBKey'.
+ *  db_ui2key          - Manual cast from 'unsigned int' to 'DBKey'.
+ *  db_str2key         - Manual cast from 'unsigned char *' to 'DBKey'.
+ *  db_init            - Initializes the database system.
+ *  db_final           - Finalizes the database system.
+\*****************************************************************************/
+
+/**
+ * Returns the fixed options according to the database type.
+ * Sets required options and unsets unsupported options.
+ * For numeric databases DB_OPT_DUP_KEY and DB_OPT_RELEASE_KEY are unset.
+ * For string databases DB_OPT_FLAT is unset.
+ * @param type Type of the database
+ * @param options Original options of the database
+ * @return Fixed options of the database
+ * @private
+ * @see #db_default_release(DBType,DBOptions)
+ * @see #db_alloc(const char *,int,DBType,DBOptions,unsigned short)
+ */
+DBOptions db_fix_options(DBType type, DBOptions options)
+{
+	DB_COUNTSTAT(db_fix_options);
+	switch (type) {
+		case DB_INT:
+		case DB_UINT: // Numeric database, do nothing with the keys
+			return (DBOptions)(options&~(DB_OPT_DUP_KEY|DB_OPT_RELEASE_KEY));
+
+		default:
+			ShowError("db_fix_options: Unknown database type %u with options %x\n", type, options);
+		case DB_STRING:
+		case DB_ISTRING: // String databases, can't be flat
+			return (DBOptions)(options&~DB_OPT_FLAT);
+	}
+}
+
+/**
+ * Returns the default comparator for the specified type of database.
+ * @param type Type of database
+ * @return Comparator for the type of database or NULL if unknown database
+ * @public
+ * @see #db_int_cmp(DBKey,DBKey,unsigned short)
+ * @see #db_uint_cmp(DBKey,DBKey,unsigned short)
+ * @see #db_string_cmp(DBKey,DBKey,unsigned short)
+ * @see #db_istring_cmp(DBKey,DBKey,unsigned short)
+ */
+DBComparator db_default_cmp(DBType type)
+{
+	DB_COUNTSTAT(db_default_cmp);
+	switch (type) {
+		case DB_INT:     return &db_int_cmp;
+		case DB_UINT:    return &db_uint_cmp;
+		case DB_STRING:  return &db_string_cmp;
+		case DB_ISTRING: return &db_istring_cmp;
+		default:
+			ShowError("db_default_cmp: Unknown database type %u\n", type);
+			return NULL;
+	}
+}
+
+/**
+ * Returns the default hasher for the specified type of database.
+ * @param type Type of database
+ * @return Hasher of the type of database or NULL if unknown database
+ * @public
+ * @see #db_int_hash(DBKey,unsigned short)
+ * @see #db_uint_hash(DBKey,unsigned short)
+ * @see #db_string_hash(DBKey,unsigned short)
+ * @see #db_istring_hash(DBKey,unsigned short)
+ */
+DBHasher db_default_hash(DBType type)
+{
+	DB_COUNTSTAT(db_default_hash);
+	switch (type) {
+		case DB_INT:     return &db_int_hash;
+		case DB_UINT:    return &db_uint_hash;
+		case DB_STRING:  return &db_string_hash;
+		case DB_ISTRING: return &db_istring_hash;
+		default:
+			ShowError("db_default_hash: Unknown database type %u\n", type);
+			return NULL;
+	}
+}
+
+/**
+ * Returns the default releaser for the specified type of database with the 
+ * specified options.
+ * NOTE: the options are fixed with {@link #db_fix_options(DBType,DBOptions)}
+ * before choosing the releaser.
+ * @param type Type of database
+ * @param options Options of the database
+ * @return Default releaser for the type of database with the specified options
+ * @public
+ * @see #db_release_nothing(DBKey,void *,DBRelease)
+ * @see #db_release_key(DBKey,void *,DBRelease)
+ * @see #db_release_data(DBKey,void *,DBRelease)
+ * @see #db_release_both(DBKey,void *,DBRelease)
+ * @see #db_custom_release(DBRelease)
+ */
+DBReleaser db_default_release(DBType type, DBOptions options)
+{
+	DB_COUNTSTAT(db_default_release);
+	options = db_fix_options(type, options);
+	if (options&DB_OPT_RELEASE_DATA) { // Release data, what about the key?
+		if (options&(DB_OPT_DUP_KEY|DB_OPT_RELEASE_KEY))
+			return &db_release_both; // Release both key and data
+		return &db_release_data; // Only release data
+	}
+	if (options&(DB_OPT_DUP_KEY|DB_OPT_RELEASE_KEY))
+		return &db_release_key; // Only release key
+	return &db_release_nothing; // Release nothing
+}
+
+/**
+ * Returns the releaser that releases the specified release options.
+ * @param which Options that specified what the releaser releases
+ * @return Releaser for the specified release options
+ * @public
+ * @see #db_release_nothing(DBKey,void *,DBRelease)
+ * @see #db_release_key(DBKey,void *,DBRelease)
+ * @see #db_release_data(DBKey,void *,DBRelease)
+ * @see #db_release_both(DBKey,void *,DBRelease)
+ * @see #db_default_release(DBType,DBOptions)
+ */
+DBReleaser db_custom_release(DBRelease which)
+{
+	DB_COUNTSTAT(db_custom_release);
+	switch (which) {
+		case DB_RELEASE_NOTHING: return &db_release_nothing;
+		case DB_RELEASE_KEY:     return &db_release_key;
+		case DB_RELEASE_DATA:    return &db_release_data;
+		case DB_RELEASE_BOTH:    return &db_release_both;
+		default:
+			ShowError("db_custom_release: Unknown release options %u\n", which);
+			return NULL;
+	}
+}
+
+/**
+ * Allocate a new database of the specified type.
+ * NOTE: the options are fixed by {@link #db_fix_options(DBType,DBOptions)}
+ * before creating the database.
+ * @param file File where the database is being allocated
+ * @param line Line of the file where the database is being allocated
+ * @param type Type of database
+ * @param options Options of the database
+ * @param maxlen Maximum length of the string to be used as key in string 
+ *          databases. If 0, the maximum number of maxlen is used (64K).
+ * @return The interface of the database
+ * @public
+ * @see #DBMap_impl
+ * @see #db_fix_options(DBType,DBOptions)
+ */
+DBMap* db_alloc(const char *file, int line, DBType type, DBOptions options, unsigned short maxlen)
+{
+	DBMap_impl* db;
+	unsigned int i;
+
+#ifdef DB_ENABLE_STATS
+	DB_COUNTSTAT(db_alloc);
+	switch (type) {
+		case DB_INT: DB_COUNTSTAT(db_int_alloc); break;
+		case DB_UINT: DB_COUNTSTAT(db_uint_alloc); break;
+		case DB_STRING: DB_COUNTSTAT(db_string_alloc); break;
+		case DB_ISTRING: DB_COUNTSTAT(db_istring_alloc); break;
+	}
+#endif /* DB_ENABLE_STATS */
+	options = db_fix_options(type, options);
+	if( options&DB_OPT_FLAT )
+		return dbflat_alloc(file, line, type, options);
+
+	CREATE(db, struct DBMap_impl, 1);
 
-	options = db_fix_options(type, options);
 	/* Interface of the database */
 	db->vtable.iterator = db_obj_iterator;
 	db->vtable.exists   = db_obj_exists;
@@ -2490,6 +3561,9 @@ DBKey db_str2key(const char *key)
 void db_init(void)
 {
 	DB_COUNTSTAT(db_init);
+#if defined(DB_ENABLE_BENCHMARK)
+	db_benchmark();
+#endif /* DB_ENABLE_BENCHMARK */
 }
 
 /**
@@ -21,6 +21,7 @@
  *  - see what functions need or should be added to the database interface   *
  *                                                                           *
  *  HISTORY:                                                                 *
+ *    2012/08/13 - Added flat open-addressing databases (DB_OPT_FLAT).
  *    2007/11/09 - Added an iterator to the database.
  *    2.1 (Athena build #???#) - Portability fix                             *
  *      - Fixed the portability of casting to union and added the functions  *
@@ -113,6 +114,9 @@ typedef enum DBType {
  * @param DB_OPT_RELEASE_BOTH Releases both key and data.
  * @param DB_OPT_ALLOW_NULL_KEY Allow NULL keys in the database.
  * @param DB_OPT_ALLOW_NULL_DATA Allow NULL data in the database.
+ * @param DB_OPT_FLAT Store the entries in a flat open-addressing table
+ *          instead of the hashtable of RED-BLACK trees. Only supported by
+ *          numeric databases (DB_INT and DB_UINT), ignored otherwise.
  * @public
  * @see #db_fix_options(DBType,DBOptions)
  * @see #db_default_release(DBType,DBOptions)
@@ -126,6 +130,7 @@ typedef enum DBOptions {
 	DB_OPT_RELEASE_BOTH    = 6,
 	DB_OPT_ALLOW_NULL_KEY  = 8,
 	DB_OPT_ALLOW_NULL_DATA = 16,
+	DB_OPT_FLAT            = 32,
 } DBOptions;
 
 /**
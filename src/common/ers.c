@@ -32,6 +32,7 @@
  *                                                                           *
  *  HISTORY:                                                                 *
  *    0.1 - Initial version                                                  *
+ *    0.2 - Usage statistics and pre-allocation of entries                   *
  *                                                                           *
  * @version 0.1 - Initial version                                            *
  * @author Flavio @ Amazon Project                                           *
@@ -39,6 +40,7 @@
  * @see common#ers.h                                                         *
 \*****************************************************************************/
 #include <stdlib.h>
+#include <time.h>
 
 #include "../common/cbasetypes.h"
 #include "../common/malloc.h" // CREATE, RECREATE, aMalloc, aFree
@@ -90,6 +92,14 @@ typedef struct ers_ll {
  * @param max Current maximum capacity of the array
  * @param destroy Destroy lock
  * @param size Size of the entries of the manager
+ * @param chunks Array with pre-allocated chunks of entries
+ * @param chunk_num Number of chunks in the array
+ * @param total Number of entries in blocks and chunks
+ * @param used Number of entries being used
+ * @param peak Highest number of entries used at the same time
+ * @param allocs Number of allocations
+ * @param last_allocs Number of allocations at the last usage report
+ * @param last_time Time of the last usage report
  * @private
  */
 typedef struct ers_impl {
@@ -139,6 +149,46 @@ typedef struct ers_impl {
 	 */
 	size_t size;
 
+	/**
+	 * Array with pre-allocated chunks of entries.
+	 */
+	uint8 **chunks;
+
+	/**
+	 * Number of chunks in the array.
+	 */
+	uint32 chunk_num;
+
+	/**
+	 * Number of entries in blocks and chunks.
+	 */
+	uint32 total;
+
+	/**
+	 * Number of entries being used.
+	 */
+	uint32 used;
+
+	/**
+	 * Highest number of entries used at the same time.
+	 */
+	uint32 peak;
+
+	/**
+	 * Number of allocations.
+	 */
+	uint64 allocs;
+
+	/**
+	 * Number of allocations at the last usage report.
+	 */
+	uint64 last_allocs;
+
+	/**
+	 * Time of the last usage report.
+	 */
+	time_t last_time;
+
 } *ERS_impl;
 
 /**
@@ -165,6 +215,7 @@ static uint32 ers_num = 0;
  *  ers_obj_free_entry  - Free an entry allocated from the manager.          *
  *  ers_obj_entry_size  - Return the size of the entries of the manager.     *
  *  ers_obj_destroy     - Destroy the instance of the manager.               *
+ *  ers_obj_prewarm     - Pre-allocate entries in the manager.               *
 \*****************************************************************************/
 
 /**
@@ -206,7 +257,11 @@ static void *ers_obj_alloc_entry(ERS self)
 		obj->free = ERS_BLOCK_ENTRIES -1;
 		ret = &obj->blocks[obj->num][obj->free*obj->size];
 		obj->num++;
+		obj->total += ERS_BLOCK_ENTRIES;
 	}
+	obj->allocs++;
+	if (++obj->used > obj->peak)
+		obj->peak = obj->used;
 	return ret;
 }
 
@@ -236,6 +291,7 @@ static void ers_obj_free_entry(ERS self, void *entry)
 	reuse = (ERLinkedList)entry;
 	reuse->next = obj->reuse;
 	obj->reuse = reuse;
+	obj->used--;
 }
 
 /**
@@ -292,23 +348,13 @@ static void ers_obj_destroy(ERS self)
 		}
 	}
 	reuse = obj->reuse;
-	count = 0;
 	// Check for missing/extra entries
-	for (i = 0; i < obj->num; i++) {
-		if (i == 0) {
-			count = ERS_BLOCK_ENTRIES -obj->free;
-		} else if (count > UINT32_MAX -ERS_BLOCK_ENTRIES) {
-			count = UINT32_MAX;
-			break;
-		} else {
-			count += ERS_BLOCK_ENTRIES;
-		}
-		while (reuse && count) {
-			count--;
-			old = reuse;
-			reuse = reuse->next;
-			old->next = NULL; // this makes duplicate frees report as missing entries
-		}
+	count = obj->total -obj->free;
+	while (reuse && count) {
+		count--;
+		old = reuse;
+		reuse = reuse->next;
+		old->next = NULL; // this makes duplicate frees report as missing entries
 	}
 	if (count) { // missing entries
 		ShowWarning("ers::destroy : %u entries missing (possible double free), continuing destruction (entry size=%u).\n",
@@ -327,13 +373,71 @@ static void ers_obj_destroy(ERS self)
 			aFree(obj->blocks[i]); // release block of entries
 		aFree(obj->blocks); // release array of blocks
 	}
+	if (obj->chunk_num) {
+		for (i = 0; i < obj->chunk_num; i++)
+			aFree(obj->chunks[i]); // release chunk of entries
+		aFree(obj->chunks); // release array of chunks
+	}
 	aFree(obj); // release manager
 }
 
+/**
+ * Make sure the manager has at least count entries ready to be allocated.
+ * The missing entries are allocated in one contiguous chunk and added to the 
+ * reusable entries, lowest address first.
+ * The unused entries of the last block are moved to the reusable entries so 
+ * a new block never hides them.
+ * @param self Interface of the entry manager
+ * @param count Number of entries that should be available
+ * @see #ERLinkedList
+ * @see ERS_impl#chunks
+ * @see ERS_impl::vtable#prewarm
+ */
+static void ers_obj_prewarm(ERS self, uint32 count)
+{
+	ERS_impl obj = (ERS_impl)self;
+	ERLinkedList reuse;
+	uint32 available;
+	uint32 i;
+	uint8 *chunk;
+
+	if (obj == NULL) {
+		ShowError("ers::prewarm : NULL object, aborting pre-allocation.\n");
+		return;
+	}
+
+	available = obj->total -obj->used;
+	if (available >= count)
+		return; // enough entries
+	count -= available;
+	if (count > UINT32_MAX -obj->total) {
+		ShowError("ers::prewarm : too many entries requested, aborting pre-allocation (entry size=%u).\n",
+				obj->size);
+		return;
+	}
+
+	while (obj->free) { // move unused entries to the reusable entries
+		obj->free--;
+		reuse = (ERLinkedList)&obj->blocks[obj->num -1][obj->free*obj->size];
+		reuse->next = obj->reuse;
+		obj->reuse = reuse;
+	}
+	CREATE(chunk, uint8, obj->size*count);
+	RECREATE(obj->chunks, uint8 *, obj->chunk_num +1);
+	obj->chunks[obj->chunk_num++] = chunk;
+	for (i = count; i > 0; i--) {
+		reuse = (ERLinkedList)&chunk[(i -1)*obj->size];
+		reuse->next = obj->reuse;
+		obj->reuse = reuse;
+	}
+	obj->total += count;
+}
+
 /*****************************************************************************\
  *  (3) Public functions.                                                    *
  *  ers_new               - Get a new instance of an entry manager.          *
  *  ers_report            - Print a report about the current state.          *
+ *  ers_report_usage      - Print the usage statistics of the managers.      *
  *  ers_force_destroy_all - Force the destruction of all the managers.       *
 \*****************************************************************************/
 
@@ -386,6 +490,7 @@ ERS ers_new(uint32 size)
 	obj->vtable.free       = ers_obj_free_entry;
 	obj->vtable.entry_size = ers_obj_entry_size;
 	obj->vtable.destroy    = ers_obj_destroy;
+	obj->vtable.prewarm    = ers_obj_prewarm;
 	// Block reusage system
 	obj->reuse   = NULL;
 	obj->blocks  = NULL;
@@ -393,6 +498,15 @@ ERS ers_new(uint32 size)
 	obj->num     = 0;
 	obj->max     = 0;
 	obj->destroy = 1;
+	obj->chunks    = NULL;
+	obj->chunk_num = 0;
+	// Statistics
+	obj->total       = 0;
+	obj->used        = 0;
+	obj->peak        = 0;
+	obj->allocs      = 0;
+	obj->last_allocs = 0;
+	obj->last_time   = time(NULL);
 	// Properties
 	obj->size = size;
 	ers_root[ers_num++] = obj;
@@ -413,10 +527,8 @@ ERS ers_new(uint32 size)
 void ers_report(void)
 {
 	uint32 i;
-	uint32 j;
-	uint32 used;
 	uint32 reusable;
-	uint32 extra;
+	uint32 expected;
 	ERLinkedList reuse;
 	ERS_impl obj;
 
@@ -427,53 +539,54 @@ void ers_report(void)
 	ShowMessage("entries per block   : %u\n", ERS_BLOCK_ENTRIES);
 	for (i = 0; i < ers_num; i++) {
 		obj = ers_root[i];
-		reuse = obj->reuse;
-		used = 0;
+		// Count reusable entries
+		expected = obj->total -obj->free -obj->used;
 		reusable = 0;
-		// Count used and reusable entries
-		for (j = 0; j < obj->num; j++) {
-			if (j == 0) { // take into acount the free entries
-				used = ERS_BLOCK_ENTRIES -obj->free;
-			} else if (reuse) { // counting reusable entries
-				used = ERS_BLOCK_ENTRIES;
-			} else { // no more reusable entries, count remaining used entries
-				for (; j < obj->num; j++) {
-					if (used > UINT32_MAX -ERS_BLOCK_ENTRIES) { // overflow
-						used = UINT32_MAX;
-						break;
-					}
-					used += ERS_BLOCK_ENTRIES;
-				}
-				break;
-			}
-			while (used && reuse) { // count reusable entries
-				used--;
-				if (reusable != UINT32_MAX)
-					reusable++;
-				reuse = reuse->next;
-			}
-		}
-		// Count extra reusable entries
-		extra = 0;
-		while (reuse && extra != UINT32_MAX) {
-			extra++;
-			reuse = reuse->next;
-		}
+		for (reuse = obj->reuse; reuse && reusable != UINT32_MAX; reuse = reuse->next)
+			reusable++;
 		// Entry manager report
 		ShowMessage(CL_BOLD"[Entry manager #%u report]\n"CL_NORMAL, i);
 		ShowMessage("\tinstances          : %u\n", obj->destroy);
 		ShowMessage("\tentry size         : %u\n", obj->size);
 		ShowMessage("\tblock array size   : %u\n", obj->max);
 		ShowMessage("\tallocated blocks   : %u\n", obj->num);
-		ShowMessage("\tentries being used : %u\n", used);
+		ShowMessage("\tprewarmed chunks   : %u\n", obj->chunk_num);
+		ShowMessage("\tentries being used : %u\n", obj->used);
+		ShowMessage("\tpeak entries used  : %u\n", obj->peak);
 		ShowMessage("\tunused entries     : %u\n", obj->free);
-		ShowMessage("\treusable entries   : %u\n", reusable);
-		if (extra)
-			ShowMessage("\tWARNING - %u extra reusable entries were found.\n", extra);
+		ShowMessage("\treusable entries   : %u\n", min(reusable,expected));
+		if (reusable > expected)
+			ShowMessage("\tWARNING - %u extra reusable entries were found.\n", reusable -expected);
 	}
 	ShowMessage("End of report\n");
 }
 
+/**
+ * Print the usage statistics of each entry manager, one line per manager.
+ * Shows the entries in use, the high-water mark, the entries ready to be 
+ * allocated and the allocations per second since the previous call.
+ * @see #ERS_impl
+ * @see #ers_root
+ * @see #ers_num
+ */
+void ers_report_usage(void)
+{
+	uint32 i;
+	time_t now = time(NULL);
+	ERS_impl obj;
+
+	ShowMessage(CL_BOLD"Entry Reusage System usage (%u managers):\n"CL_NORMAL, ers_num);
+	ShowMessage("  size | instances |    in use |      peak |      free |  allocs/sec\n");
+	for (i = 0; i < ers_num; i++) {
+		obj = ers_root[i];
+		ShowMessage("%6u | %9u | %9u | %9u | %9u | %11.1f\n",
+			(unsigned int)obj->size, obj->destroy, obj->used, obj->peak, obj->total -obj->used,
+			now > obj->last_time ? (double)(obj->allocs -obj->last_allocs)/(double)(now -obj->last_time) : 0.);
+		obj->last_allocs = obj->allocs;
+		obj->last_time   = now;
+	}
+}
+
 /**
  * Forcibly destroy all the entry managers, checking for nothing.
  * The system is left as if no instances or entries had ever been allocated.
@@ -498,6 +611,11 @@ void ers_force_destroy_all(void)
 				aFree(obj->blocks[j]); // block of entries
 			aFree(obj->blocks); // array of blocks
 		}
+		if (obj->chunk_num) {
+			for (j = 0; j < obj->chunk_num; j++)
+				aFree(obj->chunks[j]); // chunk of entries
+			aFree(obj->chunks); // array of chunks
+		}
 		aFree(obj); // entry manager object
 	}
 	ers_num = 0;
@@ -32,6 +32,7 @@
  *                                                                           *
  *  HISTORY:                                                                 *
  *    0.1 - Initial version                                                  *
+ *    0.2 - Usage statistics and pre-allocation of entries                   *
  *                                                                           *
  * @version 0.1 - Initial version                                            *
  * @author Flavio @ Amazon Project                                           *
@@ -49,6 +50,7 @@
  *  ERS                   - Entry manager.                                   *
  *  ers_new               - Allocate an instance of an entry manager.        *
  *  ers_report            - Print a report about the current state.          *
+ *  ers_report_usage      - Print the usage statistics of the managers.      *
  *  ers_force_destroy_all - Force the destruction of all the managers.       *
 \*****************************************************************************/
 
@@ -76,6 +78,7 @@
  * @param free Free an entry allocated from this manager
  * @param entry_size Return the size of the entries of this manager
  * @param destroy Destroy this instance of the manager
+ * @param prewarm Pre-allocate entries in this manager
  */
 typedef struct eri {
 
@@ -112,6 +115,15 @@ typedef struct eri {
 	 */
 	void (*destroy)(struct eri *self);
 
+	/**
+	 * Make sure the manager has at least count entries ready to be allocated.
+	 * The missing entries are allocated in one contiguous chunk.
+	 * Use it at startup to avoid growing the manager in bursts later on.
+	 * @param self Interface of the entry manager
+	 * @param count Number of entries that should be available
+	 */
+	void (*prewarm)(struct eri *self, uint32 count);
+
 } *ERS;
 
 #ifdef DISABLE_ERS
@@ -120,9 +132,11 @@ typedef struct eri {
 #	define ers_free(obj,entry) aFree(entry)
 #	define ers_entry_size(obj) (size_t)0
 #	define ers_destroy(obj)
+#	define ers_prewarm(obj,count)
 // Disable the public functions
 #	define ers_new(size) NULL
 #	define ers_report()
+#	define ers_report_usage()
 #	define ers_force_destroy_all()
 #else /* not DISABLE_ERS */
 // These defines should be used to allow the code to keep working whenever 
@@ -131,6 +145,7 @@ typedef struct eri {
 #	define ers_free(obj,entry) (obj)->free((obj),(entry))
 #	define ers_entry_size(obj) (obj)->entry_size(obj)
 #	define ers_destroy(obj)    (obj)->destroy(obj)
+#	define ers_prewarm(obj,count) (obj)->prewarm((obj),(count))
 
 /**
  * Get a new instance of the manager that handles the specified entry size.
@@ -153,6 +168,13 @@ ERS ers_new(uint32 size);
  */
 void ers_report(void);
 
+/**
+ * Print the usage statistics of each entry manager, one line per manager.
+ * Shows the entries in use, the high-water mark, the entries ready to be 
+ * allocated and the allocations per second since the previous call.
+ */
+void ers_report_usage(void);
+
 /**
  * Forcibly destroy all the entry managers, checking for nothing.
  * The system is left as if no instances or entries had ever been allocated.
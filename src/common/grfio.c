@@ -6,6 +6,7 @@
 #include "../common/malloc.h"
 #include "../common/showmsg.h"
 #include "../common/strlib.h"
+#include "../common/thread.h"
 #include "../common/utils.h"
 #include "grfio.h"
 
@@ -14,6 +15,9 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <zlib.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 
 //----------------------------
 //	file entry table struct
@@ -54,9 +58,28 @@ char** gentry_table		= NULL;
 int gentry_entrys		= 0;
 int gentry_maxentry		= 0;
 
+// memory mapped grf files, in the same order as gentry_table
+// (data is NULL if the file couldn't be mapped, it is read with stdio then)
+static struct grf_mapping {
+	unsigned char* data;
+	size_t size;
+}* gentry_mapping = NULL;
+
 // the path to the data directory
 char data_dir[1024] = "";
 
+// number of threads that decode the files of a batch read
+static int grfio_threads = 4;
+#define GRFIO_MAX_THREADS 32
+
+// files decoded in advance by grfio_prefetch, waiting for grfio_reads
+static struct grfio_prefetched {
+	char* fname;
+	void* data;
+	int size;
+}* prefetched = NULL;
+static int prefetched_count = 0;
+
 
 // little endian char array to uint conversion
 static unsigned int getlong(unsigned char* p)
@@ -260,26 +283,46 @@ int encode_zip(void* dest, unsigned long* destLen, const void* source, unsigned
 /***********************************************************
  ***                File List Subroutines                ***
  ***********************************************************/
-// file list hash table
-int filelist_hash[256];
+// file list hash table, grows with the number of entries (a grf holds hundreds of thousands)
+int* filelist_hash = NULL;
+unsigned int filelist_hashmask = 0;
 
 // initializes the table that holds the first elements of all hash chains
 static void hashinit(void)
 {
-	int i;
-	for (i = 0; i < 256; i++)
+	unsigned int i;
+	filelist_hashmask = 255;
+	RECREATE(filelist_hash, int, filelist_hashmask + 1);
+	for (i = 0; i <= filelist_hashmask; i++)
 		filelist_hash[i] = -1;
 }
 
-// hashes a filename string into a number from {0..255}
-static int filehash(const char* fname)
+// hashes a filename string, case insensitive
+static unsigned int filehash(const char* fname)
 {
 	unsigned int hash = 0;
 	while(*fname) {
-		hash = (hash<<1) + (hash>>7)*9 + TOLOWER(*fname);
+		hash = hash*31 + TOLOWER(*fname);
 		fname++;
 	}
-	return hash & 255;
+	return hash ^ (hash >> 16);
+}
+
+// doubles the hash table and rebuilds the chains
+static void hashgrow(void)
+{
+	unsigned int i;
+	int index;
+
+	filelist_hashmask = filelist_hashmask*2 + 1;
+	RECREATE(filelist_hash, int, filelist_hashmask + 1);
+	for (i = 0; i <= filelist_hashmask; i++)
+		filelist_hash[i] = -1;
+	for (index = 0; index < filelist_entrys; index++) {
+		unsigned int hash = filehash(filelist[index].fn) & filelist_hashmask;
+		filelist[index].next = filelist_hash[hash];
+		filelist_hash[hash] = index;
+	}
 }
 
 // finds a FILELIST entry with the specified file name
@@ -290,7 +333,7 @@ static FILELIST* filelist_find(const char* fname)
 	if (!filelist)
 		return NULL;
 
-	hash = filelist_hash[filehash(fname)];
+	hash = filelist_hash[filehash(fname) & filelist_hashmask];
 	for (index = hash; index != -1; index = filelist[index].next)
 		if(!strcmpi(filelist[index].fn, fname))
 			break;
@@ -311,22 +354,26 @@ static FILELIST* filelist_add(FILELIST* entry)
 {
 	int hash;
 
-	#define	FILELIST_ADDS	1024	// number increment of file lists `
+	#define	FILELIST_ADDS	1024	// minimum number increment of file lists `
 
 	if (filelist_entrys >= filelist_maxentry) {
-		filelist = (FILELIST *)aRealloc(filelist, (filelist_maxentry + FILELIST_ADDS) * sizeof(FILELIST));
-		memset(filelist + filelist_maxentry, '\0', FILELIST_ADDS * sizeof(FILELIST));
-		filelist_maxentry += FILELIST_ADDS;
+		int adds = max(FILELIST_ADDS, filelist_maxentry); // doubles, a grf can hold hundreds of thousands of files
+		filelist = (FILELIST *)aRealloc(filelist, (filelist_maxentry + adds) * sizeof(FILELIST));
+		memset(filelist + filelist_maxentry, '\0', adds * sizeof(FILELIST));
+		filelist_maxentry += adds;
 	}
 
 	memcpy (&filelist[filelist_entrys], entry, sizeof(FILELIST));
 
-	hash = filehash(entry->fn);
+	hash = filehash(entry->fn) & filelist_hashmask;
 	filelist[filelist_entrys].next = filelist_hash[hash];
 	filelist_hash[hash] = filelist_entrys;
 
 	filelist_entrys++;
 
+	if ((unsigned int)filelist_entrys > filelist_hashmask)
+		hashgrow(); // keep the chains short
+
 	return &filelist[filelist_entrys - 1];
 }
 
@@ -386,12 +433,46 @@ static void grfio_localpath_create(char* buffer, size_t size, const char* filena
 }
 
 
-/// Reads a file into a newly allocated buffer (from grf or data directory).
-void* grfio_reads(const char* fname, int* size)
+/// A file being read by grfio_reads or grfio_reads_batch.
+/// The grf data is decoded by grfio_job_decode, which doesn't touch the
+/// memory manager or the console, so it can run on any thread.
+struct grfio_job {
+	const char* fname;
+	FILELIST* entry; // grf entry to decode, NULL if there is nothing to decode
+	const unsigned char* mapped; // grf data inside a mapped grf, copied to src by the decoder
+	unsigned char* src; // grf data
+	unsigned char* data; // file contents
+	int size; // size of the file contents
+	unsigned long len; // size decoded by zlib
+	bool failed;
+};
+
+
+/// Prepares the read of a file. Local files are read right away.
+/// Allocates the buffers of the grf data, which is read here unless its grf file is mapped.
+static void grfio_job_prepare(struct grfio_job* job, const char* fname)
 {
-	unsigned char* buf2 = NULL;
+	FILELIST* entry;
+	int i;
 
-	FILELIST* entry = filelist_find(fname);
+	memset(job, 0, sizeof(*job));
+	job->fname = fname;
+
+	for( i = 0; i < prefetched_count; ++i )
+	{// decoded in advance
+		if( prefetched[i].fname != NULL && strcmpi(prefetched[i].fname, fname) == 0 )
+		{
+			job->data = (unsigned char*)prefetched[i].data;
+			job->size = prefetched[i].size;
+			job->failed = ( job->data == NULL );
+			aFree(prefetched[i].fname);
+			prefetched[i].fname = NULL;
+			prefetched[i].data = NULL;
+			return;
+		}
+	}
+
+	entry = filelist_find(fname);
 	if( entry == NULL || entry->gentry <= 0 )
 	{// LocalFileCheck
 		char lfname[256];
@@ -406,12 +487,10 @@ void* grfio_reads(const char* fname, int* size)
 			fseek(in,0,SEEK_END);
 			declen = ftell(in);
 			fseek(in,0,SEEK_SET);
-			buf2 = (unsigned char *)aMallocA(declen+1);  // +1 for resnametable zero-termination
-			fread(buf2, 1, declen, in);
+			job->data = (unsigned char *)aMallocA(declen+1);  // +1 for resnametable zero-termination
+			fread(job->data, 1, declen, in);
 			fclose(in);
-
-			if( size )
-				*size = declen;
+			job->size = declen;
 		}
 		else
 		{
@@ -419,54 +498,269 @@ void* grfio_reads(const char* fname, int* size)
 				entry->gentry = -entry->gentry;	// local file checked
 			} else {
 				ShowError("grfio_reads: %s not found (local file: %s)\n", fname, lfname);
-				return NULL;
+				job->failed = true;
+				return;
 			}
 		}
 	}
 
 	if( entry != NULL && entry->gentry > 0 )
 	{// Archive[GRF] File Read
+		struct grf_mapping* mapping = &gentry_mapping[entry->gentry - 1];
 		char* grfname = gentry_table[entry->gentry - 1];
-		FILE* in = fopen(grfname, "rb");
-		if( in != NULL )
+
+		if( mapping->data != NULL && (size_t)entry->srcpos + entry->srclen_aligned <= mapping->size )
+		{
+			job->src = (unsigned char *)aMallocA(entry->srclen_aligned);
+			job->mapped = mapping->data + entry->srcpos;
+		}
+		else
 		{
-			unsigned char *buf = (unsigned char *)aMallocA(entry->srclen_aligned);
+			FILE* in = fopen(grfname, "rb");
+			if( in == NULL )
+			{
+				ShowError("grfio_reads: %s not found (GRF file: %s)\n", fname, grfname);
+				job->failed = true;
+				return;
+			}
+			job->src = (unsigned char *)aMallocA(entry->srclen_aligned);
 			fseek(in, entry->srcpos, 0);
-			fread(buf, 1, entry->srclen_aligned, in);
+			fread(job->src, 1, entry->srclen_aligned, in);
 			fclose(in);
+		}
 
-			buf2 = (unsigned char *)aMallocA(entry->declen+1);  // +1 for resnametable zero-termination
-			if( entry->type & FILELIST_TYPE_FILE )
-			{// file
-				uLongf len;
-				grf_decode(buf, entry->srclen_aligned, entry->type, entry->srclen);
-				len = entry->declen;
-				decode_zip(buf2, &len, buf, entry->srclen);
-				if (len != (uLong)entry->declen) {
-					ShowError("decode_zip size mismatch err: %d != %d\n", (int)len, entry->declen);
-					aFree(buf);
-					aFree(buf2);
-					return NULL;
-				}
-			}
-			else
-			{// directory?
-				memcpy(buf2, buf, entry->declen);
-			}
+		job->data = (unsigned char *)aMallocA(entry->declen+1);  // +1 for resnametable zero-termination
+		job->size = entry->declen;
+		job->entry = entry;
+	}
+}
 
-			if( size )
-				*size = entry->declen;
 
-			aFree(buf);
+/// Decodes the grf data of a file.
+static void grfio_job_decode(struct grfio_job* job)
+{
+	FILELIST* entry = job->entry;
+
+	if( entry == NULL )
+		return;// nothing to decode
+
+	if( job->mapped != NULL )
+		memcpy(job->src, job->mapped, entry->srclen_aligned);
+
+	if( entry->type & FILELIST_TYPE_FILE )
+	{// file
+		uLongf len;
+		grf_decode(job->src, entry->srclen_aligned, entry->type, entry->srclen);
+		len = entry->declen;
+		decode_zip(job->data, &len, job->src, entry->srclen);
+		job->len = len;
+		if( len != (uLong)entry->declen )
+			job->failed = true;
+	}
+	else
+	{// directory?
+		memcpy(job->data, job->src, entry->declen);
+	}
+}
+
+
+/// Releases the grf data and returns the file contents, or NULL if the read failed.
+static void* grfio_job_finish(struct grfio_job* job, int* size)
+{
+	if( job->src != NULL )
+		aFree(job->src);
+
+	if( job->entry != NULL && job->failed )
+		ShowError("decode_zip size mismatch err: %d != %d\n", (int)job->len, job->entry->declen);
+
+	if( job->failed )
+	{
+		if( job->data != NULL )
+			aFree(job->data);
+		return NULL;
+	}
+
+	if( size )
+		*size = job->size;
+	return job->data;
+}
+
+
+/// Reads a file into a newly allocated buffer (from grf or data directory).
+void* grfio_reads(const char* fname, int* size)
+{
+	struct grfio_job job;
+
+	grfio_job_prepare(&job, fname);
+	grfio_job_decode(&job);
+	return grfio_job_finish(&job, size);
+}
+
+
+/// Returns a fingerprint of the contents of a file, without decoding it, or 0 if the file is not found.
+/// The fingerprint of a file inside a grf is the crc32 of its encoded data,
+/// and the fingerprint of a local file depends on its size and modification time.
+unsigned long grfio_fingerprint(const char* fname)
+{
+	unsigned long crc;
+	FILELIST* entry = filelist_find(fname);
+
+	if( entry == NULL || entry->gentry <= 0 )
+	{// local file
+		char lfname[256];
+		struct stat st;
+
+		grfio_localpath_create(lfname, sizeof(lfname), ( entry && entry->fnd ) ? entry->fnd : fname);
+		if( stat(lfname, &st) == 0 )
+		{
+			uint32 stamp[2];
+			stamp[0] = (uint32)st.st_size;
+			stamp[1] = (uint32)st.st_mtime;
+			crc = grfio_crc32((const unsigned char*)stamp, sizeof(stamp));
+			return ( crc != 0 ) ? crc : 1;
 		}
+		if( entry == NULL || entry->gentry == 0 )
+			return 0;
+	}
+
+	{// grf entry (same contents as long as the encoded data is the same)
+		int gentry = ( entry->gentry < 0 ) ? -entry->gentry : entry->gentry;
+		struct grf_mapping* mapping = &gentry_mapping[gentry - 1];
+
+		crc = grfio_crc32((const unsigned char*)&entry->declen, sizeof(entry->declen));
+		if( mapping->data != NULL && (size_t)entry->srcpos + entry->srclen_aligned <= mapping->size )
+			crc = crc32(crc, mapping->data + entry->srcpos, entry->srclen_aligned);
 		else
 		{
-			ShowError("grfio_reads: %s not found (GRF file: %s)\n", fname, grfname);
-			return NULL;
+			unsigned char* buf;
+			FILE* in = fopen(gentry_table[gentry - 1], "rb");
+			if( in == NULL )
+				return 0;
+			buf = (unsigned char *)aMallocA(entry->srclen_aligned);
+			fseek(in, entry->srcpos, 0);
+			fread(buf, 1, entry->srclen_aligned, in);
+			fclose(in);
+			crc = crc32(crc, buf, entry->srclen_aligned);
+			aFree(buf);
 		}
 	}
+	return ( crc != 0 ) ? crc : 1;
+}
+
+
+/// Shared state of the threads of a batch read.
+struct grfio_batch {
+	struct grfio_job* jobs;
+	int count;
+	int next; // next job to decode
+	amutex* mutex;
+};
+
+
+static void grfio_batch_main(void* arg)
+{
+	struct grfio_batch* batch = (struct grfio_batch*)arg;
+
+	for(;;)
+	{
+		int i;
+
+		amutex_lock(batch->mutex);
+		i = batch->next++;
+		amutex_unlock(batch->mutex);
+
+		if( i >= batch->count )
+			break;
+		grfio_job_decode(&batch->jobs[i]);
+	}
+}
+
+
+/// Reads several files, decoding the grf data of different files at the same time.
+/// out_data[i] and out_size[i] are set to what grfio_reads(fnames[i], ...) would return.
+/// out_size can be NULL.
+void grfio_reads_batch(const char* const* fnames, int count, void** out_data, int* out_size)
+{
+	struct grfio_batch batch;
+	athread* threads[GRFIO_MAX_THREADS];
+	int nthreads = 0;
+	int i;
+
+	if( count <= 0 )
+		return;
+
+	batch.jobs = (struct grfio_job*)aMalloc(count*sizeof(struct grfio_job));
+	batch.count = count;
+	batch.next = 0;
+	batch.mutex = amutex_create();
+
+	for( i = 0; i < count; ++i )
+		grfio_job_prepare(&batch.jobs[i], fnames[i]);
+
+	while( nthreads < grfio_threads && nthreads < count - 1 )
+	{
+		threads[nthreads] = athread_create(grfio_batch_main, &batch);
+		if( threads[nthreads] == NULL )
+			break;// decode the rest here
+		++nthreads;
+	}
+	grfio_batch_main(&batch); // this thread decodes too
+	for( i = 0; i < nthreads; ++i )
+		athread_join(threads[i]);
+	amutex_destroy(batch.mutex);
+
+	for( i = 0; i < count; ++i )
+		out_data[i] = grfio_job_finish(&batch.jobs[i], out_size ? &out_size[i] : NULL);
+	aFree(batch.jobs);
+}
+
 
-	return buf2;
+/// Releases the files that were decoded in advance and not requested.
+static void grfio_prefetch_clear(void)
+{
+	int i;
+
+	for( i = 0; i < prefetched_count; ++i )
+	{
+		if( prefetched[i].fname != NULL )
+			aFree(prefetched[i].fname);
+		if( prefetched[i].data != NULL )
+			aFree(prefetched[i].data);
+	}
+	if( prefetched != NULL )
+		aFree(prefetched);
+	prefetched = NULL;
+	prefetched_count = 0;
+}
+
+
+/// Decodes the files in advance with grfio_reads_batch.
+/// The next grfio_reads of each file returns the decoded data.
+/// Files that were decoded by a previous call and never read are released.
+void grfio_prefetch(const char* const* fnames, int count)
+{
+	void** data;
+	int* size;
+	int i;
+
+	grfio_prefetch_clear();
+	if( count <= 0 )
+		return;
+
+	data = (void**)aMalloc(count*sizeof(void*));
+	size = (int*)aCalloc(count, sizeof(int));
+	grfio_reads_batch(fnames, count, data, size);
+
+	CREATE(prefetched, struct grfio_prefetched, count);
+	for( i = 0; i < count; ++i )
+	{
+		prefetched[i].fname = aStrdup(fnames[i]);
+		prefetched[i].data = data[i];
+		prefetched[i].size = size[i];
+	}
+	prefetched_count = count;
+	aFree(data);
+	aFree(size);
 }
 
 
@@ -499,6 +793,50 @@ static bool isFullEncrypt(const char* fname)
 }
 
 
+/// Maps a grf file into memory, so the entries are not copied to read them.
+/// The mapping is private and writable, the file list of a version 01xx grf is decoded in-place.
+/// Leaves the mapping empty if the file can't be mapped (and on Windows), the file is read instead.
+static void grfio_map(const char* grfname, struct grf_mapping* mapping)
+{
+#ifndef WIN32
+	FILE* fp;
+	long size;
+	void* data;
+#endif
+
+	mapping->data = NULL;
+	mapping->size = 0;
+#ifndef WIN32
+	fp = fopen(grfname, "rb");
+	if( fp == NULL )
+		return;
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	if( size > 0 )
+	{
+		data = mmap(NULL, (size_t)size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+		if( data != MAP_FAILED )
+		{
+			mapping->data = (unsigned char*)data;
+			mapping->size = (size_t)size;
+		}
+	}
+	fclose(fp);
+#endif
+}
+
+
+static void grfio_unmap(struct grf_mapping* mapping)
+{
+#ifndef WIN32
+	if( mapping->data != NULL )
+		munmap(mapping->data, mapping->size);
+#endif
+	mapping->data = NULL;
+	mapping->size = 0;
+}
+
+
 /// Loads all entries in the specified grf file into the filelist.
 /// @param gentry index of the grf file name in the gentry_table
 static int grfio_entryread(const char* grfname, int gentry)
@@ -507,6 +845,7 @@ static int grfio_entryread(const char* grfname, int gentry)
 	unsigned char grf_header[0x2e];
 	int entry,entrys,ofs,grf_version;
 	unsigned char *grf_filelist;
+	struct grf_mapping* mapping = &gentry_mapping[gentry];
 
 	FILE* fp = fopen(grfname, "rb");
 	if( fp == NULL )
@@ -535,8 +874,13 @@ static int grfio_entryread(const char* grfname, int gentry)
 	if( grf_version == 0x01 )
 	{// ****** Grf version 01xx ******
 		list_size = grf_size - ftell(fp);
-		grf_filelist = (unsigned char *) aMallocA(list_size);
-		fread(grf_filelist,1,list_size,fp);
+		if( mapping->data != NULL )
+			grf_filelist = mapping->data + ftell(fp);
+		else
+		{
+			grf_filelist = (unsigned char *) aMallocA(list_size);
+			fread(grf_filelist,1,list_size,fp);
+		}
 		fclose(fp);
 
 		entrys = getlong(grf_header+0x26) - getlong(grf_header+0x22) - 7;
@@ -556,7 +900,6 @@ static int grfio_entryread(const char* grfname, int gentry)
 				if( strlen(fname) > sizeof(aentry.fn) - 1 )
 				{
 					ShowFatalError("GRF file name %s is too long\n", fname);
-					aFree(grf_filelist);
 					exit(EXIT_FAILURE);
 				}
 
@@ -580,7 +923,8 @@ static int grfio_entryread(const char* grfname, int gentry)
 			ofs = ofs2 + 17;
 		}
 
-		aFree(grf_filelist);
+		if( mapping->data == NULL )
+			aFree(grf_filelist);
 	}
 	else
 	if( grf_version == 0x02 )
@@ -600,13 +944,18 @@ static int grfio_entryread(const char* grfname, int gentry)
 			return 4;
 		}
 
-		rBuf = (unsigned char *)aMallocA(rSize);	// Get a Read Size
 		grf_filelist = (unsigned char *)aMallocA(eSize);	// Get a Extend Size
-		fread(rBuf,1,rSize,fp);
+		if( mapping->data != NULL )
+			decode_zip(grf_filelist, &eSize, mapping->data + ftell(fp), rSize);	// Decode function
+		else
+		{
+			rBuf = (unsigned char *)aMallocA(rSize);	// Get a Read Size
+			fread(rBuf,1,rSize,fp);
+			decode_zip(grf_filelist, &eSize, rBuf, rSize);	// Decode function
+			aFree(rBuf);
+		}
 		fclose(fp);
-		decode_zip(grf_filelist, &eSize, rBuf, rSize);	// Decode function
 		list_size = eSize;
-		aFree(rBuf);
 
 		entrys = getlong(grf_header+0x26) - 7;
 
@@ -763,8 +1112,11 @@ static int grfio_add(const char* fname)
 		gentry_maxentry += GENTRY_ADDS;
 		gentry_table = (char**)aRealloc(gentry_table, gentry_maxentry * sizeof(char*));
 		memset(gentry_table + (gentry_maxentry - GENTRY_ADDS), 0, sizeof(char*) * GENTRY_ADDS);
+		RECREATE(gentry_mapping, struct grf_mapping, gentry_maxentry);
+		memset(gentry_mapping + (gentry_maxentry - GENTRY_ADDS), 0, sizeof(struct grf_mapping) * GENTRY_ADDS);
 	}
 
+	grfio_map(fname, &gentry_mapping[gentry_entrys]);
 	gentry_table[gentry_entrys++] = aStrdup(fname);
 
 	return grfio_entryread(fname, gentry_entrys - 1);
@@ -774,6 +1126,8 @@ static int grfio_add(const char* fname)
 /// Finalizes grfio.
 void grfio_final(void)
 {
+	grfio_prefetch_clear();
+
 	if (filelist != NULL) {
 		int i;
 		for (i = 0; i < filelist_entrys; i++)
@@ -787,14 +1141,23 @@ void grfio_final(void)
 
 	if (gentry_table != NULL) {
 		int i;
-		for (i = 0; i < gentry_entrys; i++)
+		for (i = 0; i < gentry_entrys; i++) {
 			if (gentry_table[i] != NULL)
 				aFree(gentry_table[i]);
+			grfio_unmap(&gentry_mapping[i]);
+		}
 
 		aFree(gentry_table);
 		gentry_table = NULL;
+		aFree(gentry_mapping);
+		gentry_mapping = NULL;
 	}
 	gentry_entrys = gentry_maxentry = 0;
+
+	if (filelist_hash != NULL) {
+		aFree(filelist_hash);
+		filelist_hash = NULL;
+	}
 }
 
 
@@ -831,6 +1194,11 @@ void grfio_init(const char* fname)
 			{
 				safestrncpy(data_dir, w2, sizeof(data_dir));
 			}
+			else
+			if( strcmp(w1,"threads") == 0 ) // Decoding threads
+			{
+				grfio_threads = cap_value(atoi(w2), 0, GRFIO_MAX_THREADS);
+			}
 		}
 
 		fclose(data_conf);
@@ -9,6 +9,9 @@ void grfio_final(void);
 void* grfio_reads(const char* fname, int* size);
 char* grfio_find_file(const char* fname);
 #define grfio_read(fn) grfio_reads(fn, NULL)
+void grfio_reads_batch(const char* const* fnames, int count, void** out_data, int* out_size);
+void grfio_prefetch(const char* const* fnames, int count);
+unsigned long grfio_fingerprint(const char* fname);
 
 unsigned long grfio_crc32(const unsigned char *buf, unsigned int len);
 int decode_zip(void* dest, unsigned long* destLen, const void* source, unsigned long sourceLen);
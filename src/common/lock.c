@@ -57,3 +57,16 @@ int lock_fclose (FILE *fp, const char* filename, int *info) {
 	
 	return ret;
 }
+
+/// Writes the buffered data of fp to the disk.
+/// Returns 0 on success.
+int lock_fsync(FILE *fp)
+{
+	if (fp == NULL || fflush(fp) != 0)
+		return -1;
+#ifndef WIN32
+	return fsync(fileno(fp));
+#else
+	return _commit(_fileno(fp));
+#endif
+}
@@ -8,5 +8,6 @@
 
 FILE* lock_fopen(const char* filename,int *info);
 int   lock_fclose(FILE *fp,const char* filename,int *info);
+int   lock_fsync(FILE *fp);
 
 #endif /* _LOCK_H_ */
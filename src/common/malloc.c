@@ -4,6 +4,7 @@
 #include "../common/malloc.h"
 #include "../common/core.h"
 #include "../common/showmsg.h"
+#include "../common/thread.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -122,6 +123,543 @@ void aFree_(void *p, const char *file, int line, const char *func)
 
 #ifdef USE_MEMMGR
 
+#if defined(MEMMGR_SLAB)
+
+/* MEMMGR_SLAB */
+
+/*
+ * Production memory manager
+ *     Every thread allocates from its own heap of size-class slabs, so the 
+ *     common path takes no locks. Memory freed by another thread is queued 
+ *     on the owner heap and reclaimed by the owner on its next allocation 
+ *     miss. No leak tracking is done in this mode.
+ *
+ *     Slabs are SLAB_SIZE bytes aligned to SLAB_SIZE, with the slab header 
+ *     at the start. The header of any pointer is found by masking the 
+ *     address. Allocations bigger than the largest size class get a slab 
+ *     of their own (SLAB_LARGE).
+ */
+
+/* size of a slab, must be a power of two */
+#define SLAB_SIZE			( 64*1024 )
+/* size classes: 16 byte steps up to 256 bytes, then 4 steps per power of two */
+#define SLAB_CLASS_COUNT	( 16 + 4*7 )
+#define SLAB_UNIT_MAX		( 32*1024 )
+#define SLAB_LARGE			0xFFFF
+#define SLAB_MAGIC			0x51AB51ABU
+
+struct slab_heap;
+
+/* slab header */
+struct slab {
+	uint32 magic;
+	uint16 unit_class;				/* size class or SLAB_LARGE */
+	uint16 in_partial;				/* is in the partial list of the heap */
+	struct slab_heap* heap;			/* owner heap */
+	struct slab* prev;				/* partial list */
+	struct slab* next;				/* partial list */
+	struct slab* all_prev;			/* list of all slabs of the heap */
+	struct slab* all_next;			/* list of all slabs of the heap */
+	void*  free_list;				/* freed units */
+	char*  data;					/* first unit */
+	size_t unit_size;				/* size of the units (of the allocation for SLAB_LARGE) */
+	uint32 unit_count;				/* number of units */
+	uint32 unit_used;				/* number of used units */
+	uint32 unit_maxused;			/* number of units carved so far */
+};
+
+/* per-thread heap */
+struct slab_heap {
+	struct slab* partial[SLAB_CLASS_COUNT];	/* slabs with free units */
+	struct slab* empty;						/* empty slab kept for reuse */
+	struct slab* all;						/* all slabs in use */
+	uint32 slabs[SLAB_CLASS_COUNT];			/* number of slabs */
+	uint32 used[SLAB_CLASS_COUNT];			/* number of used units */
+	int64  large_bytes;						/* bytes in large allocations */
+	uint32 large_count;						/* number of large allocations */
+	amutex* remote_lock;
+	void*  remote_free;						/* units freed by other threads */
+	volatile int remote_pending;
+	bool   orphan;							/* the thread exited, the next new thread adopts the heap */
+	struct slab_heap* next;					/* list of all heaps */
+};
+
+static size_t slab_class_size[SLAB_CLASS_COUNT];
+static unsigned char slab_size2class[SLAB_UNIT_MAX/16 + 1];
+static THREAD_LOCAL struct slab_heap* slab_local_heap = NULL;
+static struct slab_heap* slab_heaps = NULL;
+static amutex* slab_heaps_lock = NULL;
+
+#define slab_of(p) ((struct slab*)((uintptr_t)(p) & ~(uintptr_t)(SLAB_SIZE - 1)))
+#define SLAB_HEADER_SIZE ( (sizeof(struct slab) + 15) & ~(size_t)15 )
+
+/* aligned system allocation */
+static void* slab_sysalloc(size_t size)
+{
+	void* p;
+#ifdef WIN32
+	p = _aligned_malloc(size, SLAB_SIZE);
+#else
+	if( posix_memalign(&p, SLAB_SIZE, size) != 0 )
+		p = NULL;
+#endif
+	if( p == NULL ) {
+		ShowFatalError("Memory manager::slab_sysalloc failed (allocating %lu bytes).\n", (unsigned long)size);
+		exit(EXIT_FAILURE);
+	}
+	return p;
+}
+
+static void slab_sysfree(void* p)
+{
+#ifdef WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+/* builds the size class tables */
+static void slab_init_classes(void)
+{
+	size_t size;
+	int i, n = 0;
+
+	for( size = 16; size <= 256; size += 16 )
+		slab_class_size[n++] = size;
+	for( size = 256; size < SLAB_UNIT_MAX; size *= 2 )
+		for( i = 1; i <= 4; ++i )
+			slab_class_size[n++] = size + size/4*i;
+
+	for( i = 0, n = 0; i <= SLAB_UNIT_MAX/16; ++i ) {
+		while( slab_class_size[n] < (size_t)i*16 )
+			++n;
+		slab_size2class[i] = (unsigned char)n;
+	}
+}
+
+/* heap of the current thread */
+static struct slab_heap* slab_heap_local(void)
+{
+	struct slab_heap* heap = slab_local_heap;
+
+	if( heap == NULL ) {
+		amutex_lock(slab_heaps_lock);
+		for( heap = slab_heaps; heap && !heap->orphan; heap = heap->next );
+		if( heap )
+			heap->orphan = false;// adopt the heap of a thread that exited
+		amutex_unlock(slab_heaps_lock);
+		if( heap == NULL ) {
+			heap = (struct slab_heap*)calloc(1, sizeof(struct slab_heap));
+			if( heap == NULL ) {
+				ShowFatalError("Memory manager::slab_heap_local failed.\n");
+				exit(EXIT_FAILURE);
+			}
+			heap->remote_lock = amutex_create();
+			amutex_lock(slab_heaps_lock);
+			heap->next = slab_heaps;
+			slab_heaps = heap;
+			amutex_unlock(slab_heaps_lock);
+		}
+		slab_local_heap = heap;
+	}
+	return heap;
+}
+
+/* adds a slab to the list of all slabs of the heap */
+static void slab_register(struct slab_heap* heap, struct slab* s)
+{
+	s->all_prev = NULL;
+	s->all_next = heap->all;
+	if( s->all_next )
+		s->all_next->all_prev = s;
+	heap->all = s;
+}
+
+/* removes a slab from the list of all slabs of the heap */
+static void slab_unregister(struct slab_heap* heap, struct slab* s)
+{
+	if( s->all_prev )
+		s->all_prev->all_next = s->all_next;
+	else
+		heap->all = s->all_next;
+	if( s->all_next )
+		s->all_next->all_prev = s->all_prev;
+	s->magic = 0;
+}
+
+static void slab_unlink(struct slab_heap* heap, struct slab* s)
+{
+	if( s->prev )
+		s->prev->next = s->next;
+	else
+		heap->partial[s->unit_class] = s->next;
+	if( s->next )
+		s->next->prev = s->prev;
+	s->prev = s->next = NULL;
+	s->in_partial = 0;
+}
+
+static void slab_link(struct slab_heap* heap, struct slab* s)
+{
+	s->prev = NULL;
+	s->next = heap->partial[s->unit_class];
+	if( s->next )
+		s->next->prev = s;
+	heap->partial[s->unit_class] = s;
+	s->in_partial = 1;
+}
+
+/* gets a new slab for the size class */
+static struct slab* slab_new(struct slab_heap* heap, unsigned short unit_class)
+{
+	struct slab* s;
+
+	if( heap->empty ) {
+		s = heap->empty;
+		heap->empty = NULL;
+	} else
+		s = (struct slab*)slab_sysalloc(SLAB_SIZE);
+
+	s->magic        = SLAB_MAGIC;
+	s->unit_class   = unit_class;
+	s->heap         = heap;
+	s->free_list    = NULL;
+	s->data         = (char*)s + SLAB_HEADER_SIZE;
+	s->unit_size    = slab_class_size[unit_class];
+	s->unit_count   = (uint32)((SLAB_SIZE - SLAB_HEADER_SIZE) / s->unit_size);
+	s->unit_used    = 0;
+	s->unit_maxused = 0;
+	slab_register(heap, s);
+	slab_link(heap, s);
+	heap->slabs[unit_class]++;
+	return s;
+}
+
+/* returns a unit to its slab, the slab must belong to the heap */
+static void slab_free_unit(struct slab_heap* heap, struct slab* s, void* ptr)
+{
+	*(void**)ptr = s->free_list;
+	s->free_list = ptr;
+	s->unit_used--;
+	heap->used[s->unit_class]--;
+
+	if( s->unit_used == 0 ) {// release the slab, keeping one for reuse
+		if( s->in_partial )
+			slab_unlink(heap, s);
+		heap->slabs[s->unit_class]--;
+		slab_unregister(heap, s);
+		if( heap->empty == NULL )
+			heap->empty = s;
+		else
+			slab_sysfree(s);
+	} else if( !s->in_partial )
+		slab_link(heap, s);
+}
+
+/* reclaims the units freed by other threads */
+static void slab_drain(struct slab_heap* heap)
+{
+	void* list;
+
+	amutex_lock(heap->remote_lock);
+	list = heap->remote_free;
+	heap->remote_free = NULL;
+	heap->remote_pending = 0;
+	amutex_unlock(heap->remote_lock);
+
+	while( list ) {
+		void* next = *(void**)list;
+		struct slab* s = slab_of(list);
+		if( s->unit_class == SLAB_LARGE ) {
+			heap->large_bytes -= s->unit_size;
+			heap->large_count--;
+			slab_unregister(heap, s);
+			slab_sysfree(s);
+		} else
+			slab_free_unit(heap, s, list);
+		list = next;
+	}
+}
+
+/* releases the heap of a thread that exits, or leaves it to the next thread if it still has slabs */
+static void slab_thread_exit(void)
+{
+	struct slab_heap* heap = slab_local_heap;
+	struct slab_heap** prev;
+	bool release;
+
+	if( heap == NULL )
+		return;
+	slab_local_heap = NULL;
+	if( heap->remote_pending )
+		slab_drain(heap);
+	if( heap->empty ) {
+		slab_sysfree(heap->empty);
+		heap->empty = NULL;
+	}
+	amutex_lock(slab_heaps_lock);
+	release = ( heap->all == NULL );
+	if( release ) {// no slab left, nothing can be freed to it anymore
+		for( prev = &slab_heaps; *prev != heap; prev = &(*prev)->next );
+		*prev = heap->next;
+	} else
+		heap->orphan = true;
+	amutex_unlock(slab_heaps_lock);
+	if( release ) {
+		amutex_destroy(heap->remote_lock);
+		free(heap);
+	}
+}
+
+void* _mmalloc(size_t size, const char *file, int line, const char *func )
+{
+	struct slab_heap* heap;
+	struct slab* s;
+	unsigned short unit_class;
+	void* ptr;
+
+	if (((long) size) < 0) {
+		ShowError("_mmalloc: %d\n", size);
+		return NULL;
+	}
+
+	if(size == 0) {
+		return NULL;
+	}
+	heap = slab_heap_local();
+
+	if( size > SLAB_UNIT_MAX ) {// large allocation, gets a slab of its own
+		s = (struct slab*)slab_sysalloc(SLAB_HEADER_SIZE + size);
+		s->magic        = SLAB_MAGIC;
+		s->unit_class   = SLAB_LARGE;
+		s->in_partial   = 0;
+		s->heap         = heap;
+		s->prev = s->next = NULL;
+		s->free_list    = NULL;
+		s->data         = (char*)s + SLAB_HEADER_SIZE;
+		s->unit_size    = size;
+		s->unit_count   = 1;
+		s->unit_used    = 1;
+		s->unit_maxused = 1;
+		slab_register(heap, s);
+		heap->large_bytes += size;
+		heap->large_count++;
+		return s->data;
+	}
+
+	unit_class = slab_size2class[(size + 15)/16];
+	s = heap->partial[unit_class];
+	if( s == NULL && heap->remote_pending ) {
+		slab_drain(heap);
+		s = heap->partial[unit_class];
+	}
+	if( s == NULL )
+		s = slab_new(heap, unit_class);
+
+	if( s->free_list ) {
+		ptr = s->free_list;
+		s->free_list = *(void**)ptr;
+	} else {
+		ptr = s->data + s->unit_size * s->unit_maxused;
+		s->unit_maxused++;
+	}
+	s->unit_used++;
+	heap->used[unit_class]++;
+	if( s->unit_used == s->unit_count )
+		slab_unlink(heap, s);// full
+	return ptr;
+}
+
+void* _mcalloc(size_t num, size_t size, const char *file, int line, const char *func )
+{
+	void *p = _mmalloc(num * size,file,line,func);
+	if( p != NULL )
+		memset(p,0,num * size);
+	return p;
+}
+
+void* _mrealloc(void *memblock, size_t size, const char *file, int line, const char *func )
+{
+	size_t old_size;
+	void* p;
+
+	if(memblock == NULL) {
+		return _mmalloc(size,file,line,func);
+	}
+
+	old_size = slab_of(memblock)->unit_size;
+	if( old_size >= size ) {
+		return memblock;
+	}
+	p = _mmalloc(size,file,line,func);
+	if(p != NULL) {
+		memcpy(p,memblock,old_size);
+	}
+	_mfree(memblock,file,line,func);
+	return p;
+}
+
+char* _mstrdup(const char *p, const char *file, int line, const char *func )
+{
+	if(p == NULL) {
+		return NULL;
+	} else {
+		size_t len = strlen(p);
+		char *string  = (char *)_mmalloc(len + 1,file,line,func);
+		memcpy(string,p,len+1);
+		return string;
+	}
+}
+
+void _mfree(void *ptr, const char *file, int line, const char *func )
+{
+	struct slab_heap* heap;
+	struct slab* s;
+
+	if (ptr == NULL)
+		return;
+
+	s = slab_of(ptr);
+	if( s->magic != SLAB_MAGIC || (char*)ptr < s->data ) {
+		ShowError("Memory manager: args of aFree 0x%p is invalid pointer %s line %d\n", ptr, file, line);
+		return;
+	}
+	heap = slab_heap_local();
+
+	if( s->unit_class == SLAB_LARGE && s->heap == heap ) {// large allocations are released right away
+		heap->large_bytes -= s->unit_size;
+		heap->large_count--;
+		slab_unregister(heap, s);
+		slab_sysfree(s);
+	} else if( s->heap == heap ) {
+		slab_free_unit(heap, s, ptr);
+	} else {// owned by another thread
+		struct slab_heap* owner = s->heap;
+		amutex_lock(owner->remote_lock);
+		*(void**)ptr = owner->remote_free;
+		owner->remote_free = ptr;
+		owner->remote_pending = 1;
+		amutex_unlock(owner->remote_lock);
+	}
+}
+
+size_t memmgr_usage (void)
+{
+	struct slab_heap* heap;
+	int64 bytes = 0;
+	int i;
+
+	if( slab_heaps_lock == NULL )
+		return 0;
+	amutex_lock(slab_heaps_lock);
+	for( heap = slab_heaps; heap; heap = heap->next ) {
+		for( i = 0; i < SLAB_CLASS_COUNT; ++i )
+			bytes += (int64)heap->used[i] * slab_class_size[i];
+		bytes += heap->large_bytes;
+	}
+	amutex_unlock(slab_heaps_lock);
+	return (size_t)(bytes / 1024);
+}
+
+/// Displays the usage of every size class and the fragmentation of the slabs.
+/// Fragmentation is the part of the slabs that is not in use.
+static void memmgr_report(void)
+{
+	struct slab_heap* heap;
+	uint32 slabs[SLAB_CLASS_COUNT], used[SLAB_CLASS_COUNT];
+	uint32 total_slabs = 0, heaps = 0, large_count = 0;
+	uint64 total_used = 0, total_capacity = 0;
+	int64 large_bytes = 0;
+	int i;
+
+	if( slab_heaps_lock == NULL )
+		return;
+	memset(slabs, 0, sizeof(slabs));
+	memset(used, 0, sizeof(used));
+	amutex_lock(slab_heaps_lock);
+	for( heap = slab_heaps; heap; heap = heap->next ) {
+		for( i = 0; i < SLAB_CLASS_COUNT; ++i ) {
+			slabs[i] += heap->slabs[i];
+			used[i] += heap->used[i];
+		}
+		large_bytes += heap->large_bytes;
+		large_count += heap->large_count;
+		++heaps;
+	}
+	amutex_unlock(slab_heaps_lock);
+
+	ShowInfo("Memory manager: %u heap(s), slab size %u bytes\n", heaps, SLAB_SIZE);
+	for( i = 0; i < SLAB_CLASS_COUNT; ++i ) {
+		uint32 capacity = slabs[i] * (uint32)((SLAB_SIZE - SLAB_HEADER_SIZE) / slab_class_size[i]);
+		if( slabs[i] == 0 )
+			continue;
+		ShowMessage("  class %5lu bytes: %5u slab(s), %8u/%8u units used, %3u%% fragmented\n",
+			(unsigned long)slab_class_size[i], slabs[i], used[i], capacity,
+			(unsigned int)((capacity - used[i])*(uint64)100/capacity));
+		total_slabs += slabs[i];
+		total_used += (uint64)used[i] * slab_class_size[i];
+		total_capacity += (uint64)slabs[i] * SLAB_SIZE;
+	}
+	ShowMessage("  large: %u allocation(s), %lu KB\n", large_count, (unsigned long)(large_bytes/1024));
+	ShowMessage("  slabs: %u, %lu KB used of %lu KB (%u%% fragmented)\n", total_slabs,
+		(unsigned long)(total_used/1024), (unsigned long)(total_capacity/1024),
+		total_capacity ? (unsigned int)((total_capacity - total_used)*100/total_capacity) : 0);
+}
+
+/// Returns true if the memory location is active.
+/// Active means it is allocated and points to a usable part.
+/// NOTE: only detects pointers that are not inside a slab, freed units of 
+///       a slab in use are reported as active.
+///       Only safe while the other threads are not allocating.
+///
+/// @param ptr Pointer to the memory
+/// @return true if the memory is active
+bool memmgr_verify(void* ptr)
+{
+	struct slab_heap* heap;
+	struct slab* s;
+	struct slab* target;
+
+	if( ptr == NULL || slab_heaps_lock == NULL )
+		return false;// never valid
+	target = slab_of(ptr);
+	amutex_lock(slab_heaps_lock);
+	for( heap = slab_heaps; heap; heap = heap->next ) {
+		for( s = heap->all; s; s = s->all_next )
+			if( s == target )
+				break;
+		if( s )
+			break;
+	}
+	amutex_unlock(slab_heaps_lock);
+	if( s == NULL || (char*)ptr < s->data )
+		return false;
+	if( s->unit_class == SLAB_LARGE )
+		return ( (char*)ptr < s->data + s->unit_size );
+	return ( (char*)ptr < s->data + s->unit_size*s->unit_maxused );
+}
+
+static void memmgr_final (void)
+{
+	struct slab_heap* heap = slab_local_heap;
+
+	if( heap && heap->remote_pending )
+		slab_drain(heap);
+	memmgr_report();
+}
+
+static void memmgr_init (void)
+{
+	slab_heaps_lock = amutex_create();
+	slab_init_classes();
+	athread_set_exit_hook(slab_thread_exit);
+	slab_heap_local();
+	ShowStatus("Memory manager initialised: "CL_WHITE"slab"CL_RESET"\n");
+}
+
+#else /* !MEMMGR_SLAB */
+
 #if defined(DEBUG)
 #define DEBUG_MEMMGR
 #endif
@@ -656,9 +1194,123 @@ static void memmgr_init (void)
 	memset(hash_unfill, 0, sizeof(hash_unfill));
 #endif /* LOG_MEMMGR */
 }
+#endif /* MEMMGR_SLAB */
 #endif /* USE_MEMMGR */
 
 
+/*======================================
+ * Arenas
+ *--------------------------------------
+ */
+
+/// Size of the chunks of an arena
+#define ARENA_CHUNK_SIZE ( 64*1024 - 64 )
+
+struct arena_chunk {
+	struct arena_chunk* next;
+	size_t size;	// usable bytes
+	size_t used;	// used bytes
+};
+
+struct malloc_arena {
+	const char* name;
+	struct arena_chunk* chunks;	// current chunk first
+	size_t allocated;			// bytes in chunks
+	size_t used;				// bytes handed out
+	struct malloc_arena* prev;
+	struct malloc_arena* next;
+};
+
+static struct malloc_arena* arenas = NULL;
+static amutex* arenas_lock = NULL;// created in malloc_init, before any thread starts
+
+#define ARENA_ALIGN(n) ( ((n) + 15) & ~(size_t)15 )
+#define ARENA_CHUNK_HEADER ARENA_ALIGN(sizeof(struct arena_chunk))
+
+/// Creates an arena.
+/// An arena hands out memory with a pointer bump and releases it all at once.
+/// It is meant for short-lived data of a single task (loading, parsing) and
+/// must only be used by one thread at a time. The chunks come from the system
+/// allocator, so any thread can use an arena whatever the memory manager.
+///
+/// @param name Name of the arena, used in reports. Must stay valid.
+malloc_arena* malloc_arena_create(const char* name)
+{
+	malloc_arena* arena;
+
+	arena = (malloc_arena*)calloc(1, sizeof(malloc_arena));
+	if( arena == NULL ) {
+		ShowFatalError("malloc_arena_create: out of memory!\n");
+		exit(EXIT_FAILURE);
+	}
+	arena->name = name;
+	amutex_lock(arenas_lock);
+	arena->next = arenas;
+	if( arenas )
+		arenas->prev = arena;
+	arenas = arena;
+	amutex_unlock(arenas_lock);
+	return arena;
+}
+
+/// Allocates memory from the arena.
+/// The memory is aligned to 16 bytes and is not initialised.
+/// Returns NULL if the system is out of memory.
+void* malloc_arena_alloc(malloc_arena* arena, size_t size)
+{
+	struct arena_chunk* chunk = arena->chunks;
+	char* ptr;
+
+	size = ARENA_ALIGN(size);
+	if( chunk == NULL || chunk->used + size > chunk->size )
+	{// new chunk
+		size_t chunk_size = max(size, ARENA_CHUNK_SIZE - ARENA_CHUNK_HEADER);
+		chunk = (struct arena_chunk*)malloc(ARENA_CHUNK_HEADER + chunk_size);
+		if( chunk == NULL )
+			return NULL;
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->allocated += chunk_size;
+	}
+	ptr = (char*)chunk + ARENA_CHUNK_HEADER + chunk->used;
+	chunk->used += size;
+	arena->used += size;
+	return ptr;
+}
+
+/// Releases all the memory of the arena.
+void malloc_arena_clear(malloc_arena* arena)
+{
+	while( arena->chunks )
+	{
+		struct arena_chunk* chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		free(chunk);
+	}
+	arena->allocated = 0;
+	arena->used = 0;
+}
+
+/// Releases all the memory of the arena and the arena itself.
+void malloc_arena_destroy(malloc_arena* arena)
+{
+	if( arena == NULL )
+		return;
+	malloc_arena_clear(arena);
+	amutex_lock(arenas_lock);
+	if( arena->prev )
+		arena->prev->next = arena->next;
+	else
+		arenas = arena->next;
+	if( arena->next )
+		arena->next->prev = arena->prev;
+	amutex_unlock(arenas_lock);
+	free(arena);
+}
+
+
 /*======================================
  * Initialise
  *--------------------------------------
@@ -693,12 +1345,30 @@ size_t malloc_usage (void)
 #endif
 }
 
+/// Displays the memory usage of the memory manager and of the arenas.
+void malloc_report(void)
+{
+	malloc_arena* arena;
+
+#if defined(USE_MEMMGR) && defined(MEMMGR_SLAB)
+	memmgr_report();
+#else
+	ShowInfo("Memory usage: %lu KB\n", (unsigned long)malloc_usage());
+#endif
+	amutex_lock(arenas_lock);
+	for( arena = arenas; arena; arena = arena->next )
+		ShowMessage("  arena '%s': %lu KB used of %lu KB\n", arena->name, (unsigned long)(arena->used/1024), (unsigned long)(arena->allocated/1024));
+	amutex_unlock(arenas_lock);
+}
+
 void malloc_final (void)
 {
 #ifdef USE_MEMMGR
 	memmgr_final ();
 #endif
 	MEMORY_CHECK();
+	amutex_destroy(arenas_lock);
+	arenas_lock = NULL;
 }
 
 void malloc_init (void)
@@ -715,4 +1385,5 @@ void malloc_init (void)
 #ifdef USE_MEMMGR
 	memmgr_init ();
 #endif
+	arenas_lock = amutex_create();
 }
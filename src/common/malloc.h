@@ -33,6 +33,11 @@
 #undef LOG_MEMMGR
 #endif
 
+// no logging for the slab allocator (thread-local size-class slabs)
+#if defined(MEMMGR_SLAB) && defined(LOG_MEMMGR)
+#undef LOG_MEMMGR
+#endif
+
 #	define aMalloc(n)		_mmalloc(n,ALC_MARK)
 #	define aCalloc(m,n)		_mcalloc(m,n,ALC_MARK)
 #	define aRealloc(p,n)	_mrealloc(p,n,ALC_MARK)
@@ -86,11 +91,22 @@
 #define CREATE(result, type, number) (result) = (type *) aCalloc ((number), sizeof(type))
 #define RECREATE(result, type, number) (result) = (type *) aRealloc ((result), sizeof(type) * (number))
 
+/////////////// Arenas /////////////////////////
+// Bump allocation with bulk release, for short-lived data of one thread
+
+typedef struct malloc_arena malloc_arena;
+
+malloc_arena* malloc_arena_create(const char* name);
+void* malloc_arena_alloc(malloc_arena* arena, size_t size);
+void malloc_arena_clear(malloc_arena* arena);
+void malloc_arena_destroy(malloc_arena* arena);
+
 ////////////////////////////////////////////////
 
 void malloc_memory_check(void);
 bool malloc_verify_ptr(void* ptr);
 size_t malloc_usage (void);
+void malloc_report(void);
 void malloc_init (void);
 void malloc_final (void);
 
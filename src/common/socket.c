@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <zlib.h>
 
 #ifdef WIN32
 	#include <winsock2.h>
@@ -147,6 +148,7 @@ int sSocket(int af, int type, int protocol)
 
 #define sBind(fd,name,namelen) bind(fd2sock(fd),name,namelen)
 #define sConnect(fd,name,namelen) connect(fd2sock(fd),name,namelen)
+#define sGetsockname(fd,name,namelen) getsockname(fd2sock(fd),name,namelen)
 #define sIoctl(fd,cmd,argp) ioctlsocket(fd2sock(fd),cmd,argp)
 #define sListen(fd,backlog) listen(fd2sock(fd),backlog)
 #define sRecv(fd,buf,len,flags) recv(fd2sock(fd),buf,len,flags)
@@ -178,6 +180,7 @@ int sSocket(int af, int type, int protocol)
 
 #define sBind bind
 #define sConnect connect
+#define sGetsockname getsockname
 #define sIoctl ioctl
 #define sListen listen
 #define sRecv recv
@@ -218,6 +221,40 @@ static size_t socket_max_client_packet = 20480;
 
 struct socket_data* session[FD_SETSIZE];
 
+// Packets sent over a server link that are at least this big are compressed,
+// if the other side accepts compressed packets (0 = never compress).
+static size_t server_compress_size = 1024;
+
+// buffer for compressing/uncompressing server packets (packets are at most 0xFFFF bytes)
+static uint8 server_zbuf[0x10000];
+
+// Inter-server traffic statistics, per packet type.
+// Tracked for the server packet range (login, char and inter packets), other ids share one entry.
+#define LINKSTAT_FIRST 0x2700
+#define LINKSTAT_LAST  0x3fff
+struct s_linkstat
+{
+	uint32 count[2]; // messages (0: sent, 1: received)
+	uint64 bytes[2]; // message bytes, uncompressed
+	uint64 wire[2];  // bytes on the wire, after compression
+};
+static struct s_linkstat* linkstats = NULL; // [cmd-LINKSTAT_FIRST] + one entry for other ids
+static uint64 linkstat_sends = 0; // send() calls on server links
+static uint32 linkstat_compressed[2] = { 0, 0 }; // compressed messages
+static unsigned int linkstat_since = 0; // tick of the last reset
+
+static struct s_linkstat* linkstat_get(int cmd)
+{
+	if( linkstats == NULL )
+	{
+		CREATE(linkstats, struct s_linkstat, LINKSTAT_LAST - LINKSTAT_FIRST + 2);
+		linkstat_since = gettick();
+	}
+	if( cmd < LINKSTAT_FIRST || cmd > LINKSTAT_LAST )
+		return &linkstats[LINKSTAT_LAST - LINKSTAT_FIRST + 1];
+	return &linkstats[cmd - LINKSTAT_FIRST];
+}
+
 #ifdef SEND_SHORTLIST
 int send_shortlist_array[FD_SETSIZE];// we only support FD_SETSIZE sockets, limit the array to that
 int send_shortlist_count = 0;// how many fd's are in the shortlist
@@ -341,6 +378,8 @@ int send_from_fifo(int fd)
 		return 0; // nothing to send
 
 	len = sSend(fd, (const char *) session[fd]->wdata, (int)session[fd]->wdata_size, 0);
+	if( session[fd]->flag.server )
+		++linkstat_sends;
 
 	if( len == SOCKET_ERROR )
 	{//An exception has occured
@@ -423,6 +462,7 @@ int connect_client(int listen_fd)
 
 	create_session(fd, recv_to_fifo, send_from_fifo, default_func_parse);
 	session[fd]->client_addr = ntohl(client_address.sin_addr.s_addr);
+	session[fd]->client_port = ntohs(client_address.sin_port);
 
 	return fd;
 }
@@ -483,7 +523,8 @@ int make_listen_bind(uint32 ip, uint16 port)
 
 int make_connection(uint32 ip, uint16 port)
 {
-	struct sockaddr_in remote_address;
+	struct sockaddr_in remote_address, local_address;
+	socklen_t len;
 	int fd;
 	int result;
 
@@ -528,6 +569,10 @@ int make_connection(uint32 ip, uint16 port)
 
 	create_session(fd, recv_to_fifo, send_from_fifo, default_func_parse);
 	session[fd]->client_addr = ntohl(remote_address.sin_addr.s_addr);
+	session[fd]->client_port = port;
+	len = sizeof(local_address);
+	if( sGetsockname(fd, (struct sockaddr*)&local_address, &len) != SOCKET_ERROR )
+		session[fd]->local_port = ntohs(local_address.sin_port);
 
 	return fd;
 }
@@ -617,10 +662,142 @@ int RFIFOSKIP(int fd, size_t len)
 		len = RFIFOREST(fd);
 	}
 
+	if( s->flag.server && len >= 2 )
+	{
+		struct s_linkstat* stat = linkstat_get(RFIFOW(fd,0));
+		++stat->count[1];
+		stat->bytes[1] += len;
+		stat->wire[1] += ( s->rdata_compressed ? s->rdata_compressed : len );
+		s->rdata_compressed = 0;
+	}
+
 	s->rdata_pos = s->rdata_pos + len;
 	return 0;
 }
 
+/// Replaces the compressed server packet at the head of the read buffer
+/// with the packet it contains, so the parser can process it normally.
+/// 0x2b28 <packet len>.W <uncompressed len>.W <zlib data>.?B
+/// Returns 1 if the packet was unpacked, 0 if more data is needed, -1 if it's invalid.
+int RFIFOUNCOMPRESS(int fd)
+{
+	struct socket_data* s;
+	size_t len, rest;
+	uLongf out_len;
+
+	if( !session_isActive(fd) )
+		return -1;
+	s = session[fd];
+
+	if( RFIFOREST(fd) < 6 )
+		return 0;
+	len = RFIFOW(fd,2);
+	if( len < 6 )
+		return -1;
+	if( RFIFOREST(fd) < len )
+		return 0;
+
+	out_len = sizeof(server_zbuf);
+	if( uncompress(server_zbuf, &out_len, RFIFOP(fd,6), (uLong)(len - 6)) != Z_OK || out_len != RFIFOW(fd,4) || out_len < 2 )
+	{
+		ShowError("RFIFOUNCOMPRESS: Invalid compressed packet from connection #%d (len=%u).\n", fd, (unsigned int)len);
+		return -1;
+	}
+
+	// drop the envelope and put the packet in its place
+	s->rdata_pos += len;
+	RFIFOFLUSH(fd);
+	rest = s->rdata_size;
+	if( rest + out_len > s->max_rdata )
+	{
+		RECREATE(s->rdata, unsigned char, rest + out_len);
+		s->max_rdata = rest + out_len;
+	}
+	memmove(s->rdata + out_len, s->rdata, rest);
+	memcpy(s->rdata, server_zbuf, out_len);
+	s->rdata_size = rest + out_len;
+
+	s->rdata_compressed = len;
+	++linkstat_compressed[1];
+	return 1;
+}
+
+/// Starts compressing the large packets sent to this server link.
+/// Only to be used when the other side announced that it accepts compressed packets.
+void socket_compress(int fd)
+{
+	if( session_isValid(fd) && session[fd]->flag.server )
+		session[fd]->compress_size = server_compress_size;
+}
+
+/// Compresses the packet that is about to be added to the write buffer, if it gets smaller.
+/// Returns the new length of the packet.
+static size_t socket_compress_packet(struct socket_data* s, size_t len)
+{
+	uint8* packet = s->wdata + s->wdata_size;
+	uLongf zlen = (uLongf)(len - 7);
+
+	if( len <= 7 || compress2(server_zbuf, &zlen, packet, (uLong)len, Z_BEST_SPEED) != Z_OK )
+		return len; // doesn't get smaller
+
+	WBUFW(packet,0) = SERVERLINK_COMPRESSED;
+	WBUFW(packet,2) = (uint16)(zlen + 6);
+	WBUFW(packet,4) = (uint16)len;
+	memcpy(WBUFP(packet,6), server_zbuf, zlen);
+	++linkstat_compressed[0];
+	return zlen + 6;
+}
+
+/// Shows the inter-server traffic statistics.
+void socket_linkstats_show(void)
+{
+	uint64 count[2] = { 0, 0 }, bytes[2] = { 0, 0 }, wire[2] = { 0, 0 };
+	int i, j;
+
+	if( linkstats == NULL )
+	{
+		ShowInfo("Server links: no traffic yet.\n");
+		return;
+	}
+
+	ShowInfo("Server link traffic over the last %u seconds:\n", DIFF_TICK(gettick(), linkstat_since) / 1000);
+	ShowMessage("  packet    sent    bytes     (wire) |    recv    bytes     (wire)\n");
+	for( i = 0; i < LINKSTAT_LAST - LINKSTAT_FIRST + 2; ++i )
+	{
+		struct s_linkstat* stat = &linkstats[i];
+		char name[8];
+
+		if( stat->count[0] == 0 && stat->count[1] == 0 )
+			continue;
+		for( j = 0; j < 2; ++j )
+		{
+			count[j] += stat->count[j];
+			bytes[j] += stat->bytes[j];
+			wire[j] += stat->wire[j];
+		}
+		if( i <= LINKSTAT_LAST - LINKSTAT_FIRST )
+			sprintf(name, "0x%04x", LINKSTAT_FIRST + i);
+		else
+			strcpy(name, "other");
+		ShowMessage("  %-6s %7u %8"PRIu64" (%8"PRIu64") | %7u %8"PRIu64" (%8"PRIu64")\n", name,
+			stat->count[0], stat->bytes[0], stat->wire[0], stat->count[1], stat->bytes[1], stat->wire[1]);
+	}
+	ShowInfo("Sent %"PRIu64" messages (%u compressed) in %"PRIu64" sends, %"PRIu64" bytes (%"PRIu64" on the wire).\n",
+		count[0], linkstat_compressed[0], linkstat_sends, bytes[0], wire[0]);
+	ShowInfo("Received %"PRIu64" messages (%u compressed), %"PRIu64" bytes (%"PRIu64" on the wire).\n",
+		count[1], linkstat_compressed[1], bytes[1], wire[1]);
+}
+
+/// Resets the inter-server traffic statistics.
+void socket_linkstats_reset(void)
+{
+	if( linkstats != NULL )
+		memset(linkstats, 0, (LINKSTAT_LAST - LINKSTAT_FIRST + 2)*sizeof(struct s_linkstat));
+	linkstat_sends = 0;
+	linkstat_compressed[0] = linkstat_compressed[1] = 0;
+	linkstat_since = gettick();
+}
+
 /// advance the WFIFO cursor (marking 'len' bytes for sending)
 int WFIFOSET(int fd, size_t len)
 {
@@ -669,6 +846,16 @@ int WFIFOSET(int fd, size_t len)
 		return 0;
 	}
 
+	if( s->flag.server )
+	{
+		struct s_linkstat* stat = linkstat_get(WFIFOW(fd,0));
+		++stat->count[0];
+		stat->bytes[0] += len;
+		if( s->compress_size && len >= s->compress_size )
+			len = socket_compress_packet(s, len);
+		stat->wire[0] += len;
+	}
+
 	s->wdata_size += len;
 	//If the interserver has 200% of its normal size full, flush the data.
 	if( s->flag.server && s->wdata_size >= 2*FIFOSIZE_SERVERLINK )
@@ -1086,6 +1273,8 @@ int socket_config_read(const char* cfgName)
 		else if (!strcmpi(w1,"socket_max_client_packet"))
 			socket_max_client_packet = strtoul(w2, NULL, 0);
 #endif
+		else if (!strcmpi(w1, "server_compress_size"))
+			server_compress_size = strtoul(w2, NULL, 0);
 		else if (!strcmpi(w1, "import"))
 			socket_config_read(w2);
 	}
@@ -1120,6 +1309,9 @@ void socket_final(void)
 		if(session[i])
 			do_close(i);
 
+	if( linkstats )
+		aFree(linkstats);
+
 	// session[0] ̃_~[f[^폜
 	aFree(session[0]->rdata);
 	aFree(session[0]->wdata);
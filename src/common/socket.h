@@ -28,6 +28,15 @@
 
 #define FIFOSIZE_SERVERLINK 256*1024
 
+// Server links can carry packets in compressed form (see RFIFOUNCOMPRESS and socket_compress).
+// 0x2b28 <packet len>.W <uncompressed len>.W <zlib data>.?B
+#define SERVERLINK_COMPRESSED 0x2b28
+// Feature bits a map-server announces when logging in to the char-server (0x2af8),
+// and the char-server answers with (0x2b29).
+#define SERVERLINK_FEATURE_COMPRESS 0x1 // accepts compressed packets
+#define SERVERLINK_FEATURE_DELTASAVE 0x2 // accepts character saves that only carry the changes (0x2b2a)
+#define SERVERLINK_FEATURE_MAPLOAD 0x4 // accepts the load of the maps (0x2b2e)
+
 // socket I/O macros
 #define RFIFOHEAD(fd)
 #define WFIFOHEAD(fd, size) do{ if((fd) && session[fd]->wdata_size + (size) > session[fd]->max_wdata ) realloc_writefifo(fd, size); }while(0)
@@ -88,12 +97,16 @@ struct socket_data
 	} flag;
 
 	uint32 client_addr; // remote client address
+	uint16 client_port; // remote port
+	uint16 local_port; // local port of outgoing connections
 
 	uint8 *rdata, *wdata;
 	size_t max_rdata, max_wdata;
 	size_t rdata_size, wdata_size;
 	size_t rdata_pos;
 	time_t rdata_tick; // time of last recv (for detecting timeouts); zero when timeout is disabled
+	size_t rdata_compressed; // wire size of the packet at the head of the read buffer, if it arrived compressed
+	size_t compress_size; // server links: packets of at least this size are sent compressed (0 = never)
 
 	RecvFunc func_recv;
 	SendFunc func_send;
@@ -126,6 +139,10 @@ int realloc_fifo(int fd, unsigned int rfifo_size, unsigned int wfifo_size);
 int realloc_writefifo(int fd, size_t addition);
 int WFIFOSET(int fd, size_t len);
 int RFIFOSKIP(int fd, size_t len);
+int RFIFOUNCOMPRESS(int fd);
+void socket_compress(int fd);
+void socket_linkstats_show(void);
+void socket_linkstats_reset(void);
 
 int do_sockets(int next);
 void do_close(int fd);
@@ -9,6 +9,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SV_SSE2
+#include <emmintrin.h>
+#endif
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 
 
 #define J_MAX_MALLOC_SIZE 65535
@@ -440,6 +449,71 @@ bool bin2hex(char* output, unsigned char* input, size_t count)
 
 
 
+/// If sv_parse_next skips the plain characters of a field in bulk.
+/// Only turned off to compare against the character by character parser.
+static bool sv_bulkscan = true;
+
+#define SV_ONES  UINT64_C(0x0101010101010101)
+#define SV_HIGHS UINT64_C(0x8080808080808080)
+// non-zero if any byte of w is c
+#define SV_HASBYTE(w,c) ( (((w)^(SV_ONES*(uint8)(c))) - SV_ONES) & ~((w)^(SV_ONES*(uint8)(c))) & SV_HIGHS )
+
+/// Returns the position of the first character at or after i that can
+/// end the field or start an escape sequence, or len if there is none.
+/// Lone '\r' characters are also returned when SV_TERMINATE_CRLF is set,
+/// the caller decides what they are.
+static int sv_skip_plain(const char* str, int i, int len, char delim, enum e_svopt opt)
+{
+	// characters that can't be skipped, unused ones are the delimiter again
+	char lf = ( opt&SV_TERMINATE_LF ) ? '\n' : delim;
+	char cr = ( opt&(SV_TERMINATE_CR|SV_TERMINATE_CRLF) ) ? '\r' : delim;
+	char esc = ( opt&SV_ESCAPE_C ) ? '\\' : delim;
+
+#if defined(SV_SSE2)
+	__m128i vdelim = _mm_set1_epi8(delim);
+	__m128i vlf = _mm_set1_epi8(lf);
+	__m128i vcr = _mm_set1_epi8(cr);
+	__m128i vesc = _mm_set1_epi8(esc);
+
+	while( i + 16 <= len )
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(str + i));
+		int mask = _mm_movemask_epi8(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, vdelim), _mm_cmpeq_epi8(v, vlf)),
+			_mm_or_si128(_mm_cmpeq_epi8(v, vcr), _mm_cmpeq_epi8(v, vesc))));
+		if( mask != 0 )
+		{
+			while( !(mask&1) )
+			{
+				mask >>= 1;
+				++i;
+			}
+			return i;
+		}
+		i += 16;
+	}
+#else
+	// 8 characters at a time, the match itself is found below
+	while( i + 8 <= len )
+	{
+		uint64 w;
+		memcpy(&w, str + i, sizeof(w));
+		if( SV_HASBYTE(w,delim) || SV_HASBYTE(w,lf) || SV_HASBYTE(w,cr) || SV_HASBYTE(w,esc) )
+			break;
+		i += 8;
+	}
+#endif
+	while( i < len && str[i] != delim && str[i] != lf && str[i] != cr && str[i] != esc )
+		++i;
+	return i;
+}
+
+#undef SV_ONES
+#undef SV_HIGHS
+#undef SV_HASBYTE
+
+
+
 /////////////////////////////////////////////////////////////////////
 /// Parses a single field in a delim-separated string.
 /// The delimiter after the field is skipped.
@@ -514,6 +588,8 @@ int sv_parse_next(struct s_svstate* sv)
 				state = END_OF_FIELD;
 			else if( IS_C_ESCAPE() )
 				state = PARSING_C_ESCAPE;
+			else if( sv_bulkscan )
+				i = sv_skip_plain(str, i+1, len, delim, opt);// normal characters
 			else
 				++i;// normal character
 			break;
@@ -739,6 +815,102 @@ int sv_split(char* str, int len, int startoff, char delim, char** out_fields, in
 	return ret;
 }
 
+/// Parses random rows with and without the bulk scan and reports any difference
+/// in the field positions, then compares the throughput of both on typical db rows.
+void sv_check(int rounds)
+{
+	static const char* tokens[] = {
+		"a", "bc", "0123456789", "Long_Field_Contents_ABCDEFGHIJKLMNOPQRSTUVWXYZ",
+		",", "\t", "|", " ", "\n", "\r", "\r\n",
+		"\\n", "\\x4F", "\\012", "\\\\", "\\\"",
+	};
+	static const char delims[] = { ',', '\t', '|', ' ' };
+	static const enum e_svopt opts[] = {
+		SV_NOESCAPE_NOTERMINATE, SV_ESCAPE_C, SV_TERMINATE_LF, SV_TERMINATE_CRLF, SV_TERMINATE_CR,
+		(enum e_svopt)(SV_TERMINATE_LF|SV_TERMINATE_CRLF), (enum e_svopt)(SV_ESCAPE_C|SV_TERMINATE_LF|SV_TERMINATE_CRLF),
+	};
+	static const char* rows[] = {
+		"1002,PORING,Poring,Poring,1,50,0,27,20,1,8,1,2,5,6,0,0,0,1,6,5,10,12,1,3,21,131,400,1872,672,480,0,0,0,0,0,0,0,909,7000,1202,100,938,400,512,1000,713,1500,741,5,619,20,0,0,0,0,4659,1\n",
+		"1,Red_Potion,Red Potion,0,50,,70,,,,,0xFFFFFFFF,7,2,,,,,,{ itemheal rand(45,65),0; },{},{}\n",
+		"5,SM_BASH,Bash,Smite_the_target_with_increased_power_and_accuracy_for_a_fixed_amount_of_SP,1,0,0,0,0,0,0,0,0,0,0,0,0\n",
+	};
+	char buf[1024];
+	int pos_bulk[130], pos_char[130];
+	int ret_bulk, ret_char;
+	int round, failures = 0;
+	size_t datalen = 0, rowlen[ARRAYLENGTH(rows)];
+	int i, n, passes;
+	clock_t t;
+	double sec_bulk, sec_char, mb;
+
+	if( rounds <= 0 )
+		rounds = 100000;
+
+	// equivalence
+	for( round = 0; round < rounds; ++round )
+	{
+		char delim = delims[rand()%ARRAYLENGTH(delims)];
+		enum e_svopt opt = opts[rand()%ARRAYLENGTH(opts)];
+		int len = 0;
+
+		n = rand()%40;
+		for( i = 0; i < n; ++i )
+		{
+			const char* token = tokens[rand()%ARRAYLENGTH(tokens)];
+			size_t l = strlen(token);
+			if( len + l >= sizeof(buf) )
+				break;
+			memcpy(buf + len, token, l);
+			len += (int)l;
+		}
+		buf[len] = '\0';
+
+		sv_bulkscan = true;
+		ret_bulk = sv_parse(buf, len, 0, delim, pos_bulk, ARRAYLENGTH(pos_bulk), opt);
+		sv_bulkscan = false;
+		ret_char = sv_parse(buf, len, 0, delim, pos_char, ARRAYLENGTH(pos_char), opt);
+		// only the first ret*2+2 positions are written
+		if( ret_bulk != ret_char || memcmp(pos_bulk, pos_char, min(ret_bulk*2+2, ARRAYLENGTH(pos_bulk))*sizeof(pos_bulk[0])) != 0 )
+		{
+			if( ++failures <= 5 )
+				ShowError("sv_check: mismatch (delim 0x%02x, opt %d, %d vs %d fields) for \"%s\"\n", (uint8)delim, opt, ret_bulk, ret_char, buf);
+		}
+	}
+	sv_bulkscan = true;
+	if( failures )
+		ShowError("sv_check: %d of %d random rows parsed differently.\n", failures, rounds);
+	else
+		ShowInfo("sv_check: %d random rows parsed identically.\n", rounds);
+
+	// throughput
+	for( i = 0; i < ARRAYLENGTH(rows); ++i )
+		datalen += rowlen[i] = strlen(rows[i]);
+	sec_bulk = sec_char = 0;
+	passes = 0;
+	t = clock();
+	do
+	{
+		for( n = 0; n < 1000; ++n )
+			for( i = 0; i < ARRAYLENGTH(rows); ++i )
+				sv_parse(rows[i], (int)rowlen[i], 0, ',', pos_bulk, ARRAYLENGTH(pos_bulk), (enum e_svopt)(SV_TERMINATE_LF|SV_TERMINATE_CRLF));
+		++passes;
+	} while( clock() - t < CLOCKS_PER_SEC/2 );
+	sec_bulk = (double)(clock() - t)/CLOCKS_PER_SEC;
+
+	sv_bulkscan = false;
+	t = clock();
+	for( round = 0; round < passes; ++round )
+		for( n = 0; n < 1000; ++n )
+			for( i = 0; i < ARRAYLENGTH(rows); ++i )
+				sv_parse(rows[i], (int)rowlen[i], 0, ',', pos_char, ARRAYLENGTH(pos_char), (enum e_svopt)(SV_TERMINATE_LF|SV_TERMINATE_CRLF));
+	sec_char = (double)(clock() - t)/CLOCKS_PER_SEC;
+	sv_bulkscan = true;
+
+	mb = (double)datalen*passes*1000/1048576;
+	ShowInfo("sv_check: parsed %.1f MB, bulk scan %.0f MB/s, per character %.0f MB/s.\n",
+		mb, sec_bulk > 0 ? mb/sec_bulk : 0., sec_char > 0 ? mb/sec_char : 0.);
+}
+
 /// Escapes src to out_dest according to the format of the C compiler.
 /// Returns the length of the escaped string.
 /// out_dest should be len*4+1 in size.
@@ -947,6 +1119,220 @@ const char* skip_escaped_c(const char* p)
 }
 
 
+/// Binary images of the sv databases, see sv_readdb.
+bool sv_db_image = false;
+
+#define SV_IMAGE_VERSION 1
+#define SV_IMAGE_MAXCOLS 512
+
+// header of a binary image, followed by the rows
+// each row is: int32 line number, int32 number of columns (can be negative),
+// followed by the columns (at most SV_IMAGE_MAXCOLS) as '\0' terminated strings
+struct sv_image_header {
+	char magic[8]; // "EASVIMG"
+	uint32 version; // SV_IMAGE_VERSION
+	uint32 size; // size of the source file
+	uint32 mtime; // modification time of the source file
+	uint32 delim; // delimiter used to split the rows
+	uint32 rows; // number of rows
+	uint32 length; // length of the rows data
+	uint32 checksum; // FNV-1a hash of the rows data
+};
+
+// growing buffer for the rows of a new image
+struct sv_image_buf {
+	uint8* data;
+	size_t len;
+	size_t max;
+};
+
+static void sv_image_append(struct sv_image_buf* buf, const void* data, size_t len)
+{
+	if( buf->len + len > buf->max )
+	{
+		buf->max = max(buf->max*2, buf->len + len + 4096);
+		RECREATE(buf->data, uint8, buf->max);
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+static uint32 sv_image_checksum(const uint8* data, size_t len)
+{
+	uint32 hash = 2166136261U;
+	size_t i;
+
+	for( i = 0; i < len; ++i )
+		hash = (hash ^ data[i]) * 16777619U;
+	return hash;
+}
+
+/// Checks that the rows of an image fit in its data, every column being '\0' terminated.
+static bool sv_image_check(const uint8* data, uint32 length, uint32 rows)
+{
+	const uint8* p = data;
+	const uint8* end = data + length;
+	uint32 i;
+	int32 j, columns;
+
+	for( i = 0; i < rows; ++i )
+	{
+		const uint8* nul;
+
+		if( end - p < 2*(int)sizeof(int32) )
+			return false;
+		memcpy(&columns, p + sizeof(int32), sizeof(columns));
+		p += 2*sizeof(int32);
+		for( j = 0; j < columns && j < SV_IMAGE_MAXCOLS; ++j )
+		{
+			if( (nul = (const uint8*)memchr(p, '\0', end - p)) == NULL )
+				return false;
+			p = nul + 1;
+		}
+	}
+	return ( p == end );
+}
+
+/// Maps the image of the source file if it is valid, returns NULL otherwise.
+static uint8* sv_image_map(const char* path, const struct stat* st, char delim, size_t* out_len)
+{
+	struct sv_image_header header;
+	struct stat imgst;
+	char imgpath[1024+4];
+	uint8* data;
+	size_t len;
+	FILE* fp;
+
+	snprintf(imgpath, sizeof(imgpath), "%s.img", path);
+	fp = fopen(imgpath, "rb");
+	if( fp == NULL )
+		return NULL;
+	if( fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, "EASVIMG", 8) != 0 || header.version != SV_IMAGE_VERSION ||
+		header.size != (uint32)st->st_size || header.mtime != (uint32)st->st_mtime || header.delim != (uint32)(uint8)delim )
+	{// outdated
+		fclose(fp);
+		return NULL;
+	}
+	len = sizeof(header) + header.length;
+	if( fstat(fileno(fp), &imgst) != 0 || (uint64)imgst.st_size != (uint64)len )
+	{// truncated (or grown) behind the header, mapping it would fault
+		ShowWarning("sv_readdb: Ignoring truncated image \"%s\".\n", imgpath);
+		fclose(fp);
+		return NULL;
+	}
+#ifdef WIN32
+	data = (uint8*)aMalloc(len);
+	fseek(fp, 0, SEEK_SET);
+	if( fread(data, 1, len, fp) != len )
+	{
+		aFree(data);
+		fclose(fp);
+		return NULL;
+	}
+#else
+	data = (uint8*)mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+	if( data == (uint8*)MAP_FAILED )
+	{
+		fclose(fp);
+		return NULL;
+	}
+#endif
+	fclose(fp);
+	if( sv_image_checksum(data + sizeof(header), header.length) != header.checksum || !sv_image_check(data + sizeof(header), header.length, header.rows) )
+	{
+		ShowWarning("sv_readdb: Ignoring corrupted image \"%s\".\n", imgpath);
+#ifdef WIN32
+		aFree(data);
+#else
+		munmap(data, len);
+#endif
+		return NULL;
+	}
+	*out_len = len;
+	return data;
+}
+
+static void sv_image_unmap(uint8* data, size_t len)
+{
+#ifdef WIN32
+	aFree(data);
+#else
+	munmap(data, len);
+#endif
+}
+
+/// Writes the image of the source file.
+/// The image is written to a temporary file and renamed, so a server killed while writing leaves no partial image.
+static void sv_image_write(const char* path, const struct stat* st, char delim, int rows, struct sv_image_buf* buf)
+{
+	struct sv_image_header header;
+	char imgpath[1024+4];
+	char tmppath[1024+8];
+	FILE* fp;
+
+	snprintf(imgpath, sizeof(imgpath), "%s.img", path);
+	snprintf(tmppath, sizeof(tmppath), "%s.img.tmp", path);
+	fp = fopen(tmppath, "wb");
+	if( fp == NULL )
+		return;// read-only, use the text file
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "EASVIMG", 8);
+	header.version = SV_IMAGE_VERSION;
+	header.size = (uint32)st->st_size;
+	header.mtime = (uint32)st->st_mtime;
+	header.delim = (uint32)(uint8)delim;
+	header.rows = rows;
+	header.length = (uint32)buf->len;
+	header.checksum = sv_image_checksum(buf->data, buf->len);
+	if( fwrite(&header, sizeof(header), 1, fp) != 1 || fwrite(buf->data, 1, buf->len, fp) != buf->len )
+	{
+		fclose(fp);
+		remove(tmppath);
+		return;
+	}
+	if( fclose(fp) != 0 )
+	{
+		remove(tmppath);
+		return;
+	}
+#ifdef WIN32
+	remove(imgpath);// rename doesn't replace files on windows
+#endif
+	if( rename(tmppath, imgpath) != 0 )
+		remove(tmppath);
+}
+
+/// Checks a row and feeds it to parseproc. Returns false if the maximum number of rows was reached.
+static bool sv_readdb_row(const char* path, int line, char** fields, int columns, int mincols, int maxcols, int maxrows, int* entries, bool (*parseproc)(char* fields[], int columns, int current))
+{
+	if( columns < mincols )
+	{
+		ShowError("sv_readdb: Insufficient columns in line %d of \"%s\" (found %d, need at least %d).\n", line, path, columns, mincols);
+		return true; // not enough columns
+	}
+	if( columns > maxcols )
+	{
+		ShowError("sv_readdb: Too many columns in line %d of \"%s\" (found %d, maximum is %d).\n", line, path, columns, maxcols );
+		return true; // too many columns
+	}
+	if( *entries == maxrows )
+	{
+		ShowError("sv_readdb: Reached the maximum allowed number of entries (%d) when parsing file \"%s\".\n", maxrows, path);
+		return false;
+	}
+
+	// parse this row
+	if( !parseproc(fields+1, columns, *entries) )
+	{
+		ShowError("sv_readdb: Could not process contents of line %d of \"%s\".\n", line, path);
+		return true; // invalid row contents
+	}
+
+	// success!
+	(*entries)++;
+	return true;
+}
+
 /// Opens and parses a file containing delim-separated columns, feeding them to the specified callback function row by row.
 /// Tracks the progress of the operation (current line number, number of successfully processed rows).
 /// Returns 'true' if it was able to process the specified file, or 'false' if it could not be read.
@@ -967,19 +1353,65 @@ bool sv_readdb(const char* directory, const char* filename, char delim, int minc
 	int columns, fields_length;
 	char path[1024], line[1024];
 	char* match;
+	struct stat st;
+	struct sv_image_buf image_buf;
+	struct sv_image_buf* image = NULL;
+	int rows = 0;
 
 	snprintf(path, sizeof(path), "%s/%s", directory, filename);
 
+	// allocate enough memory for the maximum requested amount of columns plus the reserved one
+	// (when making an image, all the columns are kept)
+	fields_length = ( sv_db_image ? max(maxcols, SV_IMAGE_MAXCOLS) : maxcols ) + 1;
+
+	if( sv_db_image && stat(path, &st) == 0 )
+	{
+		size_t len;
+		uint8* data = sv_image_map(path, &st, delim, &len);
+
+		if( data != NULL )
+		{// rows are already split
+			const struct sv_image_header* header = (const struct sv_image_header*)data;
+			char* p = (char*)data + sizeof(struct sv_image_header);
+			char* end = p + header->length;
+			uint32 i;
+			int j;
+
+			fields = (char**)aMalloc(fields_length*sizeof(char*));
+			fields[0] = NULL;
+			for( i = 0; i < header->rows && p + 2*sizeof(int32) <= end; ++i )
+			{
+				int32 n;
+				memcpy(&n, p, sizeof(n)); lines = n; p += sizeof(n);
+				memcpy(&n, p, sizeof(n)); columns = n; p += sizeof(n);
+				for( j = 0; j < columns && j < SV_IMAGE_MAXCOLS; ++j )
+				{// checked by sv_image_check, each column ends before the end of the data
+					if( j+1 < fields_length )
+						fields[j+1] = p;
+					p += strlen(p) + 1;
+				}
+				if( !sv_readdb_row(path, lines, fields, columns, mincols, maxcols, maxrows, &entries, parseproc) )
+					break;
+			}
+			aFree(fields);
+			sv_image_unmap(data, len);
+			ShowStatus("Done reading '"CL_WHITE"%d"CL_RESET"' entries in '"CL_WHITE"%s"CL_RESET"' (image).\n", entries, path);
+			return true;
+		}
+		memset(&image_buf, 0, sizeof(image_buf));
+		image = &image_buf;
+	}
+
 	// open file
 	fp = fopen(path, "r");
 	if( fp == NULL )
 	{
 		ShowError("sv_readdb: can't read %s\n", path);
+		if( image != NULL )
+			aFree(image->data);
 		return false;
 	}
 
-	// allocate enough memory for the maximum requested amount of columns plus the reserved one
-	fields_length = maxcols+1;
 	fields = (char**)aMalloc(fields_length*sizeof(char*));
 
 	// process rows one by one
@@ -998,35 +1430,28 @@ bool sv_readdb(const char* directory, const char* filename, char delim, int minc
 
 		columns = sv_split(line, strlen(line), 0, delim, fields, fields_length, (e_svopt)(SV_TERMINATE_LF|SV_TERMINATE_CRLF));
 
-		if( columns < mincols )
-		{
-			ShowError("sv_readdb: Insufficient columns in line %d of \"%s\" (found %d, need at least %d).\n", lines, path, columns, mincols);
-			continue; // not enough columns
-		}
-		if( columns > maxcols )
-		{
-			ShowError("sv_readdb: Too many columns in line %d of \"%s\" (found %d, maximum is %d).\n", lines, path, columns, maxcols );
-			continue; // too many columns
-		}
-		if( entries == maxrows )
-		{
-			ShowError("sv_readdb: Reached the maximum allowed number of entries (%d) when parsing file \"%s\".\n", maxrows, path);
-			break;
-		}
-
-		// parse this row
-		if( !parseproc(fields+1, columns, entries) )
-		{
-			ShowError("sv_readdb: Could not process contents of line %d of \"%s\".\n", lines, path);
-			continue; // invalid row contents
+		if( image != NULL )
+		{// keep the split row, before parseproc can change it
+			int32 n;
+			int i;
+			n = lines;   sv_image_append(image, &n, sizeof(n));
+			n = columns; sv_image_append(image, &n, sizeof(n));
+			for( i = 1; i <= columns && i <= SV_IMAGE_MAXCOLS && i < fields_length; ++i )
+				sv_image_append(image, fields[i], strlen(fields[i]) + 1);
+			++rows;
 		}
 
-		// success!
-		entries++;
+		if( !sv_readdb_row(path, lines, fields, columns, mincols, maxcols, maxrows, &entries, parseproc) )
+			break;
 	}
 
 	aFree(fields);
 	fclose(fp);
+	if( image != NULL )
+	{
+		sv_image_write(path, &st, delim, rows, image);
+		aFree(image->data);
+	}
 	ShowStatus("Done reading '"CL_WHITE"%d"CL_RESET"' entries in '"CL_WHITE"%s"CL_RESET"'.\n", entries, path);
 
 	return true;
@@ -112,6 +112,10 @@ int sv_parse(const char* str, int len, int startoff, char delim, int* out_pos, i
 /// Returns the number of fields found or -1 if an error occurs.
 int sv_split(char* str, int len, int startoff, char delim, char** out_fields, int nfields, enum e_svopt opt);
 
+/// Checks that sv_parse finds the same fields with and without the bulk scan
+/// on random rows and reports the throughput of both.
+void sv_check(int rounds);
+
 /// Escapes src to out_dest according to the format of the C compiler.
 /// Returns the length of the escaped string.
 /// out_dest should be len*4+1 in size.
@@ -125,6 +129,10 @@ size_t sv_unescape_c(char* out_dest, const char* src, size_t len);
 /// Skips a C escape sequence (starting with '\\').
 const char* skip_escaped_c(const char* p);
 
+/// When set, sv_readdb keeps a binary image of each file next to it ("<file>.img")
+/// and loads the already split rows from it while the text file is unchanged.
+extern bool sv_db_image;
+
 /// Opens and parses a file containing delim-separated columns, feeding them to the specified callback function row by row.
 /// Tracks the progress of the operation (current line number, number of successfully processed rows).
 /// Returns 'true' if it was able to process the specified file, or 'false' if it could not be read.
@@ -0,0 +1,230 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#include "../common/cbasetypes.h"
+#include "../common/showmsg.h"
+#include "thread.h"
+
+#include <stdlib.h>
+
+#ifdef WIN32
+	#if !defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0600
+		#undef _WIN32_WINNT
+		#define _WIN32_WINNT 0x0600 // condition variables
+	#endif
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <pthread.h>
+#endif
+
+
+struct amutex {
+#ifdef WIN32
+	CRITICAL_SECTION cs;
+#else
+	pthread_mutex_t mutex;
+#endif
+};
+
+struct acond {
+#ifdef WIN32
+	CONDITION_VARIABLE cond;
+#else
+	pthread_cond_t cond;
+#endif
+};
+
+struct athread {
+	void (*func)(void* arg);
+	void* arg;
+#ifdef WIN32
+	HANDLE handle;
+#else
+	pthread_t thread;
+#endif
+};
+
+
+/// Creates a mutex.
+/// Exits the program if it fails, like the memory manager does.
+amutex* amutex_create(void)
+{
+	amutex* mutex = (amutex*)malloc(sizeof(amutex));
+
+	if( mutex == NULL )
+	{
+		ShowFatalError("amutex_create: out of memory!\n");
+		exit(EXIT_FAILURE);
+	}
+#ifdef WIN32
+	InitializeCriticalSection(&mutex->cs);
+#else
+	pthread_mutex_init(&mutex->mutex, NULL);
+#endif
+	return mutex;
+}
+
+
+/// Destroys a mutex. The mutex must be unlocked.
+void amutex_destroy(amutex* mutex)
+{
+	if( mutex == NULL )
+		return;
+#ifdef WIN32
+	DeleteCriticalSection(&mutex->cs);
+#else
+	pthread_mutex_destroy(&mutex->mutex);
+#endif
+	free(mutex);
+}
+
+
+/// Locks a mutex, waiting until it's available.
+void amutex_lock(amutex* mutex)
+{
+#ifdef WIN32
+	EnterCriticalSection(&mutex->cs);
+#else
+	pthread_mutex_lock(&mutex->mutex);
+#endif
+}
+
+
+/// Unlocks a mutex.
+void amutex_unlock(amutex* mutex)
+{
+#ifdef WIN32
+	LeaveCriticalSection(&mutex->cs);
+#else
+	pthread_mutex_unlock(&mutex->mutex);
+#endif
+}
+
+
+/// Creates a condition variable.
+/// Exits the program if it fails.
+acond* acond_create(void)
+{
+	acond* cond = (acond*)malloc(sizeof(acond));
+
+	if( cond == NULL )
+	{
+		ShowFatalError("acond_create: out of memory!\n");
+		exit(EXIT_FAILURE);
+	}
+#ifdef WIN32
+	InitializeConditionVariable(&cond->cond);
+#else
+	pthread_cond_init(&cond->cond, NULL);
+#endif
+	return cond;
+}
+
+
+/// Destroys a condition variable. No thread may be waiting on it.
+void acond_destroy(acond* cond)
+{
+	if( cond == NULL )
+		return;
+#ifndef WIN32
+	pthread_cond_destroy(&cond->cond);
+#endif
+	free(cond);
+}
+
+
+/// Unlocks the mutex and waits until the condition is signaled.
+/// The mutex is locked again before returning.
+/// Spurious wakeups are possible, so the condition must be checked in a loop.
+void acond_wait(acond* cond, amutex* mutex)
+{
+#ifdef WIN32
+	SleepConditionVariableCS(&cond->cond, &mutex->cs, INFINITE);
+#else
+	pthread_cond_wait(&cond->cond, &mutex->mutex);
+#endif
+}
+
+
+/// Wakes up all the threads waiting on the condition.
+void acond_broadcast(acond* cond)
+{
+#ifdef WIN32
+	WakeAllConditionVariable(&cond->cond);
+#else
+	pthread_cond_broadcast(&cond->cond);
+#endif
+}
+
+
+/// Called by each thread before it exits (see athread_set_exit_hook).
+static void (*athread_exit_hook)(void) = NULL;
+
+
+#ifdef WIN32
+static DWORD WINAPI athread_main(LPVOID param)
+{
+	athread* thread = (athread*)param;
+	thread->func(thread->arg);
+	if( athread_exit_hook )
+		athread_exit_hook();
+	return 0;
+}
+#else
+static void* athread_main(void* param)
+{
+	athread* thread = (athread*)param;
+	thread->func(thread->arg);
+	if( athread_exit_hook )
+		athread_exit_hook();
+	return NULL;
+}
+#endif
+
+
+/// Starts a thread that runs func(arg).
+/// Returns NULL if the thread can't be created.
+athread* athread_create(void (*func)(void* arg), void* arg)
+{
+	athread* thread = (athread*)malloc(sizeof(athread));
+
+	if( thread == NULL )
+		return NULL;
+	thread->func = func;
+	thread->arg = arg;
+#ifdef WIN32
+	thread->handle = CreateThread(NULL, 0, athread_main, thread, 0, NULL);
+	if( thread->handle == NULL )
+#else
+	if( pthread_create(&thread->thread, NULL, athread_main, thread) != 0 )
+#endif
+	{
+		free(thread);
+		return NULL;
+	}
+	return thread;
+}
+
+
+/// Waits until the thread finishes and releases it.
+void athread_join(athread* thread)
+{
+	if( thread == NULL )
+		return;
+#ifdef WIN32
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->thread, NULL);
+#endif
+	free(thread);
+}
+
+
+/// Sets the function the threads call before they exit.
+/// Used by the memory manager to release the memory of the thread.
+void athread_set_exit_hook(void (*hook)(void))
+{
+	athread_exit_hook = hook;
+}
@@ -0,0 +1,42 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+#include "../common/cbasetypes.h"
+
+/// Storage class of variables that have a separate instance in each thread.
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+/// Mutual exclusion lock.
+/// Uses the system allocator, so it can be used by the memory manager.
+typedef struct amutex amutex;
+
+amutex* amutex_create(void);
+void amutex_destroy(amutex* mutex);
+void amutex_lock(amutex* mutex);
+void amutex_unlock(amutex* mutex);
+
+/// Condition variable, used with an amutex.
+typedef struct acond acond;
+
+acond* acond_create(void);
+void acond_destroy(acond* cond);
+void acond_wait(acond* cond, amutex* mutex);
+void acond_broadcast(acond* cond);
+
+/// Thread of execution.
+/// Threads must not use the memory manager unless it's MEMMGR_SLAB,
+/// nor the console output functions.
+typedef struct athread athread;
+
+athread* athread_create(void (*func)(void* arg), void* arg);
+void athread_join(athread* thread);
+void athread_set_exit_hook(void (*hook)(void));
+
+#endif /* _THREAD_H_ */
@@ -35,6 +35,7 @@ struct TimerData {
 
 unsigned int gettick(void);
 unsigned int gettick_nocache(void);
+int64 gettick_usec(void);
 
 int add_timer(unsigned int tick, TimerFunc func, int id, intptr_t data);
 int add_timer_interval(unsigned int tick, TimerFunc func, int id, intptr_t data, int interval);
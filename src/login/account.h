@@ -93,6 +93,8 @@ struct AccountDB
 	/// "engine.name" -> "txt", "sql", ...
 	/// "engine.version" -> internal version
 	/// "engine.comment" -> anything (suggestion: description or specs of the engine)
+	/// These read-only properties are optional:
+	/// "engine.stats" -> runtime statistics of the engine (cache hit rate, ...)
 	///
 	/// @param self Database
 	/// @param key Property name
@@ -1,6 +1,7 @@
 // Copyright (c) Athena Dev Teams - Licensed under GNU GPL
 // For more information, see LICENCE in the main folder
 
+#include "../common/db.h"
 #include "../common/malloc.h"
 #include "../common/mmo.h"
 #include "../common/showmsg.h"
@@ -10,9 +11,21 @@
 #include "account.h"
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 /// global defines
 #define ACCOUNT_SQL_DB_VERSION 20110114
+#define ACCOUNT_CACHE_FLUSH_BATCH 100 // accounts updated by one query when writing the login bookkeeping
+
+/// cached account
+struct account_cache_entry
+{
+	struct mmo_account acc;
+	time_t loaded;                    // when the account was read from the database
+	bool dirty;                       // login bookkeeping not written to the database yet
+	struct account_cache_entry* prev; // more recently used
+	struct account_cache_entry* next; // less recently used
+};
 
 /// internal structure
 typedef struct AccountDB_SQL
@@ -40,6 +53,28 @@ typedef struct AccountDB_SQL
 	char account_db[32];
 	char accreg_db[32];
 
+	// account cache
+	// Keeps the most recently used accounts, so logins don't have to read
+	// them from the database every time. Saves that only change the login
+	// bookkeeping (logincount, lastlogin, last_ip) are kept in the cache
+	// and written in batches every flush_interval ms.
+	DBMap* cache;        // int account_id -> struct account_cache_entry*
+	DBMap* cache_userid; // userid -> struct account_cache_entry*
+	struct account_cache_entry* lru_first;
+	struct account_cache_entry* lru_last;
+	int cache_count;
+	int dirty_count;
+	int flush_tid;
+	int cache_size;      // maximum number of cached accounts (0 = no cache)
+	int cache_ttl;       // how long (in seconds) a cached account is used before reading it again (0 = forever)
+	int flush_interval;  // interval (in ms) to write the login bookkeeping (0 = write immediately)
+	// cache statistics
+	unsigned int cache_hits;
+	unsigned int cache_misses;
+	unsigned int cache_evictions;
+	unsigned int flushed_saves;
+	unsigned int flushes;
+
 } AccountDB_SQL;
 
 /// internal structure
@@ -68,6 +103,12 @@ static bool account_db_sql_iter_next(AccountDBIterator* self, struct mmo_account
 static bool mmo_auth_fromsql(AccountDB_SQL* db, struct mmo_account* acc, int account_id);
 static bool mmo_auth_tosql(AccountDB_SQL* db, const struct mmo_account* acc, bool is_new);
 
+static struct account_cache_entry* account_cache_find(AccountDB_SQL* db, int account_id);
+static void account_cache_put(AccountDB_SQL* db, const struct mmo_account* acc);
+static void account_cache_remove(AccountDB_SQL* db, struct account_cache_entry* entry);
+static bool account_cache_flush(AccountDB_SQL* db);
+static int account_cache_flush_timer(int tid, unsigned int tick, int id, intptr_t data);
+
 /// public constructor
 AccountDB* account_db_sql(void)
 {
@@ -105,6 +146,13 @@ AccountDB* account_db_sql(void)
 	db->case_sensitive = false;
 	safestrncpy(db->account_db, "login", sizeof(db->account_db));
 	safestrncpy(db->accreg_db, "global_reg_value", sizeof(db->accreg_db));
+	// account cache
+	db->cache = NULL;
+	db->cache_userid = NULL;
+	db->flush_tid = INVALID_TIMER;
+	db->cache_size = 1000;
+	db->cache_ttl = 120;
+	db->flush_interval = 1000;
 
 	return &db->vtable;
 }
@@ -161,6 +209,17 @@ static bool account_db_sql_init(AccountDB* self)
 	ShowStatus("Connected to main database '%s'.\n", database);
 	Sql_PrintExtendedInfo(sql_handle);
 
+	if( db->cache_size > 0 )
+	{
+		db->cache = idb_alloc(DB_OPT_RELEASE_DATA);
+		db->cache_userid = ( db->case_sensitive ? strdb_alloc(DB_OPT_BASE, NAME_LENGTH) : stridb_alloc(DB_OPT_BASE, NAME_LENGTH) );
+		if( db->flush_interval > 0 )
+		{
+			add_timer_func_list(account_cache_flush_timer, "account_cache_flush_timer");
+			db->flush_tid = add_timer_interval(gettick() + db->flush_interval, account_cache_flush_timer, 0, (intptr_t)db, db->flush_interval);
+		}
+	}
+
 	return true;
 }	
 
@@ -169,6 +228,20 @@ static void account_db_sql_destroy(AccountDB* self)
 {
 	AccountDB_SQL* db = (AccountDB_SQL*)self;
 
+	if( db->flush_tid != INVALID_TIMER )
+	{
+		delete_timer(db->flush_tid, account_cache_flush_timer);
+		db->flush_tid = INVALID_TIMER;
+	}
+	if( db->cache != NULL )
+	{
+		account_cache_flush(db);
+		db->cache_userid->destroy(db->cache_userid, NULL);
+		db->cache->destroy(db->cache, NULL);
+		db->cache_userid = NULL;
+		db->cache = NULL;
+	}
+
 	Sql_Free(db->accounts);
 	db->accounts = NULL;
 	aFree(db);
@@ -192,6 +265,16 @@ static bool account_db_sql_get_property(AccountDB* self, const char* key, char*
 		else
 		if( strcmpi(key, "comment") == 0 )
 			safesnprintf(buf, buflen, "SQL Account Database");
+		else
+		if( strcmpi(key, "stats") == 0 )
+		{
+			unsigned int lookups = db->cache_hits + db->cache_misses;
+			if( db->cache == NULL )
+				return false;// no cache, nothing to report
+			safesnprintf(buf, buflen, "%d/%d accounts cached, %.1f%% hits (%u hits, %u misses, %u evictions), %d pending saves, %u saves written in %u flushes",
+				db->cache_count, db->cache_size, ( lookups ? 100.*db->cache_hits/lookups : 0. ), db->cache_hits, db->cache_misses, db->cache_evictions,
+				db->dirty_count, db->flushed_saves, db->flushes);
+		}
 		else
 			return false;// not found
 		return true;
@@ -253,6 +336,15 @@ static bool account_db_sql_get_property(AccountDB* self, const char* key, char*
 		else
 		if( strcmpi(key, "accreg_db") == 0 )
 			safesnprintf(buf, buflen, "%s", db->accreg_db);
+		else
+		if( strcmpi(key, "cache_size") == 0 )
+			safesnprintf(buf, buflen, "%d", db->cache_size);
+		else
+		if( strcmpi(key, "cache_ttl") == 0 )
+			safesnprintf(buf, buflen, "%d", db->cache_ttl);
+		else
+		if( strcmpi(key, "flush_interval") == 0 )
+			safesnprintf(buf, buflen, "%d", db->flush_interval);
 		else
 			return false;// not found
 		return true;
@@ -324,6 +416,15 @@ static bool account_db_sql_set_property(AccountDB* self, const char* key, const
 		else
 		if( strcmpi(key, "accreg_db") == 0 )
 			safestrncpy(db->accreg_db, value, sizeof(db->accreg_db));
+		else
+		if( strcmpi(key, "cache_size") == 0 )
+			db->cache_size = max(atoi(value), 0);
+		else
+		if( strcmpi(key, "cache_ttl") == 0 )
+			db->cache_ttl = max(atoi(value), 0);
+		else
+		if( strcmpi(key, "flush_interval") == 0 )
+			db->flush_interval = max(atoi(value), 0);
 		else
 			return false;// not found
 		return true;
@@ -392,6 +493,13 @@ static bool account_db_sql_remove(AccountDB* self, const int account_id)
 	Sql* sql_handle = db->accounts;
 	bool result = false;
 
+	if( db->cache != NULL )
+	{
+		struct account_cache_entry* entry = (struct account_cache_entry*)idb_get(db->cache, account_id);
+		if( entry != NULL )
+			account_cache_remove(db, entry);
+	}
+
 	if( SQL_SUCCESS != Sql_QueryStr(sql_handle, "START TRANSACTION")
 	||  SQL_SUCCESS != Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `account_id` = %d", db->account_db, account_id)
 	||  SQL_SUCCESS != Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `account_id` = %d", db->accreg_db, account_id) )
@@ -408,14 +516,65 @@ static bool account_db_sql_remove(AccountDB* self, const int account_id)
 static bool account_db_sql_save(AccountDB* self, const struct mmo_account* acc)
 {
 	AccountDB_SQL* db = (AccountDB_SQL*)self;
-	return mmo_auth_tosql(db, acc, false);
+	struct account_cache_entry* entry = account_cache_find(db, acc->account_id);
+
+	if( entry != NULL && db->flush_interval > 0 )
+	{// only the login bookkeeping changed? write it later
+		struct mmo_account tmp;
+		memcpy(&tmp, &entry->acc, sizeof(tmp));
+		tmp.logincount = acc->logincount;
+		memcpy(tmp.lastlogin, acc->lastlogin, sizeof(tmp.lastlogin));
+		memcpy(tmp.last_ip, acc->last_ip, sizeof(tmp.last_ip));
+		if( memcmp(&tmp, acc, sizeof(tmp)) == 0 )
+		{
+			memcpy(&entry->acc, acc, sizeof(entry->acc));
+			if( !entry->dirty )
+			{
+				entry->dirty = true;
+				++db->dirty_count;
+			}
+			return true;
+		}
+	}
+
+	if( !mmo_auth_tosql(db, acc, false) )
+	{
+		if( entry != NULL )
+			account_cache_remove(db, entry);// read it again next time
+		return false;
+	}
+
+	if( entry != NULL )
+	{// the whole account was written, including the pending bookkeeping
+		if( entry->dirty )
+		{
+			entry->dirty = false;
+			--db->dirty_count;
+		}
+		account_cache_put(db, acc);
+	}
+	return true;
 }
 
 /// retrieve data from db and store it in the provided data structure
 static bool account_db_sql_load_num(AccountDB* self, struct mmo_account* acc, const int account_id)
 {
 	AccountDB_SQL* db = (AccountDB_SQL*)self;
-	return mmo_auth_fromsql(db, acc, account_id);
+	struct account_cache_entry* entry = account_cache_find(db, account_id);
+
+	if( entry != NULL )
+	{
+		++db->cache_hits;
+		memcpy(acc, &entry->acc, sizeof(struct mmo_account));
+		return true;
+	}
+
+	if( db->cache != NULL )
+		++db->cache_misses;
+	if( !mmo_auth_fromsql(db, acc, account_id) )
+		return false;
+	account_cache_put(db, acc);
+	return true;
 }
 
 /// retrieve data from db and store it in the provided data structure
@@ -427,6 +586,17 @@ static bool account_db_sql_load_str(AccountDB* self, struct mmo_account* acc, co
 	int account_id;
 	char* data;
 
+	if( db->cache_userid != NULL )
+	{
+		struct account_cache_entry* entry = (struct account_cache_entry*)strdb_get(db->cache_userid, userid);
+		if( entry != NULL && (entry = account_cache_find(db, entry->acc.account_id)) != NULL )
+		{
+			++db->cache_hits;
+			memcpy(acc, &entry->acc, sizeof(struct mmo_account));
+			return true;
+		}
+	}
+
 	Sql_EscapeString(sql_handle, esc_userid, userid);
 
 	// get the list of account IDs for this user ID
@@ -463,6 +633,10 @@ static AccountDBIterator* account_db_sql_iterator(AccountDB* self)
 	AccountDB_SQL* db = (AccountDB_SQL*)self;
 	AccountDBIterator_SQL* iter = (AccountDBIterator_SQL*)aCalloc(1, sizeof(AccountDBIterator_SQL));
 
+	// the iterator reads the database, write the pending login bookkeeping first
+	if( db->cache != NULL )
+		account_cache_flush(db);
+
 	// set up the vtable
 	iter->vtable.destroy = &account_db_sql_iter_destroy;
 	iter->vtable.next    = &account_db_sql_iter_next;
@@ -681,3 +855,206 @@ static bool mmo_auth_tosql(AccountDB_SQL* db, const struct mmo_account* acc, boo
 
 	return result;
 }
+
+
+/// Returns the cached account, or NULL if it isn't cached.
+/// Accounts cached for longer than cache_ttl are dropped (after writing
+/// their login bookkeeping) so changes done directly in the database are seen.
+static struct account_cache_entry* account_cache_find(AccountDB_SQL* db, int account_id)
+{
+	struct account_cache_entry* entry;
+
+	if( db->cache == NULL )
+		return NULL;
+
+	entry = (struct account_cache_entry*)idb_get(db->cache, account_id);
+	if( entry == NULL )
+		return NULL;
+
+	if( db->cache_ttl > 0 && time(NULL) - entry->loaded >= db->cache_ttl )
+	{
+		if( entry->dirty )
+			account_cache_flush(db);
+		account_cache_remove(db, entry);
+		return NULL;
+	}
+
+	if( entry != db->lru_first )
+	{// move to the front of the lru list
+		entry->prev->next = entry->next;
+		if( entry->next != NULL )
+			entry->next->prev = entry->prev;
+		else
+			db->lru_last = entry->prev;
+		entry->prev = NULL;
+		entry->next = db->lru_first;
+		db->lru_first->prev = entry;
+		db->lru_first = entry;
+	}
+
+	return entry;
+}
+
+
+/// Puts a copy of the account in the cache, making room for it if needed.
+static void account_cache_put(AccountDB_SQL* db, const struct mmo_account* acc)
+{
+	struct account_cache_entry* entry;
+
+	if( db->cache == NULL )
+		return;
+
+	entry = (struct account_cache_entry*)idb_get(db->cache, acc->account_id);
+	if( entry != NULL )
+	{// update
+		if( strcmp(entry->acc.userid, acc->userid) != 0 )
+		{// the userid is the key of the userid index
+			if( strdb_get(db->cache_userid, entry->acc.userid) == entry )
+				strdb_remove(db->cache_userid, entry->acc.userid);
+			memcpy(&entry->acc, acc, sizeof(entry->acc));
+			strdb_put(db->cache_userid, entry->acc.userid, entry);
+		}
+		else
+			memcpy(&entry->acc, acc, sizeof(entry->acc));
+		return;
+	}
+
+	if( db->cache_count >= db->cache_size )
+	{// evict the least recently used account without pending bookkeeping
+		struct account_cache_entry* victim = db->lru_last;
+		while( victim != NULL && victim->dirty )
+			victim = victim->prev;
+		if( victim == NULL )
+		{// everything is dirty
+			account_cache_flush(db);
+			victim = db->lru_last;
+		}
+		if( victim != NULL )
+		{
+			account_cache_remove(db, victim);
+			++db->cache_evictions;
+		}
+	}
+
+	CREATE(entry, struct account_cache_entry, 1);
+	memcpy(&entry->acc, acc, sizeof(entry->acc));
+	entry->loaded = time(NULL);
+	entry->dirty = false;
+	entry->prev = NULL;
+	entry->next = db->lru_first;
+	if( db->lru_first != NULL )
+		db->lru_first->prev = entry;
+	else
+		db->lru_last = entry;
+	db->lru_first = entry;
+	idb_put(db->cache, acc->account_id, entry);
+	strdb_put(db->cache_userid, entry->acc.userid, entry);
+	++db->cache_count;
+}
+
+
+/// Removes the account from the cache, discarding its pending bookkeeping.
+static void account_cache_remove(AccountDB_SQL* db, struct account_cache_entry* entry)
+{
+	if( entry->prev != NULL )
+		entry->prev->next = entry->next;
+	else
+		db->lru_first = entry->next;
+	if( entry->next != NULL )
+		entry->next->prev = entry->prev;
+	else
+		db->lru_last = entry->prev;
+
+	if( entry->dirty )
+		--db->dirty_count;
+	--db->cache_count;
+
+	if( strdb_get(db->cache_userid, entry->acc.userid) == entry )
+		strdb_remove(db->cache_userid, entry->acc.userid);
+	idb_remove(db->cache, entry->acc.account_id);// frees the entry
+}
+
+
+/// Writes the login bookkeeping of the batch with a single query.
+static bool account_cache_flush_batch(AccountDB_SQL* db, struct account_cache_entry** batch, int count)
+{
+	Sql* sql_handle = db->accounts;
+	StringBuf buf;
+	bool result;
+	int i;
+
+	StringBuf_Init(&buf);
+	StringBuf_Printf(&buf, "UPDATE `%s` SET `logincount` = CASE `account_id`", db->account_db);
+	for( i = 0; i < count; ++i )
+		StringBuf_Printf(&buf, " WHEN %d THEN %u", batch[i]->acc.account_id, batch[i]->acc.logincount);
+	StringBuf_AppendStr(&buf, " END, `lastlogin` = CASE `account_id`");
+	for( i = 0; i < count; ++i )
+	{
+		char esc_lastlogin[2*sizeof(batch[i]->acc.lastlogin)+1];
+		Sql_EscapeString(sql_handle, esc_lastlogin, batch[i]->acc.lastlogin);
+		StringBuf_Printf(&buf, " WHEN %d THEN '%s'", batch[i]->acc.account_id, esc_lastlogin);
+	}
+	StringBuf_AppendStr(&buf, " END, `last_ip` = CASE `account_id`");
+	for( i = 0; i < count; ++i )
+	{
+		char esc_last_ip[2*sizeof(batch[i]->acc.last_ip)+1];
+		Sql_EscapeString(sql_handle, esc_last_ip, batch[i]->acc.last_ip);
+		StringBuf_Printf(&buf, " WHEN %d THEN '%s'", batch[i]->acc.account_id, esc_last_ip);
+	}
+	StringBuf_AppendStr(&buf, " END WHERE `account_id` IN (");
+	for( i = 0; i < count; ++i )
+		StringBuf_Printf(&buf, "%s%d", ( i ? "," : "" ), batch[i]->acc.account_id);
+	StringBuf_AppendStr(&buf, ")");
+
+	result = ( SQL_SUCCESS == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) );
+	if( !result )
+		Sql_ShowDebug(sql_handle);
+	StringBuf_Destroy(&buf);
+
+	return result;
+}
+
+
+/// Writes the pending login bookkeeping of all cached accounts.
+/// Accounts that fail to be written stay dirty and are tried again later.
+static bool account_cache_flush(AccountDB_SQL* db)
+{
+	struct account_cache_entry* batch[ACCOUNT_CACHE_FLUSH_BATCH];
+	struct account_cache_entry* entry = db->lru_first;
+	bool result = true;
+
+	while( db->dirty_count > 0 && entry != NULL )
+	{
+		int count = 0;
+		int i;
+
+		for( ; entry != NULL && count < ACCOUNT_CACHE_FLUSH_BATCH; entry = entry->next )
+			if( entry->dirty )
+				batch[count++] = entry;
+		if( count == 0 )
+			break;
+
+		if( !account_cache_flush_batch(db, batch, count) )
+		{
+			result = false;
+			continue;
+		}
+
+		for( i = 0; i < count; ++i )
+			batch[i]->dirty = false;
+		db->dirty_count -= count;
+		db->flushed_saves += count;
+		++db->flushes;
+	}
+
+	return result;
+}
+
+
+static int account_cache_flush_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	AccountDB_SQL* db = (AccountDB_SQL*)data;
+	if( db->dirty_count > 0 )
+		account_cache_flush(db);
+	return 0;
+}
@@ -0,0 +1,425 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#include "../common/cbasetypes.h"
+#include "../common/db.h"
+#include "../common/malloc.h"
+#include "../common/showmsg.h"
+#include "../common/socket.h"
+#include "../common/strlib.h"
+#include "../common/thread.h"
+#include "../common/timer.h"
+#include "../common/utils.h"
+#include "dnsbl.h"
+#include "login.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+	#include <ws2tcpip.h>
+	typedef SOCKET dnsbl_socket;
+	#define DNSBL_INVALID_SOCKET INVALID_SOCKET
+	#define dnsbl_closesocket closesocket
+#else
+	#include <netdb.h>
+	#include <unistd.h>
+	#include <sys/time.h>
+	typedef int dnsbl_socket;
+	#define DNSBL_INVALID_SOCKET (-1)
+	#define dnsbl_closesocket close
+#endif
+
+/// DNS blacklist lookups.
+/// The lookups are done by resolver threads, so a slow dnsbl server doesn't
+/// stall the login server. The answers are cached per ip for
+/// dnsbl_listed_ttl/dnsbl_clean_ttl seconds. While the answer for an ip is
+/// pending, its login packets are left in the fifo and parsed again later.
+///
+/// The resolver threads only use the preallocated job slots below, the
+/// cache and the timers belong to the main thread.
+
+#define DNSBL_MAX_SERVERS 16
+#define DNSBL_MAX_THREADS 16
+#define DNSBL_MAX_JOBS 256
+#define DNSBL_POLL_INTERVAL 20 // interval (in ms) to collect the finished lookups
+#define DNSBL_CLEANUP_INTERVAL 60*1000 // interval (in ms) to remove the expired answers
+
+enum dnsbl_job_state
+{
+	DNSBL_JOB_FREE,
+	DNSBL_JOB_QUEUED,
+	DNSBL_JOB_RUNNING,
+	DNSBL_JOB_DONE,
+};
+
+struct dnsbl_job
+{
+	enum dnsbl_job_state state;
+	uint32 ip;
+	uint16 query_id; // id of the first direct query
+	bool listed;
+};
+
+struct dnsbl_entry
+{
+	enum dnsbl_state state;
+	unsigned int expire; // tick when the answer stops being valid
+};
+
+static char dnsbl_servers[DNSBL_MAX_SERVERS][128];
+static int dnsbl_server_count = 0;
+static struct sockaddr_in dnsbl_resolver; // used when dnsbl_direct is set
+static bool dnsbl_direct = false;
+
+static struct dnsbl_job dnsbl_jobs[DNSBL_MAX_JOBS];
+static int dnsbl_queue[DNSBL_MAX_JOBS]; // ring of queued job indexes
+static int dnsbl_queue_head = 0;
+static int dnsbl_queue_count = 0;
+static bool dnsbl_stop = false;
+static int dnsbl_inflight = 0; // jobs not yet collected (main thread only)
+
+static amutex* dnsbl_mutex = NULL;
+static acond* dnsbl_cond = NULL;
+static athread* dnsbl_threads[DNSBL_MAX_THREADS];
+static int dnsbl_thread_count = 0;
+
+static DBMap* dnsbl_db = NULL; // uint32 ip -> struct dnsbl_entry*
+static int dnsbl_poll_tid = INVALID_TIMER;
+
+
+/// Sends a type A query for name to the configured resolver and waits
+/// up to dnsbl_timeout ms for the answer.
+/// Returns true if the name exists.
+static bool dnsbl_query_direct(const char* name, uint16 id)
+{
+	uint8 buf[512];
+	size_t len = 12;
+	const char* label = name;
+	dnsbl_socket s;
+	bool found = false;
+	int tries;
+
+	// header: id, recursion desired, one question
+	memset(buf, 0, len);
+	buf[0] = (uint8)(id>>8);
+	buf[1] = (uint8)id;
+	buf[2] = 0x01;
+	buf[5] = 1;
+
+	// question: name as a sequence of labels, type A, class IN
+	while( *label )
+	{
+		const char* dot = strchr(label, '.');
+		size_t n = ( dot ? (size_t)(dot - label) : strlen(label) );
+		if( n == 0 || n > 63 || len + 1 + n + 5 > sizeof(buf) )
+			return false; // malformed name
+		buf[len++] = (uint8)n;
+		memcpy(buf + len, label, n);
+		len += n;
+		label += n;
+		if( *label == '.' )
+			++label;
+	}
+	buf[len++] = 0;
+	buf[len++] = 0; buf[len++] = 1;
+	buf[len++] = 0; buf[len++] = 1;
+
+	s = socket(AF_INET, SOCK_DGRAM, 0);
+	if( s == DNSBL_INVALID_SOCKET )
+		return false;
+	if( connect(s, (struct sockaddr*)&dnsbl_resolver, sizeof(dnsbl_resolver)) != 0 || send(s, (char*)buf, (int)len, 0) != (int)len )
+	{
+		dnsbl_closesocket(s);
+		return false;
+	}
+
+	for( tries = 0; tries < 4; ++tries )
+	{// skip stray datagrams that don't answer this query
+		fd_set rfd;
+		struct timeval timeout;
+		int n;
+
+		FD_ZERO(&rfd);
+		FD_SET(s, &rfd);
+		timeout.tv_sec = login_config.dnsbl_timeout/1000;
+		timeout.tv_usec = login_config.dnsbl_timeout%1000*1000;
+		if( select((int)s + 1, &rfd, NULL, NULL, &timeout) <= 0 )
+			break; // timed out, assume not listed
+
+		n = recv(s, (char*)buf, sizeof(buf), 0);
+		if( n < 12 || buf[0] != (uint8)(id>>8) || buf[1] != (uint8)id || !(buf[2]&0x80) )
+			continue;
+
+		found = ( (buf[3]&0x0F) == 0 && (buf[6] != 0 || buf[7] != 0) ); // no error and at least one answer
+		break;
+	}
+
+	dnsbl_closesocket(s);
+	return found;
+}
+
+
+/// Resolves name with the system resolver.
+/// Returns true if the name exists.
+static bool dnsbl_query_system(const char* name)
+{
+	struct addrinfo hints;
+	struct addrinfo* res = NULL;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	if( getaddrinfo(name, NULL, &hints, &res) != 0 )
+		return false;
+	freeaddrinfo(res);
+	return true;
+}
+
+
+/// Resolver thread.
+/// Takes queued jobs and tests their ip against each dnsbl server.
+static void dnsbl_worker(void* arg)
+{
+	amutex_lock(dnsbl_mutex);
+	for(;;)
+	{
+		struct dnsbl_job* job;
+		uint32 ip;
+		uint16 query_id;
+		bool listed = false;
+		int i;
+
+		while( !dnsbl_stop && dnsbl_queue_count == 0 )
+			acond_wait(dnsbl_cond, dnsbl_mutex);
+		if( dnsbl_stop )
+			break;
+
+		job = &dnsbl_jobs[dnsbl_queue[dnsbl_queue_head]];
+		dnsbl_queue_head = (dnsbl_queue_head + 1)%DNSBL_MAX_JOBS;
+		--dnsbl_queue_count;
+		job->state = DNSBL_JOB_RUNNING;
+		ip = job->ip;
+		query_id = job->query_id;
+		amutex_unlock(dnsbl_mutex);
+
+		for( i = 0; !listed && i < dnsbl_server_count; ++i )
+		{
+			char name[256];
+			sprintf(name, "%u.%u.%u.%u.%s", ip&0xFF, (ip>>8)&0xFF, (ip>>16)&0xFF, (ip>>24)&0xFF, dnsbl_servers[i]);
+			listed = ( dnsbl_direct ? dnsbl_query_direct(name, (uint16)(query_id + i)) : dnsbl_query_system(name) );
+		}
+
+		amutex_lock(dnsbl_mutex);
+		job->listed = listed;
+		job->state = DNSBL_JOB_DONE;
+	}
+	amutex_unlock(dnsbl_mutex);
+}
+
+
+/// Moves the answers of the finished lookups to the cache.
+static int dnsbl_poll_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	int collected = 0;
+	int i;
+
+	dnsbl_poll_tid = INVALID_TIMER;
+
+	amutex_lock(dnsbl_mutex);
+	for( i = 0; i < DNSBL_MAX_JOBS; ++i )
+	{
+		struct dnsbl_job* job = &dnsbl_jobs[i];
+		struct dnsbl_entry* entry;
+
+		if( job->state != DNSBL_JOB_DONE )
+			continue;
+
+		entry = (struct dnsbl_entry*)uidb_get(dnsbl_db, job->ip);
+		if( entry != NULL )
+		{
+			entry->state = ( job->listed ? DNSBL_LISTED : DNSBL_CLEAN );
+			entry->expire = tick + 1000*( job->listed ? login_config.dnsbl_listed_ttl : login_config.dnsbl_clean_ttl );
+		}
+		job->state = DNSBL_JOB_FREE;
+		--dnsbl_inflight;
+		++collected;
+	}
+	amutex_unlock(dnsbl_mutex);
+
+	// the parked logins are parsed after the next select, keep it short
+	// (from the current tick, this timer may be running late)
+	if( dnsbl_inflight > 0 || collected > 0 )
+		dnsbl_poll_tid = add_timer(gettick() + DNSBL_POLL_INTERVAL, dnsbl_poll_timer, 0, 0);
+	return 0;
+}
+
+
+static int dnsbl_cleanup_sub(DBKey key, void* data, va_list ap)
+{
+	struct dnsbl_entry* entry = (struct dnsbl_entry*)data;
+	unsigned int tick = va_arg(ap, unsigned int);
+
+	if( entry->state != DNSBL_PENDING && DIFF_TICK(entry->expire, tick) <= 0 )
+		uidb_remove(dnsbl_db, key.ui);
+	return 0;
+}
+
+
+/// Removes the expired answers from the cache.
+static int dnsbl_cleanup_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	dnsbl_db->foreach(dnsbl_db, dnsbl_cleanup_sub, tick);
+	return 0;
+}
+
+
+/// Returns the dnsbl state of the ip.
+/// If the answer isn't cached (or expired) a lookup is queued and
+/// DNSBL_PENDING is returned until it's done.
+enum dnsbl_state dnsbl_check(uint32 ip)
+{
+	struct dnsbl_entry* entry;
+	int i;
+
+	if( dnsbl_db == NULL || dnsbl_server_count == 0 )
+		return DNSBL_CLEAN;
+
+	entry = (struct dnsbl_entry*)uidb_get(dnsbl_db, ip);
+	if( entry != NULL && (entry->state == DNSBL_PENDING || DIFF_TICK(entry->expire, gettick()) > 0) )
+		return entry->state;
+
+	amutex_lock(dnsbl_mutex);
+	ARR_FIND(0, DNSBL_MAX_JOBS, i, dnsbl_jobs[i].state == DNSBL_JOB_FREE);
+	if( i < DNSBL_MAX_JOBS )
+	{
+		dnsbl_jobs[i].state = DNSBL_JOB_QUEUED;
+		dnsbl_jobs[i].ip = ip;
+		dnsbl_jobs[i].query_id = (uint16)rand();
+		dnsbl_jobs[i].listed = false;
+		dnsbl_queue[(dnsbl_queue_head + dnsbl_queue_count)%DNSBL_MAX_JOBS] = i;
+		++dnsbl_queue_count;
+		acond_broadcast(dnsbl_cond);
+	}
+	amutex_unlock(dnsbl_mutex);
+
+	if( i == DNSBL_MAX_JOBS )
+		return DNSBL_PENDING; // all job slots are busy, try again later
+
+	if( entry == NULL )
+	{
+		CREATE(entry, struct dnsbl_entry, 1);
+		uidb_put(dnsbl_db, ip, entry);
+	}
+	entry->state = DNSBL_PENDING;
+
+	++dnsbl_inflight;
+	if( dnsbl_poll_tid == INVALID_TIMER )
+		dnsbl_poll_tid = add_timer(gettick() + DNSBL_POLL_INTERVAL, dnsbl_poll_timer, 0, 0);
+
+	return DNSBL_PENDING;
+}
+
+
+void dnsbl_init(void)
+{
+	char servers[sizeof(login_config.dnsbl_servs)];
+	char* serv;
+	int i;
+
+	if( !login_config.use_dnsbl )
+		return;
+
+	// split a copy of the server list
+	safestrncpy(servers, login_config.dnsbl_servs, sizeof(servers));
+	dnsbl_server_count = 0;
+	for( serv = strtok(servers, ","); serv != NULL; serv = strtok(NULL, ",") )
+	{
+		trim(serv);
+		if( *serv == '\0' )
+			continue;
+		if( dnsbl_server_count == DNSBL_MAX_SERVERS )
+		{
+			ShowWarning("dnsbl_init: too many dnsbl servers, ignoring '%s' and the following ones (max %d).\n", serv, DNSBL_MAX_SERVERS);
+			break;
+		}
+		safestrncpy(dnsbl_servers[dnsbl_server_count++], serv, sizeof(dnsbl_servers[0]));
+	}
+	if( dnsbl_server_count == 0 )
+	{
+		ShowWarning("dnsbl_init: use_dnsbl is enabled but no dnsbl_servers are set, DNS blacklist blocking disabled.\n");
+		return;
+	}
+
+	// direct resolver "<host>[:<port>]"
+	dnsbl_direct = false;
+	if( login_config.dnsbl_resolver[0] != '\0' )
+	{
+		char host[sizeof(login_config.dnsbl_resolver)];
+		char* port;
+		uint32 ip;
+
+		safestrncpy(host, login_config.dnsbl_resolver, sizeof(host));
+		port = strchr(host, ':');
+		if( port != NULL )
+			*port++ = '\0';
+		ip = host2ip(host);
+		if( ip == 0 )
+			ShowError("dnsbl_init: unable to resolve dnsbl_resolver '%s', using the system resolver.\n", login_config.dnsbl_resolver);
+		else
+		{
+			memset(&dnsbl_resolver, 0, sizeof(dnsbl_resolver));
+			dnsbl_resolver.sin_family = AF_INET;
+			dnsbl_resolver.sin_addr.s_addr = htonl(ip);
+			dnsbl_resolver.sin_port = htons((uint16)( port ? atoi(port) : 53 ));
+			dnsbl_direct = true;
+		}
+	}
+
+	dnsbl_db = uidb_alloc(DB_OPT_RELEASE_DATA);
+	memset(dnsbl_jobs, 0, sizeof(dnsbl_jobs));
+	dnsbl_queue_head = dnsbl_queue_count = dnsbl_inflight = 0;
+	dnsbl_stop = false;
+
+	dnsbl_mutex = amutex_create();
+	dnsbl_cond = acond_create();
+	dnsbl_thread_count = cap_value(login_config.dnsbl_threads, 1, DNSBL_MAX_THREADS);
+	for( i = 0; i < dnsbl_thread_count; ++i )
+		dnsbl_threads[i] = athread_create(dnsbl_worker, NULL);
+
+	add_timer_func_list(dnsbl_poll_timer, "dnsbl_poll_timer");
+	add_timer_func_list(dnsbl_cleanup_timer, "dnsbl_cleanup_timer");
+	add_timer_interval(gettick() + DNSBL_CLEANUP_INTERVAL, dnsbl_cleanup_timer, 0, 0, DNSBL_CLEANUP_INTERVAL);
+
+	ShowInfo("DNSBL: %d server(s), %d resolver thread(s), using %s.\n", dnsbl_server_count, dnsbl_thread_count, ( dnsbl_direct ? login_config.dnsbl_resolver : "the system resolver" ));
+}
+
+
+void dnsbl_final(void)
+{
+	int i;
+
+	if( dnsbl_db == NULL )
+		return;
+
+	amutex_lock(dnsbl_mutex);
+	dnsbl_stop = true;
+	acond_broadcast(dnsbl_cond);
+	amutex_unlock(dnsbl_mutex);
+	for( i = 0; i < dnsbl_thread_count; ++i )
+		athread_join(dnsbl_threads[i]);
+	dnsbl_thread_count = 0;
+
+	acond_destroy(dnsbl_cond);
+	amutex_destroy(dnsbl_mutex);
+	dnsbl_cond = NULL;
+	dnsbl_mutex = NULL;
+
+	if( dnsbl_poll_tid != INVALID_TIMER )
+	{
+		delete_timer(dnsbl_poll_tid, dnsbl_poll_timer);
+		dnsbl_poll_tid = INVALID_TIMER;
+	}
+
+	dnsbl_db->destroy(dnsbl_db, NULL);
+	dnsbl_db = NULL;
+}
@@ -0,0 +1,26 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#ifndef __DNSBL_H_INCLUDED__
+#define __DNSBL_H_INCLUDED__
+
+#include "../common/cbasetypes.h"
+
+enum dnsbl_state
+{
+	DNSBL_PENDING, // lookup in progress, try again later
+	DNSBL_CLEAN,   // not listed on any of the dnsbl servers
+	DNSBL_LISTED,  // listed on at least one dnsbl server
+};
+
+// initialize (starts the resolver threads)
+void dnsbl_init(void);
+
+// finalize
+void dnsbl_final(void);
+
+// check ip against the dnsbl servers, queueing a lookup if the answer isn't cached
+enum dnsbl_state dnsbl_check(uint32 ip);
+
+
+#endif // __DNSBL_H_INCLUDED__
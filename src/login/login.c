@@ -11,6 +11,7 @@
 #include "../common/timer.h"
 #include "../common/version.h"
 #include "account.h"
+#include "dnsbl.h"
 #include "ipban.h"
 #include "login.h"
 #include "loginlog.h"
@@ -367,12 +368,22 @@ int parse_console(const char* command)
 		runflag = 0;
 	else if( strcmpi("alive", command) == 0 || strcmpi("status", command) == 0 )
 		ShowInfo(CL_CYAN"Console: "CL_BOLD"I'm Alive."CL_RESET"\n");
+	else if( strcmpi("accountstats", command) == 0 )
+	{
+		char buf[256];
+		if( accounts->get_property(accounts, "engine.stats", buf, sizeof(buf)) )
+			ShowInfo("Console: account engine: %s\n", buf);
+		else
+			ShowInfo("Console: the account engine has no statistics.\n");
+	}
 	else if( strcmpi("help", command) == 0 )
 	{
 		ShowInfo("To shutdown the server:\n");
 		ShowInfo("  'shutdown|exit|quit|end'\n");
 		ShowInfo("To know if server is alive:\n");
 		ShowInfo("  'alive|status'\n");
+		ShowInfo("To show the account engine statistics (cache hit rate, pending saves, ...):\n");
+		ShowInfo("  'accountstats'\n");
 		ShowInfo("To create a new account:\n");
 		ShowInfo("  'create'\n");
 	}
@@ -980,28 +991,10 @@ int mmo_auth(struct login_session_data* sd)
 	ip2str(session[sd->fd]->client_addr, ip);
 
 	// DNS Blacklist check
-	if( login_config.use_dnsbl )
+	if( login_config.use_dnsbl && dnsbl_check(session[sd->fd]->client_addr) == DNSBL_LISTED )
 	{
-		char r_ip[16];
-		char ip_dnsbl[256];
-		char* dnsbl_serv;
-		bool matched = false;
-		uint8* sin_addr = (uint8*)&session[sd->fd]->client_addr;
-
-		sprintf(r_ip, "%u.%u.%u.%u", sin_addr[0], sin_addr[1], sin_addr[2], sin_addr[3]);
-
-		for( dnsbl_serv = strtok(login_config.dnsbl_servs,","); !matched && dnsbl_serv != NULL; dnsbl_serv = strtok(NULL,",") )
-		{
-			sprintf(ip_dnsbl, "%s.%s", r_ip, dnsbl_serv);
-			if( host2ip(ip_dnsbl) )
-				matched = true;
-		}
-
-		if( matched )
-		{
-			ShowInfo("DNSBL: (%s) Blacklisted. User Kicked.\n", r_ip);
-			return 3;
-		}
+		ShowInfo("DNSBL: (%s) Blacklisted. User Kicked.\n", ip);
+		return 3;
 	}
 
 	//Client Version check
@@ -1352,6 +1345,9 @@ int parse_login(int fd)
 			||  (command == 0x027c && packet_len < 60)
 			||  (command == 0x0825 && (packet_len < 4 || packet_len < RFIFOW(fd, 2))) )
 				return 0;
+
+			if( login_config.use_dnsbl && dnsbl_check(session[fd]->client_addr) == DNSBL_PENDING )
+				return 0; // parked until the dnsbl lookup is done
 		}
 		{
 			uint32 version;
@@ -1449,6 +1445,8 @@ int parse_login(int fd)
 		case 0x2710:	// Connection request of a char-server
 			if (RFIFOREST(fd) < 86)
 				return 0;
+			if( login_config.use_dnsbl && dnsbl_check(session[fd]->client_addr) == DNSBL_PENDING )
+				return 0; // parked until the dnsbl lookup is done
 		{
 			char server_name[20];
 			char message[256];
@@ -1544,6 +1542,11 @@ void login_set_defaults()
 	login_config.dynamic_pass_failure_ban_duration = 5;
 	login_config.use_dnsbl = false;
 	safestrncpy(login_config.dnsbl_servs, "", sizeof(login_config.dnsbl_servs));
+	login_config.dnsbl_threads = 4;
+	login_config.dnsbl_listed_ttl = 3600;
+	login_config.dnsbl_clean_ttl = 600;
+	safestrncpy(login_config.dnsbl_resolver, "", sizeof(login_config.dnsbl_resolver));
+	login_config.dnsbl_timeout = 3000;
 	safestrncpy(login_config.account_engine, "auto", sizeof(login_config.account_engine));
 }
 
@@ -1612,6 +1615,16 @@ int login_config_read(const char* cfgName)
 			login_config.use_dnsbl = (bool)config_switch(w2);
 		else if(!strcmpi(w1, "dnsbl_servers"))
 			safestrncpy(login_config.dnsbl_servs, w2, sizeof(login_config.dnsbl_servs));
+		else if(!strcmpi(w1, "dnsbl_threads"))
+			login_config.dnsbl_threads = atoi(w2);
+		else if(!strcmpi(w1, "dnsbl_listed_ttl"))
+			login_config.dnsbl_listed_ttl = (unsigned int)atoi(w2);
+		else if(!strcmpi(w1, "dnsbl_clean_ttl"))
+			login_config.dnsbl_clean_ttl = (unsigned int)atoi(w2);
+		else if(!strcmpi(w1, "dnsbl_resolver"))
+			safestrncpy(login_config.dnsbl_resolver, w2, sizeof(login_config.dnsbl_resolver));
+		else if(!strcmpi(w1, "dnsbl_timeout"))
+			login_config.dnsbl_timeout = (unsigned int)atoi(w2);
 		else if(!strcmpi(w1, "ipban_cleanup_interval"))
 			login_config.ipban_cleanup_interval = (unsigned int)atoi(w2);
 		else if(!strcmpi(w1, "ip_sync_interval"))
@@ -1677,6 +1690,8 @@ void do_final(void)
 
 	ipban_final();
 
+	dnsbl_final();
+
 	for( i = 0; account_engines[i].constructor; ++i )
 	{// destroy all account engines
 		AccountDB* db = account_engines[i].db;
@@ -1761,6 +1776,9 @@ int do_init(int argc, char** argv)
 	// initialize static and dynamic ipban system
 	ipban_init();
 
+	// initialize the dns blacklist lookups
+	dnsbl_init();
+
 	// Online user database init
 	online_db = idb_alloc(DB_OPT_RELEASE_DATA);
 	add_timer_func_list(waiting_disconnect_timer, "waiting_disconnect_timer");
@@ -75,6 +75,11 @@ struct Login_Config {
 	unsigned int dynamic_pass_failure_ban_duration; // duration of the ipban
 	bool use_dnsbl;                                 // dns blacklist blocking ?
 	char dnsbl_servs[1024];                         // comma-separated list of dnsbl servers
+	int dnsbl_threads;                              // number of threads doing the dnsbl lookups
+	unsigned int dnsbl_listed_ttl;                  // how long (in seconds) a listed ip is remembered
+	unsigned int dnsbl_clean_ttl;                   // how long (in seconds) a clean ip is remembered
+	char dnsbl_resolver[64];                        // dns server queried directly ("host[:port]", empty to use the system resolver)
+	unsigned int dnsbl_timeout;                     // timeout (in ms) of the direct dns queries
 
 	char account_engine[256];                       // name of the engine to use (defaults to auto, for the first available engine)
 };
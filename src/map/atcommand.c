@@ -4290,6 +4290,29 @@ ACMD_FUNC(reloadscript)
 	return 0;
 }
 
+/*==========================================
+ * @reloadnpc - reloads the npc files that changed since they were loaded
+ *------------------------------------------*/
+ACMD_FUNC(reloadnpc)
+{
+	int count;
+	nullpo_retr(-1, sd);
+
+	flush_fifos();
+	count = npc_reload_changed();
+	if( count < 0 )
+	{// needs a full reload
+		script_reload();
+		npc_reload();
+		clif_displaymessage(fd, msg_txt(100)); // Scripts have been reloaded.
+		return 0;
+	}
+
+	sprintf(atcmd_output, "Reloaded %d changed NPC file(s).", count);
+	clif_displaymessage(fd, atcmd_output);
+	return 0;
+}
+
 /*==========================================
  * @mapinfo [0-3] <map name> by MC_Cameri
  * => Shows information about the map [map name]
@@ -8974,6 +8997,7 @@ AtCommandInfo atcommand_info[] = {
 	{ "reloadmobdb",       99,99,     atcommand_reloadmobdb },
 	{ "reloadskilldb",     99,99,     atcommand_reloadskilldb },
 	{ "reloadscript",      99,99,     atcommand_reloadscript },
+	{ "reloadnpc",         99,99,     atcommand_reloadnpc },
 	{ "reloadatcommand",   99,99,     atcommand_reloadatcommand },
 	{ "reloadbattleconf",  99,99,     atcommand_reloadbattleconf },
 	{ "reloadstatusdb",    99,99,     atcommand_reloadstatusdb },
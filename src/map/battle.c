@@ -19,6 +19,8 @@
 #include "mercenary.h"
 #include "mob.h"
 #include "itemdb.h"
+#include "npc.h"
+#include "unit.h"
 #include "clif.h"
 #include "pet.h"
 #include "guild.h"
@@ -30,12 +32,31 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 
 int attr_fix_table[4][ELE_MAX][ELE_MAX];
 
 struct Battle_Config battle_config;
 static struct eri *delay_damage_ers; //For battle delay damage structures.
 
+/// Random numbers of the battle formulas.
+/// battle_selfcheck switches them to a seeded generator of its own, so its
+/// results repeat on every platform without reseeding the one of the server.
+static bool battle_rand_private = false;
+static uint32 battle_rand_state = 1;
+
+static int battle_rand(void)
+{
+	if( !battle_rand_private )
+		return rand();
+	// xorshift32, 15 bits like the smallest RAND_MAX
+	battle_rand_state ^= battle_rand_state << 13;
+	battle_rand_state ^= battle_rand_state >> 17;
+	battle_rand_state ^= battle_rand_state << 5;
+	return (int)(battle_rand_state >> 17);
+}
+#define rand() battle_rand()
+
 int battle_getcurrentskill(struct block_list *bl)
 {	//Returns the current/last skill in use by this bl.
 	struct unit_data *ud;
@@ -944,6 +965,245 @@ struct Damage battle_calc_misc_attack(struct block_list *src,struct block_list *
 
 //For quick div adjustment.
 #define damage_div_fix(dmg, div) { if (div > 1) (dmg)*=div; else if (div < 0) (div)*=-1; }
+
+/*==========================================
+ * Card bonus of the attacking player against the target, as a per-mille
+ * rate for each hand. The result is kept in sd->cardfix_atk, so repeated
+ * hits on the same kind of target skip the bonus tables.
+ *------------------------------------------*/
+static void battle_calc_cardfix_atk(struct map_session_data* sd, struct status_data* tstatus, int t_race2, int t_class, bool boss, int wflag, int nk, bool lh, int* out_cardfix, int* out_cardfix_)
+{
+	int cardfix = 1000, cardfix_ = 1000;
+	int i;
+	struct cardfix_key key;
+
+	memset(&key, 0, sizeof(key));
+	key.class_ = t_class;
+	key.race = tstatus->race;
+	key.race2 = t_race2;
+	key.ele = tstatus->def_ele;
+	key.size = tstatus->size;
+	key.flag = wflag&(BF_WEAPONMASK|BF_RANGEMASK|BF_SKILLMASK);
+	key.boss = boss;
+	key.lh = lh;
+	key.arrow = sd->state.arrow_atk;
+	key.noelefix = (nk&NK_NO_ELEFIX) ? 1 : 0;
+	key.left_to_right = battle_config.left_cardfix_to_right ? 1 : 0;
+	if( sd->cardfix_atk.valid && memcmp(&sd->cardfix_atk.key, &key, sizeof(key)) == 0 )
+	{// same kind of attack on the same kind of target
+		*out_cardfix = sd->cardfix_atk.cardfix;
+		*out_cardfix_ = sd->cardfix_atk.cardfix_;
+		return;
+	}
+
+	if(sd->state.arrow_atk)
+	{
+		cardfix=cardfix*(100+sd->right_weapon.addrace[tstatus->race]+sd->arrow_addrace[tstatus->race])/100;
+		if (!(nk&NK_NO_ELEFIX))
+		{
+			int ele_fix = sd->right_weapon.addele[tstatus->def_ele] + sd->arrow_addele[tstatus->def_ele];
+			for (i = 0; ARRAYLENGTH(sd->right_weapon.addele2) > i && sd->right_weapon.addele2[i].rate != 0; i++) {
+				if (sd->right_weapon.addele2[i].ele != tstatus->def_ele) continue;
+				if(!(sd->right_weapon.addele2[i].flag&wflag&BF_WEAPONMASK &&
+					 sd->right_weapon.addele2[i].flag&wflag&BF_RANGEMASK &&
+					 sd->right_weapon.addele2[i].flag&wflag&BF_SKILLMASK))
+						continue;
+				ele_fix += sd->right_weapon.addele2[i].rate;
+			}
+			cardfix=cardfix*(100+ele_fix)/100;
+		}
+		cardfix=cardfix*(100+sd->right_weapon.addsize[tstatus->size]+sd->arrow_addsize[tstatus->size])/100;
+		cardfix=cardfix*(100+sd->right_weapon.addrace2[t_race2])/100;
+		cardfix=cardfix*(100+sd->right_weapon.addrace[boss?RC_BOSS:RC_NONBOSS]+sd->arrow_addrace[boss?RC_BOSS:RC_NONBOSS])/100;
+		if( tstatus->race != RC_DEMIHUMAN )
+			cardfix=cardfix*(100+sd->right_weapon.addrace[RC_NONDEMIHUMAN]+sd->arrow_addrace[RC_NONDEMIHUMAN])/100;
+	}
+	else
+	{ // Melee attack
+		if( !battle_config.left_cardfix_to_right )
+		{
+			cardfix=cardfix*(100+sd->right_weapon.addrace[tstatus->race])/100;					
+			if (!(nk&NK_NO_ELEFIX)) {
+				int ele_fix = sd->right_weapon.addele[tstatus->def_ele];
+				for (i = 0; ARRAYLENGTH(sd->right_weapon.addele2) > i && sd->right_weapon.addele2[i].rate != 0; i++) {
+					if (sd->right_weapon.addele2[i].ele != tstatus->def_ele) continue;
+					if(!(sd->right_weapon.addele2[i].flag&wflag&BF_WEAPONMASK &&
+						 sd->right_weapon.addele2[i].flag&wflag&BF_RANGEMASK &&
+						 sd->right_weapon.addele2[i].flag&wflag&BF_SKILLMASK))
+							continue;
+					ele_fix += sd->right_weapon.addele2[i].rate;
+				}
+				cardfix=cardfix*(100+ele_fix)/100;
+			}
+			cardfix=cardfix*(100+sd->right_weapon.addsize[tstatus->size])/100;
+			cardfix=cardfix*(100+sd->right_weapon.addrace2[t_race2])/100;
+			cardfix=cardfix*(100+sd->right_weapon.addrace[boss?RC_BOSS:RC_NONBOSS])/100;
+			if( tstatus->race != RC_DEMIHUMAN )
+				cardfix=cardfix*(100+sd->right_weapon.addrace[RC_NONDEMIHUMAN])/100;
+
+			if( lh )
+			{
+				cardfix_=cardfix_*(100+sd->left_weapon.addrace[tstatus->race])/100;						
+				if (!(nk&NK_NO_ELEFIX))	{
+					int ele_fix_lh = sd->left_weapon.addele[tstatus->def_ele];							
+					for (i = 0; ARRAYLENGTH(sd->left_weapon.addele2) > i && sd->left_weapon.addele2[i].rate != 0; i++) {
+						if (sd->left_weapon.addele2[i].ele != tstatus->def_ele) continue;
+						if(!(sd->left_weapon.addele2[i].flag&wflag&BF_WEAPONMASK &&
+							 sd->left_weapon.addele2[i].flag&wflag&BF_RANGEMASK &&
+							 sd->left_weapon.addele2[i].flag&wflag&BF_SKILLMASK))
+								continue;
+						ele_fix_lh += sd->left_weapon.addele2[i].rate;
+					}
+					cardfix=cardfix*(100+ele_fix_lh)/100;
+				}
+				cardfix_=cardfix_*(100+sd->left_weapon.addsize[tstatus->size])/100;
+				cardfix_=cardfix_*(100+sd->left_weapon.addrace2[t_race2])/100;
+				cardfix_=cardfix_*(100+sd->left_weapon.addrace[boss?RC_BOSS:RC_NONBOSS])/100;
+				if( tstatus->race != RC_DEMIHUMAN )
+					cardfix_=cardfix_*(100+sd->left_weapon.addrace[RC_NONDEMIHUMAN])/100;
+			}
+		}
+		else
+		{
+			int ele_fix = sd->right_weapon.addele[tstatus->def_ele] + sd->left_weapon.addele[tstatus->def_ele];
+			for (i = 0; ARRAYLENGTH(sd->right_weapon.addele2) > i && sd->right_weapon.addele2[i].rate != 0; i++) {
+				if (sd->right_weapon.addele2[i].ele != tstatus->def_ele) continue;
+				if(!(sd->right_weapon.addele2[i].flag&wflag&BF_WEAPONMASK &&
+					 sd->right_weapon.addele2[i].flag&wflag&BF_RANGEMASK &&
+					 sd->right_weapon.addele2[i].flag&wflag&BF_SKILLMASK))
+						continue;
+				ele_fix += sd->right_weapon.addele2[i].rate;
+			}
+			for (i = 0; ARRAYLENGTH(sd->left_weapon.addele2) > i && sd->left_weapon.addele2[i].rate != 0; i++) {
+				if (sd->left_weapon.addele2[i].ele != tstatus->def_ele) continue;
+				if(!(sd->left_weapon.addele2[i].flag&wflag&BF_WEAPONMASK &&
+					 sd->left_weapon.addele2[i].flag&wflag&BF_RANGEMASK &&
+					 sd->left_weapon.addele2[i].flag&wflag&BF_SKILLMASK))
+						continue;
+				ele_fix += sd->left_weapon.addele2[i].rate;
+			}
+
+			cardfix=cardfix*(100+sd->right_weapon.addrace[tstatus->race]+sd->left_weapon.addrace[tstatus->race])/100;
+			cardfix=cardfix*(100+ele_fix)/100;
+			cardfix=cardfix*(100+sd->right_weapon.addsize[tstatus->size]+sd->left_weapon.addsize[tstatus->size])/100;
+			cardfix=cardfix*(100+sd->right_weapon.addrace2[t_race2]+sd->left_weapon.addrace2[t_race2])/100;
+			cardfix=cardfix*(100+sd->right_weapon.addrace[boss?RC_BOSS:RC_NONBOSS]+sd->left_weapon.addrace[boss?RC_BOSS:RC_NONBOSS])/100;
+			if( tstatus->race != RC_DEMIHUMAN )
+				cardfix=cardfix*(100+sd->right_weapon.addrace[RC_NONDEMIHUMAN]+sd->left_weapon.addrace[RC_NONDEMIHUMAN])/100;
+		}
+	}
+
+	for( i = 0; i < ARRAYLENGTH(sd->right_weapon.add_dmg) && sd->right_weapon.add_dmg[i].rate; i++ )
+	{
+		if( sd->right_weapon.add_dmg[i].class_ == t_class )
+		{
+			cardfix=cardfix*(100+sd->right_weapon.add_dmg[i].rate)/100;
+			break;
+		}
+	}
+
+	if( lh )
+	{
+		for( i = 0; i < ARRAYLENGTH(sd->left_weapon.add_dmg) && sd->left_weapon.add_dmg[i].rate; i++ )
+		{
+			if( sd->left_weapon.add_dmg[i].class_ == t_class )
+			{
+				cardfix_=cardfix_*(100+sd->left_weapon.add_dmg[i].rate)/100;
+				break;
+			}
+		}
+	}
+
+	if( wflag&BF_LONG )
+		cardfix=cardfix*(100+sd->long_attack_atk_rate)/100;
+
+	memcpy(&sd->cardfix_atk.key, &key, sizeof(key));
+	sd->cardfix_atk.cardfix = cardfix;
+	sd->cardfix_atk.cardfix_ = cardfix_;
+	sd->cardfix_atk.valid = true;
+	*out_cardfix = cardfix;
+	*out_cardfix_ = cardfix_;
+}
+
+/*==========================================
+ * Card reduction of the targeted player against the attacker, as a
+ * per-mille rate, kept in tsd->cardfix_def. Status changes are not included.
+ *------------------------------------------*/
+static short battle_calc_cardfix_def(struct map_session_data* tsd, struct status_data* sstatus, int s_race2, int s_class, bool boss, int s_ele, int s_ele_, int wflag, int nk, bool lh)
+{
+	short cardfix = 1000;
+	int i;
+	struct cardfix_key key;
+
+	memset(&key, 0, sizeof(key));
+	key.class_ = s_class;
+	key.race = sstatus->race;
+	key.race2 = s_race2;
+	key.ele = s_ele;
+	key.ele_ = s_ele_;
+	key.size = sstatus->size;
+	key.flag = wflag&(BF_WEAPONMASK|BF_RANGEMASK|BF_SKILLMASK);
+	key.boss = boss;
+	key.lh = lh;
+	key.noelefix = (nk&NK_NO_ELEFIX) ? 1 : 0;
+	if( tsd->cardfix_def.valid && memcmp(&tsd->cardfix_def.key, &key, sizeof(key)) == 0 )
+		return (short)tsd->cardfix_def.cardfix;
+
+	if( !(nk&NK_NO_ELEFIX) )
+	{
+		int ele_fix = tsd->subele[s_ele];
+		for (i = 0; ARRAYLENGTH(tsd->subele2) > i && tsd->subele2[i].rate != 0; i++)
+		{
+			if(tsd->subele2[i].ele != s_ele) continue;
+			if(!(tsd->subele2[i].flag&wflag&BF_WEAPONMASK &&
+				 tsd->subele2[i].flag&wflag&BF_RANGEMASK &&
+				 tsd->subele2[i].flag&wflag&BF_SKILLMASK))
+				continue;
+			ele_fix += tsd->subele2[i].rate;
+		}
+		cardfix=cardfix*(100-ele_fix)/100;
+		if( lh && s_ele_ != s_ele )
+		{
+			int ele_fix_lh = tsd->subele[s_ele_];
+			for (i = 0; ARRAYLENGTH(tsd->subele2) > i && tsd->subele2[i].rate != 0; i++)
+			{
+				if(tsd->subele2[i].ele != s_ele_) continue;
+				if(!(tsd->subele2[i].flag&wflag&BF_WEAPONMASK &&
+					 tsd->subele2[i].flag&wflag&BF_RANGEMASK &&
+					 tsd->subele2[i].flag&wflag&BF_SKILLMASK))
+					continue;
+				ele_fix_lh += tsd->subele2[i].rate;
+			}
+			cardfix=cardfix*(100-ele_fix_lh)/100;
+		}
+	}
+	cardfix=cardfix*(100-tsd->subsize[sstatus->size])/100;
+ 		cardfix=cardfix*(100-tsd->subrace2[s_race2])/100;
+	cardfix=cardfix*(100-tsd->subrace[sstatus->race])/100;
+	cardfix=cardfix*(100-tsd->subrace[boss?RC_BOSS:RC_NONBOSS])/100;
+	if( sstatus->race != RC_DEMIHUMAN )
+		cardfix=cardfix*(100-tsd->subrace[RC_NONDEMIHUMAN])/100;
+
+	for( i = 0; i < ARRAYLENGTH(tsd->add_def) && tsd->add_def[i].rate;i++ )
+	{
+		if( tsd->add_def[i].class_ == s_class )
+		{
+			cardfix=cardfix*(100-tsd->add_def[i].rate)/100;
+			break;
+		}
+	}
+
+	if( wflag&BF_SHORT )
+		cardfix=cardfix*(100-tsd->near_attack_def_rate)/100;
+	else	// BF_LONG (there's no other choice)
+		cardfix=cardfix*(100-tsd->long_attack_def_rate)/100;
+
+	memcpy(&tsd->cardfix_def.key, &key, sizeof(key));
+	tsd->cardfix_def.cardfix = cardfix;
+	tsd->cardfix_def.valid = true;
+	return cardfix;
+}
+
 /*==========================================
  * battle_calc_weapon_attack (by Skotlex)
  *------------------------------------------*/
@@ -2007,129 +2267,8 @@ static struct Damage battle_calc_weapon_attack(struct block_list *src,struct blo
 		//Card Fix, sd side
 		if( (wd.damage || wd.damage2) && !(nk&NK_NO_CARDFIX_ATK) )
 		{
-			int cardfix = 1000, cardfix_ = 1000;
-			int t_race2 = status_get_race2(target);
-			if(sd->state.arrow_atk)
-			{
-				cardfix=cardfix*(100+sd->right_weapon.addrace[tstatus->race]+sd->arrow_addrace[tstatus->race])/100;
-				if (!(nk&NK_NO_ELEFIX))
-				{
-					int ele_fix = sd->right_weapon.addele[tstatus->def_ele] + sd->arrow_addele[tstatus->def_ele];
-					for (i = 0; ARRAYLENGTH(sd->right_weapon.addele2) > i && sd->right_weapon.addele2[i].rate != 0; i++) {
-						if (sd->right_weapon.addele2[i].ele != tstatus->def_ele) continue;
-						if(!(sd->right_weapon.addele2[i].flag&wd.flag&BF_WEAPONMASK &&
-							 sd->right_weapon.addele2[i].flag&wd.flag&BF_RANGEMASK &&
-							 sd->right_weapon.addele2[i].flag&wd.flag&BF_SKILLMASK))
-								continue;
-						ele_fix += sd->right_weapon.addele2[i].rate;
-					}
-					cardfix=cardfix*(100+ele_fix)/100;
-				}
-				cardfix=cardfix*(100+sd->right_weapon.addsize[tstatus->size]+sd->arrow_addsize[tstatus->size])/100;
-				cardfix=cardfix*(100+sd->right_weapon.addrace2[t_race2])/100;
-				cardfix=cardfix*(100+sd->right_weapon.addrace[is_boss(target)?RC_BOSS:RC_NONBOSS]+sd->arrow_addrace[is_boss(target)?RC_BOSS:RC_NONBOSS])/100;
-				if( tstatus->race != RC_DEMIHUMAN )
-					cardfix=cardfix*(100+sd->right_weapon.addrace[RC_NONDEMIHUMAN]+sd->arrow_addrace[RC_NONDEMIHUMAN])/100;
-			}
-			else
-			{ // Melee attack
-				if( !battle_config.left_cardfix_to_right )
-				{
-					cardfix=cardfix*(100+sd->right_weapon.addrace[tstatus->race])/100;					
-					if (!(nk&NK_NO_ELEFIX)) {
-						int ele_fix = sd->right_weapon.addele[tstatus->def_ele];
-						for (i = 0; ARRAYLENGTH(sd->right_weapon.addele2) > i && sd->right_weapon.addele2[i].rate != 0; i++) {
-							if (sd->right_weapon.addele2[i].ele != tstatus->def_ele) continue;
-							if(!(sd->right_weapon.addele2[i].flag&wd.flag&BF_WEAPONMASK &&
-								 sd->right_weapon.addele2[i].flag&wd.flag&BF_RANGEMASK &&
-								 sd->right_weapon.addele2[i].flag&wd.flag&BF_SKILLMASK))
-									continue;
-							ele_fix += sd->right_weapon.addele2[i].rate;
-						}
-						cardfix=cardfix*(100+ele_fix)/100;
-					}
-					cardfix=cardfix*(100+sd->right_weapon.addsize[tstatus->size])/100;
-					cardfix=cardfix*(100+sd->right_weapon.addrace2[t_race2])/100;
-					cardfix=cardfix*(100+sd->right_weapon.addrace[is_boss(target)?RC_BOSS:RC_NONBOSS])/100;
-					if( tstatus->race != RC_DEMIHUMAN )
-						cardfix=cardfix*(100+sd->right_weapon.addrace[RC_NONDEMIHUMAN])/100;
-
-					if( flag.lh )
-					{
-						cardfix_=cardfix_*(100+sd->left_weapon.addrace[tstatus->race])/100;						
-						if (!(nk&NK_NO_ELEFIX))	{
-							int ele_fix_lh = sd->left_weapon.addele[tstatus->def_ele];							
-							for (i = 0; ARRAYLENGTH(sd->left_weapon.addele2) > i && sd->left_weapon.addele2[i].rate != 0; i++) {
-								if (sd->left_weapon.addele2[i].ele != tstatus->def_ele) continue;
-								if(!(sd->left_weapon.addele2[i].flag&wd.flag&BF_WEAPONMASK &&
-									 sd->left_weapon.addele2[i].flag&wd.flag&BF_RANGEMASK &&
-									 sd->left_weapon.addele2[i].flag&wd.flag&BF_SKILLMASK))
-										continue;
-								ele_fix_lh += sd->left_weapon.addele2[i].rate;
-							}
-							cardfix=cardfix*(100+ele_fix_lh)/100;
-						}
-						cardfix_=cardfix_*(100+sd->left_weapon.addsize[tstatus->size])/100;
-						cardfix_=cardfix_*(100+sd->left_weapon.addrace2[t_race2])/100;
-						cardfix_=cardfix_*(100+sd->left_weapon.addrace[is_boss(target)?RC_BOSS:RC_NONBOSS])/100;
-						if( tstatus->race != RC_DEMIHUMAN )
-							cardfix_=cardfix_*(100+sd->left_weapon.addrace[RC_NONDEMIHUMAN])/100;
-					}
-				}
-				else
-				{
-					int ele_fix = sd->right_weapon.addele[tstatus->def_ele] + sd->left_weapon.addele[tstatus->def_ele];
-					for (i = 0; ARRAYLENGTH(sd->right_weapon.addele2) > i && sd->right_weapon.addele2[i].rate != 0; i++) {
-						if (sd->right_weapon.addele2[i].ele != tstatus->def_ele) continue;
-						if(!(sd->right_weapon.addele2[i].flag&wd.flag&BF_WEAPONMASK &&
-							 sd->right_weapon.addele2[i].flag&wd.flag&BF_RANGEMASK &&
-							 sd->right_weapon.addele2[i].flag&wd.flag&BF_SKILLMASK))
-								continue;
-						ele_fix += sd->right_weapon.addele2[i].rate;
-					}
-					for (i = 0; ARRAYLENGTH(sd->left_weapon.addele2) > i && sd->left_weapon.addele2[i].rate != 0; i++) {
-						if (sd->left_weapon.addele2[i].ele != tstatus->def_ele) continue;
-						if(!(sd->left_weapon.addele2[i].flag&wd.flag&BF_WEAPONMASK &&
-							 sd->left_weapon.addele2[i].flag&wd.flag&BF_RANGEMASK &&
-							 sd->left_weapon.addele2[i].flag&wd.flag&BF_SKILLMASK))
-								continue;
-						ele_fix += sd->left_weapon.addele2[i].rate;
-					}
-
-					cardfix=cardfix*(100+sd->right_weapon.addrace[tstatus->race]+sd->left_weapon.addrace[tstatus->race])/100;
-					cardfix=cardfix*(100+ele_fix)/100;
-					cardfix=cardfix*(100+sd->right_weapon.addsize[tstatus->size]+sd->left_weapon.addsize[tstatus->size])/100;
-					cardfix=cardfix*(100+sd->right_weapon.addrace2[t_race2]+sd->left_weapon.addrace2[t_race2])/100;
-					cardfix=cardfix*(100+sd->right_weapon.addrace[is_boss(target)?RC_BOSS:RC_NONBOSS]+sd->left_weapon.addrace[is_boss(target)?RC_BOSS:RC_NONBOSS])/100;
-					if( tstatus->race != RC_DEMIHUMAN )
-						cardfix=cardfix*(100+sd->right_weapon.addrace[RC_NONDEMIHUMAN]+sd->left_weapon.addrace[RC_NONDEMIHUMAN])/100;
-				}
-			}
-
-			for( i = 0; i < ARRAYLENGTH(sd->right_weapon.add_dmg) && sd->right_weapon.add_dmg[i].rate; i++ )
-			{
-				if( sd->right_weapon.add_dmg[i].class_ == t_class )
-				{
-					cardfix=cardfix*(100+sd->right_weapon.add_dmg[i].rate)/100;
-					break;
-				}
-			}
-
-			if( flag.lh )
-			{
-				for( i = 0; i < ARRAYLENGTH(sd->left_weapon.add_dmg) && sd->left_weapon.add_dmg[i].rate; i++ )
-				{
-					if( sd->left_weapon.add_dmg[i].class_ == t_class )
-					{
-						cardfix_=cardfix_*(100+sd->left_weapon.add_dmg[i].rate)/100;
-						break;
-					}
-				}
-			}
-
-			if( wd.flag&BF_LONG )
-				cardfix=cardfix*(100+sd->long_attack_atk_rate)/100;
-
+			int cardfix, cardfix_;
+			battle_calc_cardfix_atk(sd, tstatus, status_get_race2(target), t_class, is_boss(target), wd.flag, nk, flag.lh, &cardfix, &cardfix_);
 			if( cardfix != 1000 || cardfix_ != 1000 )
 				ATK_RATE2(cardfix/10, cardfix_/10);	//What happens if you use right-to-left and there's no right weapon, only left?
 		}
@@ -2145,60 +2284,7 @@ static struct Damage battle_calc_weapon_attack(struct block_list *src,struct blo
 	//Card Fix, tsd sid
 	if( tsd && !(nk&NK_NO_CARDFIX_DEF) )
 	{
-		short s_race2,s_class;
-		short cardfix=1000;
-
-		s_race2 = status_get_race2(src);
-		s_class = status_get_class(src);
-
-		if( !(nk&NK_NO_ELEFIX) )
-		{
-			int ele_fix = tsd->subele[s_ele];
-			for (i = 0; ARRAYLENGTH(tsd->subele2) > i && tsd->subele2[i].rate != 0; i++)
-			{
-				if(tsd->subele2[i].ele != s_ele) continue;
-				if(!(tsd->subele2[i].flag&wd.flag&BF_WEAPONMASK &&
-					 tsd->subele2[i].flag&wd.flag&BF_RANGEMASK &&
-					 tsd->subele2[i].flag&wd.flag&BF_SKILLMASK))
-					continue;
-				ele_fix += tsd->subele2[i].rate;
-			}
-			cardfix=cardfix*(100-ele_fix)/100;
-			if( flag.lh && s_ele_ != s_ele )
-			{
-				int ele_fix_lh = tsd->subele[s_ele_];
-				for (i = 0; ARRAYLENGTH(tsd->subele2) > i && tsd->subele2[i].rate != 0; i++)
-				{
-					if(tsd->subele2[i].ele != s_ele_) continue;
-					if(!(tsd->subele2[i].flag&wd.flag&BF_WEAPONMASK &&
-						 tsd->subele2[i].flag&wd.flag&BF_RANGEMASK &&
-						 tsd->subele2[i].flag&wd.flag&BF_SKILLMASK))
-						continue;
-					ele_fix_lh += tsd->subele2[i].rate;
-				}
-				cardfix=cardfix*(100-ele_fix_lh)/100;
-			}
-		}
-		cardfix=cardfix*(100-tsd->subsize[sstatus->size])/100;
- 		cardfix=cardfix*(100-tsd->subrace2[s_race2])/100;
-		cardfix=cardfix*(100-tsd->subrace[sstatus->race])/100;
-		cardfix=cardfix*(100-tsd->subrace[is_boss(src)?RC_BOSS:RC_NONBOSS])/100;
-		if( sstatus->race != RC_DEMIHUMAN )
-			cardfix=cardfix*(100-tsd->subrace[RC_NONDEMIHUMAN])/100;
-
-		for( i = 0; i < ARRAYLENGTH(tsd->add_def) && tsd->add_def[i].rate;i++ )
-		{
-			if( tsd->add_def[i].class_ == s_class )
-			{
-				cardfix=cardfix*(100-tsd->add_def[i].rate)/100;
-				break;
-			}
-		}
-
-		if( wd.flag&BF_SHORT )
-			cardfix=cardfix*(100-tsd->near_attack_def_rate)/100;
-		else	// BF_LONG (there's no other choice)
-			cardfix=cardfix*(100-tsd->long_attack_def_rate)/100;
+		short cardfix = battle_calc_cardfix_def(tsd, sstatus, status_get_race2(src), status_get_class(src), is_boss(src), s_ele, s_ele_, wd.flag, nk, flag.lh);
 
 		if( tsd->sc.data[SC_DEF_RATE] )
 			cardfix=cardfix*(100-tsd->sc.data[SC_DEF_RATE]->val1)/100;
@@ -4015,6 +4101,7 @@ static const struct _battle_data {
 	{ "cashshop_show_points",               &battle_config.cashshop_show_points,            0,      0,      1,              },
 	{ "mail_show_status",                   &battle_config.mail_show_status,                0,      0,      2,              },
 	{ "client_limit_unit_lv",               &battle_config.client_limit_unit_lv,            0,      0,      BL_ALL,         },
+	{ "ers_prewarm",                        &battle_config.ers_prewarm,                     0,      0,      INT_MAX,        },
 // BattleGround Settings
 	{ "bg_update_interval",                 &battle_config.bg_update_interval,              1000,   100,    INT_MAX,        },
 	{ "bg_short_attack_damage_rate",        &battle_config.bg_short_damage_rate,            80,     0,      INT_MAX,        },
@@ -4129,9 +4216,438 @@ int battle_config_read(const char* cfgName)
 	return 0;
 }
 
+/*==========================================
+ * Battle formula check [server:battlecheck]
+ * Runs fixed attacks between synthetic players and monsters with a fixed
+ * random seed, compares the results with the ones recorded in a file and
+ * reports how many damage calculations per second were done.
+ * The results are kept in db/battlecheck.txt and only change when the
+ * formulas or the databases they read are changed on purpose; they are
+ * recorded again with 'server:battlecheck record'.
+ *------------------------------------------*/
+
+#define SELFCHECK_SEED 0x5eed
+#define SELFCHECK_MAX_RESULTS 512
+
+/// Synthetic unit of the battle check.
+/// Players get the equipment and skills, monsters only use class_.
+struct selfcheck_unit {
+	const char* name;
+	bool pc;
+	int class_;
+	int str, agi, vit, int_, dex, luk;
+	int weapon, weapon_cards[3];
+	int left, left_cards[3];// shield or left hand weapon
+	int armor, armor_card;
+	struct { int id, lv; } skills[3];
+	struct { int type, val1; } sc[2];
+};
+
+static const struct selfcheck_unit selfcheck_attackers[] = {
+	{ "knight",   true, JOB_KNIGHT,   90, 60, 40,  1, 60, 20, 1116, { 4092, 4035, 4140 },    0, { 0, 0, 0 }, 2314, 4031, { { SM_TWOHAND, 10 }, { 0, 0 }, { 0, 0 } }, { { SC_BLESSING, 10 }, { SC_INCREASEAGI, 10 } } },
+	{ "assassin", true, JOB_ASSASSIN, 80, 90, 30,  1, 50, 30, 1201, { 4111, 0, 0 },       1101, { 4092, 0, 0 }, 2301,    0, { { AS_RIGHT, 5 }, { AS_LEFT, 5 }, { AS_KATAR, 10 } }, { { 0, 0 }, { 0, 0 } } },
+	{ "wizard",   true, JOB_WIZARD,    1, 40, 30, 99, 80,  1, 1601, { 0, 0, 0 },             0, { 0, 0, 0 }, 2301,    0, { { 0, 0 }, { 0, 0 }, { 0, 0 } }, { { SC_BLESSING, 10 }, { 0, 0 } } },
+	{ "hunter",   true, JOB_HUNTER,   30, 60, 30, 40, 99, 40,    0, { 0, 0, 0 },             0, { 0, 0, 0 }, 2301,    0, { { 0, 0 }, { 0, 0 }, { 0, 0 } }, { { 0, 0 }, { 0, 0 } } },
+};
+
+static const struct selfcheck_unit selfcheck_targets[] = {
+	{ "poring",   false, 1002 },
+	{ "ghoul",    false, 1036 },
+	{ "osiris",   false, 1038 },
+	{ "eddga",    false, 1115 },
+	{ "crusader", true, JOB_CRUSADER, 60, 30, 80, 30, 40, 10, 1101, { 0, 0, 0 }, 2105, { 4058, 0, 0 }, 2314, 4047, { { 0, 0 }, { 0, 0 }, { 0, 0 } }, { { SC_ANGELUS, 10 }, { 0, 0 } } },
+};
+
+static const struct {
+	const char* name;
+	int type, skill_num, skill_lv;
+} selfcheck_attacks[] = {
+	{ "attack",    BF_WEAPON, 0,             0 },
+	{ "bash",      BF_WEAPON, SM_BASH,      10 },
+	{ "pierce",    BF_WEAPON, KN_PIERCE,    10 },
+	{ "sonicblow", BF_WEAPON, AS_SONICBLOW, 10 },
+	{ "firebolt",  BF_MAGIC,  MG_FIREBOLT,  10 },
+	{ "stormgust", BF_MAGIC,  WZ_STORMGUST, 10 },
+	{ "heal",      BF_MAGIC,  AL_HEAL,      10 },
+	{ "blastmine", BF_MISC,   HT_BLASTMINE,  5 },
+};
+
+/// Recorded result of a check.
+struct selfcheck_result {
+	char name[64];
+	unsigned long hash;
+	bool seen;
+};
+
+static unsigned long selfcheck_hash(unsigned long hash, int value)
+{
+	int i;
+	for( i = 0; i < 4; ++i )
+	{
+		hash ^= (value >> (i*8))&0xff;
+		hash = (hash*16777619)&0xffffffff;
+	}
+	return hash;
+}
+
+static unsigned long selfcheck_hash_status(struct status_data* status)
+{
+	unsigned long hash = 2166136261UL;
+	hash = selfcheck_hash(hash, status->max_hp);
+	hash = selfcheck_hash(hash, status->max_sp);
+	hash = selfcheck_hash(hash, status->str);
+	hash = selfcheck_hash(hash, status->agi);
+	hash = selfcheck_hash(hash, status->vit);
+	hash = selfcheck_hash(hash, status->int_);
+	hash = selfcheck_hash(hash, status->dex);
+	hash = selfcheck_hash(hash, status->luk);
+	hash = selfcheck_hash(hash, status->batk);
+	hash = selfcheck_hash(hash, status->matk_min);
+	hash = selfcheck_hash(hash, status->matk_max);
+	hash = selfcheck_hash(hash, status->hit);
+	hash = selfcheck_hash(hash, status->flee);
+	hash = selfcheck_hash(hash, status->flee2);
+	hash = selfcheck_hash(hash, status->cri);
+	hash = selfcheck_hash(hash, status->def);
+	hash = selfcheck_hash(hash, status->def2);
+	hash = selfcheck_hash(hash, status->mdef);
+	hash = selfcheck_hash(hash, status->mdef2);
+	hash = selfcheck_hash(hash, status->speed);
+	hash = selfcheck_hash(hash, status->amotion);
+	hash = selfcheck_hash(hash, status->rhw.atk);
+	hash = selfcheck_hash(hash, status->rhw.atk2);
+	hash = selfcheck_hash(hash, status->lhw.atk);
+	hash = selfcheck_hash(hash, status->lhw.atk2);
+	hash = selfcheck_hash(hash, status->def_ele);
+	hash = selfcheck_hash(hash, status->race);
+	hash = selfcheck_hash(hash, status->size);
+	return hash;
+}
+
+/// Creates a player that is not connected and not on the map.
+/// Only map_id2sd finds it (map_addprivatepc), so the item scripts can attach to it.
+static struct map_session_data* selfcheck_pc(const struct selfcheck_unit* u, int m, int x, int y)
+{
+	struct map_session_data* sd;
+	int i, n = 0;
+
+	CREATE(sd, struct map_session_data, 1);
+	sd->bl.id = npc_get_new_npc_id();
+	sd->bl.type = BL_PC;
+	sd->bl.m = m;
+	sd->bl.x = x;
+	sd->bl.y = y;
+	sd->fd = 0;
+	sd->status.account_id = sd->status.char_id = sd->bl.id;
+	safestrncpy(sd->status.name, u->name, NAME_LENGTH);
+	sd->status.class_ = u->class_;
+	sd->class_ = pc_jobid2mapid(u->class_);
+	sd->status.base_level = 99;
+	sd->status.job_level = 50;
+	sd->status.str = u->str;
+	sd->status.agi = u->agi;
+	sd->status.vit = u->vit;
+	sd->status.int_ = u->int_;
+	sd->status.dex = u->dex;
+	sd->status.luk = u->luk;
+	sd->status.hp = sd->status.max_hp = 1;
+	sd->status.sp = sd->status.max_sp = 1;
+	for( i = 0; i < ARRAYLENGTH(u->skills) && u->skills[i].id; ++i )
+	{
+		sd->status.skill[u->skills[i].id].id = u->skills[i].id;
+		sd->status.skill[u->skills[i].id].lv = u->skills[i].lv;
+	}
+
+	if( u->weapon )
+	{
+		sd->status.inventory[n].nameid = u->weapon;
+		memcpy(sd->status.inventory[n].card, u->weapon_cards, sizeof(u->weapon_cards));
+		sd->status.inventory[n].equip = itemdb_search(u->weapon)->equip&EQP_WEAPON;
+		++n;
+	}
+	if( u->left )
+	{
+		sd->status.inventory[n].nameid = u->left;
+		memcpy(sd->status.inventory[n].card, u->left_cards, sizeof(u->left_cards));
+		sd->status.inventory[n].equip = EQP_HAND_L;
+		++n;
+	}
+	if( u->armor )
+	{
+		sd->status.inventory[n].nameid = u->armor;
+		sd->status.inventory[n].card[0] = u->armor_card;
+		sd->status.inventory[n].equip = EQP_ARMOR;
+		++n;
+	}
+	for( i = 0; i < n; ++i )
+	{
+		sd->status.inventory[i].amount = 1;
+		sd->status.inventory[i].identify = 1;
+	}
+
+	sd->followtimer = INVALID_TIMER;
+	sd->invincible_timer = INVALID_TIMER;
+	sd->npc_timer_id = INVALID_TIMER;
+	sd->pvp_timer = INVALID_TIMER;
+	sd->rental_timer = INVALID_TIMER;
+	for( i = 0; i < MAX_SKILL_LEVEL; i++ )
+		sd->spirit_timer[i] = INVALID_TIMER;
+	for( i = 0; i < ARRAYLENGTH(sd->autobonus); i++ )
+		sd->autobonus[i].active = INVALID_TIMER;
+	for( i = 0; i < ARRAYLENGTH(sd->autobonus2); i++ )
+		sd->autobonus2[i].active = INVALID_TIMER;
+	for( i = 0; i < ARRAYLENGTH(sd->autobonus3); i++ )
+		sd->autobonus3[i].active = INVALID_TIMER;
+	for( i = 0; i < MAX_EVENTTIMER; i++ )
+		sd->eventtimer[i] = INVALID_TIMER;
+	for( i = 0; i < 3; i++ )
+		sd->hate_mob[i] = -1;
+
+	pc_setinventorydata(sd);
+	pc_setequipindex(sd);
+	status_change_init(&sd->bl);
+	unit_dataset(&sd->bl);
+	map_addprivatepc(sd);
+	status_calc_pc(sd, true);
+	sd->battle_status.hp = sd->battle_status.max_hp;
+	sd->battle_status.sp = sd->battle_status.max_sp;
+	return sd;
+}
+
+static struct block_list* selfcheck_unit_create(const struct selfcheck_unit* u, int m, int x, int y)
+{
+	struct block_list* bl;
+	int i;
+
+	if( u->pc )
+		bl = &selfcheck_pc(u, m, x, y)->bl;
+	else
+	{
+		struct spawn_data data;
+		struct mob_data* md;
+
+		memset(&data, 0, sizeof(data));
+		data.m = m;
+		data.x = x;
+		data.y = y;
+		data.class_ = u->class_;
+		safestrncpy(data.name, u->name, NAME_LENGTH);
+		md = mob_spawn_dataset(&data);
+		status_calc_mob(md, true);
+		bl = &md->bl;
+	}
+
+	for( i = 0; i < ARRAYLENGTH(u->sc) && u->sc[i].type; ++i )
+		status_change_start(bl, (enum sc_type)u->sc[i].type, 10000, u->sc[i].val1, 0, 0, 0, 600000, 3);
+	return bl;
+}
+
+static void selfcheck_unit_free(struct block_list* bl)
+{
+	status_change_clear(bl, 1);
+	if( bl->type == BL_PC )
+	{
+		struct map_session_data* sd = BL_CAST(BL_PC, bl);
+		pc_delautobonus(sd, sd->autobonus, ARRAYLENGTH(sd->autobonus), false);
+		pc_delautobonus(sd, sd->autobonus2, ARRAYLENGTH(sd->autobonus2), false);
+		pc_delautobonus(sd, sd->autobonus3, ARRAYLENGTH(sd->autobonus3), false);
+		if( sd->regstr )
+			aFree(sd->regstr);
+		if( sd->reg )
+			aFree(sd->reg);
+		map_delprivatepc(sd);
+		aFree(sd);
+	}
+	else
+		unit_free(bl, CLR_OUTSIGHT);
+}
+
+static struct selfcheck_result* selfcheck_find(struct selfcheck_result* results, int count, const char* name)
+{
+	int i;
+	ARR_FIND(0, count, i, strcmp(results[i].name, name) == 0);
+	return ( i < count ) ? &results[i] : NULL;
+}
+
+/// Checks the result of one case against the recorded one.
+/// When recording, keeps the result instead. Returns false on a mismatch.
+static bool selfcheck_compare(struct selfcheck_result* results, int* count, const char* name, unsigned long hash, bool record)
+{
+	struct selfcheck_result* r = selfcheck_find(results, *count, name);
+
+	if( record )
+	{
+		if( r == NULL && *count < SELFCHECK_MAX_RESULTS )
+			r = &results[(*count)++];
+		if( r != NULL )
+		{
+			safestrncpy(r->name, name, sizeof(r->name));
+			r->hash = hash;
+			r->seen = true;
+		}
+		return true;
+	}
+	if( r == NULL )
+	{
+		ShowError("battle_selfcheck: %s has no recorded result.\n", name);
+		return false;
+	}
+	r->seen = true;
+	if( r->hash != hash )
+	{
+		ShowError("battle_selfcheck: %s differs from the recorded result.\n", name);
+		return false;
+	}
+	return true;
+}
+
+/// Runs the battle check. Returns false if a result differs from the recorded ones,
+/// or if there are no recorded results (unless recording them).
+bool battle_selfcheck(int rounds, const char* file, bool record)
+{
+	struct block_list* attackers[ARRAYLENGTH(selfcheck_attackers)];
+	struct block_list* targets[ARRAYLENGTH(selfcheck_targets)];
+	struct selfcheck_result* results;
+	char name[64], line[256];
+	int count = 0, mismatches = 0, cases = 0, seed = SELFCHECK_SEED;
+	int i, j, k, n, m, x, y;
+	unsigned int calls = 0, calcs = 0;
+	double sec_attack = 0, sec_status;
+	clock_t t;
+	FILE* fp;
+
+	if( map_num == 0 )
+	{
+		ShowError("battle_selfcheck: no maps loaded.\n");
+		return false;
+	}
+	if( rounds <= 0 )
+		rounds = 1000;
+	if( file == NULL || *file == '\0' )
+		file = "db/battlecheck.txt";
+
+	CREATE(results, struct selfcheck_result, SELFCHECK_MAX_RESULTS);
+	if( !record )
+	{
+		if( (fp = fopen(file, "r")) == NULL )
+		{
+			ShowError("battle_selfcheck: can't read the recorded results in '%s' (see 'server:battlecheck record').\n", file);
+			aFree(results);
+			return false;
+		}
+		while( count < SELFCHECK_MAX_RESULTS && fgets(line, sizeof(line), fp) )
+		{
+			if( line[0] == '/' && line[1] == '/' )
+				continue;
+			if( sscanf(line, "%63s %lx", results[count].name, &results[count].hash) == 2 )
+				++count;
+		}
+		fclose(fp);
+	}
+
+	// all units stand next to each other in the middle of the first map
+	m = 0;
+	x = map[m].xs/2;
+	y = map[m].ys/2;
+	for( i = 0; i < ARRAYLENGTH(attackers); ++i )
+		attackers[i] = selfcheck_unit_create(&selfcheck_attackers[i], m, x, y);
+	for( j = 0; j < ARRAYLENGTH(targets); ++j )
+		targets[j] = selfcheck_unit_create(&selfcheck_targets[j], m, x+1, y);
+
+	for( i = 0; i < ARRAYLENGTH(attackers); ++i )
+	{
+		sprintf(name, "status:%s", selfcheck_attackers[i].name);
+		++cases;
+		if( !selfcheck_compare(results, &count, name, selfcheck_hash_status(status_get_status_data(attackers[i])), record) )
+			++mismatches;
+	}
+	for( j = 0; j < ARRAYLENGTH(targets); ++j )
+	{
+		sprintf(name, "status:%s", selfcheck_targets[j].name);
+		++cases;
+		if( !selfcheck_compare(results, &count, name, selfcheck_hash_status(status_get_status_data(targets[j])), record) )
+			++mismatches;
+	}
+
+	// damage
+	battle_rand_private = true;
+	for( i = 0; i < ARRAYLENGTH(attackers); ++i )
+	for( j = 0; j < ARRAYLENGTH(targets); ++j )
+	for( k = 0; k < ARRAYLENGTH(selfcheck_attacks); ++k )
+	{
+		unsigned long hash = 2166136261UL;
+
+		battle_rand_state = (uint32)seed++;
+		t = clock();
+		for( n = 0; n < rounds; ++n )
+		{
+			struct Damage d = battle_calc_attack(selfcheck_attacks[k].type, attackers[i], targets[j], selfcheck_attacks[k].skill_num, selfcheck_attacks[k].skill_lv, 0);
+			hash = selfcheck_hash(hash, d.damage);
+			hash = selfcheck_hash(hash, d.damage2);
+			hash = selfcheck_hash(hash, d.type);
+			hash = selfcheck_hash(hash, d.div_);
+			hash = selfcheck_hash(hash, d.blewcount);
+			hash = selfcheck_hash(hash, d.flag);
+			hash = selfcheck_hash(hash, d.dmg_lv);
+		}
+		sec_attack += (double)(clock() - t)/CLOCKS_PER_SEC;
+		calls += rounds;
+
+		sprintf(name, "%d:%s>%s:%s", rounds, selfcheck_attackers[i].name, selfcheck_targets[j].name, selfcheck_attacks[k].name);
+		++cases;
+		if( !selfcheck_compare(results, &count, name, hash, record) )
+			++mismatches;
+	}
+	battle_rand_private = false;
+
+	// status calculation
+	t = clock();
+	do
+	{
+		for( i = 0; i < ARRAYLENGTH(attackers); ++i )
+			status_calc_pc(BL_CAST(BL_PC, attackers[i]), false);
+		calcs += ARRAYLENGTH(attackers);
+	} while( clock() - t < CLOCKS_PER_SEC/2 );
+	sec_status = (double)(clock() - t)/CLOCKS_PER_SEC;
+
+	for( i = 0; i < ARRAYLENGTH(attackers); ++i )
+		selfcheck_unit_free(attackers[i]);
+	for( j = 0; j < ARRAYLENGTH(targets); ++j )
+		selfcheck_unit_free(targets[j]);
+
+	if( record )
+	{
+		if( (fp = fopen(file, "w")) == NULL )
+		{
+			ShowError("battle_selfcheck: can't write the results to '%s'.\n", file);
+			++mismatches;
+		}
+		else
+		{
+			fprintf(fp, "// Battle formula check results, see 'server:battlecheck' in the map-server console.\n");
+			fprintf(fp, "// Structure: <case> <hash>\n");
+			fprintf(fp, "// The results change with the battle formulas and with the item, monster and skill\n");
+			fprintf(fp, "// databases; record them again with 'server:battlecheck record' when that is intended.\n");
+			for( i = 0; i < count; ++i )
+				fprintf(fp, "%s %08lx\n", results[i].name, results[i].hash);
+			fclose(fp);
+			ShowInfo("battle_selfcheck: recorded %d results in '%s'.\n", count, file);
+		}
+	}
+	else if( mismatches )
+		ShowError("battle_selfcheck: %d of %d results differ from '%s'.\n", mismatches, cases, file);
+	else
+		ShowInfo("battle_selfcheck: %d results match (%d rounds, seed %d).\n", cases, rounds, SELFCHECK_SEED);
+	ShowInfo("battle_selfcheck: %.0f damage calculations/s, %.0f status_calc_pc/s.\n",
+		sec_attack > 0 ? calls/sec_attack : 0., sec_status > 0 ? calcs/sec_status : 0.);
+	aFree(results);
+	return ( mismatches == 0 );
+}
+
 void do_init_battle(void)
 {
 	delay_damage_ers = ers_new(sizeof(struct delay_damage));
+	ers_prewarm(delay_damage_ers, battle_config.ers_prewarm);
 	add_timer_func_list(battle_delay_damage_sub, "battle_delay_damage_sub");
 }
 
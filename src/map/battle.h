@@ -488,6 +488,7 @@ extern struct Battle_Config
 	int cashshop_show_points;
 	int mail_show_status;
 	int client_limit_unit_lv;
+	int ers_prewarm;
 
 	// [BattleGround Settings]
 	int bg_update_interval;
@@ -499,6 +500,8 @@ extern struct Battle_Config
 	int bg_flee_penalty;
 } battle_config;
 
+bool battle_selfcheck(int rounds, const char* file, bool record);
+
 void do_init_battle(void);
 void do_final_battle(void);
 extern int battle_config_read(const char *cfgName);
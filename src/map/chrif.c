@@ -25,25 +25,43 @@
 #include "chrif.h"
 #include "quest.h"
 #include "storage.h"
+#include "replay.h"
+#include "script.h" // get_str()
+#include "mapreg.h" // mapreg_update()
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <time.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 static int check_connect_char_server(int tid, unsigned int tick, int id, intptr_t data);
+static void chrif_authok_sub(const uint8* buf, int len);
+static int chrif_handoff_timer(int tid, unsigned int tick, int id, intptr_t data);
+static void chrif_handoff(int fd);
+static void chrif_handoff_takeover(int fd);
+static void chrif_handoff_result(int fd);
+static void chrif_handoff_revert(int fd);
+static int chrif_replay_end(int tid, unsigned int tick, int id, intptr_t data);
+static void chrif_mapmoved(int fd);
+static void chrif_parse_mapreg(int fd);
 
 static struct eri *auth_db_ers; //For reutilizing player login structures.
 static DBMap* auth_db; // int id -> struct auth_node*
 
-static const int packet_len_table[0x3d] = { // U - used, F - free
+static const int packet_len_table[0x41] = { // U - used, F - free
 	60, 3,-1,27,10,-1, 6,-1,	// 2af8-2aff: U->2af8, U->2af9, U->2afa, U->2afb, U->2afc, U->2afd, U->2afe, U->2aff
 	 6,-1,18, 7,-1,35,30, 0,	// 2b00-2b07: U->2b00, U->2b01, U->2b02, U->2b03, U->2b04, U->2b05, U->2b06, F->2b07
 	 6,30, 0, 0,86, 7,44,34,	// 2b08-2b0f: U->2b08, U->2b09, F->2b0a, F->2b0b, U->2b0c, U->2b0d, U->2b0e, U->2b0f
 	11,10,10, 0,11, 0,266,10,	// 2b10-2b17: U->2b10, U->2b11, U->2b12, F->2b13, U->2b14, F->2b15, U->2b16, U->2b17
 	 2,10, 2,-1,-1,-1, 2, 7,	// 2b18-2b1f: U->2b18, U->2b19, U->2b1a, U->2b1b, U->2b1c, U->2b1d, U->2b1e, U->2b1f
 	-1,10, 8, 2, 2,14,19,19,	// 2b20-2b27: U->2b20, U->2b21, U->2b22, U->2b23, U->2b24, U->2b25, U->2b26, U->2b27
+	-1, 6,-1,11,-1,-1,-1,10,	// 2b28-2b2f: U->2b28, U->2b29, U->2b2a, U->2b2b, U->2b2c, U->2b2d, U->2b2e, U->2b2f
+	-1,-1, 5, 5,10,-1,-1,10,	// 2b30-2b37: U->2b30, U->2b31, U->2b32, U->2b33, U->2b34, U->2b35, U->2b36, U->2b37
+	 4,				// 2b38: U->2b38
 };
 
 //Used Packets:
@@ -95,6 +113,23 @@ static const int packet_len_table[0x3d] = { // U - used, F - free
 //2b25: Incoming, chrif_deadopt -> 'Removes baby from Father ID and Mother ID'
 //2b26: Outgoing, chrif_authreq -> 'client authentication request'
 //2b27: Incoming, chrif_authfail -> 'client authentication failed'
+//2b28: Both, SERVERLINK_COMPRESSED -> 'compressed packet, see RFIFOUNCOMPRESS'
+//2b29: Incoming, chrif_features -> 'features of the char-server link (accepts compressed packets, delta saves)'
+//2b2a: Outgoing, chrif_save -> 'charsave of char XY account XY (changes since the previous save)'
+//2b2b: Incoming, chrif_save_resync -> 'a delta save couldn't be applied, send the complete struct'
+//2b2c: Outgoing, chrif_assignmaps -> 'which of these maps do we load?' (own connection, before the maps are read)
+//2b2d: Incoming, chrif_assignmaps_parse -> 'the maps assigned to this map-server'
+//2b2e: Outgoing, chrif_sendmapload -> 'users and monsters of each map, cpu usage'
+//2b2f: Incoming, chrif_handoff -> 'hand off a map to another map-server'
+//2b30: Outgoing, chrif_handoff -> 'state of the map handed off (monsters, floor items, npc variables)'
+//2b31: Incoming, chrif_handoff_takeover -> 'take over a map, with its state'
+//2b32: Outgoing, chrif_handoff_takeover -> 'map taken over (ok / fail)'
+//2b33: Incoming, chrif_handoff_result -> 'the map handed off moved (ok / fail)'
+//2b34: Incoming, chrif_mapmoved -> 'a map moved to another map-server'
+//2b35: Outgoing, chrif_mapreg -> 'a permanent global variable changed (map groups)'
+//2b36: Incoming, chrif_parse_mapreg -> 'a permanent global variable changed, in the order of the char-server (map groups)'
+//2b37: Incoming, chrif_handoff_revert -> 'put a map taken over back on standby, its move didn't complete'
+//2b38: Outgoing, chrif_handoff_timer -> 'gave up the handoff of a map'
 
 int chrif_connected = 0;
 int char_fd = -1;
@@ -104,6 +139,26 @@ static uint32 char_ip = 0;
 static uint16 char_port = 6121;
 static char userid[NAME_LENGTH], passwd[NAME_LENGTH];
 static int chrif_state = 0;
+
+/// Status of a character as of its last save, what the delta saves (0x2b2a) are made against.
+struct chrif_save_base {
+	int seq; // sequence of the last save, 0 for a full save (0x2b01)
+	struct mmo_charstatus status;
+};
+static DBMap* save_db; // int char_id -> struct chrif_save_base*
+static bool chrif_delta_save = false; // the char-server accepts delta saves
+static bool chrif_mapload = false; // the char-server wants the load of the maps (0x2b2e)
+static DBMap* mapreg_pending_db; // int uid -> number of changes of the permanent global variable sent and not back yet (map groups)
+#define MAPLOAD_INTERVAL 60000 // interval of the map load reports
+#define CHRIF_SAVE_BLOCK 32 // the status is compared in blocks of this many bytes
+
+/// Save statistics, see chrif_savestats_show.
+static struct {
+	unsigned int full, delta, unchanged, resync;
+	uint64 full_bytes, delta_bytes;
+	unsigned int since;
+} save_stats;
+
 int other_mapserver_count=0; //Holds count of how many other map servers are online (apart of this instance) [Skotlex]
 
 //Interval at which map server updates online listing. [Valaris]
@@ -155,7 +210,10 @@ bool chrif_auth_delete(int account_id, int char_id, enum sd_state state)
 		if (session[fd] && session[fd]->session_data == node->sd)
 			session[fd]->session_data = NULL;
 		if (node->char_dat) aFree(node->char_dat);
-		if (node->sd) aFree(node->sd);
+		if (node->sd) {
+			idb_remove(save_db, node->sd->status.char_id);
+			aFree(node->sd);
+		}
 		ers_free(auth_db_ers, node);
 		idb_remove(auth_db,account_id);
 		return true;
@@ -260,6 +318,93 @@ int chrif_isconnected(void)
 	return (char_fd > 0 && session[char_fd] != NULL && chrif_state == 2);
 }
 
+/// Sends the status of a character to the char-server.
+/// When the char-server has the previous save, only the blocks that changed since then are sent (0x2b2a),
+/// otherwise the whole status is (0x2b01).
+/// Map-server changes always send the whole status, the next map-server gets the character from the char-server.
+static void chrif_save_status(struct map_session_data* sd, int flag)
+{
+	const uint8* cur = (const uint8*)&sd->status;
+	struct chrif_save_base* base = NULL;
+	size_t i, len;
+
+	if( chrif_delta_save && flag != 2 && (base = (struct chrif_save_base*)idb_get(save_db, sd->status.char_id)) != NULL )
+	{// delta save, 0x2b2a <len>.W <account id>.L <char id>.L <flag>.B <base seq>.L <seq>.L { <offset>.W <len>.W <data>.?B }*
+		const uint8* old = (const uint8*)&base->status;
+		int seq = (base->seq + 1)&0x7fffffff;
+
+		WFIFOHEAD(char_fd, 21 + sizeof(sd->status) + 4);
+		len = 21;
+		for( i = 0; i < sizeof(sd->status); )
+		{
+			size_t start = i;
+			while( i < sizeof(sd->status) && memcmp(cur + i, old + i, min(CHRIF_SAVE_BLOCK, sizeof(sd->status) - i)) != 0 )
+				i += CHRIF_SAVE_BLOCK;
+			if( i == start )
+			{
+				i += CHRIF_SAVE_BLOCK;
+				continue;
+			}
+			i = min(i, sizeof(sd->status));
+			if( len + 4 + i - start > 21 + sizeof(sd->status) )
+			{
+				len = 21 + sizeof(sd->status);
+				break;
+			}
+			WFIFOW(char_fd,len) = (uint16)start;
+			WFIFOW(char_fd,len+2) = (uint16)(i - start);
+			memcpy(WFIFOP(char_fd,len+4), cur + start, i - start);
+			len += 4 + i - start;
+		}
+
+		if( len == 21 && flag == 0 )
+		{// nothing changed
+			save_stats.unchanged++;
+			return;
+		}
+		if( len < 21 + sizeof(sd->status) )
+		{
+			WFIFOW(char_fd,0) = 0x2b2a;
+			WFIFOW(char_fd,2) = (uint16)len;
+			WFIFOL(char_fd,4) = sd->status.account_id;
+			WFIFOL(char_fd,8) = sd->status.char_id;
+			WFIFOB(char_fd,12) = (flag==1)?1:0; //Flag to tell char-server this character is quitting.
+			WFIFOL(char_fd,13) = base->seq;
+			WFIFOL(char_fd,17) = seq;
+			WFIFOSET(char_fd,len);
+
+			memcpy(&base->status, &sd->status, sizeof(sd->status));
+			base->seq = seq;
+			save_stats.delta++;
+			save_stats.delta_bytes += len;
+			return;
+		}
+		// as big as the whole status
+	}
+
+	WFIFOHEAD(char_fd, sizeof(sd->status) + 13);
+	WFIFOW(char_fd,0) = 0x2b01;
+	WFIFOW(char_fd,2) = sizeof(sd->status) + 13;
+	WFIFOL(char_fd,4) = sd->status.account_id;
+	WFIFOL(char_fd,8) = sd->status.char_id;
+	WFIFOB(char_fd,12) = (flag==1)?1:0; //Flag to tell char-server this character is quitting.
+	memcpy(WFIFOP(char_fd,13), &sd->status, sizeof(sd->status));
+	WFIFOSET(char_fd, WFIFOW(char_fd,2));
+	save_stats.full++;
+	save_stats.full_bytes += sizeof(sd->status) + 13;
+
+	if( chrif_delta_save )
+	{// the char-server has this one now
+		if( base == NULL && (base = (struct chrif_save_base*)idb_get(save_db, sd->status.char_id)) == NULL )
+		{
+			CREATE(base, struct chrif_save_base, 1);
+			idb_put(save_db, sd->status.char_id, base);
+		}
+		memcpy(&base->status, &sd->status, sizeof(sd->status));
+		base->seq = 0;
+	}
+}
+
 /*==========================================
  * Saves character data.
  * Flag = 1: Character is quitting
@@ -271,6 +416,13 @@ int chrif_save(struct map_session_data *sd, int flag)
 
 	pc_makesavestatus(sd);
 
+	if( sd->state.replay )
+	{// replayed session, the character is a copy of a live one and the char-server must not see it
+		if( flag && sd->state.active && chrif_auth_logout(sd, flag==1?ST_LOGOUT:ST_MAPCHANGE) )
+			add_timer(gettick(), chrif_replay_end, sd->status.account_id, (flag==1)?ST_LOGOUT:ST_MAPCHANGE);
+		return 0;
+	}
+
 	if (flag && sd->state.active) //Store player data which is quitting.
 	{
 		//FIXME: SC are lost if there's no connection at save-time because of the way its related data is cleared immediately after this function. [Skotlex]
@@ -297,14 +449,7 @@ int chrif_save(struct map_session_data *sd, int flag)
 	if (sd->state.reg_dirty&1)
 		intif_saveregistry(sd, 1); //Save account2 regs
 
-	WFIFOHEAD(char_fd, sizeof(sd->status) + 13);
-	WFIFOW(char_fd,0) = 0x2b01;
-	WFIFOW(char_fd,2) = sizeof(sd->status) + 13;
-	WFIFOL(char_fd,4) = sd->status.account_id;
-	WFIFOL(char_fd,8) = sd->status.char_id;
-	WFIFOB(char_fd,12) = (flag==1)?1:0; //Flag to tell char-server this character is quitting.
-	memcpy(WFIFOP(char_fd,13), &sd->status, sizeof(sd->status));
-	WFIFOSET(char_fd, WFIFOW(char_fd,2));
+	chrif_save_status(sd, flag);
 
 	if( sd->status.pet_id > 0 && sd->pd )
 		intif_save_petdata(sd->status.account_id,&sd->pd->pet);
@@ -328,25 +473,31 @@ int chrif_connect(int fd)
 	WFIFOW(fd,0) = 0x2af8;
 	memcpy(WFIFOP(fd,2), userid, NAME_LENGTH);
 	memcpy(WFIFOP(fd,26), passwd, NAME_LENGTH);
-	WFIFOL(fd,50) = 0;
+	WFIFOL(fd,50) = SERVERLINK_FEATURE_COMPRESS|SERVERLINK_FEATURE_DELTASAVE|SERVERLINK_FEATURE_MAPLOAD;
 	WFIFOL(fd,54) = htonl(clif_getip());
 	WFIFOW(fd,58) = htons(clif_getport());
 	WFIFOSET(fd,60);
 
+	// new link, the char-server answers what it supports in chrif_features
+	chrif_delta_save = false;
+	chrif_mapload = false;
+	save_db->clear(save_db, NULL);
+
 	return 0;
 }
 
 // sends maps to char-server
 int chrif_sendmap(int fd)
 {
-	int i;
+	int i, n;
 	ShowStatus("Sending maps to char server...\n");
 	// Sending normal maps, not instances
 	WFIFOHEAD(fd, 4 + instance_start * 4);
 	WFIFOW(fd,0) = 0x2afa;
-	for(i = 0; i < instance_start; i++)
-		WFIFOW(fd,4+i*4) = map[i].index;
-	WFIFOW(fd,2) = 4 + i * 4;
+	for(i = 0, n = 0; i < instance_start; i++)
+		if( !map[i].standby ) // maps on standby are served by other map-servers
+			WFIFOW(fd,4+(n++)*4) = map[i].index;
+	WFIFOW(fd,2) = 4 + n * 4;
 	WFIFOSET(fd,WFIFOW(fd,2));
 
 	return 0;
@@ -392,11 +543,51 @@ static void chrif_save_ack(int fd)
 	chrif_check_shutdown();
 }
 
+/// The char-server couldn't apply a delta save (it doesn't have the previous one), send the whole status.
+static void chrif_save_resync(int fd)
+{
+	int account_id = RFIFOL(fd,2);
+	int char_id = RFIFOL(fd,6);
+	int flag = RFIFOB(fd,10);
+	struct auth_node* node = chrif_search(account_id);
+	struct map_session_data* sd;
+
+	save_stats.resync++;
+	idb_remove(save_db, char_id);
+	if( node != NULL && node->char_id == char_id && node->state == ST_LOGOUT && node->sd != NULL )
+		sd = node->sd; // final save, waiting for the ack
+	else if( (sd = map_id2sd(account_id)) == NULL || sd->status.char_id != char_id )
+	{
+		ShowWarning("chrif_save_resync: Character %d:%d is gone, its last changes are lost.\n", account_id, char_id);
+		return;
+	}
+
+	pc_makesavestatus(sd);
+	chrif_save_status(sd, flag);
+}
+
+/// Ends the logout or map-server change of a replayed session, in place of the answer of the char-server.
+static int chrif_replay_end(int tid, unsigned int tick, int id, intptr_t data)
+{
+	struct auth_node* node = chrif_search(id);
+
+	if( node == NULL || node->sd == NULL || !node->sd->state.replay || node->state != (enum sd_state)data )
+		return 0;
+	if( node->state == ST_MAPCHANGE )
+		clif_authfail_fd(node->fd, 0); // can't follow to another map-server
+	chrif_auth_delete(node->account_id, node->char_id, node->state);
+	chrif_check_shutdown();
+	return 0;
+}
+
 // request to move a character between mapservers
 int chrif_changemapserver(struct map_session_data* sd, uint32 ip, uint16 port)
 {
 	nullpo_retr(-1, sd);
 
+	if( sd->state.replay )
+		return -1; // ended by chrif_replay_end
+
 	if (other_mapserver_count < 1)
 	{	//No other map servers are online!
 		clif_authfail_fd(sd->fd, 0);
@@ -468,6 +659,19 @@ int chrif_connectack(int fd)
 
 	return 0;
 }
+
+/*==========================================
+ * Features of the char-server link, sent before 0x2af9 if we announced ours
+ *------------------------------------------*/
+static int chrif_features(int fd)
+{
+	if( RFIFOL(fd,2)&SERVERLINK_FEATURE_COMPRESS )
+		socket_compress(fd);
+	chrif_delta_save = ( (RFIFOL(fd,2)&SERVERLINK_FEATURE_DELTASAVE) != 0 );
+	chrif_mapload = ( (RFIFOL(fd,2)&SERVERLINK_FEATURE_MAPLOAD) != 0 );
+
+	return 0;
+}
 static int chrif_reconnect(DBKey key,void *data,va_list ap)
 {
 	struct auth_node *node=(struct auth_node*)data;
@@ -556,6 +760,8 @@ int chrif_scdata_request(int account_id, int char_id)
 void chrif_authreq(struct map_session_data *sd)
 {
 	struct auth_node *node= chrif_search(sd->bl.id);
+	const uint8* data;
+	int len;
 
 	if( node != NULL )
 	{
@@ -563,6 +769,14 @@ void chrif_authreq(struct map_session_data *sd)
 		return;
 	}
 
+	if( (data = replay_authdata(sd->fd, sd->status.account_id, sd->login_id1, &len)) != NULL )
+	{// replayed session, use the recorded character data
+		sd->state.replay = 1;
+		chrif_sd_to_auth(sd, ST_LOGIN);
+		chrif_authok_sub(data, len);
+		return;
+	}
+
 	if( !chrif_isconnected() )
 		return;
 
@@ -579,8 +793,9 @@ void chrif_authreq(struct map_session_data *sd)
 
 /*==========================================
  * Auth confirmation ack
+ * buf is the 0x2afd packet from offset 4
  *------------------------------------------*/
-void chrif_authok(int fd)
+static void chrif_authok_sub(const uint8* buf, int len)
 {
 	int account_id;
 	uint32 login_id1;
@@ -592,19 +807,12 @@ void chrif_authok(int fd)
 	struct auth_node *node;
 	TBL_PC* sd;
 
-	//Check if both servers agree on the struct's size
-	if( RFIFOW(fd,2) - 24 != sizeof(struct mmo_charstatus) )
-	{
-		ShowError("chrif_authok: Data size mismatch! %d != %d\n", RFIFOW(fd,2) - 24, sizeof(struct mmo_charstatus));
-		return;
-	}
-
-	account_id = RFIFOL(fd,4);
-	login_id1 = RFIFOL(fd,8);
-	login_id2 = RFIFOL(fd,12);
-	expiration_time = (time_t)(int32)RFIFOL(fd,16);
-	gmlevel = RFIFOL(fd,20);
-	status = (struct mmo_charstatus*)RFIFOP(fd,24);
+	account_id = RBUFL(buf,0);
+	login_id1 = RBUFL(buf,4);
+	login_id2 = RBUFL(buf,8);
+	expiration_time = (time_t)(int32)RBUFL(buf,12);
+	gmlevel = RBUFL(buf,16);
+	status = (struct mmo_charstatus*)RBUFP(buf,20);
 
 	char_id = status->char_id;
 
@@ -636,6 +844,7 @@ void chrif_authok(int fd)
 		node->char_id == char_id &&
 		node->login_id1 == login_id1 )
 	{ //Auth Ok
+		replay_capture_auth(sd->fd, buf, len);
 		if (pc_authok(sd, login_id2, expiration_time, gmlevel, status))
 			return;
 	} else { //Auth Failed
@@ -645,6 +854,18 @@ void chrif_authok(int fd)
 	chrif_auth_delete(account_id, char_id, ST_LOGIN);
 }
 
+void chrif_authok(int fd)
+{
+	//Check if both servers agree on the struct's size
+	if( RFIFOW(fd,2) - 24 != sizeof(struct mmo_charstatus) )
+	{
+		ShowError("chrif_authok: Data size mismatch! %d != %d\n", RFIFOW(fd,2) - 24, sizeof(struct mmo_charstatus));
+		return;
+	}
+
+	chrif_authok_sub((const uint8*)RFIFOP(fd,4), RFIFOW(fd,2) - 4);
+}
+
 // client authentication failed
 void chrif_authfail(int fd)
 {
@@ -1264,6 +1485,8 @@ int chrif_ragsrvinfo(int base_rate, int job_rate, int drop_rate)
 int chrif_char_offline(struct map_session_data *sd)
 {
 	chrif_check(-1);
+	if( sd->state.replay )
+		return 0; // replayed session, unknown to the char-server
 
 	WFIFOHEAD(char_fd,10);
 	WFIFOW(char_fd,0) = 0x2b17;
@@ -1321,6 +1544,8 @@ int chrif_char_reset_offline(void)
 int chrif_char_online(struct map_session_data *sd)
 {
 	chrif_check(-1);
+	if( sd->state.replay )
+		return 0; // replayed session, unknown to the char-server
 
 	WFIFOHEAD(char_fd,10);
 	WFIFOW(char_fd,0) = 0x2b19;
@@ -1338,6 +1563,7 @@ void chrif_on_disconnect(void)
 	if( chrif_connected != 1 )
 		ShowWarning("Connection to Char Server lost.\n\n");
 	chrif_connected = 0;
+	mapreg_pending_db->clear(mapreg_pending_db, NULL); // their echoes are lost
 	
  	other_mapserver_count = 0; //Reset counter. We receive ALL maps from all map-servers on reconnect.
 	map_eraseallipport();
@@ -1400,6 +1626,18 @@ int chrif_parse(int fd)
 	while (RFIFOREST(fd) >= 2)
 	{
 		cmd = RFIFOW(fd,0);
+		if (cmd == SERVERLINK_COMPRESSED)
+		{// unpack it in the buffer and parse the packet it contains
+			int r = RFIFOUNCOMPRESS(fd);
+			if (r == 0)
+				return 0;
+			if (r < 0)
+			{
+				set_eof(fd);
+				return 0;
+			}
+			continue;
+		}
 		if (cmd < 0x2af8 || cmd >= 0x2af8 + ARRAYLENGTH(packet_len_table) || packet_len_table[cmd-0x2af8] == 0)
 		{
 			int r = intif_parse(fd); // intifɓn
@@ -1449,6 +1687,14 @@ int chrif_parse(int fd)
 		case 0x2b24: chrif_keepalive_ack(fd); break;
 		case 0x2b25: chrif_deadopt(RFIFOL(fd,2), RFIFOL(fd,6), RFIFOL(fd,10)); break;
 		case 0x2b27: chrif_authfail(fd); break;
+		case 0x2b29: chrif_features(fd); break;
+		case 0x2b2b: chrif_save_resync(fd); break;
+		case 0x2b2f: chrif_handoff(fd); break;
+		case 0x2b31: chrif_handoff_takeover(fd); break;
+		case 0x2b33: chrif_handoff_result(fd); break;
+		case 0x2b34: chrif_mapmoved(fd); break;
+		case 0x2b36: chrif_parse_mapreg(fd); break;
+		case 0x2b37: chrif_handoff_revert(fd); break;
 		default:
 			ShowError("chrif_parse : unknown packet (session #%d): 0x%x. Disconnecting.\n", fd, cmd);
 			set_eof(fd);
@@ -1510,6 +1756,490 @@ int send_users_tochar(void)
 	return 0;
 }
 
+/// Sends the load of the maps to the char-server, which assigns the maps of the map-servers with map_assign: yes.
+/// 0x2b2e <len>.W <cpu usage>.W { <map index>.W <users>.W <monsters>.W }*
+/// The cpu usage is the permille of the time the map-server used the cpu since the previous report.
+static int chrif_sendmapload(int tid, unsigned int tick, int id, intptr_t data)
+{
+	static clock_t last_clock = 0;
+	static unsigned int last_tick = 0;
+	clock_t now = clock();
+	unsigned int cpu = 0;
+	int m, len;
+
+	if( last_tick != 0 && DIFF_TICK(tick, last_tick) > 0 )
+		cpu = (unsigned int)((double)(now - last_clock) * 1000 * 1000 / CLOCKS_PER_SEC / DIFF_TICK(tick, last_tick));
+	last_clock = now;
+	last_tick = tick;
+
+	if( !chrif_isconnected() || !chrif_mapload )
+		return 0;
+
+	WFIFOHEAD(char_fd, 6 + instance_start * 6);
+	WFIFOW(char_fd,0) = 0x2b2e;
+	WFIFOW(char_fd,4) = (uint16)min(cpu, 0xffff);
+	for( m = 0, len = 6; m < instance_start; ++m )
+	{
+		int i, mobs = 0;
+
+		if( map[m].standby )
+			continue;
+		for( i = 0; i < MAX_MOB_LIST_PER_MAP; ++i )
+			if( map[m].moblist[i] != NULL )
+				mobs += map[m].moblist[i]->num;
+		WFIFOW(char_fd,len) = map[m].index;
+		WFIFOW(char_fd,len+2) = (uint16)min(map[m].users, 0xffff);
+		WFIFOW(char_fd,len+4) = (uint16)min(mobs, 0xffff);
+		len += 6;
+	}
+	WFIFOW(char_fd,2) = len;
+	WFIFOSET(char_fd,len);
+	return 0;
+}
+
+#define HANDOFF_TIMEOUT 30000 // how long to wait for the char-server to move a map handed off (ms)
+#define HANDOFF_PARK_DELAY 1000 // how long a map is parked before its state is taken, so the delayed drops and damage land (ms)
+
+/// Map being handed off to another map-server.
+static struct {
+	int m; // -1 if none
+	unsigned char* state; // state sent, to put the floor items back if the map doesn't move (NULL while parked)
+	int len;
+	int timer;
+	uint32 ip; // map-server taking over the map
+	uint16 port;
+} chrif_handoff_data = { -1, NULL, 0, INVALID_TIMER, 0, 0 };
+
+/// Ends the handoff and lets the players and monsters of the map go on. If the map didn't move, puts its floor items back.
+static void chrif_handoff_end(bool moved)
+{
+	int m = chrif_handoff_data.m;
+
+	if( m < 0 )
+		return;
+	if( chrif_handoff_data.timer != INVALID_TIMER )
+		delete_timer(chrif_handoff_data.timer, chrif_handoff_timer);
+	map[m].frozen = false;
+	if( !moved && chrif_handoff_data.state )
+		map_handoff_unpack(m, chrif_handoff_data.state, chrif_handoff_data.len, true);
+	if( chrif_handoff_data.state )
+		aFree(chrif_handoff_data.state);
+	chrif_handoff_data.m = -1;
+	chrif_handoff_data.state = NULL;
+	chrif_handoff_data.len = 0;
+	chrif_handoff_data.timer = INVALID_TIMER;
+}
+
+/// Sends the state of the map handed off, once it was parked long enough.
+/// The floor items are taken off the map until the answer (0x2b33), so they can't be picked up twice.
+/// S 2b30 <len>.W <map index>.W <result>.B <state>.?B
+static void chrif_handoff_send(void)
+{
+	int m = chrif_handoff_data.m, len;
+
+	if( !chrif_isconnected() )
+	{
+		ShowWarning("chrif_handoff: Lost the char-server, map '%s' stays on this map-server.\n", map[m].name);
+		chrif_handoff_end(false);
+		return;
+	}
+
+	WFIFOHEAD(char_fd, 0xffff);
+	WFIFOW(char_fd,0) = 0x2b30;
+	WFIFOW(char_fd,4) = map[m].index;
+	if( (len = map_handoff_pack(m, WFIFOP(char_fd,7), 0xffff - 7)) < 0 )
+	{
+		WFIFOB(char_fd,6) = 4;
+		WFIFOW(char_fd,2) = 7;
+		WFIFOSET(char_fd,7);
+		ShowWarning("chrif_handoff: Can't hand off map '%s' (result 4).\n", map[m].name);
+		chrif_handoff_end(false);
+		return;
+	}
+	WFIFOB(char_fd,6) = 0;
+	WFIFOW(char_fd,2) = 7 + len;
+	chrif_handoff_data.state = (unsigned char*)aMalloc(len);
+	memcpy(chrif_handoff_data.state, WFIFOP(char_fd,7), len);
+	chrif_handoff_data.len = len;
+	chrif_handoff_data.timer = add_timer(gettick() + HANDOFF_TIMEOUT, chrif_handoff_timer, 0, 0);
+	WFIFOSET(char_fd, 7 + len);
+
+	ShowStatus("Handing off map '"CL_WHITE"%s"CL_RESET"' to map-server %u.%u.%u.%u:%u (%d bytes of state).\n", map[m].name, CONVIP(chrif_handoff_data.ip), chrif_handoff_data.port, len);
+}
+
+/// The map handed off was parked long enough, or the char-server didn't say whether it moved.
+/// In that case the map stays here, and the char-server is told so it doesn't move it after all
+/// (it times out the move before this, this is in case the answer got lost).
+/// S 2b38 <map index>.W
+static int chrif_handoff_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	int m = chrif_handoff_data.m;
+
+	if( chrif_handoff_data.timer != tid )
+		return 0;
+	chrif_handoff_data.timer = INVALID_TIMER;
+	if( chrif_handoff_data.state == NULL )
+	{
+		chrif_handoff_send();
+		return 0;
+	}
+	ShowWarning("chrif_handoff: No answer from the char-server, map '%s' stays on this map-server.\n", map[m].name);
+	if( chrif_isconnected() )
+	{
+		WFIFOHEAD(char_fd,4);
+		WFIFOW(char_fd,0) = 0x2b38;
+		WFIFOW(char_fd,2) = map[m].index;
+		WFIFOSET(char_fd,4);
+	}
+	chrif_handoff_end(false);
+	return 0;
+}
+
+/// Hands off a map to another map-server: sends its state, which the char-server relays to the new map-server.
+/// The map is parked first (map_data::frozen): its players can't act, its monsters don't think
+/// and nothing on it takes damage, so nothing changes that wouldn't move with it.
+/// The state is sent (chrif_handoff_send) once what was already under way landed.
+/// R 2b2f <map index>.W <ip>.L <port>.W
+/// S 2b30 <len>.W <map index>.W <result>.B <state>.?B
+/// result: 0 = ok, 1 = not served here, 2 = source of instances, 3 = busy, 4 = state too large
+static void chrif_handoff(int fd)
+{
+	unsigned short mapindex = RFIFOW(fd,2);
+	uint32 ip = ntohl(RFIFOL(fd,4));
+	uint16 port = ntohs(RFIFOW(fd,8));
+	int m = map_mapindex2mapid(mapindex);
+	uint8 result = 0;
+
+	if( m < 0 || map[m].standby || map[m].instance_id )
+		result = 1;
+	else if( map[m].flag.src4instance )
+		result = 2; // the instances stay on this map-server
+	else if( chrif_handoff_data.m >= 0 )
+		result = 3;
+
+	if( result != 0 )
+	{
+		WFIFOHEAD(fd,7);
+		WFIFOW(fd,0) = 0x2b30;
+		WFIFOW(fd,2) = 7;
+		WFIFOW(fd,4) = mapindex;
+		WFIFOB(fd,6) = result;
+		WFIFOSET(fd,7);
+		ShowWarning("chrif_handoff: Can't hand off map '%s' (result %d).\n", mapindex_id2name(mapindex), result);
+		return;
+	}
+
+	chrif_handoff_data.m = m;
+	chrif_handoff_data.ip = ip;
+	chrif_handoff_data.port = port;
+	chrif_handoff_data.timer = add_timer(gettick() + HANDOFF_PARK_DELAY, chrif_handoff_timer, 0, 0);
+	map[m].frozen = true;
+	ShowStatus("Parking map '"CL_WHITE"%s"CL_RESET"' to hand it off to map-server %u.%u.%u.%u:%u.\n", map[m].name, CONVIP(ip), port);
+}
+
+/// Takes over a map on standby, handed off by another map-server.
+/// R 2b31 <len>.W <map index>.W <result>.B <state>.?B
+/// S 2b32 <map index>.W <result>.B
+/// result: 0 = ok, 1 = not on standby here, 2 = invalid state
+static void chrif_handoff_takeover(int fd)
+{
+	unsigned short mapindex = RFIFOW(fd,4);
+	int m = map_mapindex2mapid(mapindex);
+	uint8 result = 0;
+
+	if( m < 0 || !map[m].standby )
+		result = 1;
+	else
+	{// the npcs of a map on standby didn't run their OnInit, the state sent replaces what it sets up
+		map[m].standby = false;
+		npc_event_doall_map("OnInit", m);
+		if( !map_handoff_unpack(m, RFIFOP(fd,7), RFIFOW(fd,2) - 7, false) )
+		{
+			map[m].standby = true; // its npc timers stop
+			result = 2;
+		}
+		else
+		{
+			map[m].standby_ip = 0;
+			map[m].standby_port = 0;
+		}
+	}
+
+	WFIFOHEAD(fd,5);
+	WFIFOW(fd,0) = 0x2b32;
+	WFIFOW(fd,2) = mapindex;
+	WFIFOB(fd,4) = result;
+	WFIFOSET(fd,5);
+
+	if( result == 0 )
+		ShowStatus("Took over map '"CL_WHITE"%s"CL_RESET"'.\n", map[m].name);
+	else
+		ShowWarning("chrif_handoff_takeover: Can't take over map '%s' (result %d).\n", mapindex_id2name(mapindex), result);
+}
+
+/// Sends the players of map m, which went on standby, to the map-server that serves it now.
+/// Returns the number of players sent.
+static int chrif_handoff_sendplayers(int m)
+{
+	struct s_mapiterator* iter;
+	struct map_session_data* sd;
+	int* ids;
+	int i, count = 0;
+
+	// collected first, pc_setpos frees them
+	CREATE(ids, int, map[m].users + 1);
+	iter = mapit_getallusers();
+	for( sd = (TBL_PC*)mapit_first(iter); mapit_exists(iter) && count < map[m].users; sd = (TBL_PC*)mapit_next(iter) )
+		if( sd->bl.m == m )
+			ids[count++] = sd->bl.id;
+	mapit_free(iter);
+	for( i = 0; i < count; ++i )
+		if( (sd = map_id2sd(ids[i])) != NULL && sd->bl.m == m )
+			pc_setpos(sd, map[m].index, sd->bl.x, sd->bl.y, CLR_TELEPORT);
+	aFree(ids);
+	return count;
+}
+
+/// Answer to the handoff of a map. If it moved, the map goes on standby and its players follow it.
+/// R 2b33 <map index>.W <result>.B
+static void chrif_handoff_result(int fd)
+{
+	unsigned short mapindex = RFIFOW(fd,2);
+	int m = chrif_handoff_data.m, count;
+
+	if( m < 0 || map[m].index != mapindex )
+		return;
+	if( RFIFOB(fd,4) != 0 )
+	{
+		ShowWarning("chrif_handoff_result: Map '%s' didn't move (result %d), it stays on this map-server.\n", map[m].name, RFIFOB(fd,4));
+		chrif_handoff_end(false);
+		return;
+	}
+	if( chrif_handoff_data.state == NULL )
+		return; // still parked, its state wasn't sent yet
+
+	map[m].standby = true;
+	map[m].standby_ip = chrif_handoff_data.ip;
+	map[m].standby_port = chrif_handoff_data.port;
+	chrif_handoff_end(true);
+	count = chrif_handoff_sendplayers(m);
+
+	ShowStatus("Map '"CL_WHITE"%s"CL_RESET"' moved, '"CL_WHITE"%d"CL_RESET"' players sent to its new map-server.\n", map[m].name, count);
+}
+
+static int chrif_handoff_revert_sub(struct block_list* bl, va_list ap)
+{
+	map_clearflooritem(bl->id);
+	return 0;
+}
+
+/// Puts a map taken over back on standby: its move didn't complete in time and it stays on the source map-server,
+/// which kept its floor items.
+/// R 2b37 <map index>.W <ip>.L <port>.W
+static void chrif_handoff_revert(int fd)
+{
+	unsigned short mapindex = RFIFOW(fd,2);
+	int m = map_mapindex2mapid(mapindex);
+
+	if( m < 0 || map[m].standby || m == chrif_handoff_data.m )
+		return;
+	map_foreachinmap(chrif_handoff_revert_sub, m, BL_ITEM);
+	map[m].standby = true;
+	map[m].standby_ip = ntohl(RFIFOL(fd,4));
+	map[m].standby_port = ntohs(RFIFOW(fd,8));
+	chrif_handoff_sendplayers(m);
+	ShowWarning("chrif_handoff_revert: The move of map '%s' didn't complete, it goes back on standby.\n", map[m].name);
+}
+
+/// Shares the change of a permanent global variable with the other map groups.
+/// The change is already applied here. The char-server sends it back to all the groups (0x2b36),
+/// sender included, which sets a single order for the changes of all of them.
+/// S 2b35 <len>.W <ip>.L <key>.L <group>.W <index>.L <value>.L <name>.?B <str>.?B
+void chrif_mapreg(int uid, int val, const char* str)
+{
+	const char* name = get_str(uid&0x00ffffff);
+	int namelen, len;
+
+	if( map_groups <= 1 || name[1] == '@' )
+		return; // temporary global variables stay in each group
+	if( !chrif_isconnected() )
+	{// at startup every group runs the same OnInit events
+		if( runflag == MAPSERVER_ST_RUNNING )
+			ShowWarning("chrif_mapreg: No char-server, the change of '%s' isn't shared with the other map groups.\n", name);
+		return;
+	}
+	namelen = (int)strlen(name) + 1;
+	len = 22 + namelen + ( str ? (int)safestrnlen(str, 255) + 1 : 0 ); // strings of up to 255 characters, like the sql storage
+	WFIFOHEAD(char_fd,len);
+	WFIFOW(char_fd,0) = 0x2b35;
+	WFIFOW(char_fd,2) = len;
+	WFIFOL(char_fd,4) = clif_getip();
+	WFIFOL(char_fd,8) = map_group_key;
+	WFIFOW(char_fd,12) = map_group;
+	WFIFOL(char_fd,14) = (uint32)uid >> 24;
+	WFIFOL(char_fd,18) = val;
+	memcpy(WFIFOP(char_fd,22), name, namelen);
+	if( str )
+		safestrncpy((char*)WFIFOP(char_fd,22+namelen), str, len - 22 - namelen);
+	WFIFOSET(char_fd,len);
+	idb_put(mapreg_pending_db, uid, (void*)((intptr_t)idb_get(mapreg_pending_db, uid) + 1));
+}
+
+/// A permanent global variable changed in a map group of this map-server, in the order of the char-server.
+/// The own changes are already applied. The changes of the other groups are applied, unless an own change
+/// of the same variable is still on its way back: it comes later in the order and overwrites them.
+/// R 2b36 <len>.W <ip>.L <key>.L <group>.W <index>.L <value>.L <name>.?B <str>.?B
+static void chrif_parse_mapreg(int fd)
+{
+	const char* name = (const char*)RFIFOP(fd,22);
+	int len = RFIFOW(fd,2), namelen, uid, pending;
+
+	if( map_groups <= 1 || RFIFOL(fd,4) != clif_getip() || RFIFOL(fd,8) != map_group_key )
+		return; // another map-server
+	namelen = ( len > 22 ) ? (int)safestrnlen(name, len - 22) + 1 : 0;
+	if( namelen < 2 || 22 + namelen > len || name[0] != '$' )
+		return;
+	if( len > 22 + namelen )
+		RFIFOB(fd,len-1) = '\0';
+
+	uid = (RFIFOL(fd,14)<<24)|add_str(name);
+	pending = (int)(intptr_t)idb_get(mapreg_pending_db, uid);
+	if( RFIFOW(fd,12) == map_group )
+	{// own change, back
+		if( pending > 1 )
+			idb_put(mapreg_pending_db, uid, (void*)(intptr_t)(pending - 1));
+		else
+			idb_remove(mapreg_pending_db, uid);
+		return;
+	}
+	if( pending > 0 )
+		return;
+	mapreg_update(name, RFIFOL(fd,14), RFIFOL(fd,18), ( len > 22 + namelen ) ? (const char*)RFIFOP(fd,22+namelen) : NULL);
+}
+
+/// A map moved to another map-server.
+/// R 2b34 <map index>.W <ip>.L <port>.W
+static void chrif_mapmoved(int fd)
+{
+	map_setipport(RFIFOW(fd,2), ntohl(RFIFOL(fd,4)), ntohs(RFIFOW(fd,8)));
+}
+
+
+static bool chrif_assign_done;
+static bool chrif_assign_closed; // connection closed before the answer, ask again
+
+/// Answer of the char-server to chrif_assignmaps.
+/// 0x2b2d <len>.W <result>.B { <map index>.W }*
+/// result: 0 = the maps to load follow, 1 = refused (wrong user/password), 2 = map assignment is off, 3 = all the slots are in use
+static int chrif_assignmaps_parse(int fd)
+{
+	unsigned short* mapindexes;
+	int i, count, removed;
+
+	if( session[fd]->flag.eof )
+	{
+		if( !chrif_assign_done )
+			chrif_assign_closed = true;
+		do_close(fd);
+		return 0;
+	}
+	if( RFIFOREST(fd) < 4 || RFIFOREST(fd) < RFIFOW(fd,2) )
+		return 0;
+	if( RFIFOW(fd,0) != 0x2b2d )
+	{
+		ShowError("chrif_assignmaps: Unexpected packet 0x%04x from the char-server.\n", RFIFOW(fd,0));
+		set_eof(fd);
+		return 0;
+	}
+
+	switch( RFIFOB(fd,4) )
+	{
+	case 0:
+		count = (RFIFOW(fd,2) - 5) / 2;
+		CREATE(mapindexes, unsigned short, count + 1);
+		for( i = 0; i < count; ++i )
+			mapindexes[i] = RFIFOW(fd,5+i*2);
+		removed = map_keepmaps(mapindexes, count);
+		aFree(mapindexes);
+		ShowStatus("The char-server assigned '"CL_WHITE"%d"CL_RESET"' maps to this map-server ('"CL_WHITE"%d"CL_RESET"' left to the other map-servers).\n", count, removed);
+		break;
+	case 1:
+		ShowError("chrif_assignmaps: The char-server refused the user/password, loading all the listed maps.\n");
+		break;
+	case 3:
+		removed = map_keepmaps(NULL, 0);
+		ShowError("chrif_assignmaps: All the map_assign_servers slots of the char-server are in use, no maps loaded ('"CL_WHITE"%d"CL_RESET"' left to the other map-servers).\n", removed);
+		break;
+	default:
+		ShowWarning("chrif_assignmaps: Map assignment is off in the char-server (map_assign_servers), loading all the listed maps.\n");
+		break;
+	}
+	chrif_assign_done = true;
+	RFIFOSKIP(fd, RFIFOW(fd,2));
+	set_eof(fd);
+	return 0;
+}
+
+/// Asks the char-server which of the listed maps this map-server loads (map_assign: yes).
+/// Done before the maps are read, on a connection of its own, waiting until the char-server answers.
+/// 0x2b2c <len>.W <user id>.24B <password>.24B <ip>.L <port>.W { <map index>.W }*
+void chrif_assignmaps(void)
+{
+	int fd, i, len;
+
+	ShowStatus("Asking the char-server which maps to load...\n");
+	chrif_assign_done = false;
+	chrif_assign_closed = true;
+	while( chrif_assign_closed )
+	{
+		chrif_assign_closed = false;
+		while( (fd = make_connection(char_ip, char_port)) == -1 )
+		{
+			if( runflag == CORE_ST_STOP )
+				return;
+			ShowStatus("Char-server not available, trying again in 5 seconds...\n");
+#ifdef _WIN32
+			Sleep(5000);
+#else
+			sleep(5);
+#endif
+		}
+		session[fd]->func_parse = chrif_assignmaps_parse;
+		session[fd]->flag.server = 1;
+		realloc_fifo(fd, FIFOSIZE_SERVERLINK, FIFOSIZE_SERVERLINK);
+
+		WFIFOHEAD(fd, 58 + map_num * 2);
+		WFIFOW(fd,0) = 0x2b2c;
+		memcpy(WFIFOP(fd,4), userid, NAME_LENGTH);
+		memcpy(WFIFOP(fd,28), passwd, NAME_LENGTH);
+		WFIFOL(fd,52) = htonl(clif_getip());
+		WFIFOW(fd,56) = htons(clif_getport());
+		for( i = 0, len = 58; i < map_num; ++i )
+		{
+			unsigned short index = mapindex_name2id(map[i].name);
+			if( index == 0 )
+				continue; // not in the map index
+			WFIFOW(fd,len) = index;
+			len += 2;
+		}
+		WFIFOW(fd,2) = len;
+		WFIFOSET(fd,len);
+
+		while( !chrif_assign_done && !chrif_assign_closed && runflag != CORE_ST_STOP )
+			do_sockets(100);
+
+		if( chrif_assign_closed && runflag != CORE_ST_STOP )
+		{// not ready yet (no login-server connection), ask again
+			ShowStatus("The char-server closed the connection, trying again in 5 seconds...\n");
+#ifdef _WIN32
+			Sleep(5000);
+#else
+			sleep(5);
+#endif
+		}
+	}
+}
+
 /*==========================================
  * timer֐
  * charIƂ̐ڑmFA؂Ăēxڑ
@@ -1553,6 +2283,29 @@ static int check_connect_char_server(int tid, unsigned int tick, int id, intptr_
 	return 0;
 }
 
+/// Shows how many bytes the character saves took, full and delta.
+void chrif_savestats_show(void)
+{
+	unsigned int saves = save_stats.full + save_stats.delta + save_stats.unchanged;
+	uint64 bytes = save_stats.full_bytes + save_stats.delta_bytes;
+	size_t full_size = sizeof(struct mmo_charstatus) + 13;
+
+	ShowInfo("Character saves over the last %u seconds (delta saves are %s):\n", DIFF_TICK(gettick(), save_stats.since) / 1000, chrif_delta_save ? "on" : "off");
+	ShowMessage("  full:      %7u saves, %10"PRIu64" bytes\n", save_stats.full, save_stats.full_bytes);
+	ShowMessage("  delta:     %7u saves, %10"PRIu64" bytes (%"PRIu64" bytes per save)\n", save_stats.delta, save_stats.delta_bytes, save_stats.delta ? save_stats.delta_bytes / save_stats.delta : 0);
+	ShowMessage("  unchanged: %7u saves (not sent)\n", save_stats.unchanged);
+	ShowMessage("  resyncs:   %7u (delta saves the char-server couldn't apply)\n", save_stats.resync);
+	if( saves > 0 )
+		ShowInfo("%"PRIu64" bytes per save, %u with full saves only (%"PRIu64"%%).\n", bytes / saves, (unsigned int)full_size, bytes * 100 / ((uint64)saves * full_size));
+}
+
+/// Resets the character save statistics.
+void chrif_savestats_reset(void)
+{
+	memset(&save_stats, 0, sizeof(save_stats));
+	save_stats.since = gettick();
+}
+
 int auth_db_final(DBKey k,void *d,va_list ap)
 {
 	struct auth_node *node=(struct auth_node*)d;
@@ -1577,6 +2330,8 @@ int do_final_chrif(void)
 
 	auth_db->destroy(auth_db, auth_db_final);
 	ers_destroy(auth_db_ers);
+	save_db->destroy(save_db, NULL);
+	mapreg_pending_db->destroy(mapreg_pending_db, NULL);
 	return 0;
 }
 
@@ -1587,10 +2342,16 @@ int do_init_chrif(void)
 {
 	auth_db = idb_alloc(DB_OPT_BASE);
 	auth_db_ers = ers_new(sizeof(struct auth_node));
+	save_db = idb_alloc(DB_OPT_RELEASE_DATA);
+	mapreg_pending_db = idb_alloc(DB_OPT_BASE);
+	save_stats.since = gettick();
 
 	add_timer_func_list(check_connect_char_server, "check_connect_char_server");
 	add_timer_func_list(ping_char_server, "ping_char_server");
 	add_timer_func_list(auth_db_cleanup, "auth_db_cleanup");
+	add_timer_func_list(chrif_sendmapload, "chrif_sendmapload");
+	add_timer_func_list(chrif_handoff_timer, "chrif_handoff_timer");
+	add_timer_func_list(chrif_replay_end, "chrif_replay_end");
 
 	// establish map-char connection if not present
 	add_timer_interval(gettick() + 1000, check_connect_char_server, 0, 0, 10 * 1000);
@@ -1604,5 +2365,8 @@ int do_init_chrif(void)
 	// send the user count every 10 seconds, to hide the charserver's online counting problem
 	add_timer_interval(gettick() + 1000, send_usercount_tochar, 0, 0, UPDATE_INTERVAL);
 
+	// report the load of the maps, for the map assignment of the char-server
+	add_timer_interval(gettick() + MAPLOAD_INTERVAL, chrif_sendmapload, 0, 0, MAPLOAD_INTERVAL);
+
 	return 0;
 }
@@ -62,5 +62,9 @@ int do_final_chrif(void);
 int do_init_chrif(void);
 
 int chrif_flush_fifo(void);
+void chrif_assignmaps(void);
+void chrif_mapreg(int uid, int val, const char* str);
+void chrif_savestats_show(void);
+void chrif_savestats_reset(void);
 
 #endif /* _CHRIF_H_ */
@@ -40,6 +40,7 @@
 #include "clif.h"
 #include "mail.h"
 #include "quest.h"
+#include "replay.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -238,6 +239,12 @@ uint32 clif_getip(void)
 	return map_ip;
 }
 
+/// Returns the ip the map-server is bound to, 0 if bound to all interfaces.
+uint32 clif_getbindip(void)
+{
+	return bind_ip;
+}
+
 //Refreshes map_server ip, returns the new ip if the ip changed, otherwise it returns 0.
 uint32 clif_refresh_ip(void)
 {
@@ -15755,12 +15762,215 @@ void clif_parse_debug(int fd,struct map_session_data *sd)
 }
 
 
+/*==========================================
+ * Packet profiling
+ * Records count, bytes and a latency histogram for each packet id and for 
+ * each handler. Off by default, toggled with clif_packet_profile().
+ * A packet id used by different handlers in several packet versions is 
+ * counted under the first handler seen.
+ *------------------------------------------*/
+
+/// Number of buckets of the latency histogram.
+/// Bucket 0 counts packets handled in less than 1us, bucket n in less than 2^n us.
+#define PACKET_PROFILE_BUCKETS 24
+/// Maximum number of distinct handlers.
+#define PACKET_PROFILE_HANDLERS 512
+
+struct s_packet_stats {
+	unsigned int count;
+	uint64 bytes;
+	uint64 time;				// total time in microseconds
+	unsigned int max_time;		// slowest packet in microseconds
+	unsigned int hist[PACKET_PROFILE_BUCKETS];
+};
+
+typedef void (*packet_func)(int, struct map_session_data *);
+
+static struct {
+	bool enabled;
+	int64 start;	// time the profiling was enabled/reset
+	int64 time;		// time of profiling before the last restart
+	struct s_packet_stats cmd[MAX_PACKET_DB+1];
+	short cmd_handler[MAX_PACKET_DB+1];	// index of the handler+1, 0 if unknown
+	struct {
+		packet_func func;
+		const char* name;
+		struct s_packet_stats stats;
+	} handler[PACKET_PROFILE_HANDLERS];
+	int handler_count;
+} packet_profile;
+
+/// Registers the name of a packet handler, done while reading the packet db.
+static void clif_packet_profile_name(packet_func func, const char* name)
+{
+	int i;
+
+	ARR_FIND(0, packet_profile.handler_count, i, packet_profile.handler[i].func == func);
+	if( i < packet_profile.handler_count || i == PACKET_PROFILE_HANDLERS )
+		return;
+	packet_profile.handler[i].func = func;
+	packet_profile.handler[i].name = name;
+	packet_profile.handler_count++;
+}
+
+static void clif_packet_stats_add(struct s_packet_stats* stats, int len, unsigned int usec)
+{
+	int bucket = 0;
+
+	while( bucket < PACKET_PROFILE_BUCKETS-1 && (usec>>bucket) != 0 )
+		++bucket;
+	stats->count++;
+	stats->bytes += len;
+	stats->time += usec;
+	if( stats->max_time < usec )
+		stats->max_time = usec;
+	stats->hist[bucket]++;
+}
+
+/// Records a handled packet.
+static void clif_packet_profile_add(int cmd, packet_func func, int len, int64 usec)
+{
+	int i = packet_profile.cmd_handler[cmd];
+	unsigned int time = (unsigned int)cap_value(usec, 0, UINT_MAX);
+
+	if( i == 0 && func != NULL )
+	{// first time this packet id is seen with a handler
+		ARR_FIND(0, packet_profile.handler_count, i, packet_profile.handler[i].func == func);
+		if( i == packet_profile.handler_count )
+		{// not in the packet db (hardcoded), register it without name
+			if( i == PACKET_PROFILE_HANDLERS )
+				i = -1;
+			else
+				clif_packet_profile_name(func, NULL);
+		}
+		packet_profile.cmd_handler[cmd] = i = i+1;
+	}
+
+	clif_packet_stats_add(&packet_profile.cmd[cmd], len, time);
+	if( i > 0 )
+		clif_packet_stats_add(&packet_profile.handler[i-1].stats, len, time);
+}
+
+/// Returns the upper bound of the latency of the given percentile, in microseconds.
+static unsigned int clif_packet_stats_percentile(const struct s_packet_stats* stats, int percent)
+{
+	uint64 target = ((uint64)stats->count*percent + 99)/100;
+	uint64 sum = 0;
+	int i;
+
+	for( i = 0; i < PACKET_PROFILE_BUCKETS; ++i )
+	{
+		sum += stats->hist[i];
+		if( sum >= target )
+			break;
+	}
+	if( i >= PACKET_PROFILE_BUCKETS-1 )
+		return stats->max_time;
+	return min(1u<<i, stats->max_time);
+}
+
+static const char* clif_packet_profile_handlername(int handler)
+{
+	if( handler <= 0 )
+		return "-";
+	if( packet_profile.handler[handler-1].name == NULL )
+		return "(hardcoded)";
+	return packet_profile.handler[handler-1].name;
+}
+
+/// qsort comparator, highest total time first
+static int clif_packet_profile_cmp_handler(const void* a, const void* b)
+{
+	uint64 ta = packet_profile.handler[*(const int*)a].stats.time;
+	uint64 tb = packet_profile.handler[*(const int*)b].stats.time;
+	return ( ta < tb ) ? 1 : ( ta > tb ) ? -1 : 0;
+}
+
+/// qsort comparator, highest count first
+static int clif_packet_profile_cmp_cmd(const void* a, const void* b)
+{
+	unsigned int ca = packet_profile.cmd[*(const int*)a].count;
+	unsigned int cb = packet_profile.cmd[*(const int*)b].count;
+	return ( ca < cb ) ? 1 : ( ca > cb ) ? -1 : 0;
+}
+
+/// Enables or disables the packet profiling.
+void clif_packet_profile(bool enable)
+{
+	if( enable == packet_profile.enabled )
+		return;
+	if( enable )
+		packet_profile.start = gettick_usec();
+	else
+		packet_profile.time += gettick_usec() - packet_profile.start;
+	packet_profile.enabled = enable;
+}
+
+/// Clears the recorded packet statistics.
+void clif_packet_profile_reset(void)
+{
+	int i;
+
+	memset(packet_profile.cmd, 0, sizeof(packet_profile.cmd));
+	memset(packet_profile.cmd_handler, 0, sizeof(packet_profile.cmd_handler));
+	for( i = 0; i < packet_profile.handler_count; ++i )
+		memset(&packet_profile.handler[i].stats, 0, sizeof(packet_profile.handler[i].stats));
+	packet_profile.time = 0;
+	packet_profile.start = gettick_usec();
+}
+
+/// Displays the recorded packet statistics.
+/// Handlers are sorted by total time, packet ids by count.
+/// Latencies are in microseconds, percentiles are histogram upper bounds.
+void clif_packet_profile_report(int max_lines)
+{
+	int* order;
+	int i, n;
+	int64 elapsed = packet_profile.time;
+
+	if( packet_profile.enabled )
+		elapsed += gettick_usec() - packet_profile.start;
+
+	ShowInfo("Packet profile (%s, %.1f seconds recorded):\n", packet_profile.enabled ? "running" : "stopped", (double)elapsed/1000000.);
+
+	CREATE(order, int, max(packet_profile.handler_count, MAX_PACKET_DB+1));
+
+	for( i = 0, n = 0; i < packet_profile.handler_count; ++i )
+		if( packet_profile.handler[i].stats.count )
+			order[n++] = i;
+	qsort(order, n, sizeof(int), clif_packet_profile_cmp_handler);
+	ShowMessage("  %-28s %10s %12s %10s %8s %8s %8s %8s\n", "handler", "count", "bytes", "total ms", "avg us", "p50 us", "p99 us", "max us");
+	for( i = 0; i < n && i < max_lines; ++i )
+	{
+		const struct s_packet_stats* stats = &packet_profile.handler[order[i]].stats;
+		ShowMessage("  %-28s %10u %12"PRIu64" %10.1f %8.1f %8u %8u %8u\n", clif_packet_profile_handlername(order[i]+1),
+			stats->count, stats->bytes, (double)stats->time/1000., (double)stats->time/stats->count,
+			clif_packet_stats_percentile(stats, 50), clif_packet_stats_percentile(stats, 99), stats->max_time);
+	}
+
+	for( i = 0, n = 0; i <= MAX_PACKET_DB; ++i )
+		if( packet_profile.cmd[i].count )
+			order[n++] = i;
+	qsort(order, n, sizeof(int), clif_packet_profile_cmp_cmd);
+	ShowMessage("  %-6s %-21s %10s %12s %10s %8s %8s %8s\n", "packet", "handler", "count", "bytes", "pkt/sec", "avg us", "p99 us", "max us");
+	for( i = 0; i < n && i < max_lines; ++i )
+	{
+		const struct s_packet_stats* stats = &packet_profile.cmd[order[i]];
+		ShowMessage("  0x%04x %-21s %10u %12"PRIu64" %10.1f %8.1f %8u %8u\n", order[i], clif_packet_profile_handlername(packet_profile.cmd_handler[order[i]]),
+			stats->count, stats->bytes, elapsed > 0 ? (double)stats->count*1000000./elapsed : 0.,
+			(double)stats->time/stats->count, clif_packet_stats_percentile(stats, 99), stats->max_time);
+	}
+
+	aFree(order);
+}
+
 /// Main client packet processing function
 static int clif_parse(int fd)
 {
 	int cmd, packet_ver, packet_len, err;
 	TBL_PC* sd;
 	int pnum;
+	int64 profile_start;
 
 	//TODO apply delays or disconnect based on packet throughput [FlavioJS]
 	// Note: "click masters" can do 80+ clicks in 10 seconds
@@ -15789,6 +15999,7 @@ static int clif_parse(int fd)
 		} else {
 			ShowInfo("Closed connection from '"CL_WHITE"%s"CL_RESET"'.\n", ip2str(session[fd]->client_addr, NULL));
 		}
+		replay_capture_close(fd);
 		do_close(fd);
 		return 0;
 	}
@@ -15858,6 +16069,9 @@ static int clif_parse(int fd)
 	if ((int)RFIFOREST(fd) < packet_len)
 		return 0; // not enough data received to form the packet
 
+	replay_capture_packet(fd, (const uint8*)RFIFOP(fd,0), packet_len);
+	profile_start = ( packet_profile.enabled ? gettick_usec() : 0 );
+
 	if( packet_db[packet_ver][cmd].func == clif_parse_debug )
 		packet_db[packet_ver][cmd].func(fd, sd);
 	else
@@ -15869,6 +16083,9 @@ static int clif_parse(int fd)
 		if( sd && sd->bl.prev == NULL && packet_db[packet_ver][cmd].func != clif_parse_LoadEndAck )
 			; //Only valid packet when player is not on a map
 		else
+		if( sd && map[sd->bl.m].frozen && packet_db[packet_ver][cmd].func != clif_parse_TickSend )
+			; //Player parked while the map is handed off to another map-server
+		else
 		if( sd && session[sd->fd]->flag.eof )
 			; //No more packets accepted
 		else
@@ -15914,6 +16131,9 @@ static int clif_parse(int fd)
 	}
 #endif
 
+	if( profile_start && packet_profile.enabled )
+		clif_packet_profile_add(cmd, packet_db[packet_ver][cmd].func, packet_len, gettick_usec() - profile_start);
+
 	RFIFOSKIP(fd, packet_len);
 
 	}; // main loop end
@@ -16447,7 +16667,10 @@ static int packetdb_readdb(void)
 		// look up processing function by name
 		ARR_FIND( 0, ARRAYLENGTH(clif_parse_func), j, clif_parse_func[j].name != NULL && strcmp(str[2],clif_parse_func[j].name)==0 );
 		if( j < ARRAYLENGTH(clif_parse_func) )
+		{
 			packet_db[packet_ver][cmd].func = clif_parse_func[j].func;
+			clif_packet_profile_name(clif_parse_func[j].func, clif_parse_func[j].name);
+		}
 
 		// set the identifying cmd for the packet_db version
 		if (strcmp(str[2],"wanttoconnection")==0)
@@ -305,6 +305,7 @@ void clif_setbindip(const char* ip);
 void clif_setport(uint16 port);
 
 uint32 clif_getip(void);
+uint32 clif_getbindip(void);
 uint32 clif_refresh_ip(void);
 uint16 clif_getport(void);
 
@@ -651,6 +652,11 @@ void clif_displayexp(struct map_session_data *sd, unsigned int exp, char type, b
 int clif_send(const uint8* buf, int len, struct block_list* bl, enum send_target type);
 int do_init_clif(void);
 
+// packet profiling
+void clif_packet_profile(bool enable);
+void clif_packet_profile_reset(void);
+void clif_packet_profile_report(int max_lines);
+
 #ifndef TXT_ONLY
 // MAIL SYSTEM
 void clif_Mail_window(int fd, int flag);
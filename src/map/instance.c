@@ -160,6 +160,8 @@ int instance_add_map(const char *name, int instance_id, bool usebasename)
 	map[im].m = im;
 	map[im].instance_id = instance_id;
 	map[im].instance_src_map = m;
+	map[im].standby = false;
+	map[im].frozen = false;
 	map[m].flag.src4instance = 1; // Flag this map as a src map for instances
 
 	instance[instance_id].map[instance[instance_id].num_map++] = im; // Attach to actual instance
@@ -58,12 +58,29 @@ bool CheckForCharServer(void)
 	return ((char_fd <= 0) || session[char_fd] == NULL || session[char_fd]->wdata == NULL);
 }
 
+/// Returns true if the character is played by a replay (replay.c).
+/// It is a copy of a live character, so nothing it does is sent to the char-server.
+static bool intif_isreplay(int account_id)
+{
+	struct map_session_data* sd = map_id2sd(account_id);
+	return ( sd != NULL && sd->state.replay );
+}
+
+/// Same as intif_isreplay, by character id.
+static bool intif_isreplay_char(int char_id)
+{
+	struct map_session_data* sd = map_charid2sd(char_id);
+	return ( sd != NULL && sd->state.replay );
+}
+
 // pet
 int intif_create_pet(int account_id,int char_id,short pet_class,short pet_lv,short pet_egg_id,
 	short pet_equip,short intimate,short hungry,char rename_flag,char incuvate,char *pet_name)
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd, 24 + NAME_LENGTH);
 	WFIFOW(inter_fd,0) = 0x3080;
 	WFIFOL(inter_fd,2) = account_id;
@@ -86,6 +103,8 @@ int intif_request_petdata(int account_id,int char_id,int pet_id)
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd, 14);
 	WFIFOW(inter_fd,0) = 0x3081;
 	WFIFOL(inter_fd,2) = account_id;
@@ -100,6 +119,8 @@ int intif_save_petdata(int account_id,struct s_pet *p)
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd, sizeof(struct s_pet) + 8);
 	WFIFOW(inter_fd,0) = 0x3082;
 	WFIFOW(inter_fd,2) = sizeof(struct s_pet) + 8;
@@ -126,6 +147,8 @@ int intif_rename(struct map_session_data *sd, int type, char *name)
 {
 	if (CheckForCharServer())
 		return 1;
+	if( sd->state.replay )
+		return 1; // replayed session, never saved
 
 	WFIFOHEAD(inter_fd,NAME_LENGTH+12);
 	WFIFOW(inter_fd,0) = 0x3006;
@@ -280,6 +303,8 @@ int intif_saveregistry(struct map_session_data *sd, int type)
 
 	if (CheckForCharServer())
 		return -1;
+	if( sd->state.replay )
+		return 0; // replayed session, never saved
 
 	switch (type) {
 	case 3: //Character reg
@@ -373,6 +398,8 @@ bool intif_create_party(struct party_member* member, const char* name, int item,
 	if (CheckForCharServer())
 		return false;
 	nullpo_retr(false, member);
+	if( intif_isreplay(member->account_id) )
+		return false; // replayed session, never saved
 
 	WFIFOHEAD(inter_fd,64);
 	WFIFOW(inter_fd,0) = 0x3020;
@@ -401,6 +428,8 @@ int intif_party_addmember(int party_id,struct party_member *member)
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(member->account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd,42);
 	WFIFOW(inter_fd,0)=0x3022;
 	WFIFOW(inter_fd,2)=8+sizeof(struct party_member);
@@ -414,6 +443,8 @@ int intif_party_changeoption(int party_id,int account_id,int exp,int item)
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd,14);
 	WFIFOW(inter_fd,0)=0x3023;
 	WFIFOL(inter_fd,2)=party_id;
@@ -428,6 +459,8 @@ int intif_party_leave(int party_id,int account_id, int char_id)
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd,14);
 	WFIFOW(inter_fd,0)=0x3024;
 	WFIFOL(inter_fd,2)=party_id;
@@ -445,6 +478,8 @@ int intif_party_changemap(struct map_session_data *sd,int online)
 		return 0;
 	if(!sd)
 		return 0;
+	if( sd->state.replay )
+		return 0; // replayed session, never saved
 
 	if( (m=map_mapindex2mapid(sd->mapindex)) >= 0 && map[m].instance_id )
 		mapindex = map[map[m].instance_src_map].index;
@@ -496,6 +531,8 @@ int intif_party_leaderchange(int party_id,int account_id,int char_id)
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd,14);
 	WFIFOW(inter_fd,0)=0x3029;
 	WFIFOL(inter_fd,2)=party_id;
@@ -512,6 +549,8 @@ int intif_guild_create(const char *name,const struct guild_member *master)
 	if (CheckForCharServer())
 		return 0;
 	nullpo_ret(master);
+	if( intif_isreplay(master->account_id) )
+		return 0; // replayed session, never saved
 
 	WFIFOHEAD(inter_fd,sizeof(struct guild_member)+(8+NAME_LENGTH));
 	WFIFOW(inter_fd,0)=0x3030;
@@ -538,6 +577,8 @@ int intif_guild_addmember(int guild_id,struct guild_member *m)
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(m->account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd,sizeof(struct guild_member)+8);
 	WFIFOW(inter_fd,0) = 0x3032;
 	WFIFOW(inter_fd,2) = sizeof(struct guild_member)+8;
@@ -565,6 +606,8 @@ int intif_guild_leave(int guild_id,int account_id,int char_id,int flag,const cha
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd, 55);
 	WFIFOW(inter_fd, 0) = 0x3034;
 	WFIFOL(inter_fd, 2) = guild_id;
@@ -580,6 +623,8 @@ int intif_guild_memberinfoshort(int guild_id,int account_id,int char_id,int onli
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd, 19);
 	WFIFOW(inter_fd, 0) = 0x3035;
 	WFIFOL(inter_fd, 2) = guild_id;
@@ -641,6 +686,8 @@ int intif_guild_change_memberinfo(int guild_id,int account_id,int char_id,
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd, len + 18);
 	WFIFOW(inter_fd, 0)=0x303a;
 	WFIFOW(inter_fd, 2)=len+18;
@@ -671,6 +718,8 @@ int intif_guild_skillup(int guild_id, int skill_num, int account_id, int max)
 {
 	if( CheckForCharServer() )
 		return 0;
+	if( intif_isreplay(account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd, 18);
 	WFIFOW(inter_fd, 0)  = 0x303c;
 	WFIFOL(inter_fd, 2)  = guild_id;
@@ -685,6 +734,8 @@ int intif_guild_alliance(int guild_id1,int guild_id2,int account_id1,int account
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(account_id1) || intif_isreplay(account_id2) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd,19);
 	WFIFOW(inter_fd, 0)=0x303d;
 	WFIFOL(inter_fd, 2)=guild_id1;
@@ -759,6 +810,8 @@ int intif_homunculus_create(int account_id, struct s_homunculus *sh)
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd, sizeof(struct s_homunculus)+8);
 	WFIFOW(inter_fd,0) = 0x3090;
 	WFIFOW(inter_fd,2) = sizeof(struct s_homunculus)+8;
@@ -772,6 +825,8 @@ int intif_homunculus_requestload(int account_id, int homun_id)
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd, 10);
 	WFIFOW(inter_fd,0) = 0x3091;
 	WFIFOL(inter_fd,2) = account_id;
@@ -784,6 +839,8 @@ int intif_homunculus_requestsave(int account_id, struct s_homunculus* sh)
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(account_id) )
+		return 0; // replayed session, never saved
 	WFIFOHEAD(inter_fd, sizeof(struct s_homunculus)+8);
 	WFIFOW(inter_fd,0) = 0x3092;
 	WFIFOW(inter_fd,2) = sizeof(struct s_homunculus)+8;
@@ -1406,6 +1463,8 @@ int intif_quest_save(TBL_PC *sd)
 
 	if(CheckForCharServer())
 		return 0;
+	if( sd->state.replay )
+		return 0; // replayed session, never saved
 
 	len = sizeof(struct quest)*sd->num_quests + 8;
 
@@ -1435,6 +1494,8 @@ int intif_Mail_requestinbox(int char_id, unsigned char flag)
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay_char(char_id) )
+		return 0; // replayed session, never saved
 
 	WFIFOHEAD(inter_fd,7);
 	WFIFOW(inter_fd,0) = 0x3048;
@@ -1637,6 +1698,8 @@ int intif_Mail_send(int account_id, struct mail_message *msg)
 
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay(account_id) )
+		return 0; // replayed session, never saved
 
 	WFIFOHEAD(inter_fd,len);
 	WFIFOW(inter_fd,0) = 0x304d;
@@ -1746,6 +1809,8 @@ int intif_Auction_register(struct auction_data *auction)
 	
 	if( CheckForCharServer() )
 		return 0;
+	if( intif_isreplay_char(auction->seller_id) )
+		return 0; // replayed session, never saved
 
 	WFIFOHEAD(inter_fd,len);
 	WFIFOW(inter_fd,0) = 0x3051;
@@ -1794,6 +1859,8 @@ int intif_Auction_cancel(int char_id, unsigned int auction_id)
 {
 	if( CheckForCharServer() )
 		return 0;
+	if( intif_isreplay_char(char_id) )
+		return 0; // replayed session, never saved
 
 	WFIFOHEAD(inter_fd,10);
 	WFIFOW(inter_fd,0) = 0x3052;
@@ -1825,6 +1892,8 @@ int intif_Auction_close(int char_id, unsigned int auction_id)
 {
 	if( CheckForCharServer() )
 		return 0;
+	if( intif_isreplay_char(char_id) )
+		return 0; // replayed session, never saved
 
 	WFIFOHEAD(inter_fd,10);
 	WFIFOW(inter_fd,0) = 0x3053;
@@ -1858,6 +1927,8 @@ int intif_Auction_bid(int char_id, const char* name, unsigned int auction_id, in
 
 	if( CheckForCharServer() )
 		return 0;
+	if( intif_isreplay_char(char_id) )
+		return 0; // replayed session, never saved
 
 	WFIFOHEAD(inter_fd,len);
 	WFIFOW(inter_fd,0) = 0x3055;
@@ -1916,6 +1987,8 @@ int intif_mercenary_create(struct s_mercenary *merc)
 
 	if( CheckForCharServer() )
 		return 0;
+	if( intif_isreplay_char(merc->char_id) )
+		return 0; // replayed session, never saved
 
 	WFIFOHEAD(inter_fd,size);
 	WFIFOW(inter_fd,0) = 0x3070;
@@ -1943,6 +2016,8 @@ int intif_mercenary_request(int merc_id, int char_id)
 {
 	if (CheckForCharServer())
 		return 0;
+	if( intif_isreplay_char(char_id) )
+		return 0; // replayed session, never saved
 
 	WFIFOHEAD(inter_fd,10);
 	WFIFOW(inter_fd,0) = 0x3071;
@@ -1978,6 +2053,8 @@ int intif_mercenary_save(struct s_mercenary *merc)
 
 	if( CheckForCharServer() )
 		return 0;
+	if( intif_isreplay_char(merc->char_id) )
+		return 0; // replayed session, never saved
 
 	WFIFOHEAD(inter_fd,size);
 	WFIFOW(inter_fd,0) = 0x3073;
@@ -821,11 +821,11 @@ static bool itemdb_parse_dbrow(char** str, const char* source, int line, int scr
 	}
 
 	if (*str[19])
-		id->script = parse_script(str[19], source, line, scriptopt);
+		id->script = parse_script_cached(str[19], strlen(str[19]), source, line, scriptopt);
 	if (*str[20])
-		id->equip_script = parse_script(str[20], source, line, scriptopt);
+		id->equip_script = parse_script_cached(str[20], strlen(str[20]), source, line, scriptopt);
 	if (*str[21])
-		id->unequip_script = parse_script(str[21], source, line, scriptopt);
+		id->unequip_script = parse_script_cached(str[21], strlen(str[21]), source, line, scriptopt);
 
 	return true;
 }
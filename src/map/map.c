@@ -12,12 +12,14 @@
 #include "../common/nullpo.h"
 #include "../common/strlib.h"
 #include "../common/utils.h"
+#include "../common/ers.h" // ers_report_usage()
 
 #include "map.h"
 #include "path.h"
 #include "chrif.h"
 #include "clif.h"
 #include "duel.h"
+#include "replay.h"
 #include "intif.h"
 #include "npc.h"
 #include "pc.h"
@@ -53,6 +55,13 @@
 #include <math.h>
 #ifndef _WIN32
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h> // waitpid()
+#include <fcntl.h> // open()
+#endif
+#ifdef __linux__
+#include <sys/prctl.h> // prctl()
 #endif
 
 #ifndef TXT_ONLY
@@ -160,6 +169,18 @@ char wisp_server_name[NAME_LENGTH] = "Server"; // can be modified in char-server
 int console = 0;
 int enable_spy = 0; //To enable/disable @spy commands, which consume too much cpu time when sending packets. [Skotlex]
 int enable_grf = 0;	//To enable/disable reading maps from GRF files, bypassing mapcache [blackhole89]
+static bool map_battlecheck = false; // --battlecheck, runs battle_selfcheck after loading and exits
+static struct map_session_data* map_private_pc[8]; // players only found by map_id2sd (map_addprivatepc)
+static int map_private_pc_count = 0;
+static bool map_assign = false; // the listed maps are shared with other map-servers, the char-server tells which ones to load
+static bool map_assign_standby = false; // the maps of the other map-servers are loaded too, to take them over without a restart
+#define MAX_MAP_GROUPS 32
+int map_groups = 1; // number of processes the listed maps are split among
+int map_group = 0; // map group of this process (0 = the process that was started, owner of the permanent global variables and of the server events)
+uint32 map_group_key = 0; // identifies the map groups of this map-server (pid of the first group)
+#ifndef _WIN32
+static pid_t map_group_pid[MAX_MAP_GROUPS]; // processes of the other map groups (first group only)
+#endif
 
 /*==========================================
  * server player count (of all mapservers)
@@ -1630,8 +1651,37 @@ int map_quit(struct map_session_data *sd)
  *------------------------------------------*/
 struct map_session_data * map_id2sd(int id)
 {
+	struct map_session_data* sd;
+	int i;
+
 	if (id <= 0) return NULL;
-	return (struct map_session_data*)idb_get(pc_db,id);
+	sd = (struct map_session_data*)idb_get(pc_db,id);
+	if( sd == NULL && map_private_pc_count > 0 )
+	{
+		ARR_FIND(0, map_private_pc_count, i, map_private_pc[i]->bl.id == id);
+		if( i < map_private_pc_count )
+			sd = map_private_pc[i];
+	}
+	return sd;
+}
+
+/// Adds a player that is not connected and not in the id db, so map_id2sd finds it (battle_selfcheck).
+/// The item scripts can attach to it, while the rest of the server doesn't see it.
+bool map_addprivatepc(struct map_session_data* sd)
+{
+	if( map_private_pc_count == ARRAYLENGTH(map_private_pc) )
+		return false;
+	map_private_pc[map_private_pc_count++] = sd;
+	return true;
+}
+
+void map_delprivatepc(struct map_session_data* sd)
+{
+	int i;
+
+	ARR_FIND(0, map_private_pc_count, i, map_private_pc[i] == sd);
+	if( i < map_private_pc_count )
+		map_private_pc[i] = map_private_pc[--map_private_pc_count];
 }
 
 struct mob_data * map_id2md(int id)
@@ -2200,6 +2250,12 @@ int map_mapname2ipport(unsigned short name, uint32* ip, uint16* port)
 	struct map_data_other_server *mdos=NULL;
 
 	mdos = (struct map_data_other_server*)uidb_get(map_db,(unsigned int)name);
+	if(mdos && mdos->cell && ((struct map_data*)mdos)->standby && ((struct map_data*)mdos)->standby_ip)
+	{// local map on standby, served by another map-server
+		*ip = ((struct map_data*)mdos)->standby_ip;
+		*port = ((struct map_data*)mdos)->standby_port;
+		return 0;
+	}
 	if(mdos==NULL || mdos->cell) //If gat isn't null, this is a local map.
 		return -1;
 	*ip=mdos->ip;
@@ -2592,6 +2648,12 @@ int map_setipport(unsigned short mapindex, uint32 ip, uint16 port)
 
 	mdos=(struct map_data_other_server *)uidb_ensure(map_db,(unsigned int)mapindex, create_map_data_other_server);
 	
+	if(mdos->cell && ((struct map_data*)mdos)->standby)
+	{// local map on standby, remember who serves it
+		((struct map_data*)mdos)->standby_ip = ip;
+		((struct map_data*)mdos)->standby_port = port;
+		return 1;
+	}
 	if(mdos->cell) //Local map,Do nothing. Give priority to our own local maps over ones from another server. [Skotlex]
 		return 0;
 	if(ip == clif_getip() && port == clif_getport()) {
@@ -2631,6 +2693,12 @@ int map_eraseipport(unsigned short mapindex, uint32 ip, uint16 port)
 	struct map_data_other_server *mdos;
 
 	mdos = (struct map_data_other_server*)uidb_get(map_db,(unsigned int)mapindex);
+	if(mdos && mdos->cell && ((struct map_data*)mdos)->standby && ((struct map_data*)mdos)->standby_ip == ip && ((struct map_data*)mdos)->standby_port == port)
+	{// the map-server serving our standby map is gone
+		((struct map_data*)mdos)->standby_ip = 0;
+		((struct map_data*)mdos)->standby_port = 0;
+		return 1;
+	}
 	if(!mdos || mdos->cell) //Map either does not exists or is a local map.
 		return 0;
 
@@ -2771,6 +2839,582 @@ int map_delmap(char* mapname)
 	return 0;
 }
 
+/// Keeps only the listed maps (map indexes) in the map list, the ones the char-server assigned to this map-server.
+/// With map_assign_standby the other maps are loaded on standby, to take them over later.
+/// Returns the number of maps left to the other map-servers.
+int map_keepmaps(const unsigned short* mapindexes, int count)
+{
+	int i, j, n = 0, left = 0;
+
+	for( i = 0; i < map_num; ++i )
+	{
+		unsigned short index = mapindex_name2id(map[i].name);
+
+		ARR_FIND(0, count, j, mapindexes[j] == index);
+		if( j == count )
+		{
+			left++;
+			if( !map_assign_standby )
+				continue;
+			map[i].standby = true;
+		}
+		if( n != i )
+			memcpy(&map[n], &map[i], sizeof(map[0]));
+		++n;
+	}
+	map_num = n;
+	return left;
+}
+
+/*==========================================
+ * Map groups
+ * With map_groups > 1 the map-server splits into that many processes
+ * after reading its configuration, each with its own port, timers,
+ * sessions and database connections, so the maps use several cores.
+ * Each group is a map-server of its own for the char-server: players
+ * change group like they change map-server, and broadcasts, whispers,
+ * parties and guilds already go through the char-server.
+ * The maps are split by the char-server with map_assign: yes (by load),
+ * else every map_groups-th listed map goes to each group.
+ * The permanent global variables are owned by the first group, which
+ * saves them; their changes go to every group through the char-server
+ * (chrif_mapreg), which sets a single order for all of them.
+ *------------------------------------------*/
+
+/// Starts the processes of the other map groups.
+/// Each one listens on map_port + its group number.
+static void map_group_fork(void)
+{
+#ifdef _WIN32
+	if( map_groups > 1 )
+	{
+		ShowWarning("map_groups: Not supported on Windows, running a single map group.\n");
+		map_groups = 1;
+	}
+#else
+	int i;
+
+	map_group_key = (uint32)getpid();
+	for( i = 1; i < map_groups; ++i )
+	{
+		pid_t pid = fork();
+
+		if( pid < 0 )
+		{
+			ShowFatalError("map_group_fork: Can't start map group %d (%s).\n", i, strerror(errno));
+			exit(EXIT_FAILURE); // the other groups end with this one
+		}
+		if( pid == 0 )
+		{
+			int fd;
+
+			map_group = i;
+			srand(gettick() ^ (unsigned int)getpid()); // the groups don't draw the same random numbers
+			if( (fd = open("/dev/null", O_RDONLY)) >= 0 )
+			{// the console reads the terminal of the first group only
+				dup2(fd, STDIN_FILENO);
+				close(fd);
+			}
+#ifdef __linux__
+			prctl(PR_SET_PDEATHSIG, SIGTERM); // ends with the first group
+#endif
+			clif_setport(clif_getport() + i);
+			map_port = clif_getport();
+			return;
+		}
+		map_group_pid[i] = pid;
+	}
+	if( map_groups > 1 )
+		ShowStatus("Started '"CL_WHITE"%d"CL_RESET"' map groups (ports %d-%d).\n", map_groups, clif_getport(), clif_getport() + map_groups - 1);
+#endif
+}
+
+/// Keeps the maps of this map group, when the char-server doesn't assign them.
+static void map_group_keepmaps(void)
+{
+	unsigned short* mapindexes;
+	int i, count = 0, left;
+
+	if( map_groups <= 1 )
+		return;
+	CREATE(mapindexes, unsigned short, map_num + 1);
+	for( i = map_group; i < map_num; i += map_groups )
+		mapindexes[count++] = mapindex_name2id(map[i].name);
+	left = map_keepmaps(mapindexes, count);
+	aFree(mapindexes);
+	ShowStatus("Map group %d loads '"CL_WHITE"%d"CL_RESET"' maps ('"CL_WHITE"%d"CL_RESET"' left to the other map groups).\n", map_group, count, left);
+}
+
+#ifndef _WIN32
+/// Reports the map groups that ended (crashed or killed), their maps are offline until the map-server restarts.
+static int map_group_check(int tid, unsigned int tick, int id, intptr_t data)
+{
+	int i, status;
+
+	for( i = 1; i < map_groups; ++i )
+	{
+		if( map_group_pid[i] > 0 && waitpid(map_group_pid[i], &status, WNOHANG) == map_group_pid[i] )
+		{
+			ShowError("Map group %d (pid %d) ended (status %d), its maps are offline.\n", i, (int)map_group_pid[i], status);
+			map_group_pid[i] = 0;
+		}
+	}
+	return 0;
+}
+#endif
+
+/// Stops the other map groups and waits for them to end.
+static void map_group_final(void)
+{
+#ifndef _WIN32
+	int i;
+
+	if( map_group != 0 )
+		return;
+	for( i = 1; i < map_groups; ++i )
+		if( map_group_pid[i] > 0 )
+			kill(map_group_pid[i], SIGTERM);
+	for( i = 1; i < map_groups; ++i )
+		if( map_group_pid[i] > 0 )
+			waitpid(map_group_pid[i], NULL, 0);
+#endif
+}
+
+/*==========================================
+ * Map handoff
+ * The state of a map that moves with it to another map-server:
+ * the monsters, the floor items and the variables of the npcs.
+ * Monsters of spawn lines are matched by their spawn line, since
+ * both map-servers read the same scripts; the other monsters are
+ * spawned again. Skill units, loot and damage logs don't move.
+ *------------------------------------------*/
+struct map_handoff_mobs {
+	int m;
+	struct mob_data** list;
+	int count, max;
+};
+
+static int map_handoff_mobs_sub(struct mob_data* md, va_list args)
+{
+	struct map_handoff_mobs* mobs = va_arg(args, struct map_handoff_mobs*);
+
+	if( md->bl.m != mobs->m )
+		return 0;
+	if( mobs->count == mobs->max )
+	{
+		mobs->max += 256;
+		RECREATE(mobs->list, struct mob_data*, mobs->max);
+	}
+	mobs->list[mobs->count++] = md;
+	return 0;
+}
+
+/// qsort callback, groups the monsters by spawn line.
+static int map_handoff_mobs_cmp(const void* a, const void* b)
+{
+	const struct mob_data* ma = *(const struct mob_data**)a;
+	const struct mob_data* mb = *(const struct mob_data**)b;
+	if( ma->spawn != mb->spawn )
+		return ( (uintptr_t)ma->spawn < (uintptr_t)mb->spawn ) ? -1 : 1;
+	return ma->bl.id - mb->bl.id;
+}
+
+/// Lists the monsters of map m, dead ones waiting to respawn included, grouped by spawn line.
+static void map_handoff_getmobs(int m, struct map_handoff_mobs* mobs)
+{
+	memset(mobs, 0, sizeof(*mobs));
+	mobs->m = m;
+	map_foreachmob(map_handoff_mobs_sub, mobs);
+	if( mobs->count > 1 )
+		qsort(mobs->list, mobs->count, sizeof(struct mob_data*), map_handoff_mobs_cmp);
+}
+
+/// Remaining time of a timer, in ms.
+static unsigned int map_handoff_remaining(int tid, unsigned int tick)
+{
+	const struct TimerData* timer = get_timer(tid);
+	if( timer == NULL || DIFF_TICK(timer->tick, tick) < 0 )
+		return 0;
+	return (unsigned int)DIFF_TICK(timer->tick, tick);
+}
+
+static int map_handoff_items_sub(struct block_list* bl, va_list args)
+{
+	struct flooritem_data*** list = va_arg(args, struct flooritem_data***);
+	int* count = va_arg(args, int*);
+	int* max = va_arg(args, int*);
+
+	if( *count == *max )
+	{
+		*max += 64;
+		RECREATE(*list, struct flooritem_data*, *max);
+	}
+	(*list)[(*count)++] = (struct flooritem_data*)bl;
+	return 1;
+}
+
+/// Returns true if all the npcs that run the script are on map m.
+/// Duplicated npcs share one script and its variables, which stay on the
+/// map-server when one of their maps moves.
+static bool map_handoff_ownscript(int m, struct script_code* script)
+{
+	struct s_mapiterator* iter = mapit_geteachnpc();
+	struct block_list* bl;
+	bool own = true;
+
+	for( bl = (struct block_list*)mapit_first(iter); mapit_exists(iter); bl = (struct block_list*)mapit_next(iter) )
+	{
+		struct npc_data* nd = (struct npc_data*)bl;
+
+		if( nd->subtype == SCRIPT && nd->u.scr.script == script && nd->bl.m != m )
+		{
+			own = false;
+			break;
+		}
+	}
+	mapit_free(iter);
+	return own;
+}
+
+/// Writes the state of map m to buf, to move the map to another map-server.
+/// The floor items are taken off the map; map_handoff_unpack with items_only puts them back.
+/// <spawn lines>.W { <class>.W <x>.W <y>.W <xs>.W <ys>.W <count>.W { <dead>.B <x>.W <y>.W <hp or respawn ms>.L }* }*
+/// <monsters>.W { <class>.W <x>.W <y>.W <hp>.L <guardian>.W <name>.24B <event>.50B }*
+/// <items>.W { <x>.W <y>.W <lifetime ms>.L <item>.?B }*
+/// <npcs>.W { <exname>.24B <variables>.?B }* (only the npcs whose script runs on no other map)
+/// Returns the length written, or -1 if it doesn't fit in size bytes.
+int map_handoff_pack(int m, unsigned char* buf, int size)
+{
+	struct map_handoff_mobs mobs;
+	struct flooritem_data** items = NULL;
+	unsigned int tick = gettick();
+	int i, j, len, pos, count, item_count = 0, item_max = 0;
+
+	map_handoff_getmobs(m, &mobs);
+
+	// monsters of spawn lines
+	len = 2;
+	count = 0;
+	for( i = 0; i < mobs.count; i = j )
+	{
+		struct spawn_data* spawn = mobs.list[i]->spawn;
+
+		for( j = i + 1; j < mobs.count && mobs.list[j]->spawn == spawn; ++j );
+		if( spawn == NULL || mobs.list[i]->master_id )
+			continue;
+		if( len + 12 + (j-i)*9 > size )
+			break;
+		WBUFW(buf,len) = spawn->class_;
+		WBUFW(buf,len+2) = spawn->x;
+		WBUFW(buf,len+4) = spawn->y;
+		WBUFW(buf,len+6) = spawn->xs;
+		WBUFW(buf,len+8) = spawn->ys;
+		WBUFW(buf,len+10) = j - i;
+		len += 12;
+		for( ; i < j; ++i )
+		{
+			struct mob_data* md = mobs.list[i];
+			WBUFB(buf,len) = ( md->bl.prev == NULL );
+			WBUFW(buf,len+1) = md->bl.x;
+			WBUFW(buf,len+3) = md->bl.y;
+			WBUFL(buf,len+5) = ( md->bl.prev == NULL ) ? map_handoff_remaining(md->spawn_timer, tick) : md->status.hp;
+			len += 9;
+		}
+		count++;
+	}
+	if( i < mobs.count )
+	{
+		aFree(mobs.list);
+		return -1;
+	}
+	WBUFW(buf,0) = count;
+
+	// other monsters
+	pos = len;
+	len += 2;
+	count = 0;
+	for( i = 0; i < mobs.count; ++i )
+	{
+		struct mob_data* md = mobs.list[i];
+
+		if( md->spawn != NULL || md->master_id || md->bl.prev == NULL || mob_is_clone(md->class_) )
+			continue;
+		if( len + 86 > size )
+		{
+			len = -1;
+			break;
+		}
+		WBUFW(buf,len) = md->class_;
+		WBUFW(buf,len+2) = md->bl.x;
+		WBUFW(buf,len+4) = md->bl.y;
+		WBUFL(buf,len+6) = md->status.hp;
+		WBUFW(buf,len+10) = ( md->guardian_data ) ? md->guardian_data->number : -2;
+		memcpy(WBUFP(buf,len+12), md->name, NAME_LENGTH);
+		memcpy(WBUFP(buf,len+36), md->npc_event, EVENT_NAME_LENGTH);
+		len += 86;
+		count++;
+	}
+	if( mobs.list )
+		aFree(mobs.list);
+	if( len < 0 || len + 2 > size )
+		return -1;
+	WBUFW(buf,pos) = count;
+
+	// floor items
+	pos = len;
+	len += 2;
+	map_foreachinmap(map_handoff_items_sub, m, BL_ITEM, &items, &item_count, &item_max);
+	for( i = 0; i < item_count; ++i )
+	{
+		struct flooritem_data* fitem = items[i];
+		if( len + 8 + (int)sizeof(struct item) > size )
+			break;
+		WBUFW(buf,len) = fitem->bl.x;
+		WBUFW(buf,len+2) = fitem->bl.y;
+		WBUFL(buf,len+4) = map_handoff_remaining(fitem->cleartimer, tick);
+		memcpy(WBUFP(buf,len+8), &fitem->item_data, sizeof(struct item));
+		len += 8 + sizeof(struct item);
+	}
+	if( i < item_count || len + 2 > size )
+	{
+		if( items )
+			aFree(items);
+		return -1;
+	}
+	WBUFW(buf,pos) = item_count;
+
+	// variables of the npcs
+	pos = len;
+	len += 2;
+	count = 0;
+	for( i = 0; i < map[m].npc_num; ++i )
+	{
+		struct npc_data* nd = map[m].npc[i];
+		int varlen;
+
+		if( nd->subtype != SCRIPT || nd->u.scr.script == NULL || nd->u.scr.script->script_vars == NULL || !map_handoff_ownscript(m, nd->u.scr.script) )
+			continue;
+		if( len + NAME_LENGTH > size || (varlen = script_vars_pack(nd->u.scr.script->script_vars, WBUFP(buf,len+NAME_LENGTH), size - len - NAME_LENGTH)) < 0 )
+			break;
+		memcpy(WBUFP(buf,len), nd->exname, NAME_LENGTH);
+		len += NAME_LENGTH + varlen;
+		count++;
+	}
+	if( i < map[m].npc_num )
+	{
+		if( items )
+			aFree(items);
+		return -1;
+	}
+	WBUFW(buf,pos) = count;
+
+	// everything fits, take the floor items
+	for( i = 0; i < item_count; ++i )
+		map_clearflooritem(items[i]->bl.id);
+	if( items )
+		aFree(items);
+	return len;
+}
+
+/// Puts a monster of a spawn line in the state it had on the other map-server.
+static void map_handoff_setmob(struct mob_data* md, bool dead, short x, short y, unsigned int value, unsigned int tick)
+{
+	if( dead )
+	{
+		if( md->bl.prev != NULL )
+			unit_remove_map(&md->bl, CLR_OUTSIGHT);
+		if( md->spawn_timer != INVALID_TIMER )
+			delete_timer(md->spawn_timer, mob_delayspawn);
+		md->spawn_timer = add_timer(tick + max(value, 500), mob_delayspawn, md->bl.id, 0);
+		return;
+	}
+	if( md->bl.prev == NULL )
+	{
+		if( md->spawn_timer != INVALID_TIMER )
+		{
+			delete_timer(md->spawn_timer, mob_delayspawn);
+			md->spawn_timer = INVALID_TIMER;
+		}
+		mob_spawn(md);
+	}
+	if( md->bl.x != x || md->bl.y != y )
+		unit_movepos(&md->bl, x, y, 0, false);
+	md->status.hp = cap_value(value, 1, md->status.max_hp);
+}
+
+/// Reads the state written by map_handoff_pack into map m, which takes the map over from another map-server.
+/// With items_only, only puts the floor items back (the map didn't move after all).
+/// Returns false if the data is invalid.
+bool map_handoff_unpack(int m, const unsigned char* buf, int len, bool items_only)
+{
+	struct map_handoff_mobs mobs;
+	struct spawn_data** used = NULL;
+	unsigned int tick = gettick();
+	int i, j, k, count, pos = 2, *ids;
+	bool dynamic = false;
+
+	if( len < 2 )
+		return false;
+
+	if( !items_only )
+	{
+		// spawn the cached monsters, they aren't on a map without players
+		map_handoff_getmobs(m, &mobs);
+		ARR_FIND(0, mobs.count, i, mobs.list[i]->spawn != NULL && mobs.list[i]->spawn->state.dynamic);
+		ARR_FIND(0, MAX_MOB_LIST_PER_MAP, j, map[m].moblist[j] != NULL);
+		if( i == mobs.count && j < MAX_MOB_LIST_PER_MAP && map[m].users == 0 && battle_config.dynamic_mobs )
+			dynamic = true;
+		if( mobs.list )
+			aFree(mobs.list);
+		if( dynamic )
+			map_spawnmobs(m);
+
+		// the other monsters are spawned again (freed by id, a master frees its slaves)
+		map_handoff_getmobs(m, &mobs);
+		CREATE(ids, int, mobs.count + 1);
+		for( i = 0, j = 0; i < mobs.count; ++i )
+		{
+			if( mobs.list[i]->spawn == NULL )
+			{
+				ids[j++] = mobs.list[i]->bl.id;
+				mobs.list[i] = NULL;
+			}
+		}
+		while( j > 0 )
+		{
+			struct mob_data* md = map_id2md(ids[--j]);
+			if( md )
+				unit_free(&md->bl, CLR_OUTSIGHT);
+		}
+		aFree(ids);
+		CREATE(used, struct spawn_data*, RBUFW(buf,0) + 1);
+	}
+	else
+		memset(&mobs, 0, sizeof(mobs));
+
+	// monsters of spawn lines
+	count = RBUFW(buf,0);
+	for( k = 0; k < count; ++k )
+	{
+		struct spawn_data* spawn = NULL;
+		int num;
+
+		if( pos + 12 > len || pos + 12 + (num = RBUFW(buf,pos+10))*9 > len )
+			break;
+		if( !items_only )
+		{// first unused spawn line with the same class and area
+			for( i = 0; i < mobs.count; ++i )
+			{
+				struct spawn_data* s = ( mobs.list[i] ) ? mobs.list[i]->spawn : NULL;
+				if( s == NULL || s->class_ != (short)RBUFW(buf,pos) || s->x != RBUFW(buf,pos+2) || s->y != RBUFW(buf,pos+4) ||
+					s->xs != (short)RBUFW(buf,pos+6) || s->ys != (short)RBUFW(buf,pos+8) )
+					continue;
+				ARR_FIND(0, k, j, used[j] == s);
+				if( j == k )
+				{
+					spawn = s;
+					break;
+				}
+			}
+			used[k] = spawn;
+		}
+		pos += 12;
+		for( j = 0; j < num; ++j, pos += 9 )
+		{
+			for( ; spawn != NULL && i < mobs.count && mobs.list[i] && mobs.list[i]->spawn == spawn && mobs.list[i]->master_id; ++i );
+			if( spawn == NULL || i == mobs.count || mobs.list[i] == NULL || mobs.list[i]->spawn != spawn )
+				continue; // not on this map-server
+			map_handoff_setmob(mobs.list[i++], RBUFB(buf,pos) != 0, RBUFW(buf,pos+1), RBUFW(buf,pos+3), RBUFL(buf,pos+5), tick);
+		}
+	}
+	if( used )
+		aFree(used);
+	if( mobs.list )
+		aFree(mobs.list);
+	if( dynamic )
+		map_removemobs(m); // unloaded again unless players come
+	if( k < count )
+		return false;
+
+	// other monsters
+	if( pos + 2 > len )
+		return false;
+	count = RBUFW(buf,pos);
+	pos += 2;
+	if( pos + count*86 > len )
+		return false;
+	for( k = 0; k < count; ++k, pos += 86 )
+	{
+		char name[NAME_LENGTH], event[EVENT_NAME_LENGTH];
+		short class_ = RBUFW(buf,pos), x = RBUFW(buf,pos+2), y = RBUFW(buf,pos+4), guardian = RBUFW(buf,pos+10);
+		struct mob_data* md;
+		int id;
+
+		if( items_only )
+			continue;
+		safestrncpy(name, (const char*)RBUFP(buf,pos+12), sizeof(name));
+		safestrncpy(event, (const char*)RBUFP(buf,pos+36), sizeof(event));
+		if( guardian >= 0 && guardian < MAX_GUARDIANS )
+			id = mob_spawn_guardian(map[m].name, x, y, name, class_, event, guardian, true);
+		else if( guardian == -1 )
+			id = mob_spawn_guardian(map[m].name, x, y, name, class_, event, 0, false);
+		else
+			id = mob_once_spawn(NULL, m, x, y, name, class_, 1, event);
+		if( id && (md = map_id2md(id)) != NULL )
+			md->status.hp = cap_value(RBUFL(buf,pos+6), 1, md->status.max_hp);
+	}
+
+	// floor items
+	if( pos + 2 > len )
+		return false;
+	count = RBUFW(buf,pos);
+	pos += 2;
+	if( pos + count*(8 + (int)sizeof(struct item)) > len )
+		return false;
+	for( k = 0; k < count; ++k, pos += 8 + sizeof(struct item) )
+	{
+		struct item item_data;
+		struct flooritem_data* fitem;
+		int id;
+
+		memcpy(&item_data, RBUFP(buf,pos+8), sizeof(struct item));
+		id = map_addflooritem(&item_data, item_data.amount, m, RBUFW(buf,pos), RBUFW(buf,pos+2), 0, 0, 0, 0);
+		if( id && (fitem = (struct flooritem_data*)map_id2bl(id)) != NULL && fitem->bl.type == BL_ITEM )
+		{// keep the remaining lifetime
+			delete_timer(fitem->cleartimer, map_clearflooritem_timer);
+			fitem->cleartimer = add_timer(tick + max(RBUFL(buf,pos+4), 1000), map_clearflooritem_timer, fitem->bl.id, 0);
+		}
+	}
+	if( items_only )
+		return true;
+
+	// variables of the npcs
+	if( pos + 2 > len )
+		return false;
+	count = RBUFW(buf,pos);
+	pos += 2;
+	for( k = 0; k < count; ++k )
+	{
+		char exname[NAME_LENGTH];
+		struct npc_data* nd;
+		struct linkdb_node* vars = NULL;
+		struct linkdb_node** node;
+		int varlen;
+
+		if( pos + NAME_LENGTH > len )
+			return false;
+		safestrncpy(exname, (const char*)RBUFP(buf,pos), sizeof(exname));
+		nd = npc_name2id(exname);
+		node = ( nd && nd->subtype == SCRIPT && nd->u.scr.script && map_handoff_ownscript(m, nd->u.scr.script) ) ? &nd->u.scr.script->script_vars : &vars;
+		if( (varlen = script_vars_unpack(node, RBUFP(buf,pos+NAME_LENGTH), len - pos - NAME_LENGTH)) < 0 )
+			return false;
+		if( vars )
+			script_free_vars(&vars); // npc not on this map-server, or its script is shared with other maps
+		pos += NAME_LENGTH + varlen;
+	}
+	return true;
+}
+
 /// Initializes map flags and adjusts them depending on configuration.
 void map_flags_init(void)
 {
@@ -2868,6 +3512,36 @@ int map_readgat (struct map_data* m)
 	return 1;
 }
 
+/// Number of maps whose GAT and RSW files are decoded together when reading from GRF files.
+#define MAP_GRF_PREFETCH 64
+
+/// Decodes the GAT and RSW files of the maps that follow 'start' in advance,
+/// so the GRF entries of several maps are decoded at the same time.
+static void map_grf_prefetch(int start)
+{
+	char names[MAP_GRF_PREFETCH*2][256];
+	const char* fnames[MAP_GRF_PREFETCH*2];
+	int i, count = 0;
+
+	for( i = start; i < map_num && i < start + MAP_GRF_PREFETCH; ++i )
+	{
+		char* found;
+
+		sprintf(names[count], "data\\%s.gat", map[i].name);
+		fnames[count] = names[count];
+		++count;
+
+		// same name as map_waterheight
+		sprintf(names[count], "data\\%s.rsw", map[i].name);
+		found = grfio_find_file(names[count]);
+		if( found )
+			safestrncpy(names[count], found, sizeof(names[count]));
+		fnames[count] = names[count];
+		++count;
+	}
+	grfio_prefetch(fnames, count);
+}
+
 /*======================================
  * Add/Remove map to the map_db
  *--------------------------------------*/
@@ -2889,6 +3563,7 @@ int map_readallmaps (void)
 	int i;
 	FILE* fp=NULL;
 	int maps_removed = 0;
+	int prefetch_end = 0;
 	char *map_cache_buffer = NULL; // Has the uncompressed gat data of all maps, so just one allocation has to be made
 	char map_cache_decode_buffer[MAX_MAP_SIZE];
 
@@ -2921,7 +3596,14 @@ int map_readallmaps (void)
 
 		// show progress
 		if(enable_grf)
+		{
+			if( i >= prefetch_end )
+			{
+				map_grf_prefetch(i);
+				prefetch_end = i + MAP_GRF_PREFETCH;
+			}
 			ShowStatus("Loading maps [%i/%i]: %s"CL_CLL"\r", i, map_num, map[i].name);
+		}
 
 		// try to load the map
 		if( !
@@ -2967,6 +3649,9 @@ int map_readallmaps (void)
 	// intialization and configuration-dependent adjustments of mapflags
 	map_flags_init();
 
+	if( enable_grf )
+		grfio_prefetch(NULL, 0); // release what wasn't used
+
 	if( !enable_grf ) {
 		fclose(fp);
 
@@ -3050,6 +3735,111 @@ int parse_console(const char* buf)
 		{
 			runflag = 0;
 		}
+		else if( strcmpi("memory", command) == 0 )
+		{
+			malloc_report();
+		}
+		else if( strcmpi("ers", command) == 0 )
+		{
+			ers_report_usage();
+		}
+		else if( strncmpi("linkstats", command, 9) == 0 )
+		{
+			const char* arg = command + 9;
+			while( ISSPACE(*arg) )
+				++arg;
+			if( strcmpi("reset", arg) == 0 )
+				socket_linkstats_reset();
+			else
+				socket_linkstats_show();
+		}
+		else if( strncmpi("savestats", command, 9) == 0 )
+		{
+			const char* arg = command + 9;
+			while( ISSPACE(*arg) )
+				++arg;
+			if( strcmpi("reset", arg) == 0 )
+				chrif_savestats_reset();
+			else
+				chrif_savestats_show();
+		}
+		else if( strncmpi("packetprof", command, 10) == 0 )
+		{
+			const char* arg = command + 10;
+			while( ISSPACE(*arg) )
+				++arg;
+			if( strcmpi("on", arg) == 0 )
+				clif_packet_profile(true);
+			else if( strcmpi("off", arg) == 0 )
+				clif_packet_profile(false);
+			else if( strcmpi("reset", arg) == 0 )
+				clif_packet_profile_reset();
+			else
+			{
+				if( strncmpi("show", arg, 4) == 0 )
+					arg += 4;
+				clif_packet_profile_report(atoi(arg) > 0 ? atoi(arg) : 30);
+			}
+		}
+		else if( strncmpi("svcheck", command, 7) == 0 )
+		{
+			sv_check(atoi(command + 7));
+		}
+		else if( strncmpi("statuscalc", command, 10) == 0 )
+		{
+			const char* arg = command + 10;
+			while( ISSPACE(*arg) )
+				++arg;
+			status_calc_report(strcmpi("reset", arg) == 0);
+		}
+		else if( strncmpi("battlecheck", command, 11) == 0 )
+		{
+			const char* arg = command + 11;
+			char file[256] = "";
+			int rounds = 0;
+			bool record = false;
+			while( ISSPACE(*arg) )
+				++arg;
+			if( strncmpi("record", arg, 6) == 0 )
+			{
+				record = true;
+				arg += 6;
+			}
+			sscanf(arg, "%d %255s", &rounds, file);
+			battle_selfcheck(rounds, file, record);
+		}
+		else if( strncmpi("capture", command, 7) == 0 )
+		{
+			const char* arg = command + 7;
+			while( ISSPACE(*arg) )
+				++arg;
+			if( strncmpi("on", arg, 2) == 0 )
+			{
+				arg += 2;
+				while( ISSPACE(*arg) )
+					++arg;
+				replay_capture_start(*arg ? arg : "log/capture.bin");
+			}
+			else
+				replay_capture_stop();
+		}
+		else if( strncmpi("replay", command, 6) == 0 )
+		{
+			char filename[256];
+			int speed = 1;
+			const char* arg = command + 6;
+			while( ISSPACE(*arg) )
+				++arg;
+			if( strcmpi("stop", arg) == 0 )
+			{
+				replay_report();
+				replay_stop();
+			}
+			else if( *arg == '\0' || strcmpi("show", arg) == 0 )
+				replay_report();
+			else if( sscanf(arg, "%255s %d", filename, &speed) >= 1 )
+				replay_start(filename, speed);
+		}
 	}
 	else if( strcmpi("help", type) == 0 )
 	{
@@ -3061,6 +3851,27 @@ int parse_console(const char* buf)
 		ShowInfo("IE: @spawn\n");
 		ShowInfo("To shutdown the server:\n");
 		ShowInfo("  server:shutdown\n");
+		ShowInfo("To display the memory usage:\n");
+		ShowInfo("  server:memory\n");
+		ShowInfo("To display the usage of the entry managers:\n");
+		ShowInfo("  server:ers\n");
+		ShowInfo("To display the char-server link traffic per packet type:\n");
+		ShowInfo("  server:linkstats [reset]\n");
+		ShowInfo("To display how many bytes the character saves take:\n");
+		ShowInfo("  server:savestats [reset]\n");
+		ShowInfo("To profile the client packets (show lists the N busiest entries, default 30):\n");
+		ShowInfo("  server:packetprof on|off|reset|show [N]\n");
+		ShowInfo("To check and benchmark the db text parser (default 100000 random rows):\n");
+		ShowInfo("  server:svcheck [rows]\n");
+		ShowInfo("To show how often each stat was recalculated since the last reset:\n");
+		ShowInfo("  server:statuscalc [reset]\n");
+		ShowInfo("To check the battle formulas against recorded results and benchmark them\n");
+		ShowInfo("(default 1000 rounds per case, file db/battlecheck.txt, 'record' rewrites the results):\n");
+		ShowInfo("  server:battlecheck [record] [rounds] [file]\n");
+		ShowInfo("To capture the client packets (default file log/capture.bin):\n");
+		ShowInfo("  server:capture on [file]|off\n");
+		ShowInfo("To replay a capture against this server (speed is a multiplier, default 1):\n");
+		ShowInfo("  server:replay <file> [speed]|show|stop\n");
 	}
 
 	return 0;
@@ -3136,11 +3947,23 @@ int map_config_read(char *cfgName)
 		if (strcmpi(w1, "delmap") == 0)
 			map_delmap(w2);
 		else
+		if (strcmpi(w1, "map_assign") == 0)
+			map_assign = config_switch(w2);
+		else
+		if (strcmpi(w1, "map_assign_standby") == 0)
+			map_assign_standby = config_switch(w2);
+		else
+		if (strcmpi(w1, "map_groups") == 0)
+			map_groups = cap_value(atoi(w2), 1, MAX_MAP_GROUPS);
+		else
 		if (strcmpi(w1, "npc") == 0)
 			npc_addsrcfile(w2);
 		else
 		if (strcmpi(w1, "delnpc") == 0)
 			npc_delsrcfile(w2);
+		else
+		if (strcmpi(w1, "npc_load_threads") == 0)
+			npc_load_threads = cap_value(atoi(w2), 0, 32);
 		else if (strcmpi(w1, "autosave_time") == 0) {
 			autosave_interval = atoi(w2);
 			if (autosave_interval < 1) //Revert to default saving.
@@ -3174,6 +3997,9 @@ int map_config_read(char *cfgName)
 		if(strcmpi(w1,"db_path") == 0)
 			strncpy(db_path,w2,255);
 		else
+		if (strcmpi(w1, "db_image") == 0)
+			sv_db_image = config_switch(w2) ? true : false;
+		else
 		if (strcmpi(w1, "console") == 0) {
 			console = config_switch(w2);
 			if (console)
@@ -3409,6 +4235,8 @@ void do_final(void)
 
 	ShowStatus("Terminating...\n");
 
+	map_group_final();
+
 	// remove all objects on maps
 	for (i = 0; i < map_num; i++)
 	{
@@ -3447,6 +4275,7 @@ void do_final(void)
 	do_final_unit();
 	do_final_battleground();
 	do_final_duel();
+	do_final_replay();
 	
 	map_db->destroy(map_db, map_db_final);
 	
@@ -3521,6 +4350,7 @@ static void map_helpscreen(bool do_exit)
 	ShowInfo("  -?, -h [--help]\t\tDisplays this help screen.\n");
 	ShowInfo("  -v [--version]\t\tDisplays the server's version.\n");
 	ShowInfo("  --run-once\t\t\tCloses server after loading (testing).\n");
+	ShowInfo("  --battlecheck\t\t\tRuns the battle check after loading and exits (non-zero on a mismatch).\n");
 	ShowInfo("  --map-config <file>\t\tAlternative map-server configuration.\n");
 	ShowInfo("  --battle-config <file>\tAlternative battle configuration.\n");
 	ShowInfo("  --atcommand-config <file>\tAlternative atcommand configuration.\n");
@@ -3673,6 +4503,10 @@ int do_init(int argc, char *argv[])
 			{
 				runflag = CORE_ST_STOP;
 			}
+			else if( strcmp(arg, "battlecheck") == 0 )
+			{
+				map_battlecheck = true;
+			}
 			else
 			{
 				ShowError("Unknown option '%s'.\n", argv[i]);
@@ -3723,13 +4557,17 @@ int do_init(int argc, char *argv[])
 	inter_config_read(INTER_CONF_NAME);
 	log_config_read(LOG_CONF_NAME);
 
-	id_db = idb_alloc(DB_OPT_BASE);
-	pc_db = idb_alloc(DB_OPT_BASE);	//Added for reliable map_id2sd() use. [Skotlex]
-	mobid_db = idb_alloc(DB_OPT_BASE);	//Added to lower the load of the lazy mob ai. [Skotlex]
+	if( map_battlecheck )
+		map_groups = 1;
+	map_group_fork(); // before any connection is made
+
+	id_db = idb_alloc(DB_OPT_FLAT);
+	pc_db = idb_alloc(DB_OPT_FLAT);	//Added for reliable map_id2sd() use. [Skotlex]
+	mobid_db = idb_alloc(DB_OPT_FLAT);	//Added to lower the load of the lazy mob ai. [Skotlex]
 	bossid_db = idb_alloc(DB_OPT_BASE); // Used for Convex Mirror quick MVP search
 	map_db = uidb_alloc(DB_OPT_BASE);
 	nick_db = idb_alloc(DB_OPT_BASE);
-	charid_db = idb_alloc(DB_OPT_BASE);
+	charid_db = idb_alloc(DB_OPT_FLAT);
 	regen_db = idb_alloc(DB_OPT_BASE); // efficient status_natural_heal processing
 
 	iwall_db = strdb_alloc(DB_OPT_RELEASE_DATA,2*NAME_LENGTH+2+1); // [Zephyrus] Invisible Walls
@@ -3744,12 +4582,23 @@ int do_init(int argc, char *argv[])
 	if(enable_grf)
 		grfio_init(GRF_PATH_FILENAME);
 
+	if( map_assign )
+		chrif_assignmaps();
+	else
+		map_group_keepmaps();
 	map_readallmaps();
 
 	add_timer_func_list(map_freeblock_timer, "map_freeblock_timer");
 	add_timer_func_list(map_clearflooritem_timer, "map_clearflooritem_timer");
 	add_timer_func_list(map_removemobs_timer, "map_removemobs_timer");
 	add_timer_interval(gettick()+1000, map_freeblock_timer, 0, 0, 60*1000);
+#ifndef _WIN32
+	if( map_group == 0 && map_groups > 1 )
+	{
+		add_timer_func_list(map_group_check, "map_group_check");
+		add_timer_interval(gettick()+5000, map_group_check, 0, 0, 5000);
+	}
+#endif
 
 	do_init_atcommand();
 	do_init_battle();
@@ -3773,9 +4622,15 @@ int do_init(int argc, char *argv[])
 	do_init_unit();
 	do_init_battleground();
 	do_init_duel();
+	do_init_replay();
 
 	npc_event_do_oninit();	// npcOnInitCxg?s
 
+	if( map_battlecheck )
+	{// headless battle check, for scripted testing
+		exit(battle_selfcheck(0, NULL, false) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
 	if( console )
 	{
 		//##TODO invoke a CONSOLE_START plugin event
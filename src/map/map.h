@@ -277,6 +277,7 @@ struct spawn_data {
 		unsigned int boss : 1;
 	} state;
 	char name[NAME_LENGTH],eventname[EVENT_NAME_LENGTH]; //Name/event
+	struct npc_src_list* src; //Npc source file of the spawn, NULL if none
 };
 
 
@@ -510,6 +511,11 @@ struct map_data {
 	// Instance Variables
 	int instance_id;
 	int instance_src_map;
+	// Map assignment
+	bool standby; // loaded, but served by another map-server (map_assign_standby)
+	uint32 standby_ip; // map-server serving the map while on standby (0 if none)
+	uint16 standby_port;
+	bool frozen; // being handed off, its players and monsters are parked (no actions, no AI, no damage)
 };
 
 /// Stores information about a remote map (for multi-mapserver setups).
@@ -529,6 +535,9 @@ void map_setgatcell(int m, int x, int y, int gat);
 
 extern struct map_data map[];
 extern int map_num;
+extern int map_groups;
+extern int map_group;
+extern uint32 map_group_key;
 
 extern int autosave_interval;
 extern int minsave_interval;
@@ -607,6 +616,8 @@ int map_eraseipport(unsigned short map, uint32 ip, uint16 port);
 int map_eraseallipport(void);
 void map_addiddb(struct block_list *);
 void map_deliddb(struct block_list *bl);
+bool map_addprivatepc(struct map_session_data* sd);
+void map_delprivatepc(struct map_session_data* sd);
 void map_foreachpc(int (*func)(struct map_session_data* sd, va_list args), ...);
 void map_foreachmob(int (*func)(struct mob_data* md, va_list args), ...);
 void map_foreachnpc(int (*func)(struct npc_data* nd, va_list args), ...);
@@ -644,6 +655,9 @@ int map_random_dir(struct block_list *bl, short *x, short *y); // [Skotlex]
 int cleanup_sub(struct block_list *bl, va_list ap);
 
 int map_delmap(char* mapname);
+int map_keepmaps(const unsigned short* mapindexes, int count);
+int map_handoff_pack(int m, unsigned char* buf, int size);
+bool map_handoff_unpack(int m, const unsigned char* buf, int len, bool items_only);
 void map_flags_init(void);
 
 bool map_iwall_set(int m, int x, int y, int size, int dir, bool shootable, const char* wall_name);
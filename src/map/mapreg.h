@@ -13,5 +13,6 @@ int mapreg_readreg(int uid);
 char* mapreg_readregstr(int uid);
 bool mapreg_setreg(int uid, int val);
 bool mapreg_setregstr(int uid, const char* str);
+void mapreg_update(const char* name, int index, int val, const char* str);
 
 #endif /* _MAPREG_H_ */
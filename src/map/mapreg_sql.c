@@ -8,7 +8,8 @@
 #include "../common/sql.h"
 #include "../common/strlib.h"
 #include "../common/timer.h"
-#include "map.h" // mmysql_handle
+#include "chrif.h" // chrif_mapreg()
+#include "map.h" // mmysql_handle, map_group
 #include "script.h"
 #include <stdlib.h>
 #include <string.h>
@@ -33,8 +34,7 @@ char* mapreg_readregstr(int uid)
 	return (char*)idb_get(mapregstr_db, uid);
 }
 
-/// Modifies the value of an integer variable.
-bool mapreg_setreg(int uid, int val)
+static void mapreg_setreg_sub(int uid, int val)
 {
 	int num = (uid & 0x00ffffff);
 	int i   = (uid & 0xff000000) >> 24;
@@ -44,7 +44,7 @@ bool mapreg_setreg(int uid, int val)
 	{
 		if( idb_put(mapreg_db,uid,(void*)(intptr_t)val) )
 			mapreg_dirty = true; // already exists, delay write
-		else if(name[1] != '@')
+		else if(name[1] != '@' && map_group == 0) // saved by the first map group
 		{// write new wariable to database
 			char tmp_str[32*2+1];
 			Sql_EscapeStringLen(mmysql_handle, tmp_str, name, strnlen(name, 32));
@@ -56,18 +56,15 @@ bool mapreg_setreg(int uid, int val)
 	{
 		idb_remove(mapreg_db,uid);
 
-		if( name[1] != '@' )
+		if( name[1] != '@' && map_group == 0 )
 		{// Remove from database because it is unused.
 			if( SQL_ERROR == Sql_Query(mmysql_handle, "DELETE FROM `%s` WHERE `varname`='%s' AND `index`='%d'", mapreg_table, name, i) )
 				Sql_ShowDebug(mmysql_handle);
 		}
 	}
-
-	return true;
 }
 
-/// Modifies the value of a string variable.
-bool mapreg_setregstr(int uid, const char* str)
+static void mapreg_setregstr_sub(int uid, const char* str)
 {
 	int num = (uid & 0x00ffffff);
 	int i   = (uid & 0xff000000) >> 24;
@@ -75,7 +72,7 @@ bool mapreg_setregstr(int uid, const char* str)
 	
 	if( str == NULL || *str == 0 )
 	{
-		if(name[1] != '@') {
+		if(name[1] != '@' && map_group == 0) {
 			if( SQL_ERROR == Sql_Query(mmysql_handle, "DELETE FROM `%s` WHERE `varname`='%s' AND `index`='%d'", mapreg_table, name, i) )
 				Sql_ShowDebug(mmysql_handle);
 		}
@@ -85,7 +82,7 @@ bool mapreg_setregstr(int uid, const char* str)
 	{
 		if (idb_put(mapregstr_db,uid, aStrdup(str)))
 			mapreg_dirty = true;
-		else if(name[1] != '@') { //put returned null, so we must insert.
+		else if(name[1] != '@' && map_group == 0) { //put returned null, so we must insert.
 			// Someone is causing a database size infinite increase here without name[1] != '@' [Lance]
 			char tmp_str[32*2+1];
 			char tmp_str2[255*2+1];
@@ -95,10 +92,37 @@ bool mapreg_setregstr(int uid, const char* str)
 				Sql_ShowDebug(mmysql_handle);
 		}
 	}
+}
+
+/// Modifies the value of an integer variable.
+/// With map groups, the permanent variables are shared with the other groups.
+bool mapreg_setreg(int uid, int val)
+{
+	mapreg_setreg_sub(uid, val);
+	chrif_mapreg(uid, val, NULL);
+	return true;
+}
 
+/// Modifies the value of a string variable.
+/// With map groups, the permanent variables are shared with the other groups.
+bool mapreg_setregstr(int uid, const char* str)
+{
+	mapreg_setregstr_sub(uid, str);
+	chrif_mapreg(uid, 0, str);
 	return true;
 }
 
+/// Applies the change of a permanent variable made by another map group.
+void mapreg_update(const char* name, int index, int val, const char* str)
+{
+	int uid = (index<<24)|add_str(name);
+
+	if( name[strlen(name)-1] == '$' )
+		mapreg_setregstr_sub(uid, str);
+	else
+		mapreg_setreg_sub(uid, val);
+}
+
 /// Loads permanent variables from database
 static void script_load_mapreg(void)
 {
@@ -149,6 +173,12 @@ static void script_save_mapreg(void)
 	void* data;
 	DBKey key;
 
+	if( map_group != 0 )
+	{// saved by the first map group
+		mapreg_dirty = false;
+		return;
+	}
+
 	iter = mapreg_db->iterator(mapreg_db);
 	for( data = iter->first(iter,&key); iter->exists(iter); data = iter->next(iter,&key) )
 	{
@@ -8,6 +8,8 @@
 #include "../common/showmsg.h"
 #include "../common/strlib.h"
 #include "../common/timer.h"
+#include "chrif.h" // chrif_mapreg()
+#include "map.h" // map_group
 #include "script.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,8 +35,7 @@ char* mapreg_readregstr(int uid)
 	return (char*)idb_get(mapregstr_db, uid);
 }
 
-/// Modifies the value of an integer variable.
-bool mapreg_setreg(int uid, int val)
+static void mapreg_setreg_sub(int uid, int val)
 {
 	if( val != 0 )
 		idb_put(mapreg_db,uid,(void*)(intptr_t)val);
@@ -42,11 +43,9 @@ bool mapreg_setreg(int uid, int val)
 		idb_remove(mapreg_db,uid);
 
 	mapreg_dirty = true;
-	return true;
 }
 
-/// Modifies the value of a string variable.
-bool mapreg_setregstr(int uid, const char* str)
+static void mapreg_setregstr_sub(int uid, const char* str)
 {
 	if( str == NULL || *str == 0 )
 		idb_remove(mapregstr_db,uid);
@@ -54,9 +53,37 @@ bool mapreg_setregstr(int uid, const char* str)
 		idb_put(mapregstr_db,uid,aStrdup(str));
 
 	mapreg_dirty = true;
+}
+
+/// Modifies the value of an integer variable.
+/// With map groups, the permanent variables are shared with the other groups.
+bool mapreg_setreg(int uid, int val)
+{
+	mapreg_setreg_sub(uid, val);
+	chrif_mapreg(uid, val, NULL);
+	return true;
+}
+
+/// Modifies the value of a string variable.
+/// With map groups, the permanent variables are shared with the other groups.
+bool mapreg_setregstr(int uid, const char* str)
+{
+	mapreg_setregstr_sub(uid, str);
+	chrif_mapreg(uid, 0, str);
 	return true;
 }
 
+/// Applies the change of a permanent variable made by another map group.
+void mapreg_update(const char* name, int index, int val, const char* str)
+{
+	int uid = (index<<24)|add_str(name);
+
+	if( name[strlen(name)-1] == '$' )
+		mapreg_setregstr_sub(uid, str);
+	else
+		mapreg_setreg_sub(uid, val);
+}
+
 /// Loads permanent variables from savefile
 static void script_load_mapreg(void)
 {
@@ -105,6 +132,12 @@ static void script_save_mapreg(void)
 	void* data;
 	DBKey key;
 
+	if( map_group != 0 )
+	{// saved by the first map group
+		mapreg_dirty = false;
+		return;
+	}
+
 	fp = lock_fopen(mapreg_txt,&lock);
 	if( fp == NULL )
 	{
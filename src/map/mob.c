@@ -1298,6 +1298,9 @@ static bool mob_ai_sub_hard(struct mob_data *md, unsigned int tick)
 
 	if(md->bl.prev == NULL || md->status.hp <= 0)
 		return false;
+
+	if( map[md->bl.m].frozen )
+		return false; // parked while the map is handed off
 		
 	if (DIFF_TICK(tick, md->last_thinktime) < MIN_MOBTHINKTIME)
 		return false;
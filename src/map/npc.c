@@ -11,6 +11,7 @@
 #include "../common/ers.h"
 #include "../common/db.h"
 #include "../common/socket.h"
+#include "../common/thread.h"
 #include "map.h"
 #include "log.h"
 #include "clif.h"
@@ -41,10 +42,58 @@ struct npc_data* fake_nd;
 // linked list of npc source files
 struct npc_src_list {
 	struct npc_src_list* next;
+	uint64 hash; // hash of the contents when the file was last loaded
+	bool loaded; // the file was loaded
+	bool mapflags; // the file sets mapflags
+	bool reload; // marked for an incremental reload, see npc_reload_changed
 	char name[4]; // dynamic array, the structure is allocated with extra bytes (string length)
 };
 static struct npc_src_list* npc_src_files = NULL;
 
+/// Number of threads that read the npc files while they are being parsed (0: none)
+int npc_load_threads = 4;
+#define MAX_NPC_LOAD_THREADS 32
+
+// npc source file read in advance by the loader threads
+struct npc_src_load {
+	const char* name;
+	struct npc_src_list* src; // entry in the npc source file list, if any
+	malloc_arena* arena; // holds the contents and the line index, released at once after parsing
+	char* buffer; // file contents, NULL if it couldn't be read
+	uint64 hash; // hash of the contents
+	size_t len;
+	bool notfound;
+	int error; // errno of the read error
+	int* lines; // offset of the start of each line
+	int line_count;
+	int64 read_usec; // time spent reading the file
+	int64 parse_usec; // time spent parsing the file
+	bool done;
+};
+
+// state of the npc file loader
+static struct {
+	struct npc_src_load* files;
+	int count;
+	int next; // next file to be read
+	amutex* mutex;
+	acond* cond;
+} npc_loader;
+
+// line index of the file being parsed, see npc_strline
+static const char* npc_src_buffer = NULL;
+static const int* npc_src_lines = NULL;
+static int npc_src_line_count = 0;
+
+static int64 npc_script_usec = 0; // time spent compiling scripts
+
+// source file being parsed, see npc_parsesrcload
+static struct npc_src_list* npc_src_current = NULL;
+
+// user functions replaced by an incremental reload, they can still be in use by sleeping scripts
+static struct script_code** npc_retired_code = NULL;
+static int npc_retired_count = 0;
+
 static int npc_id=START_NPC_NUM;
 static int npc_warp=0;
 static int npc_shop=0;
@@ -268,6 +317,13 @@ int npc_event_export(char* lname, void* data, va_list ap)
 }
 
 int npc_event_sub(struct map_session_data* sd, struct event_data* ev, const char* eventname); //[Lance]
+/// Returns true if the npc is on a map on standby.
+/// The map-server that serves the map runs the events and timers of its npcs.
+static bool npc_isstandby(struct npc_data* nd)
+{
+	return ( nd->bl.m >= 0 && map[nd->bl.m].standby );
+}
+
 /*==========================================
  * SĂNPCOn*Cxgs
  *------------------------------------------*/
@@ -278,17 +334,25 @@ int npc_event_doall_sub(DBKey key, void* data, va_list ap)
 	int* c;
 	const char* name;
 	int rid;
+	bool server;
 
 	nullpo_ret(ev = (struct event_data *)data);
 	nullpo_ret(c = va_arg(ap, int *));
 	nullpo_ret(name = va_arg(ap, const char *));
 	rid = va_arg(ap, int);
+	server = (bool)va_arg(ap, int);
 
 	p = strchr(p, ':'); // match only the event name
-	if( p && strcmpi(name, p) == 0 /* && !ev->nd->src_id */ ) // Do not run on duplicates. [Paradox924X]
+	if( p && strcmpi(name, p) == 0 && !npc_isstandby(ev->nd) /* && !ev->nd->src_id */ ) // Do not run on duplicates. [Paradox924X]
 	{
 		if(rid) // a player may only have 1 script running at the same time
 			npc_event_sub(map_id2sd(rid),ev,key.str);
+		else if( server && map_group != 0 && ev->nd->bl.m < 0 )
+		{// every map group runs this event, the first one announces it and shares its global variables
+			script_group_local = true;
+			run_script(ev->nd->u.scr.script,ev->pos,0,ev->nd->bl.id);
+			script_group_local = false;
+		}
 		else
 			run_script(ev->nd->u.scr.script,ev->pos,rid,ev->nd->bl.id);
 		(*c)++;
@@ -308,7 +372,7 @@ static int npc_event_do_sub(DBKey key, void* data, va_list ap)
 	nullpo_ret(c = va_arg(ap, int *));
 	nullpo_ret(name = va_arg(ap, const char *));
 
-	if( p && strcmpi(name, p) == 0 )
+	if( p && strcmpi(name, p) == 0 && !npc_isstandby(ev->nd) )
 	{
 		run_script(ev->nd->u.scr.script,ev->pos,0,ev->nd->bl.id);
 		(*c)++;
@@ -323,7 +387,7 @@ int npc_event_do(const char* name)
 	int c = 0;
 
 	if( name[0] == ':' && name[1] == ':' )
-		ev_db->foreach(ev_db,npc_event_doall_sub,&c,name,0);
+		ev_db->foreach(ev_db,npc_event_doall_sub,&c,name,0,false);
 	else
 		ev_db->foreach(ev_db,npc_event_do_sub,&c,name);
 
@@ -334,13 +398,38 @@ int npc_event_doall(const char* name)
 {
 	return npc_event_doall_id(name, 0);
 }
+// runs the specified event of the npcs on map m (global only)
+int npc_event_doall_map(const char* name, int m)
+{
+	struct s_mapiterator* iter = mapit_geteachnpc();
+	struct block_list* bl;
+	char buf[EVENT_NAME_LENGTH];
+	int c = 0;
+
+	for( bl = (struct block_list*)mapit_first(iter); mapit_exists(iter); bl = (struct block_list*)mapit_next(iter) )
+	{
+		struct npc_data* nd = (struct npc_data*)bl;
+		struct event_data* ev;
+
+		if( nd->bl.m != m || nd->subtype != SCRIPT || npc_isstandby(nd) )
+			continue;
+		safesnprintf(buf, sizeof(buf), "%s::%s", nd->exname, name);
+		if( (ev = (struct event_data*)strdb_get(ev_db, buf)) != NULL )
+		{
+			run_script(ev->nd->u.scr.script,ev->pos,0,ev->nd->bl.id);
+			c++;
+		}
+	}
+	mapit_free(iter);
+	return c;
+}
 // runs the specified event, with a RID attached (global only)
 int npc_event_doall_id(const char* name, int rid)
 {
 	int c = 0;
 	char buf[64];
 	safesnprintf(buf, sizeof(buf), "::%s", name);
-	ev_db->foreach(ev_db,npc_event_doall_sub,&c,buf,rid);
+	ev_db->foreach(ev_db,npc_event_doall_sub,&c,buf,rid,true);
 	return c;
 }
 
@@ -450,6 +539,7 @@ struct timer_event_data {
 	int rid; //Attached player for this timer.
 	int next; //timer index (starts with 0, then goes up to nd->u.scr.timeramount)
 	int time; //holds total time elapsed for the script from when timer was started to when last time the event triggered.
+	bool group_local; // started by a group local script (see script_state::group_local)
 };
 
 /*==========================================
@@ -464,6 +554,7 @@ int npc_timerevent(int tid, unsigned int tick, int id, intptr_t data)
 	struct npc_timerevent_list *te;
 	struct timer_event_data *ted = (struct timer_event_data*)data;
 	struct map_session_data *sd=NULL;
+	bool group_local;
 
 	if( nd == NULL )
 	{
@@ -478,6 +569,14 @@ int npc_timerevent(int tid, unsigned int tick, int id, intptr_t data)
 		return 0;
 	}
 
+	if( !ted->rid && npc_isstandby(nd) )
+	{// the map moved to another map-server, which runs the timer
+		nd->u.scr.timerid = INVALID_TIMER;
+		nd->u.scr.timertick = 0;
+		ers_free(timer_event_ers, ted);
+		return 0;
+	}
+
 	// These stuffs might need to be restored.
 	old_rid = nd->u.scr.rid;	
 	old_tick = nd->u.scr.timertick;
@@ -490,6 +589,7 @@ int npc_timerevent(int tid, unsigned int tick, int id, intptr_t data)
 
 	// Locate the event
 	te = nd->u.scr.timer_event + ted->next;
+	group_local = ted->group_local;
 
 	// Arrange for the next event
 	ted->next++;	
@@ -515,7 +615,9 @@ int npc_timerevent(int tid, unsigned int tick, int id, intptr_t data)
 	}
 
 	// Run the script
+	script_group_local = group_local;
 	run_script(nd->u.scr.script,te->pos,nd->u.scr.rid,nd->bl.id);	
+	script_group_local = false;
 	
 	nd->u.scr.rid = old_rid; // Attached-rid should be restored anyway.
 	if( sd )
@@ -564,6 +666,7 @@ int npc_timerevent_start(struct npc_data* nd, int rid)
 
 	// Arrange for the next event		
 	ted = ers_alloc(timer_event_ers, struct timer_event_data);
+	ted->group_local = ( sd == NULL && script_group_local && nd->bl.m < 0 );
 	ted->next = j; // Set event index
 	ted->time = nd->u.scr.timer_event[j].timer;
 	next = nd->u.scr.timer_event[j].timer - nd->u.scr.timer;
@@ -1551,13 +1654,33 @@ static int npc_unload_ev(DBKey key, void* data, va_list ap)
 	return 0;
 }
 
+/// Ends the dialogs of the players with the npc, before it is unloaded.
+static void npc_unload_dialogs(struct npc_data* nd)
+{
+	struct s_mapiterator* iter;
+	struct map_session_data* sd;
+
+	iter = mapit_getallusers();
+	for( sd = (TBL_PC*)mapit_first(iter); mapit_exists(iter); sd = (TBL_PC*)mapit_next(iter) )
+	{
+		if( sd->npc_id != nd->bl.id )
+			continue;
+		clif_scriptclose(sd, nd->bl.id);
+		npc_event_dequeue(sd);
+	}
+	mapit_free(iter);
+}
+
 static int npc_unload_dup_sub(struct npc_data* nd, va_list args)
 {
 	int src_id;
 
 	src_id = va_arg(args, int);
 	if (nd->src_id == src_id)
+	{
+		npc_unload_dialogs(nd);
 		npc_unload(nd);
+	}
 	return 0;
 }
 
@@ -1681,7 +1804,7 @@ void npc_addsrcfile(const char* name)
 		file = file->next;
 	}
 
-	file = (struct npc_src_list*)aMalloc(sizeof(struct npc_src_list) + strlen(name));
+	file = (struct npc_src_list*)aCalloc(1, sizeof(struct npc_src_list) + strlen(name));
 	file->next = NULL;
 	strncpy(file->name, name, strlen(name) + 1);
 	if( file_prev == NULL )
@@ -1718,6 +1841,40 @@ void npc_delsrcfile(const char* name)
 	}
 }
 
+/// Returns the line number of the position pos in buffer.
+/// Uses the line index of the file being parsed instead of counting the
+/// newlines when possible.
+static int npc_strline(const char* buffer, size_t pos)
+{
+	int min, max;
+
+	if( buffer != npc_src_buffer || npc_src_lines == NULL )
+		return strline(buffer, pos);
+
+	// binary search for the last line that starts at or before pos
+	min = 0;
+	max = npc_src_line_count - 1;
+	while( min < max )
+	{
+		int mid = (min + max + 1)/2;
+		if( npc_src_lines[mid] <= (int)pos )
+			min = mid;
+		else
+			max = mid - 1;
+	}
+	return min + 1;
+}
+
+/// Compiles the script [src,end), keeping track of the time spent doing it.
+/// Scripts that didn't change since they were last compiled come from the script cache.
+static struct script_code* npc_parse_script_code(const char* src, const char* end, const char* file, int line, int options)
+{
+	int64 tick = gettick_usec();
+	struct script_code* code = parse_script_cached(src, end - src, file, line, options);
+	npc_script_usec += gettick_usec() - tick;
+	return code;
+}
+
 /// Parses and sets the name and exname of a npc.
 /// Assumes that m, x and y are already set in nd.
 static void npc_parsename(struct npc_data* nd, const char* name, const char* start, const char* buffer, const char* filepath)
@@ -1733,7 +1890,7 @@ static void npc_parsename(struct npc_data* nd, const char* name, const char* sta
 		size_t len = p-name;
 		if( len > NAME_LENGTH )
 		{
-			ShowWarning("npc_parsename: Display name of '%s' is too long (len=%u) in file '%s', line'%d'. Truncating to %u characters.\n", name, (unsigned int)len, filepath, strline(buffer,start-buffer), NAME_LENGTH);
+			ShowWarning("npc_parsename: Display name of '%s' is too long (len=%u) in file '%s', line'%d'. Truncating to %u characters.\n", name, (unsigned int)len, filepath, npc_strline(buffer,start-buffer), NAME_LENGTH);
 			safestrncpy(nd->name, name, sizeof(nd->name));
 		}
 		else
@@ -1743,14 +1900,14 @@ static void npc_parsename(struct npc_data* nd, const char* name, const char* sta
 		}
 		len = strlen(p+2);
 		if( len > NAME_LENGTH )
-			ShowWarning("npc_parsename: Unique name of '%s' is too long (len=%u) in file '%s', line'%d'. Truncating to %u characters.\n", name, (unsigned int)len, filepath, strline(buffer,start-buffer), NAME_LENGTH);
+			ShowWarning("npc_parsename: Unique name of '%s' is too long (len=%u) in file '%s', line'%d'. Truncating to %u characters.\n", name, (unsigned int)len, filepath, npc_strline(buffer,start-buffer), NAME_LENGTH);
 		safestrncpy(nd->exname, p+2, sizeof(nd->exname));
 	}
 	else
 	{// <Display name>
 		size_t len = strlen(name);
 		if( len > NAME_LENGTH )
-			ShowWarning("npc_parsename: Name '%s' is too long (len=%u) in file '%s', line'%d'. Truncating to %u characters.\n", name, (unsigned int)len, filepath, strline(buffer,start-buffer), NAME_LENGTH);
+			ShowWarning("npc_parsename: Name '%s' is too long (len=%u) in file '%s', line'%d'. Truncating to %u characters.\n", name, (unsigned int)len, filepath, npc_strline(buffer,start-buffer), NAME_LENGTH);
 		safestrncpy(nd->name, name, sizeof(nd->name));
 		safestrncpy(nd->exname, name, sizeof(nd->exname));
 	}
@@ -1758,7 +1915,7 @@ static void npc_parsename(struct npc_data* nd, const char* name, const char* sta
 	if( *nd->exname == '\0' || strstr(nd->exname,"::") != NULL )
 	{// invalid
 		snprintf(newname, ARRAYLENGTH(newname), "0_%d_%d_%d", nd->bl.m, nd->bl.x, nd->bl.y);
-		ShowWarning("npc_parsename: Invalid unique name in file '%s', line'%d'. Renaming '%s' to '%s'.\n", filepath, strline(buffer,start-buffer), nd->exname, newname);
+		ShowWarning("npc_parsename: Invalid unique name in file '%s', line'%d'. Renaming '%s' to '%s'.\n", filepath, npc_strline(buffer,start-buffer), nd->exname, newname);
 		safestrncpy(nd->exname, newname, sizeof(nd->exname));
 	}
 
@@ -1778,7 +1935,7 @@ static void npc_parsename(struct npc_data* nd, const char* name, const char* sta
 		strcpy(this_mapname, (nd->bl.m==-1?"(not on a map)":mapindex_id2name(map[nd->bl.m].index)));
 		strcpy(other_mapname, (dnd->bl.m==-1?"(not on a map)":mapindex_id2name(map[dnd->bl.m].index)));
 
-		ShowWarning("npc_parsename: Duplicate unique name in file '%s', line'%d'. Renaming '%s' to '%s'.\n", filepath, strline(buffer,start-buffer), nd->exname, newname);
+		ShowWarning("npc_parsename: Duplicate unique name in file '%s', line'%d'. Renaming '%s' to '%s'.\n", filepath, npc_strline(buffer,start-buffer), nd->exname, newname);
 		ShowDebug("this npc:\n   display name '%s'\n   unique name '%s'\n   map=%s, x=%d, y=%d\n", nd->name, nd->exname, this_mapname, nd->bl.x, nd->bl.y);
 		ShowDebug("other npc:\n   display name '%s'\n   unique name '%s'\n   map=%s, x=%d, y=%d\n", dnd->name, dnd->exname, other_mapname, dnd->bl.x, dnd->bl.y);
 		safestrncpy(nd->exname, newname, sizeof(nd->exname));
@@ -1839,7 +1996,7 @@ static const char* npc_parse_warp(char* w1, char* w2, char* w3, char* w4, const
 	if( sscanf(w1, "%31[^,],%d,%d", mapname, &x, &y) != 3
 	||	sscanf(w4, "%d,%d,%31[^,],%d,%d", &xs, &ys, to_mapname, &to_x, &to_y) != 5 )
 	{
-		ShowError("npc_parse_warp: Invalid warp definition in file '%s', line '%d'.\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, strline(buffer,start-buffer), w1, w2, w3, w4);
+		ShowError("npc_parse_warp: Invalid warp definition in file '%s', line '%d'.\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, npc_strline(buffer,start-buffer), w1, w2, w3, w4);
 		return strchr(start,'\n');// skip and continue
 	}
 
@@ -1847,11 +2004,12 @@ static const char* npc_parse_warp(char* w1, char* w2, char* w3, char* w4, const
 	i = mapindex_name2id(to_mapname);
 	if( i == 0 )
 	{
-		ShowError("npc_parse_warp: Unknown destination map in file '%s', line '%d' : %s\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, strline(buffer,start-buffer), to_mapname, w1, w2, w3, w4);
+		ShowError("npc_parse_warp: Unknown destination map in file '%s', line '%d' : %s\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, npc_strline(buffer,start-buffer), to_mapname, w1, w2, w3, w4);
 		return strchr(start,'\n');// skip and continue
 	}
 
 	CREATE(nd, struct npc_data, 1);
+	nd->src = npc_src_current;
 
 	nd->bl.id = npc_get_new_npc_id();
 	map_addnpc(m, nd);
@@ -1908,7 +2066,7 @@ static const char* npc_parse_shop(char* w1, char* w2, char* w3, char* w4, const
 		if( sscanf(w1, "%31[^,],%d,%d,%d", mapname, &x, &y, &dir) != 4
 		||	strchr(w4, ',') == NULL )
 		{
-			ShowError("npc_parse_shop: Invalid shop definition in file '%s', line '%d'.\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, strline(buffer,start-buffer), w1, w2, w3, w4);
+			ShowError("npc_parse_shop: Invalid shop definition in file '%s', line '%d'.\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, npc_strline(buffer,start-buffer), w1, w2, w3, w4);
 			return strchr(start,'\n');// skip and continue
 		}
 		
@@ -1927,13 +2085,13 @@ static const char* npc_parse_shop(char* w1, char* w2, char* w3, char* w4, const
 		struct item_data* id;
 		if( sscanf(p, ",%d:%d", &nameid, &value) != 2 )
 		{
-			ShowError("npc_parse_shop: Invalid item definition in file '%s', line '%d'. Ignoring the rest of the line...\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, strline(buffer,start-buffer), w1, w2, w3, w4);
+			ShowError("npc_parse_shop: Invalid item definition in file '%s', line '%d'. Ignoring the rest of the line...\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, npc_strline(buffer,start-buffer), w1, w2, w3, w4);
 			break;
 		}
 
 		if( (id = itemdb_exists(nameid)) == NULL )
 		{
-			ShowWarning("npc_parse_shop: Invalid sell item in file '%s', line '%d' (id '%d').\n", filepath, strline(buffer,start-buffer), nameid);
+			ShowWarning("npc_parse_shop: Invalid sell item in file '%s', line '%d' (id '%d').\n", filepath, npc_strline(buffer,start-buffer), nameid);
 			p = strchr(p+1,',');
 			continue;
 		}
@@ -1947,7 +2105,7 @@ static const char* npc_parse_shop(char* w1, char* w2, char* w3, char* w4, const
 		if( type == SHOP && value*0.75 < id->value_sell*1.24 )
 		{// Exploit possible: you can buy and sell back with profit
 			ShowWarning("npc_parse_shop: Item %s [%d] discounted buying price (%d->%d) is less than overcharged selling price (%d->%d) at file '%s', line '%d'.\n",
-				id->name, nameid, value, (int)(value*0.75), id->value_sell, (int)(id->value_sell*1.24), filepath, strline(buffer,start-buffer));
+				id->name, nameid, value, (int)(value*0.75), id->value_sell, (int)(id->value_sell*1.24), filepath, npc_strline(buffer,start-buffer));
 		}
 		//for logs filters, atcommands and iteminfo script command
 		if( id->maxchance == 0 )
@@ -1959,11 +2117,12 @@ static const char* npc_parse_shop(char* w1, char* w2, char* w3, char* w4, const
 	}
 	if( i == 0 )
 	{
-		ShowWarning("npc_parse_shop: Ignoring empty shop in file '%s', line '%d'.\n", filepath, strline(buffer,start-buffer));
+		ShowWarning("npc_parse_shop: Ignoring empty shop in file '%s', line '%d'.\n", filepath, npc_strline(buffer,start-buffer));
 		return strchr(start,'\n');// continue
 	}
 
 	CREATE(nd, struct npc_data, 1);
+	nd->src = npc_src_current;
 	CREATE(nd->u.shop.shop_item, struct npc_item_list, i);
 	memcpy(nd->u.shop.shop_item, items, sizeof(struct npc_item_list)*i);
 	nd->u.shop.count = i;
@@ -2056,7 +2215,7 @@ static const char* npc_skip_script(const char* start, const char* buffer, const
 	p = strchr(start,'{');
 	if( p == NULL )
 	{
-		ShowError("npc_skip_script: Missing left curly in file '%s', line'%d'.", filepath, strline(buffer,start-buffer));
+		ShowError("npc_skip_script: Missing left curly in file '%s', line'%d'.", filepath, npc_strline(buffer,start-buffer));
 		return NULL;// can't continue
 	}
 
@@ -2092,7 +2251,7 @@ static const char* npc_skip_script(const char* start, const char* buffer, const
 		}
 		else if( *p == '\0' )
 		{// end of buffer
-			ShowError("Missing %d right curlys at file '%s', line '%d'.\n", curly_count, filepath, strline(buffer,p-buffer));
+			ShowError("Missing %d right curlys at file '%s', line '%d'.\n", curly_count, filepath, npc_strline(buffer,p-buffer));
 			return NULL;// can't continue
 		}
 	}
@@ -2128,7 +2287,7 @@ static const char* npc_parse_script(char* w1, char* w2, char* w3, char* w4, cons
 	{// npc in a map
 		if( sscanf(w1, "%31[^,],%d,%d,%d", mapname, &x, &y, &dir) != 4 )
 		{
-			ShowError("npc_parse_script: Invalid placement format for a script in file '%s', line '%d'. Skipping the rest of file...\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, strline(buffer,start-buffer), w1, w2, w3, w4);
+			ShowError("npc_parse_script: Invalid placement format for a script in file '%s', line '%d'. Skipping the rest of file...\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, npc_strline(buffer,start-buffer), w1, w2, w3, w4);
 			return NULL;// unknown format, don't continue
 		}
 		m = map_mapname2mapid(mapname);
@@ -2138,7 +2297,7 @@ static const char* npc_parse_script(char* w1, char* w2, char* w3, char* w4, cons
 	end = strchr(start,'\n');
 	if( strstr(w4,",{") == NULL || script_start == NULL || (end != NULL && script_start > end) )
 	{
-		ShowError("npc_parse_script: Missing left curly ',{' in file '%s', line '%d'. Skipping the rest of the file.\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, strline(buffer,start-buffer), w1, w2, w3, w4);
+		ShowError("npc_parse_script: Missing left curly ',{' in file '%s', line '%d'. Skipping the rest of the file.\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, npc_strline(buffer,start-buffer), w1, w2, w3, w4);
 		return NULL;// can't continue
 	}
 	++script_start;
@@ -2147,7 +2306,7 @@ static const char* npc_parse_script(char* w1, char* w2, char* w3, char* w4, cons
 	if( end == NULL )
 		return NULL;// (simple) parse error, don't continue
 
-	script = parse_script(script_start, filepath, strline(buffer,script_start-buffer), SCRIPT_USE_LABEL_DB);
+	script = npc_parse_script_code(script_start, end, filepath, npc_strline(buffer,script_start-buffer), SCRIPT_USE_LABEL_DB);
 	label_list = NULL;
 	label_list_num = 0;
 	if( script )
@@ -2158,6 +2317,7 @@ static const char* npc_parse_script(char* w1, char* w2, char* w3, char* w4, cons
 	}
 
 	CREATE(nd, struct npc_data, 1);
+	nd->src = npc_src_current;
 
 	if( sscanf(w4, "%d,%d,%d", &class_, &xs, &ys) == 3 )
 	{// OnTouch area defined
@@ -2287,14 +2447,14 @@ const char* npc_parse_duplicate(char* w1, char* w2, char* w3, char* w4, const ch
 	// get the npc being duplicated
 	if( w2[length-1] != ')' || length <= 11 || length-11 >= sizeof(srcname) )
 	{// does not match 'duplicate(%127s)', name is empty or too long
-		ShowError("npc_parse_script: bad duplicate name in file '%s', line '%d' : %s\n", filepath, strline(buffer,start-buffer), w2);
+		ShowError("npc_parse_script: bad duplicate name in file '%s', line '%d' : %s\n", filepath, npc_strline(buffer,start-buffer), w2);
 		return end;// next line, try to continue
 	}
 	safestrncpy(srcname, w2+10, length-10);
 
 	dnd = npc_name2id(srcname);
 	if( dnd == NULL) {
-		ShowError("npc_parse_script: original npc not found for duplicate in file '%s', line '%d' : %s\n", filepath, strline(buffer,start-buffer), srcname);
+		ShowError("npc_parse_script: original npc not found for duplicate in file '%s', line '%d' : %s\n", filepath, npc_strline(buffer,start-buffer), srcname);
 		return end;// next line, try to continue
 	}
 	src_id = dnd->bl.id;
@@ -2310,7 +2470,7 @@ const char* npc_parse_duplicate(char* w1, char* w2, char* w3, char* w4, const ch
 	{
 		if( sscanf(w1, "%31[^,],%d,%d,%d", mapname, &x, &y, &dir) != 4 )// <map name>,<x>,<y>,<facing>
 		{
-			ShowError("npc_parse_duplicate: Invalid placement format for duplicate in file '%s', line '%d'. Skipping line...\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, strline(buffer,start-buffer), w1, w2, w3, w4);
+			ShowError("npc_parse_duplicate: Invalid placement format for duplicate in file '%s', line '%d'. Skipping line...\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, npc_strline(buffer,start-buffer), w1, w2, w3, w4);
 			return end;// next line, try to continue
 		}
 		m = map_mapname2mapid(mapname);
@@ -2321,11 +2481,12 @@ const char* npc_parse_duplicate(char* w1, char* w2, char* w3, char* w4, const ch
 	else if( type != WARP ) class_ = atoi(w4);// <sprite id>
 	else
 	{
-		ShowError("npc_parse_duplicate: Invalid span format for duplicate warp in file '%s', line '%d'. Skipping line...\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, strline(buffer,start-buffer), w1, w2, w3, w4);
+		ShowError("npc_parse_duplicate: Invalid span format for duplicate warp in file '%s', line '%d'. Skipping line...\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, npc_strline(buffer,start-buffer), w1, w2, w3, w4);
 		return end;// next line, try to continue
 	}
 
 	CREATE(nd, struct npc_data, 1);
+	nd->src = npc_src_current;
 
 	nd->bl.prev = nd->bl.next = NULL;
 	nd->bl.m = m;
@@ -2650,7 +2811,7 @@ static const char* npc_parse_function(char* w1, char* w2, char* w3, char* w4, co
 	end = strchr(start,'\n');
 	if( *w4 != '{' || script_start == NULL || (end != NULL && script_start > end) )
 	{
-		ShowError("npc_parse_function: Missing left curly '%%TAB%%{' in file '%s', line '%d'. Skipping the rest of the file.\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, strline(buffer,start-buffer), w1, w2, w3, w4);
+		ShowError("npc_parse_function: Missing left curly '%%TAB%%{' in file '%s', line '%d'. Skipping the rest of the file.\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, npc_strline(buffer,start-buffer), w1, w2, w3, w4);
 		return NULL;// can't continue
 	}
 	++script_start;
@@ -2659,15 +2820,20 @@ static const char* npc_parse_function(char* w1, char* w2, char* w3, char* w4, co
 	if( end == NULL )
 		return NULL;// (simple) parse error, don't continue
 
-	script = parse_script(script_start, filepath, strline(buffer,start-buffer), SCRIPT_RETURN_EMPTY_SCRIPT);
+	script = npc_parse_script_code(script_start, end, filepath, npc_strline(buffer,start-buffer), SCRIPT_RETURN_EMPTY_SCRIPT);
 	if( script == NULL )// parse error, continue
 		return end;
 
 	func_db = script_get_userfunc_db();
 	oldscript = (struct script_code*)strdb_put(func_db, w3, script);
-	if( oldscript != NULL )
+	if( oldscript != NULL && npc_src_current != NULL && npc_src_current->reload )
+	{// incremental reload, keep the old code until the next full reload
+		RECREATE(npc_retired_code, struct script_code*, npc_retired_count+1);
+		npc_retired_code[npc_retired_count++] = oldscript;
+	}
+	else if( oldscript != NULL )
 	{
-		ShowInfo("npc_parse_function: Overwriting user function [%s] (%s:%d)\n", w3, filepath, strline(buffer,start-buffer));
+		ShowInfo("npc_parse_function: Overwriting user function [%s] (%s:%d)\n", w3, filepath, npc_strline(buffer,start-buffer));
 		script_free_vars(&oldscript->script_vars);
 		aFree(oldscript->script_buf);
 		aFree(oldscript);
@@ -2704,6 +2870,7 @@ static const char* npc_parse_mob(char* w1, char* w2, char* w3, char* w4, const c
 
 	memset(&mob, 0, sizeof(struct spawn_data));
 
+	mob.src = npc_src_current;
 	mob.state.boss = !strcmpi(w2,"boss_monster");
 
 	// w1=<map name>,<x>,<y>,<xs>,<ys>
@@ -2711,12 +2878,12 @@ static const char* npc_parse_mob(char* w1, char* w2, char* w3, char* w4, const c
 	if( sscanf(w1, "%31[^,],%d,%d,%d,%d", mapname, &x, &y, &xs, &ys) < 3
 	||	sscanf(w4, "%d,%d,%u,%u,%127[^\t\r\n]", &class_, &num, &mob.delay1, &mob.delay2, mob.eventname) < 2 )
 	{
-		ShowError("npc_parse_mob: Invalid mob definition in file '%s', line '%d'.\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, strline(buffer,start-buffer), w1, w2, w3, w4);
+		ShowError("npc_parse_mob: Invalid mob definition in file '%s', line '%d'.\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, npc_strline(buffer,start-buffer), w1, w2, w3, w4);
 		return strchr(start,'\n');// skip and continue
 	}
 	if( mapindex_name2id(mapname) == 0 )
 	{
-		ShowError("npc_parse_mob: Unknown map '%s' in file '%s', line '%d'.\n", mapname, filepath, strline(buffer,start-buffer));
+		ShowError("npc_parse_mob: Unknown map '%s' in file '%s', line '%d'.\n", mapname, filepath, npc_strline(buffer,start-buffer));
 		return strchr(start,'\n');// skip and continue
 	}
 	m =  map_mapname2mapid(mapname);
@@ -2726,20 +2893,20 @@ static const char* npc_parse_mob(char* w1, char* w2, char* w3, char* w4, const c
 
 	if( x < 0 || x >= map[mob.m].xs || y < 0 || y >= map[mob.m].ys )
 	{
-		ShowError("npc_parse_mob: Spawn coordinates out of range: %s (%d,%d), map size is (%d,%d) - %s %s (file '%s', line '%d').\n", map[mob.m].name, x, y, (map[mob.m].xs-1), (map[mob.m].ys-1), w1, w3, filepath, strline(buffer,start-buffer));
+		ShowError("npc_parse_mob: Spawn coordinates out of range: %s (%d,%d), map size is (%d,%d) - %s %s (file '%s', line '%d').\n", map[mob.m].name, x, y, (map[mob.m].xs-1), (map[mob.m].ys-1), w1, w3, filepath, npc_strline(buffer,start-buffer));
 		return strchr(start,'\n');// skip and continue
 	}
 
 	// check monster ID if exists!
 	if( mobdb_checkid(class_) == 0 )
 	{
-		ShowError("npc_parse_mob: Unknown mob ID %d (file '%s', line '%d').\n", class_, filepath, strline(buffer,start-buffer));
+		ShowError("npc_parse_mob: Unknown mob ID %d (file '%s', line '%d').\n", class_, filepath, npc_strline(buffer,start-buffer));
 		return strchr(start,'\n');// skip and continue
 	}
 
 	if( num < 1 || num > 1000 )
 	{
-		ShowError("npc_parse_mob: Invalid number of monsters %d, must be inside the range [1,1000] (file '%s', line '%d').\n", num, filepath, strline(buffer,start-buffer));
+		ShowError("npc_parse_mob: Invalid number of monsters %d, must be inside the range [1,1000] (file '%s', line '%d').\n", num, filepath, npc_strline(buffer,start-buffer));
 		return strchr(start,'\n');// skip and continue
 	}
 
@@ -2785,7 +2952,7 @@ static const char* npc_parse_mob(char* w1, char* w2, char* w3, char* w4, const c
 	}
 
 	if(mob.delay1>0xfffffff || mob.delay2>0xfffffff) {
-		ShowError("npc_parse_mob: Invalid spawn delays %u %u (file '%s', line '%d').\n", mob.delay1, mob.delay2, filepath, strline(buffer,start-buffer));
+		ShowError("npc_parse_mob: Invalid spawn delays %u %u (file '%s', line '%d').\n", mob.delay1, mob.delay2, filepath, npc_strline(buffer,start-buffer));
 		return strchr(start,'\n');// skip and continue
 	}
 
@@ -2800,7 +2967,7 @@ static const char* npc_parse_mob(char* w1, char* w2, char* w3, char* w4, const c
 	//Verify dataset.
 	if( !mob_parse_dataset(&mob) )
 	{
-		ShowError("npc_parse_mob: Invalid dataset for monster ID %d (file '%s', line '%d').\n", class_, filepath, strline(buffer,start-buffer));
+		ShowError("npc_parse_mob: Invalid dataset for monster ID %d (file '%s', line '%d').\n", class_, filepath, npc_strline(buffer,start-buffer));
 		return strchr(start,'\n');// skip and continue
 	}
 
@@ -2868,16 +3035,19 @@ static const char* npc_parse_mapflag(char* w1, char* w2, char* w3, char* w4, con
 	char mapname[32];
 	int state = 1;
 
+	if( npc_src_current != NULL )
+		npc_src_current->mapflags = true;
+
 	// w1=<mapname>
 	if( sscanf(w1, "%31[^,]", mapname) != 1 )
 	{
-		ShowError("npc_parse_mapflag: Invalid mapflag definition in file '%s', line '%d'.\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, strline(buffer,start-buffer), w1, w2, w3, w4);
+		ShowError("npc_parse_mapflag: Invalid mapflag definition in file '%s', line '%d'.\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, npc_strline(buffer,start-buffer), w1, w2, w3, w4);
 		return strchr(start,'\n');// skip and continue
 	}
 	m = map_mapname2mapid(mapname);
 	if( m < 0 )
 	{
-		ShowWarning("npc_parse_mapflag: Unknown map in file '%s', line '%d' : %s\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", mapname, filepath, strline(buffer,start-buffer), w1, w2, w3, w4);
+		ShowWarning("npc_parse_mapflag: Unknown map in file '%s', line '%d' : %s\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", mapname, filepath, npc_strline(buffer,start-buffer), w1, w2, w3, w4);
 		return strchr(start,'\n');// skip and continue
 	}
 
@@ -2898,7 +3068,7 @@ static const char* npc_parse_mapflag(char* w1, char* w2, char* w3, char* w4, con
 			map[m].save.x = savex;
 			map[m].save.y = savey;
 			if (!map[m].save.map) {
-				ShowWarning("npc_parse_mapflag: Specified save point map '%s' for mapflag 'nosave' not found (file '%s', line '%d'), using 'SavePoint'.\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", savemap, filepath, strline(buffer,start-buffer), w1, w2, w3, w4);
+				ShowWarning("npc_parse_mapflag: Specified save point map '%s' for mapflag 'nosave' not found (file '%s', line '%d'), using 'SavePoint'.\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", savemap, filepath, npc_strline(buffer,start-buffer), w1, w2, w3, w4);
 				map[m].save.x = -1;
 				map[m].save.y = -1;
 			}
@@ -2936,12 +3106,12 @@ static const char* npc_parse_mapflag(char* w1, char* w2, char* w3, char* w4, con
 			map[m].flag.gvg = 0;
 			map[m].flag.gvg_dungeon = 0;
 			map[m].flag.gvg_castle = 0;
-			ShowWarning("npc_parse_mapflag: You can't set PvP and GvG flags for the same map! Removing GvG flags from %s (file '%s', line '%d').\n", map[m].name, filepath, strline(buffer,start-buffer));
+			ShowWarning("npc_parse_mapflag: You can't set PvP and GvG flags for the same map! Removing GvG flags from %s (file '%s', line '%d').\n", map[m].name, filepath, npc_strline(buffer,start-buffer));
 		}
 		if( state && map[m].flag.battleground )
 		{
 			map[m].flag.battleground = 0;
-			ShowWarning("npc_parse_mapflag: You can't set GvG and BattleGround flags for the same map! Removing BattleGround flag from %s (file '%s', line '%d').\n", map[m].name, filepath, strline(buffer,start-buffer));
+			ShowWarning("npc_parse_mapflag: You can't set GvG and BattleGround flags for the same map! Removing BattleGround flag from %s (file '%s', line '%d').\n", map[m].name, filepath, npc_strline(buffer,start-buffer));
 		}
 	}
 	else if (!strcmpi(w3,"pvp_noparty"))
@@ -2985,12 +3155,12 @@ static const char* npc_parse_mapflag(char* w1, char* w2, char* w3, char* w4, con
 		if( state && map[m].flag.pvp )
 		{
 			map[m].flag.pvp = 0;
-			ShowWarning("npc_parse_mapflag: You can't set PvP and GvG flags for the same map! Removing PvP flag from %s (file '%s', line '%d').\n", map[m].name, filepath, strline(buffer,start-buffer));
+			ShowWarning("npc_parse_mapflag: You can't set PvP and GvG flags for the same map! Removing PvP flag from %s (file '%s', line '%d').\n", map[m].name, filepath, npc_strline(buffer,start-buffer));
 		}
 		if( state && map[m].flag.battleground )
 		{
 			map[m].flag.battleground = 0;
-			ShowWarning("npc_parse_mapflag: You can't set PvP and BattleGround flags for the same map! Removing BattleGround flag from %s (file '%s', line '%d').\n", map[m].name, filepath, strline(buffer,start-buffer));
+			ShowWarning("npc_parse_mapflag: You can't set PvP and BattleGround flags for the same map! Removing BattleGround flag from %s (file '%s', line '%d').\n", map[m].name, filepath, npc_strline(buffer,start-buffer));
 		}
 	}
 	else if (!strcmpi(w3,"gvg_noparty"))
@@ -3017,14 +3187,14 @@ static const char* npc_parse_mapflag(char* w1, char* w2, char* w3, char* w4, con
 		if( map[m].flag.battleground && map[m].flag.pvp )
 		{
 			map[m].flag.pvp = 0;
-			ShowWarning("npc_parse_mapflag: You can't set PvP and BattleGround flags for the same map! Removing PvP flag from %s (file '%s', line '%d').\n", map[m].name, filepath, strline(buffer,start-buffer));
+			ShowWarning("npc_parse_mapflag: You can't set PvP and BattleGround flags for the same map! Removing PvP flag from %s (file '%s', line '%d').\n", map[m].name, filepath, npc_strline(buffer,start-buffer));
 		}
 		if( map[m].flag.battleground && (map[m].flag.gvg || map[m].flag.gvg_dungeon || map[m].flag.gvg_castle) )
 		{
 			map[m].flag.gvg = 0;
 			map[m].flag.gvg_dungeon = 0;
 			map[m].flag.gvg_castle = 0;
-			ShowWarning("npc_parse_mapflag: You can't set GvG and BattleGround flags for the same map! Removing GvG flag from %s (file '%s', line '%d').\n", map[m].name, filepath, strline(buffer,start-buffer));
+			ShowWarning("npc_parse_mapflag: You can't set GvG and BattleGround flags for the same map! Removing GvG flag from %s (file '%s', line '%d').\n", map[m].name, filepath, npc_strline(buffer,start-buffer));
 		}
 	}
 	else if (!strcmpi(w3,"noexppenalty"))
@@ -3117,40 +3287,107 @@ static const char* npc_parse_mapflag(char* w1, char* w2, char* w3, char* w4, con
 	else if (!strcmpi(w3,"reset"))
 		map[m].flag.reset=state;
 	else
-		ShowError("npc_parse_mapflag: unrecognized mapflag '%s' (file '%s', line '%d').\n", w3, filepath, strline(buffer,start-buffer));
+		ShowError("npc_parse_mapflag: unrecognized mapflag '%s' (file '%s', line '%d').\n", w3, filepath, npc_strline(buffer,start-buffer));
 
 	return strchr(start,'\n');// continue
 }
 
-void npc_parsesrcfile(const char* filepath)
+/// Reads a npc file and builds its line index.
+/// Runs in the loader threads, so it only uses the system allocator and doesn't output anything.
+static void npc_readsrcfile(struct npc_src_load* file)
 {
-	int m, lines = 0;
+	int64 tick = gettick_usec();
 	FILE* fp;
-	size_t len;
-	char* buffer;
-	const char* p;
+	size_t len, i;
+	int n;
 
-	// read whole file to buffer
-	fp = fopen(filepath, "rb");
+	fp = fopen(file->name, "rb");
 	if( fp == NULL )
 	{
-		ShowError("npc_parsesrcfile: File not found '%s'.\n", filepath);
+		file->notfound = true;
+		file->read_usec = gettick_usec() - tick;
 		return;
 	}
 	fseek(fp, 0, SEEK_END);
 	len = ftell(fp);
-	buffer = (char*)aMalloc(len+1);
+	file->arena = malloc_arena_create("npc file");
+	file->buffer = (char*)malloc_arena_alloc(file->arena, len+1);
+	if( file->buffer == NULL )
+	{
+		file->error = ENOMEM;
+		malloc_arena_destroy(file->arena);
+		file->arena = NULL;
+		fclose(fp);
+		file->read_usec = gettick_usec() - tick;
+		return;
+	}
 	fseek(fp, 0, SEEK_SET);
-	len = fread(buffer, sizeof(char), len, fp);
-	buffer[len] = '\0';
+	len = fread(file->buffer, sizeof(char), len, fp);
+	file->buffer[len] = '\0';
 	if( ferror(fp) )
 	{
-		ShowError("npc_parsesrcfile: Failed to read file '%s' - %s\n", filepath, strerror(errno));
-		aFree(buffer);
+		file->error = errno;
+		malloc_arena_destroy(file->arena);
+		file->arena = NULL;
+		file->buffer = NULL;
 		fclose(fp);
+		file->read_usec = gettick_usec() - tick;
 		return;
 	}
 	fclose(fp);
+	file->len = len;
+
+	// contents hash (64-bit FNV-1a) and line index
+	file->hash = 0xcbf29ce484222325ULL;
+	n = 1;
+	for( i = 0; i < len; ++i )
+	{
+		file->hash = (file->hash ^ (uint8)file->buffer[i]) * 0x100000001b3ULL;
+		if( file->buffer[i] == '\n' )
+			++n;
+	}
+	file->lines = (int*)malloc_arena_alloc(file->arena, n*sizeof(int));
+	if( file->lines != NULL )
+	{
+		file->lines[0] = 0;
+		n = 1;
+		for( i = 0; i < len; ++i )
+			if( file->buffer[i] == '\n' )
+				file->lines[n++] = (int)(i+1);
+		file->line_count = n;
+	}
+	file->read_usec = gettick_usec() - tick;
+}
+
+/// Parses a npc file that was read by npc_readsrcfile and releases its contents.
+static void npc_parsesrcload(struct npc_src_load* file)
+{
+	const char* filepath = file->name;
+	const char* buffer = file->buffer;
+	size_t len = file->len;
+	int m, lines = 0;
+	const char* p;
+
+	if( file->src != NULL )
+	{
+		file->src->hash = file->hash;
+		file->src->loaded = true;
+		file->src->mapflags = false;
+	}
+	if( file->notfound )
+	{
+		ShowError("npc_parsesrcfile: File not found '%s'.\n", filepath);
+		return;
+	}
+	if( buffer == NULL )
+	{
+		ShowError("npc_parsesrcfile: Failed to read file '%s' - %s\n", filepath, strerror(file->error));
+		return;
+	}
+	npc_src_buffer = buffer;
+	npc_src_lines = file->lines;
+	npc_src_line_count = file->line_count;
+	npc_src_current = file->src;
 
 	// parse buffer
 	for( p = skip_space(buffer); p && *p ; p = skip_space(p) )
@@ -3164,30 +3401,30 @@ void npc_parsesrcfile(const char* filepath)
 		count = sv_parse(p, len+buffer-p, 0, '\t', pos, ARRAYLENGTH(pos), (e_svopt)(SV_TERMINATE_LF|SV_TERMINATE_CRLF));
 		if( count < 0 )
 		{
-			ShowError("npc_parsesrcfile: Parse error in file '%s', line '%d'. Stopping...\n", filepath, strline(buffer,p-buffer));
+			ShowError("npc_parsesrcfile: Parse error in file '%s', line '%d'. Stopping...\n", filepath, npc_strline(buffer,p-buffer));
 			break;
 		}
 		// fill w1
 		if( pos[3]-pos[2] > ARRAYLENGTH(w1)-1 )
-			ShowWarning("npc_parsesrcfile: w1 truncated, too much data (%d) in file '%s', line '%d'.\n", pos[3]-pos[2], filepath, strline(buffer,p-buffer));
+			ShowWarning("npc_parsesrcfile: w1 truncated, too much data (%d) in file '%s', line '%d'.\n", pos[3]-pos[2], filepath, npc_strline(buffer,p-buffer));
 		i = min(pos[3]-pos[2], ARRAYLENGTH(w1)-1);
 		memcpy(w1, p+pos[2], i*sizeof(char));
 		w1[i] = '\0';
 		// fill w2
 		if( pos[5]-pos[4] > ARRAYLENGTH(w2)-1 )
-			ShowWarning("npc_parsesrcfile: w2 truncated, too much data (%d) in file '%s', line '%d'.\n", pos[5]-pos[4], filepath, strline(buffer,p-buffer));
+			ShowWarning("npc_parsesrcfile: w2 truncated, too much data (%d) in file '%s', line '%d'.\n", pos[5]-pos[4], filepath, npc_strline(buffer,p-buffer));
 		i = min(pos[5]-pos[4], ARRAYLENGTH(w2)-1);
 		memcpy(w2, p+pos[4], i*sizeof(char));
 		w2[i] = '\0';
 		// fill w3
 		if( pos[7]-pos[6] > ARRAYLENGTH(w3)-1 )
-			ShowWarning("npc_parsesrcfile: w3 truncated, too much data (%d) in file '%s', line '%d'.\n", pos[7]-pos[6], filepath, strline(buffer,p-buffer));
+			ShowWarning("npc_parsesrcfile: w3 truncated, too much data (%d) in file '%s', line '%d'.\n", pos[7]-pos[6], filepath, npc_strline(buffer,p-buffer));
 		i = min(pos[7]-pos[6], ARRAYLENGTH(w3)-1);
 		memcpy(w3, p+pos[6], i*sizeof(char));
 		w3[i] = '\0';
 		// fill w4 (to end of line)
 		if( pos[1]-pos[8] > ARRAYLENGTH(w4)-1 )
-			ShowWarning("npc_parsesrcfile: w4 truncated, too much data (%d) in file '%s', line '%d'.\n", pos[1]-pos[8], filepath, strline(buffer,p-buffer));
+			ShowWarning("npc_parsesrcfile: w4 truncated, too much data (%d) in file '%s', line '%d'.\n", pos[1]-pos[8], filepath, npc_strline(buffer,p-buffer));
 		if( pos[8] != -1 )
 		{
 			i = min(pos[1]-pos[8], ARRAYLENGTH(w4)-1);
@@ -3199,7 +3436,7 @@ void npc_parsesrcfile(const char* filepath)
 
 		if( count < 3 )
 		{// Unknown syntax
-			ShowError("npc_parsesrcfile: Unknown syntax in file '%s', line '%d'. Stopping...\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, strline(buffer,p-buffer), w1, w2, w3, w4);
+			ShowError("npc_parsesrcfile: Unknown syntax in file '%s', line '%d'. Stopping...\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, npc_strline(buffer,p-buffer), w1, w2, w3, w4);
 			break;
 		}
 
@@ -3209,7 +3446,7 @@ void npc_parsesrcfile(const char* filepath)
 			sscanf(w1,"%[^,]",mapname);
 			if( !mapindex_name2id(mapname) )
 			{// Incorrect map, we must skip the script info...
-				ShowError("npc_parsesrcfile: Unknown map '%s' in file '%s', line '%d'. Skipping line...\n", mapname, filepath, strline(buffer,p-buffer));
+				ShowError("npc_parsesrcfile: Unknown map '%s' in file '%s', line '%d'. Skipping line...\n", mapname, filepath, npc_strline(buffer,p-buffer));
 				if( strcasecmp(w2,"script") == 0 && count > 3 )
 				{
 					if((p = npc_skip_script(p,buffer,filepath)) == NULL)
@@ -3264,13 +3501,158 @@ void npc_parsesrcfile(const char* filepath)
 		}
 		else
 		{
-			ShowError("npc_parsesrcfile: Unable to parse, probably a missing or extra TAB in file '%s', line '%d'. Skipping line...\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, strline(buffer,p-buffer), w1, w2, w3, w4);
+			ShowError("npc_parsesrcfile: Unable to parse, probably a missing or extra TAB in file '%s', line '%d'. Skipping line...\n * w1=%s\n * w2=%s\n * w3=%s\n * w4=%s\n", filepath, npc_strline(buffer,p-buffer), w1, w2, w3, w4);
 			p = strchr(p,'\n');// skip and continue
 		}
 	}
-	aFree(buffer);
 
-	return;
+	npc_src_buffer = NULL;
+	npc_src_lines = NULL;
+	npc_src_line_count = 0;
+	npc_src_current = NULL;
+	malloc_arena_destroy(file->arena);
+	file->arena = NULL;
+	file->buffer = NULL;
+	file->lines = NULL;
+}
+
+void npc_parsesrcfile(const char* filepath)
+{
+	struct npc_src_load file;
+
+	memset(&file, 0, sizeof(file));
+	file.name = filepath;
+	for( file.src = npc_src_files; file.src != NULL && strcmp(file.src->name, filepath) != 0; file.src = file.src->next );
+	npc_readsrcfile(&file);
+	npc_parsesrcload(&file);
+}
+
+/// Loader thread. Reads the npc files in list order, ahead of the main thread.
+static void npc_loader_main(void* arg)
+{
+	for(;;)
+	{
+		struct npc_src_load* file;
+
+		amutex_lock(npc_loader.mutex);
+		if( npc_loader.next >= npc_loader.count )
+		{
+			amutex_unlock(npc_loader.mutex);
+			break;
+		}
+		file = &npc_loader.files[npc_loader.next++];
+		amutex_unlock(npc_loader.mutex);
+
+		npc_readsrcfile(file);
+
+		amutex_lock(npc_loader.mutex);
+		file->done = true;
+		acond_broadcast(npc_loader.cond);
+		amutex_unlock(npc_loader.mutex);
+	}
+}
+
+/// Loads the npc source files (all or only the ones marked for reload).
+/// The files are read by npc_load_threads threads while the main thread
+/// parses them, in list order, so the result doesn't depend on the threads.
+static void npc_loadsrcfiles(bool marked)
+{
+	athread* threads[MAX_NPC_LOAD_THREADS];
+	struct npc_src_list* nsl;
+	int64 tick = gettick_usec();
+	int64 read_usec = 0, wait_usec = 0, parse_usec = 0;
+	int slowest[3] = { -1, -1, -1 };
+	int i, j, thread_count = 0;
+
+	memset(&npc_loader, 0, sizeof(npc_loader));
+	for( nsl = npc_src_files; nsl != NULL; nsl = nsl->next )
+		if( !marked || nsl->reload )
+			++npc_loader.count;
+	if( npc_loader.count == 0 )
+		return;
+	CREATE(npc_loader.files, struct npc_src_load, npc_loader.count);
+	for( i = 0, nsl = npc_src_files; nsl != NULL; nsl = nsl->next )
+	{
+		if( marked && !nsl->reload )
+			continue;
+		npc_loader.files[i].name = nsl->name;
+		npc_loader.files[i].src = nsl;
+		++i;
+	}
+	npc_script_usec = 0;
+
+	if( npc_load_threads > 0 && npc_loader.count > 1 )
+	{
+		npc_loader.mutex = amutex_create();
+		npc_loader.cond = acond_create();
+		for( i = 0; i < npc_load_threads && i < MAX_NPC_LOAD_THREADS && i < npc_loader.count; ++i )
+		{
+			threads[thread_count] = athread_create(npc_loader_main, NULL);
+			if( threads[thread_count] == NULL )
+			{
+				ShowWarning("npc_loadsrcfiles: Failed to create loader thread, using %d.\n", thread_count);
+				break;
+			}
+			++thread_count;
+		}
+	}
+
+	for( i = 0; i < npc_loader.count; ++i )
+	{
+		struct npc_src_load* file = &npc_loader.files[i];
+		bool read = true;
+		int64 start;
+
+		ShowStatus("Loading NPC file: %s"CL_CLL"\r", file->name);
+		if( thread_count > 0 )
+		{// take the file from the loader threads, or read it here if they haven't got to it yet
+			start = gettick_usec();
+			amutex_lock(npc_loader.mutex);
+			if( npc_loader.next <= i )
+				npc_loader.next = i + 1;
+			else
+			{
+				read = false;
+				while( !file->done )
+					acond_wait(npc_loader.cond, npc_loader.mutex);
+			}
+			amutex_unlock(npc_loader.mutex);
+			wait_usec += gettick_usec() - start;
+		}
+		if( read )
+			npc_readsrcfile(file);
+		read_usec += file->read_usec;
+
+		start = gettick_usec();
+		npc_parsesrcload(file);
+		file->parse_usec = gettick_usec() - start;
+		parse_usec += file->parse_usec;
+
+		// keep track of the slowest files
+		ARR_FIND(0, ARRAYLENGTH(slowest), j, slowest[j] < 0 || npc_loader.files[slowest[j]].parse_usec < file->parse_usec);
+		if( j < ARRAYLENGTH(slowest) )
+		{
+			memmove(&slowest[j+1], &slowest[j], (ARRAYLENGTH(slowest)-j-1)*sizeof(slowest[0]));
+			slowest[j] = i;
+		}
+	}
+
+	for( i = 0; i < thread_count; ++i )
+		athread_join(threads[i]);
+	if( npc_loader.mutex != NULL )
+	{
+		acond_destroy(npc_loader.cond);
+		amutex_destroy(npc_loader.mutex);
+	}
+
+	ShowInfo("Loaded '"CL_WHITE"%d"CL_RESET"' NPC files in '"CL_WHITE"%u"CL_RESET"' ms (read %u ms by %d thread(s), waited %u ms, parsed %u ms, compiled scripts %u ms)."CL_CLL"\n",
+		npc_loader.count, (unsigned int)((gettick_usec() - tick)/1000), (unsigned int)(read_usec/1000), thread_count,
+		(unsigned int)(wait_usec/1000), (unsigned int)(parse_usec/1000), (unsigned int)(npc_script_usec/1000));
+	for( i = 0; i < ARRAYLENGTH(slowest) && slowest[i] >= 0; ++i )
+		ShowInfo("\t- '"CL_WHITE"%s"CL_RESET"' parsed in %u ms\n", npc_loader.files[slowest[i]].name, (unsigned int)(npc_loader.files[slowest[i]].parse_usec/1000));
+
+	aFree(npc_loader.files);
+	memset(&npc_loader, 0, sizeof(npc_loader));
 }
 
 int npc_script_event(struct map_session_data* sd, enum npce_event type)
@@ -3344,9 +3726,25 @@ void npc_read_event_script(void)
 	}
 }
 
+/// Frees the user functions that were replaced by incremental reloads.
+static void npc_free_retired_code(void)
+{
+	int i;
+
+	for( i = 0; i < npc_retired_count; ++i )
+	{
+		script_free_vars(&npc_retired_code[i]->script_vars);
+		aFree(npc_retired_code[i]->script_buf);
+		aFree(npc_retired_code[i]);
+	}
+	if( npc_retired_code != NULL )
+		aFree(npc_retired_code);
+	npc_retired_code = NULL;
+	npc_retired_count = 0;
+}
+
 int npc_reload(void)
 {
-	struct npc_src_list *nsl;
 	int m, i;
 	int npc_new_min = npc_id;
 	struct s_mapiterator* iter;
@@ -3390,6 +3788,9 @@ int npc_reload(void)
 	// clear mob spawn lookup index
 	mob_clear_spawninfo();
 
+	// the sleeping scripts were stopped by script_reload
+	npc_free_retired_code();
+
 	// clear npc-related data structures
 	ev_db->clear(ev_db,NULL);
 	npcname_db->clear(npcname_db,NULL);
@@ -3399,13 +3800,9 @@ int npc_reload(void)
 	// reset mapflags
 	map_flags_init();
 
-	//TODO: the following code is copy-pasted from do_init_npc(); clean it up
 	// Reloading npcs now
-	for (nsl = npc_src_files; nsl; nsl = nsl->next)
-	{
-		ShowStatus("Loading NPC file: %s"CL_CLL"\r", nsl->name);
-		npc_parsesrcfile(nsl->name);
-	}
+	npc_loadsrcfiles(false);
+	script_cache_save(false); // the item scripts weren't parsed again
 
 	ShowInfo ("Done loading '"CL_WHITE"%d"CL_RESET"' NPCs:"CL_CLL"\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Warps\n"
@@ -3432,6 +3829,187 @@ int npc_reload(void)
 	return 0;
 }
 
+/// Removes a mob spawn from the mob spawn lookup index.
+static void npc_unload_spawninfo(struct spawn_data* data, int num)
+{
+	struct mob_db* db = mob_db(data->class_);
+	int i, j;
+
+	ARR_FIND(0, ARRAYLENGTH(db->spawn), i, db->spawn[i].mapindex == map[data->m].index);
+	if( i == ARRAYLENGTH(db->spawn) )
+		return;
+	db->spawn[i].qty -= num;
+	if( db->spawn[i].qty <= 0 )
+	{// remove from the list
+		memmove(&db->spawn[i], &db->spawn[i+1], (ARRAYLENGTH(db->spawn)-i-1)*sizeof(db->spawn[0]));
+		memset(&db->spawn[ARRAYLENGTH(db->spawn)-1], 0, sizeof(db->spawn[0]));
+		return;
+	}
+	// keep the list sorted
+	for( j = i; j+1 < ARRAYLENGTH(db->spawn) && db->spawn[j+1].qty > db->spawn[i].qty; ++j );
+	if( j != i )
+	{
+		unsigned short mapindex = db->spawn[i].mapindex;
+		int qty = db->spawn[i].qty;
+		memmove(&db->spawn[i], &db->spawn[i+1], (j-i)*sizeof(db->spawn[0]));
+		db->spawn[j].mapindex = mapindex;
+		db->spawn[j].qty = qty;
+	}
+}
+
+/// Reloads only the npc files that changed since they were loaded.
+/// The npcs, mob spawns and sleeping scripts of the other files are kept.
+/// Files with duplicates of npcs of a changed file are reloaded as well.
+/// Returns the number of reloaded files, or -1 if a full reload is needed
+/// because a changed file sets mapflags (they aren't tracked per file).
+int npc_reload_changed(void)
+{
+	const char* events[] = { "OnInit", "OnInterIfInit", "OnInterIfInitOnce" };
+	struct npc_src_list* nsl;
+	struct s_mapiterator* iter;
+	struct block_list* bl;
+	int count = 0, unloaded = 0, loaded = 0, ran = 0;
+	int npc_new_min = npc_id;
+	bool changed;
+	int m, i;
+
+	// compare the contents of the files
+	for( nsl = npc_src_files; nsl != NULL; nsl = nsl->next )
+	{
+		struct npc_src_load file;
+
+		memset(&file, 0, sizeof(file));
+		file.name = nsl->name;
+		npc_readsrcfile(&file);
+		nsl->reload = ( !nsl->loaded || file.hash != nsl->hash );
+		free(file.buffer);
+		free(file.lines);
+		if( nsl->reload && nsl->loaded && nsl->mapflags )
+		{
+			ShowInfo("npc_reload_changed: '%s' sets mapflags, a full reload is needed.\n", nsl->name);
+			for( nsl = npc_src_files; nsl != NULL; nsl = nsl->next )
+				nsl->reload = false;
+			return -1;
+		}
+	}
+
+	// duplicates of reloaded npcs are reloaded with them
+	do
+	{
+		changed = false;
+		iter = mapit_geteachnpc();
+		for( bl = (struct block_list*)mapit_first(iter); mapit_exists(iter); bl = (struct block_list*)mapit_next(iter) )
+		{
+			struct npc_data* nd = (struct npc_data*)bl;
+			struct npc_data* snd;
+
+			if( nd->src_id == 0 || nd->src == NULL || nd->src->reload )
+				continue;
+			snd = map_id2nd(nd->src_id);
+			if( snd != NULL && snd->src != NULL && snd->src->reload )
+			{
+				nd->src->reload = true;
+				changed = true;
+			}
+		}
+		mapit_free(iter);
+	}
+	while( changed );
+
+	for( nsl = npc_src_files; nsl != NULL; nsl = nsl->next )
+		if( nsl->reload )
+			++count;
+	if( count == 0 )
+		return 0;
+
+	iter = mapit_geteachnpc();
+	for( bl = (struct block_list*)mapit_first(iter); mapit_exists(iter); bl = (struct block_list*)mapit_next(iter) )
+		if( ((struct npc_data*)bl)->src != NULL && ((struct npc_data*)bl)->src->reload )
+			++unloaded;
+	mapit_free(iter);
+
+	// remove the npcs and mobs of the reloaded files
+	iter = mapit_geteachiddb();
+	for( bl = (struct block_list*)mapit_first(iter); mapit_exists(iter); bl = (struct block_list*)mapit_next(iter) )
+	{
+		if( bl->type == BL_NPC )
+		{
+			struct npc_data* nd = (struct npc_data*)bl;
+
+			if( nd->src == NULL || !nd->src->reload )
+				continue;
+			npc_unload_dialogs(nd);
+			if( nd->subtype == SCRIPT )
+				npc_unload_duplicates(nd);
+			npc_unload(nd);
+		}
+		else if( bl->type == BL_MOB )
+		{
+			struct mob_data* md = (struct mob_data*)bl;
+
+			if( md->spawn == NULL || md->spawn->src == NULL || !md->spawn->src->reload )
+				continue;
+			if( !md->spawn->state.dynamic )
+				npc_unload_spawninfo(md->spawn, 1);
+			unit_free(bl, CLR_OUTSIGHT);
+		}
+	}
+	mapit_free(iter);
+
+	for( m = 0; m < map_num; m++ )
+	{
+		for( i = 0; i < MAX_MOB_LIST_PER_MAP; i++ )
+		{
+			struct spawn_data* data = map[m].moblist[i];
+			if( data != NULL && data->src != NULL && data->src->reload )
+			{
+				npc_unload_spawninfo(data, data->num);
+				aFree(data);
+				map[m].moblist[i] = NULL;
+			}
+		}
+	}
+
+	// load the files again
+	npc_loadsrcfiles(true);
+	script_cache_save(false); // only the changed files were parsed again
+	npc_read_event_script();
+
+	// run the init events of the new npcs
+	iter = mapit_geteachnpc();
+	for( bl = (struct block_list*)mapit_first(iter); mapit_exists(iter); bl = (struct block_list*)mapit_next(iter) )
+	{
+		struct npc_data* nd = (struct npc_data*)bl;
+
+		if( nd->bl.id < npc_new_min || nd->src == NULL || !nd->src->reload )
+			continue;
+		++loaded;
+		if( nd->subtype != SCRIPT )
+			continue;
+		for( i = 0; i < ARRAYLENGTH(events); ++i )
+		{
+			char name[EVENT_NAME_LENGTH];
+			struct event_data* ev;
+
+			if( i > 0 && CheckForCharServer() )
+				break;// OnInterIf* events need the char-server
+			safesnprintf(name, sizeof(name), "%s::%s", nd->exname, events[i]);
+			if( (ev = (struct event_data*)strdb_get(ev_db, name)) != NULL )
+			{
+				run_script(ev->nd->u.scr.script, ev->pos, 0, ev->nd->bl.id);
+				++ran;
+			}
+		}
+	}
+	mapit_free(iter);
+
+	for( nsl = npc_src_files; nsl != NULL; nsl = nsl->next )
+		nsl->reload = false;
+
+	ShowInfo("Reloaded '"CL_WHITE"%d"CL_RESET"' changed NPC files: '"CL_WHITE"%d"CL_RESET"' NPCs unloaded, '"CL_WHITE"%d"CL_RESET"' loaded, '"CL_WHITE"%d"CL_RESET"' init events executed.\n", count, unloaded, loaded, ran);
+	return count;
+}
+
 /*==========================================
  * I
  *------------------------------------------*/
@@ -3455,6 +4033,7 @@ int do_final_npc(void)
 	npcname_db->destroy(npcname_db, NULL);
 	ers_destroy(timer_event_ers);
 	npc_clearsrcfile();
+	npc_free_retired_code();
 
 	return 0;
 }
@@ -3498,7 +4077,6 @@ static void npc_debug_warps(void)
  *------------------------------------------*/
 int do_init_npc(void)
 {
-	struct npc_src_list *file;
 	int i;
 
 	//Stock view data for normal npcs.
@@ -3514,11 +4092,8 @@ int do_init_npc(void)
 
 	// process all npc files
 	ShowStatus("Loading NPCs...\r");
-	for( file = npc_src_files; file != NULL; file = file->next )
-	{
-		ShowStatus("Loading NPC file: %s"CL_CLL"\r", file->name);
-		npc_parsesrcfile(file->name);
-	}
+	npc_loadsrcfiles(false);
+	script_cache_save(true);
 
 	ShowInfo ("Done loading '"CL_WHITE"%d"CL_RESET"' NPCs:"CL_CLL"\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Warps\n"
@@ -42,6 +42,7 @@ struct npc_data {
 	void* chatdb; // pointer to a npc_parse struct (see npc_chat.c)
 	enum npc_subtype subtype;
 	int src_id;
+	struct npc_src_list* src; // source file, NULL if not loaded from a file
 	union {
 		struct {
 			struct script_code *script;
@@ -138,6 +139,7 @@ int npc_do_ontimer(int npc_id, int option);
 int npc_event_do(const char* name);
 int npc_event_doall(const char* name);
 int npc_event_doall_id(const char* name, int rid);
+int npc_event_doall_map(const char* name, int m);
 bool npc_event_isspecial(const char* eventname);
 
 int npc_timerevent_start(struct npc_data* nd, int rid);
@@ -149,6 +151,7 @@ int npc_remove_map(struct npc_data* nd);
 void npc_unload_duplicates (struct npc_data* nd);
 int npc_unload(struct npc_data* nd);
 int npc_reload(void);
+int npc_reload_changed(void);
 void npc_read_event_script(void);
 int npc_script_event(struct map_session_data* sd, enum npce_event type);
 
@@ -156,5 +159,6 @@ int npc_duplicate4instance(struct npc_data *snd, int m);
 int npc_cashshop_buy(struct map_session_data *sd, int nameid, int amount, int points);
 
 extern struct npc_data* fake_nd;
+extern int npc_load_threads;
 
 #endif /* _NPC_H_ */
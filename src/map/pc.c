@@ -44,7 +44,7 @@
 #include <time.h>
 
 
-#define PVP_CALCRANK_INTERVAL 1000	// PVPʌvZ̊Ԋu
+#define PVP_CALCRANK_INTERVAL 1000	// PVP���ʌv�Z�̊Ԋu
 static unsigned int exp_table[CLASS_COUNT][2][MAX_LEVEL];
 static unsigned int max_level[CLASS_COUNT][2];
 static unsigned int statp[MAX_LEVEL+1];
@@ -561,7 +561,7 @@ int pc_makesavestatus(struct map_session_data *sd)
 }
 
 /*==========================================
- * ?b̏?
+ * ��?�b̏����?
  *------------------------------------------*/
 int pc_setnewpc(struct map_session_data *sd, int account_id, int char_id, int login_id1, unsigned int client_tick, int sex, int fd)
 {
@@ -832,7 +832,7 @@ bool pc_adoption(struct map_session_data *p1_sd, struct map_session_data *p2_sd,
 int pc_isequip(struct map_session_data *sd,int n)
 {
 	struct item_data *item;
-	//?{q̏ꍇ̌̐EƂZo
+	//?����{�q�̏ꍇ�̌��̐E�Ƃ��Z�o����
 
 	nullpo_ret(sd);
 
@@ -901,8 +901,8 @@ int pc_isequip(struct map_session_data *sd,int n)
 }
 
 /*==========================================
- * session idɖ薳
- * charI瑗ĂXe?^Xݒ
+ * session id�ɖ�薳��
+ * char�I���瑗���Ă����X�e?�^�X��ݒ�
  *------------------------------------------*/
 bool pc_authok(struct map_session_data *sd, int login_id2, time_t expiration_time, int gmlevel, struct mmo_charstatus *st)
 {
@@ -944,6 +944,12 @@ bool pc_authok(struct map_session_data *sd, int login_id2, time_t expiration_tim
 		sd->status.clothes_color = MIN_CLOTH_COLOR;
 	}
 
+	if( sd->state.replay )
+	{// replayed session, keep it away from the party, guild, pet, homunculus and mercenary of the live character
+		sd->status.party_id = sd->status.guild_id = 0;
+		sd->status.pet_id = sd->status.hom_id = sd->status.mer_id = 0;
+	}
+
 	//Initializations to null/0 unneeded since map_session_data was filled with 0 upon allocation.
 	if(!sd->status.hp) pc_setdead(sd);
 	sd->state.connect_new = 1;
@@ -1005,7 +1011,7 @@ bool pc_authok(struct map_session_data *sd, int login_id2, time_t expiration_tim
 	for( i = 0; i < 3; i++ )
 		sd->hate_mob[i] = -1;
 
-	// ʒu̐ݒ
+	// �ʒu�̐ݒ�
 	if ((i=pc_setpos(sd,sd->status.last_point.map, sd->status.last_point.x, sd->status.last_point.y, CLR_OUTSIGHT)) != 0) {
 		ShowError ("Last_point_map %s - id %d not found (error code %d)\n", mapindex_id2name(sd->status.last_point.map), sd->status.last_point.map, i);
 
@@ -1219,7 +1225,7 @@ static int pc_calc_skillpoint(struct map_session_data* sd)
 
 
 /*==========================================
- * ?XĽvZ
+ * ?������X�L���̌v�Z
  *------------------------------------------*/
 int pc_calc_skilltree(struct map_session_data *sd)
 {
@@ -1891,13 +1897,14 @@ int pc_bonus_subele(struct map_session_data* sd, unsigned char ele, short rate,
 }
 
 /*==========================================
- * ? iɂ\͓̃{?iXݒ
+ * ? ���i�ɂ��\�͓��̃{?�i�X�ݒ�
  *------------------------------------------*/
 int pc_bonus(struct map_session_data *sd,int type,int val)
 {
 	struct status_data *status;
 	int bonus;
 	nullpo_ret(sd);
+	sd->cardfix_atk.valid = sd->cardfix_def.valid = false;
 
 	status = &sd->base_status;
 
@@ -2459,13 +2466,14 @@ int pc_bonus(struct map_session_data *sd,int type,int val)
 }
 
 /*==========================================
- * ? iɂ\͓̃{?iXݒ
+ * ? ���i�ɂ��\�͓��̃{?�i�X�ݒ�
  *------------------------------------------*/
 int pc_bonus2(struct map_session_data *sd,int type,int type2,int val)
 {
 	int i;
 
 	nullpo_ret(sd);
+	sd->cardfix_atk.valid = sd->cardfix_def.valid = false;
 
 	switch(type){
 	case SP_ADDELE:
@@ -2929,6 +2937,7 @@ int pc_bonus2(struct map_session_data *sd,int type,int type2,int val)
 int pc_bonus3(struct map_session_data *sd,int type,int type2,int type3,int val)
 {
 	nullpo_ret(sd);
+	sd->cardfix_atk.valid = sd->cardfix_def.valid = false;
 
 	switch(type){
 	case SP_ADD_MONSTER_DROP_ITEM:
@@ -3057,6 +3066,7 @@ int pc_bonus3(struct map_session_data *sd,int type,int type2,int type3,int val)
 int pc_bonus4(struct map_session_data *sd,int type,int type2,int type3,int type4,int val)
 {
 	nullpo_ret(sd);
+	sd->cardfix_atk.valid = sd->cardfix_def.valid = false;
 
 	switch(type){
 	case SP_AUTOSPELL:
@@ -3099,6 +3109,7 @@ int pc_bonus4(struct map_session_data *sd,int type,int type2,int type3,int type4
 int pc_bonus5(struct map_session_data *sd,int type,int type2,int type3,int type4,int type5,int val)
 {
 	nullpo_ret(sd);
+	sd->cardfix_atk.valid = sd->cardfix_def.valid = false;
 
 	switch(type){
 	case SP_AUTOSPELL:
@@ -3191,7 +3202,7 @@ int pc_skill(TBL_PC* sd, int id, int level, int flag)
 	return 1;
 }
 /*==========================================
- * J?h?
+ * �J?�h?��
  *------------------------------------------*/
 int pc_insert_card(struct map_session_data* sd, int idx_card, int idx_equip)
 {
@@ -3244,18 +3255,18 @@ int pc_insert_card(struct map_session_data* sd, int idx_card, int idx_equip)
 }
 
 //
-// ACe
+// �A�C�e����
 //
 
 /*==========================================
- * XLɂ锃lC
+ * �X�L���ɂ�锃���l�C��
  *------------------------------------------*/
 int pc_modifybuyvalue(struct map_session_data *sd,int orig_value)
 {
 	int skill,val = orig_value,rate1 = 0,rate2 = 0;
-	if((skill=pc_checkskill(sd,MC_DISCOUNT))>0)	// fBXJEg
+	if((skill=pc_checkskill(sd,MC_DISCOUNT))>0)	// �f�B�X�J�E���g
 		rate1 = 5+skill*2-((skill==10)? 1:0);
-	if((skill=pc_checkskill(sd,RG_COMPULSION))>0)	// RpVfBXJEg
+	if((skill=pc_checkskill(sd,RG_COMPULSION))>0)	// �R���p���V�����f�B�X�J�E���g
 		rate2 = 5+skill*4;
 	if(rate1 < rate2) rate1 = rate2;
 	if(rate1)
@@ -3267,12 +3278,12 @@ int pc_modifybuyvalue(struct map_session_data *sd,int orig_value)
 }
 
 /*==========================================
- * XLɂ?lC
+ * �X�L���ɂ��?��l�C��
  *------------------------------------------*/
 int pc_modifysellvalue(struct map_session_data *sd,int orig_value)
 {
 	int skill,val = orig_value,rate = 0;
-	if((skill=pc_checkskill(sd,MC_OVERCHARGE))>0)	// I?o?`?W
+	if((skill=pc_checkskill(sd,MC_OVERCHARGE))>0)	// �I?�o?�`��?�W
 		rate = 5+skill*2-((skill==10)? 1:0);
 	if(rate)
 		val = (int)((double)orig_value*(double)(100+rate)/100.);
@@ -3283,8 +3294,8 @@ int pc_modifysellvalue(struct map_session_data *sd,int orig_value)
 }
 
 /*==========================================
- * ACe𔃂bɁAVACegA
- * 3ɂ邩mF
+ * �A�C�e���𔃂����bɁA�V�����A�C�e�������g�����A
+ * 3�������ɂ����邩�m�F
  *------------------------------------------*/
 int pc_checkadditem(struct map_session_data *sd,int nameid,int amount)
 {
@@ -3311,7 +3322,7 @@ int pc_checkadditem(struct map_session_data *sd,int nameid,int amount)
 }
 
 /*==========================================
- * 󂫃ACě?
+ * �󂫃A�C�e�����̌�?
  *------------------------------------------*/
 int pc_inventoryblank(struct map_session_data *sd)
 {
@@ -3328,7 +3339,7 @@ int pc_inventoryblank(struct map_session_data *sd)
 }
 
 /*==========================================
- * ?
+ * ������?��
  *------------------------------------------*/
 int pc_payzeny(struct map_session_data *sd,int zeny)
 {
@@ -3437,7 +3448,7 @@ void pc_getcash(struct map_session_data *sd, int cash, int points)
 }
 
 /*==========================================
- * 𓾂
+ * �����𓾂�
  *------------------------------------------*/
 int pc_getzeny(struct map_session_data *sd,int zeny)
 {
@@ -3466,7 +3477,7 @@ int pc_getzeny(struct map_session_data *sd,int zeny)
 }
 
 /*==========================================
- * ACeTāACfbNXԂ
+ * �A�C�e����T���āA�C���f�b�N�X��Ԃ�
  *------------------------------------------*/
 int pc_search_inventory(struct map_session_data *sd,int item_id)
 {
@@ -3478,7 +3489,7 @@ int pc_search_inventory(struct map_session_data *sd,int item_id)
 }
 
 /*==========================================
- * ACeǉB?̂item\??𖳎
+ * �A�C�e���ǉ��B��?�̂�item�\��?��?���𖳎�
  *------------------------------------------*/
 int pc_additem(struct map_session_data *sd,struct item *item_data,int amount)
 {
@@ -3540,7 +3551,7 @@ int pc_additem(struct map_session_data *sd,struct item *item_data,int amount)
 }
 
 /*==========================================
- * ACe炷
+ * �A�C�e�������炷
  *------------------------------------------*/
 int pc_delitem(struct map_session_data *sd,int n,int amount,int type, short reason)
 {
@@ -3566,7 +3577,7 @@ int pc_delitem(struct map_session_data *sd,int n,int amount,int type, short reas
 }
 
 /*==========================================
- * ACe𗎂
+ * �A�C�e���𗎂�
  *------------------------------------------*/
 int pc_dropitem(struct map_session_data *sd,int n,int amount)
 {
@@ -3611,7 +3622,7 @@ int pc_dropitem(struct map_session_data *sd,int n,int amount)
 }
 
 /*==========================================
- * ACeE
+ * �A�C�e�����E��
  *------------------------------------------*/
 int pc_takeitem(struct map_session_data *sd,struct flooritem_data *fitem)
 {
@@ -3624,7 +3635,7 @@ int pc_takeitem(struct map_session_data *sd,struct flooritem_data *fitem)
 	nullpo_ret(fitem);
 
 	if(!check_distance_bl(&fitem->bl, &sd->bl, 2) && sd->ud.skillid!=BS_GREED)
-		return 0;	// 
+		return 0;	// ����������
 
 	if (sd->status.party_id)
 		p = party_search(sd->status.party_id);
@@ -3821,7 +3832,7 @@ int pc_isUseitem(struct map_session_data *sd,int n)
 }
 
 /*==========================================
- * ACeg
+ * �A�C�e�����g��
  *------------------------------------------*/
 int pc_useitem(struct map_session_data *sd,int n)
 {
@@ -3926,7 +3937,7 @@ int pc_useitem(struct map_session_data *sd,int n)
 }
 
 /*==========================================
- * J?gACeǉB?̂item\??𖳎
+ * �J?�g�A�C�e���ǉ��B��?�̂�item�\��?��?���𖳎�
  *------------------------------------------*/
 int pc_cart_additem(struct map_session_data *sd,struct item *item_data,int amount)
 {
@@ -3985,7 +3996,7 @@ int pc_cart_additem(struct map_session_data *sd,struct item *item_data,int amoun
 }
 
 /*==========================================
- * J?gACe炷
+ * �J?�g�A�C�e�������炷
  *------------------------------------------*/
 int pc_cart_delitem(struct map_session_data *sd,int n,int amount,int type)
 {
@@ -4010,7 +4021,7 @@ int pc_cart_delitem(struct map_session_data *sd,int n,int amount,int type)
 }
 
 /*==========================================
- * J?gփACeړ
+ * �J?�g�փA�C�e���ړ�
  *------------------------------------------*/
 int pc_putitemtocart(struct map_session_data *sd,int idx,int amount)
 {
@@ -4033,7 +4044,7 @@ int pc_putitemtocart(struct map_session_data *sd,int idx,int amount)
 }
 
 /*==========================================
- * J?g?̃ACe?mF(?̍Ԃ)
+ * �J?�g?�̃A�C�e��?�m�F(��?�̍�����Ԃ�)
  *------------------------------------------*/
 int pc_cartitem_amount(struct map_session_data* sd, int idx, int amount)
 {
@@ -4049,7 +4060,7 @@ int pc_cartitem_amount(struct map_session_data* sd, int idx, int amount)
 }
 
 /*==========================================
- * J?gACeړ
+ * �J?�g����A�C�e���ړ�
  *------------------------------------------*/
 int pc_getitemfromcart(struct map_session_data *sd,int idx,int amount)
 {
@@ -4073,7 +4084,7 @@ int pc_getitemfromcart(struct map_session_data *sd,int idx,int amount)
 }
 
 /*==========================================
- * XeBiJ
+ * �X�e�B���i���J
  *------------------------------------------*/
 int pc_show_steal(struct block_list *bl,va_list ap)
 {
@@ -4235,6 +4246,8 @@ int pc_setpos(struct map_session_data* sd, unsigned short mapindex, int x, int y
 	}
 
 	m = map_mapindex2mapid(mapindex);
+	if( m >= 0 && map[m].standby )
+		m = -1; // served by another map-server
 	if( map[m].flag.src4instance && sd->status.party_id && (p = party_search(sd->status.party_id)) != NULL && p->instance_id )
 	{
 		// Request the mapid of this src map into the instance of the party
@@ -4372,7 +4385,7 @@ int pc_setpos(struct map_session_data* sd, unsigned short mapindex, int x, int y
 }
 
 /*==========================================
- * PC̃_?v
+ * PC�̃����_����?�v
  *------------------------------------------*/
 int pc_randomwarp(struct map_session_data *sd, clr_type type)
 {
@@ -4383,7 +4396,7 @@ int pc_randomwarp(struct map_session_data *sd, clr_type type)
 
 	m=sd->bl.m;
 
-	if (map[sd->bl.m].flag.noteleport)	// e|?g֎~
+	if (map[sd->bl.m].flag.noteleport)	// �e���|?�g�֎~
 		return 0;
 
 	do{
@@ -4486,10 +4499,10 @@ int pc_memo(struct map_session_data* sd, int pos)
 }
 
 //
-// ??
+// ����??
 //
 /*==========================================
- * XL? LĂꍇLvԂ
+ * �X�L����?�� ���L���Ă����ꍇLv���Ԃ�
  *------------------------------------------*/
 int pc_checkskill(struct map_session_data *sd,int skill_id)
 {
@@ -4515,13 +4528,13 @@ int pc_checkskill(struct map_session_data *sd,int skill_id)
 }
 
 /*==========================================
- * ?XɂXL??`FbN
- * ?F
- *   struct map_session_data *sd	ZbVf?^
- *   int nameid						?iID
- * ԂlF
- *   0		?XȂ
- *   -1		XL
+ * ����?�X�ɂ��X�L����??�`�F�b�N
+ * ��?�F
+ *   struct map_session_data *sd	�Z�b�V�����f?�^
+ *   int nameid						?���iID
+ * �Ԃ�l�F
+ *   0		?�X�Ȃ�
+ *   -1		�X�L��������
  *------------------------------------------*/
 int pc_checkallowskill(struct map_session_data *sd)
 {
@@ -4567,7 +4580,7 @@ int pc_checkallowskill(struct map_session_data *sd)
 }
 
 /*==========================================
- * ? ĩ`FbN
+ * ? ���i�̃`�F�b�N
  *------------------------------------------*/
 int pc_checkequip(struct map_session_data *sd,int pos)
 {
@@ -5069,7 +5082,7 @@ static void pc_calcexp(struct map_session_data *sd, unsigned int *base_exp, unsi
 	return;
 }
 /*==========================================
- * ??l擾
+ * ??�l�擾
  *------------------------------------------*/
 int pc_gainexp(struct map_session_data *sd, struct block_list *src, unsigned int base_exp,unsigned int job_exp,bool quest)
 {
@@ -5164,7 +5177,7 @@ unsigned int pc_maxjoblv(struct map_session_data *sd)
 };
 
 /*==========================================
- * base levelKv??lvZ
+ * base level���K�v??�l�v�Z
  *------------------------------------------*/
 unsigned int pc_nextbaseexp(struct map_session_data *sd)
 {
@@ -5186,7 +5199,7 @@ unsigned int pc_thisbaseexp(struct map_session_data *sd)
 
 
 /*==========================================
- * job levelKv??lvZ
+ * job level���K�v??�l�v�Z
  *------------------------------------------*/
 unsigned int pc_nextjobexp(struct map_session_data *sd)
 {
@@ -5358,7 +5371,7 @@ int pc_statusup2(struct map_session_data* sd, int type, int val)
 }
 
 /*==========================================
- * XL|CgU
+ * �X�L���|�C���g����U��
  *------------------------------------------*/
 int pc_skillup(struct map_session_data *sd,int skill_num)
 {
@@ -6126,10 +6139,10 @@ void pc_revive(struct map_session_data *sd,unsigned int hp, unsigned int sp)
 	if(battle_config.pc_invincible_time > 0)
 		pc_setinvincibletimer(sd, battle_config.pc_invincible_time);
 }
-// script? A
+// script? �A
 //
 /*==========================================
- * scriptpPCXe?^X?ݏo
+ * script�pPC�X�e?�^�X?�ݏo��
  *------------------------------------------*/
 int pc_readparam(struct map_session_data* sd,int type)
 {
@@ -6196,7 +6209,7 @@ int pc_readparam(struct map_session_data* sd,int type)
 }
 
 /*==========================================
- * scriptpPCXe?^Xݒ
+ * script�pPC�X�e?�^�X�ݒ�
  *------------------------------------------*/
 int pc_setparam(struct map_session_data *sd,int type,int val)
 {
@@ -6363,7 +6376,7 @@ void pc_heal(struct map_session_data *sd,unsigned int hp,unsigned int sp, int ty
 }
 
 /*==========================================
- * HP/SP
+ * HP/SP��
  *------------------------------------------*/
 int pc_itemheal(struct map_session_data *sd,int itemid, int hp,int sp)
 {
@@ -6415,7 +6428,7 @@ int pc_itemheal(struct map_session_data *sd,int itemid, int hp,int sp)
 }
 
 /*==========================================
- * HP/SP
+ * HP/SP��
  *------------------------------------------*/
 int pc_percentheal(struct map_session_data *sd,int hp,int sp)
 {
@@ -6453,9 +6466,9 @@ int pc_percentheal(struct map_session_data *sd,int hp,int sp)
 }
 
 /*==========================================
- * E?X
- * ?	job E 0`23
- *		upper ʏ 0, ? 1, {q 2, ̂܂ -1
+ * �E?�X
+ * ��?	job �E�� 0�`23
+ *		upper �ʏ� 0, ?�� 1, �{�q 2, ���̂܂� -1
  * Rewrote to make it tidider [Celest]
  *------------------------------------------*/
 int pc_jobchange(struct map_session_data *sd,int job, int upper)
@@ -6532,7 +6545,7 @@ int pc_jobchange(struct map_session_data *sd,int job, int upper)
 	for(i=0;i<EQI_MAX;i++) {
 		if(sd->equip_index[i] >= 0)
 			if(!pc_isequip(sd,sd->equip_index[i]))
-				pc_unequipitem(sd,sd->equip_index[i],2);	// ?O
+				pc_unequipitem(sd,sd->equip_index[i],2);	// ?���O��
 	}
 
 	//Change look, if disguised, you need to undisguise 
@@ -6591,7 +6604,7 @@ int pc_jobchange(struct map_session_data *sd,int job, int upper)
 }
 
 /*==========================================
- * ?X
+ * ������?�X
  *------------------------------------------*/
 int pc_equiplookall(struct map_session_data *sd)
 {
@@ -6613,7 +6626,7 @@ int pc_equiplookall(struct map_session_data *sd)
 }
 
 /*==========================================
- * ?X
+ * ������?�X
  *------------------------------------------*/
 int pc_changelook(struct map_session_data *sd,int type,int val)
 {
@@ -6673,7 +6686,7 @@ int pc_changelook(struct map_session_data *sd,int type,int val)
 }
 
 /*==========================================
- * t?i(,yR,J?g)ݒ
+ * �t?�i(��,�y�R,�J?�g)�ݒ�
  *------------------------------------------*/
 int pc_setoption(struct map_session_data *sd,int type)
 {
@@ -6753,7 +6766,7 @@ int pc_setoption(struct map_session_data *sd,int type)
 }
 
 /*==========================================
- * J?gݒ
+ * �J?�g�ݒ�
  *------------------------------------------*/
 int pc_setcart(struct map_session_data *sd,int type)
 {
@@ -6778,12 +6791,12 @@ int pc_setcart(struct map_session_data *sd,int type)
 }
 
 /*==========================================
- * ݒ
+ * ��ݒ�
  *------------------------------------------*/
 int pc_setfalcon(TBL_PC* sd, int flag)
 {
 	if( flag ){
-		if( pc_checkskill(sd,HT_FALCON)>0 )	// t@R}X^?XL
+		if( pc_checkskill(sd,HT_FALCON)>0 )	// �t�@���R���}�X�^��?�X�L������
 			pc_setoption(sd,sd->sc.option|OPTION_FALCON);
 	} else if( pc_isfalcon(sd) ){
 		pc_setoption(sd,sd->sc.option&~OPTION_FALCON); // remove falcon
@@ -6793,12 +6806,12 @@ int pc_setfalcon(TBL_PC* sd, int flag)
 }
 
 /*==========================================
- * yRyRݒ
+ * �y�R�y�R�ݒ�
  *------------------------------------------*/
 int pc_setriding(TBL_PC* sd, int flag)
 {
 	if( flag ){
-		if( pc_checkskill(sd,KN_RIDING) > 0 ) // CfBOXL
+		if( pc_checkskill(sd,KN_RIDING) > 0 ) // ���C�f�B���O�X�L������
 			pc_setoption(sd, sd->sc.option|OPTION_RIDING);
 	} else if( pc_isriding(sd) ){
 		pc_setoption(sd, sd->sc.option&~OPTION_RIDING);
@@ -6808,7 +6821,7 @@ int pc_setriding(TBL_PC* sd, int flag)
 }
 
 /*==========================================
- * ACehbvs
+ * �A�C�e���h���b�v�s����
  *------------------------------------------*/
 int pc_candrop(struct map_session_data *sd,struct item *item)
 {
@@ -6821,7 +6834,7 @@ int pc_candrop(struct map_session_data *sd,struct item *item)
 }
 
 /*==========================================
- * scriptp??̒l?
+ * script�p??�̒l��?��
  *------------------------------------------*/
 int pc_readreg(struct map_session_data* sd, int reg)
 {
@@ -6833,7 +6846,7 @@ int pc_readreg(struct map_session_data* sd, int reg)
 	return ( i < sd->reg_num ) ? sd->reg[i].data : 0;
 }
 /*==========================================
- * scriptp??̒lݒ
+ * script�p??�̒l��ݒ�
  *------------------------------------------*/
 int pc_setreg(struct map_session_data* sd, int reg, int val)
 {
@@ -6861,7 +6874,7 @@ int pc_setreg(struct map_session_data* sd, int reg, int val)
 }
 
 /*==========================================
- * scriptp??̒l?
+ * script�p������??�̒l��?��
  *------------------------------------------*/
 char* pc_readregstr(struct map_session_data* sd, int reg)
 {
@@ -6873,7 +6886,7 @@ char* pc_readregstr(struct map_session_data* sd, int reg)
 	return ( i < sd->regstr_num ) ? sd->regstr[i].data : NULL;
 }
 /*==========================================
- * scriptp??̒lݒ
+ * script�p������??�̒l��ݒ�
  *------------------------------------------*/
 int pc_setregstr(struct map_session_data* sd, int reg, const char* str)
 {
@@ -7153,7 +7166,7 @@ int pc_setregistry_str(struct map_session_data *sd,const char *reg,const char *v
 }
 
 /*==========================================
- * Cxg^C}??
+ * �C�x���g�^�C�}??��
  *------------------------------------------*/
 static int pc_eventtimer(int tid, unsigned int tick, int id, intptr_t data)
 {
@@ -7178,7 +7191,7 @@ static int pc_eventtimer(int tid, unsigned int tick, int id, intptr_t data)
 }
 
 /*==========================================
- * Cxg^C}?ǉ
+ * �C�x���g�^�C�}?�ǉ�
  *------------------------------------------*/
 int pc_addeventtimer(struct map_session_data *sd,int tick,const char *name)
 {
@@ -7196,7 +7209,7 @@ int pc_addeventtimer(struct map_session_data *sd,int tick,const char *name)
 }
 
 /*==========================================
- * Cxg^C}?폜
+ * �C�x���g�^�C�}?�폜
  *------------------------------------------*/
 int pc_deleventtimer(struct map_session_data *sd,const char *name)
 {
@@ -7226,7 +7239,7 @@ int pc_deleventtimer(struct map_session_data *sd,const char *name)
 }
 
 /*==========================================
- * Cxg^C}?JEglǉ
+ * �C�x���g�^�C�}?�J�E���g�l�ǉ�
  *------------------------------------------*/
 int pc_addeventtimercount(struct map_session_data *sd,const char *name,int tick)
 {
@@ -7245,7 +7258,7 @@ int pc_addeventtimercount(struct map_session_data *sd,const char *name,int tick)
 }
 
 /*==========================================
- * Cxg^C}?S폜
+ * �C�x���g�^�C�}?�S�폜
  *------------------------------------------*/
 int pc_cleareventtimer(struct map_session_data *sd)
 {
@@ -7268,10 +7281,10 @@ int pc_cleareventtimer(struct map_session_data *sd)
 }
 
 //
-// ? 
+// ? ����
 //
 /*==========================================
- * ACe?
+ * �A�C�e����?������
  *------------------------------------------*/
 int pc_equipitem(struct map_session_data *sd,int n,int req_pos)
 {
@@ -7433,7 +7446,7 @@ int pc_equipitem(struct map_session_data *sd,int n,int req_pos)
 }
 
 /*==========================================
- * ? O
+ * ? �����������O��
  * type:
  * 0 - only unequip
  * 1 - calculate status after unequipping
@@ -7546,8 +7559,8 @@ int pc_unequipitem(struct map_session_data *sd,int n,int flag)
 }
 
 /*==========================================
- * ACeindex?l߂
- * ? i?\`FbNsȂ
+ * �A�C�e����index��?���l�߂���
+ * ? ���i��?���\�`�F�b�N���s�Ȃ�
  *------------------------------------------*/
 int pc_checkitem(struct map_session_data *sd)
 {
@@ -7627,7 +7640,7 @@ int pc_checkitem(struct map_session_data *sd)
 }
 
 /*==========================================
- * PVPʌvZp(foreachinarea)
+ * PVP���ʌv�Z�p(foreachinarea)
  *------------------------------------------*/
 int pc_calc_pvprank_sub(struct block_list *bl,va_list ap)
 {
@@ -7641,7 +7654,7 @@ int pc_calc_pvprank_sub(struct block_list *bl,va_list ap)
 	return 0;
 }
 /*==========================================
- * PVPʌvZ
+ * PVP���ʌv�Z
  *------------------------------------------*/
 int pc_calc_pvprank(struct map_session_data *sd)
 {
@@ -7656,7 +7669,7 @@ int pc_calc_pvprank(struct map_session_data *sd)
 	return sd->pvp_rank;
 }
 /*==========================================
- * PVPʌvZ(timer)
+ * PVP���ʌv�Z(timer)
  *------------------------------------------*/
 int pc_calc_pvprank_timer(int tid, unsigned int tick, int id, intptr_t data)
 {
@@ -7672,7 +7685,7 @@ int pc_calc_pvprank_timer(int tid, unsigned int tick, int id, intptr_t data)
 }
 
 /*==========================================
- * sd͌Ă邩(?̏ꍇ͑char_idԂ)
+ * sd�͌������Ă��邩(?���̏ꍇ�͑�����char_id��Ԃ�)
  *------------------------------------------*/
 int pc_ismarried(struct map_session_data *sd)
 {
@@ -7684,7 +7697,7 @@ int pc_ismarried(struct map_session_data *sd)
 		return 0;
 }
 /*==========================================
- * sddstsdƌ(dstsdsď?bɍs)
+ * sd��dstsd�ƌ���(dstsd��sd�̌���?�������bɍs��)
  *------------------------------------------*/
 int pc_marriage(struct map_session_data *sd,struct map_session_data *dstsd)
 {
@@ -7742,7 +7755,7 @@ int pc_divorce(struct map_session_data *sd)
 }
 
 /*==========================================
- * sd̑map_session_dataԂ
+ * sd�̑�����map_session_data��Ԃ�
  *------------------------------------------*/
 struct map_session_data *pc_get_partner(struct map_session_data *sd)
 {
@@ -7841,7 +7854,7 @@ void pc_regen (struct map_session_data *sd, unsigned int diff_tick)
 }
 
 /*==========================================
- * Z?u|Cg̕ۑ
+ * �Z?�u�|�C���g�̕ۑ�
  *------------------------------------------*/
 int pc_setsavepoint(struct map_session_data *sd, short mapindex,int x,int y)
 {
@@ -7855,7 +7868,7 @@ int pc_setsavepoint(struct map_session_data *sd, short mapindex,int x,int y)
 }
 
 /*==========================================
- * Z?u (timer??)
+ * �����Z?�u (timer??)
  *------------------------------------------*/
 int pc_autosave(int tid, unsigned int tick, int id, intptr_t data)
 {
@@ -8077,7 +8090,7 @@ int pc_readdb(void)
 	FILE *fp;
 	char line[24000],*p;
 
-	// Kv??l??
+	// �K�v??�l?��?��
 	memset(exp_table,0,sizeof(exp_table));
 	memset(max_level,0,sizeof(max_level));
 	sprintf(line, "%s/exp.txt", db_path);
@@ -8160,11 +8173,11 @@ int pc_readdb(void)
 	}
 	ShowStatus("Done reading '"CL_WHITE"%s"CL_RESET"'.\n","exp.txt");
 
-	// XLc?
+	// �X�L���c��?
 	memset(skill_tree,0,sizeof(skill_tree));
 	sv_readdb(db_path, "skill_tree.txt", ',', 3+MAX_PC_SKILL_REQUIRE*2, 4+MAX_PC_SKILL_REQUIRE*2, -1, &pc_readdb_skilltree);
 
-	// ?Ce?u
+	// ?���C���e?�u��
 	for(i=0;i<4;i++)
 		for(j=0;j<ELE_MAX;j++)
 			for(k=0;k<ELE_MAX;k++)
@@ -8215,7 +8228,7 @@ int pc_readdb(void)
 	fclose(fp);
 	ShowStatus("Done reading '"CL_WHITE"%s"CL_RESET"'.\n","attr_fix.txt");
 
-	// XLc?
+	// �X�L���c��?
 	memset(statp,0,sizeof(statp));
 	i=1;
 	sprintf(line, "%s/statpoint.txt", db_path);
@@ -8311,7 +8324,7 @@ int pc_read_motd(void)
 }
 
 /*==========================================
- * pc? W
+ * pc? �W������
  *------------------------------------------*/
 void do_final_pc(void)
 {
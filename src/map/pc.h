@@ -84,6 +84,21 @@ struct s_autobonus {
 	unsigned short pos;
 };
 
+/// What the card bonus of an attack depends on, besides the bonuses themselves.
+struct cardfix_key {
+	int class_;
+	short race, race2, ele, ele_, size, flag;
+	unsigned char boss, lh, arrow, noelefix, left_to_right;
+};
+
+/// Last card bonus rate calculated for this player, see battle_calc_cardfix_atk/def.
+/// Cleared whenever the bonuses change.
+struct cardfix_cache {
+	struct cardfix_key key;
+	int cardfix, cardfix_;
+	bool valid;
+};
+
 struct map_session_data {
 	struct block_list bl;
 	struct unit_data ud;
@@ -139,6 +154,7 @@ struct map_session_data {
 		unsigned short autobonus; //flag to indicate if an autobonus is activated. [Inkfish]
 		struct guild *gmaster_flag;
 		unsigned int warping : 1;//states whether you're in the middle of a warp processing
+		unsigned int replay : 1; // session of a replay (replay.c), a copy of a live character that is never saved
 	} state;
 	struct {
 		unsigned char no_weapon_damage, no_magic_damage, no_misc_damage;
@@ -218,6 +234,7 @@ struct map_session_data {
 	short disguise; // [Valaris]
 
 	struct weapon_data right_weapon, left_weapon;
+	struct cardfix_cache cardfix_atk, cardfix_def;
 	
 	// here start arrays to be globally zeroed at the beginning of status_calc_pc()
 	int param_bonus[6],param_equip[6]; //Stores card/equipment bonuses.
@@ -573,6 +590,7 @@ int pc_reg_received(struct map_session_data *sd);
 int pc_isequip(struct map_session_data *sd,int n);
 int pc_equippoint(struct map_session_data *sd,int n);
 int pc_setinventorydata(struct map_session_data *sd);
+int pc_setequipindex(struct map_session_data *sd);
 
 int pc_checkskill(struct map_session_data *sd,int skill_id);
 int pc_checkallowskill(struct map_session_data *sd);
@@ -0,0 +1,493 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#include "../common/cbasetypes.h"
+#include "../common/db.h"
+#include "../common/malloc.h"
+#include "../common/mmo.h" // struct mmo_charstatus
+#include "../common/showmsg.h"
+#include "../common/socket.h"
+#include "../common/strlib.h" // safestrncpy()
+#include "../common/timer.h"
+#include "../common/utils.h" // cap_value()
+
+#include "clif.h" // clif_getport(), clif_getbindip()
+#include "replay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Capture file format (little endian):
+//   header: "EAREPLAY" <uint32 version> <uint32 sizeof(struct mmo_charstatus)>
+//   records: <uint8 type> <uint32 session> <int64 time> <uint16 len> <len bytes>
+// time is in microseconds since the start of the capture.
+// REPLAY_AUTH data is the 0x2afd packet from offset 4
+// (account_id, login_id1, login_id2, expiration_time, gmlevel, mmo_charstatus).
+
+#define REPLAY_MAGIC "EAREPLAY"
+#define REPLAY_VERSION 1
+#define REPLAY_FILE_HEADER 16
+#define REPLAY_RECORD_HEADER 15
+/// Time the replay waits for the server after the last record, in microseconds.
+#define REPLAY_LINGER 5000000
+/// Number of buckets of the tick histogram (log2 microseconds).
+#define REPLAY_TICK_BUCKETS 32
+
+enum replay_record_type
+{
+	REPLAY_CONNECT = 1,	// a client connected
+	REPLAY_PACKET  = 2,	// packet received from the client
+	REPLAY_AUTH    = 3,	// character data received from the char-server
+	REPLAY_CLOSE   = 4,	// the connection was closed
+};
+
+#define REPLAY_IGNORED ((uint32)-1)
+
+/// Address the replayed connections use, the loopback interface unless the map-server is bound to another one.
+#define REPLAY_ADDR ( clif_getbindip() ? clif_getbindip() : 0x7F000001 )
+
+static struct
+{
+	FILE* fp;
+	int64 start;
+	uint32 session[FD_SETSIZE];	// capture session of each fd, 0 if none
+	uint32 next_session;
+} capture;
+
+struct replay_record
+{
+	uint8 type;
+	uint32 session;
+	int64 time;
+	uint16 len;
+	const uint8* data;
+	int next_auth;	// next REPLAY_AUTH record of the same account, -1 if none
+};
+
+static struct
+{
+	char filename[256];
+	uint8* buffer;	// contents of the capture file
+	struct replay_record* records;
+	int count;
+	int pos;
+	int speed;
+	int64 start;
+	int tid;
+	DBMap* sessions;	// capture session -> client fd
+	DBMap* ports;	// local port of a client fd -> client fd
+	DBMap* auths;	// account id -> first REPLAY_AUTH record + 1
+	uint32 session[FD_SETSIZE];	// capture session of each client fd, 0 if none
+	// statistics
+	int64 last_tick;
+	unsigned int ticks;
+	unsigned int tick_hist[REPLAY_TICK_BUCKETS];
+	unsigned int tick_max;
+	unsigned int packets;
+	uint64 bytes_received;	// by the server
+	uint64 bytes_sent;	// by the server
+} replay;
+
+static int replay_timer(int tid, unsigned int tick, int id, intptr_t data);
+
+
+/*==========================================
+ * Capture
+ *------------------------------------------*/
+
+static void replay_capture_write(uint8 type, uint32 session_id, const uint8* data, int len)
+{
+	uint8 head[REPLAY_RECORD_HEADER];
+	int64 time = gettick_usec() - capture.start;
+
+	WBUFB(head,0) = type;
+	WBUFL(head,1) = session_id;
+	WBUFL(head,5) = (uint32)time;
+	WBUFL(head,9) = (uint32)(time>>32);
+	WBUFW(head,13) = (uint16)len;
+	fwrite(head, 1, sizeof(head), capture.fp);
+	if( len > 0 )
+		fwrite(data, 1, len, capture.fp);
+}
+
+/// Starts recording the packets of the clients that connect from now on.
+bool replay_capture_start(const char* filename)
+{
+	uint8 head[REPLAY_FILE_HEADER];
+	int fd;
+
+	if( capture.fp != NULL )
+	{
+		ShowWarning("replay_capture_start: a capture is already running.\n");
+		return false;
+	}
+	capture.fp = fopen(filename, "wb");
+	if( capture.fp == NULL )
+	{
+		ShowError("replay_capture_start: failed to open '%s' for writing.\n", filename);
+		return false;
+	}
+
+	memcpy(head, REPLAY_MAGIC, 8);
+	WBUFL(head,8) = REPLAY_VERSION;
+	WBUFL(head,12) = sizeof(struct mmo_charstatus);
+	fwrite(head, 1, sizeof(head), capture.fp);
+
+	// sessions that are already connected can't be replayed
+	for( fd = 0; fd < FD_SETSIZE; ++fd )
+		capture.session[fd] = ( session[fd] ? REPLAY_IGNORED : 0 );
+	capture.next_session = 0;
+	capture.start = gettick_usec();
+	ShowStatus("Capturing client packets to '"CL_WHITE"%s"CL_RESET"'.\n", filename);
+	return true;
+}
+
+void replay_capture_stop(void)
+{
+	if( capture.fp == NULL )
+		return;
+	fclose(capture.fp);
+	capture.fp = NULL;
+	ShowStatus("Packet capture stopped (%u sessions).\n", capture.next_session);
+}
+
+/// Records a packet received from a client.
+void replay_capture_packet(int fd, const uint8* data, int len)
+{
+	if( capture.fp == NULL || capture.session[fd] == REPLAY_IGNORED )
+		return;
+	if( capture.session[fd] == 0 )
+	{// new session
+		capture.session[fd] = ++capture.next_session;
+		replay_capture_write(REPLAY_CONNECT, capture.session[fd], NULL, 0);
+	}
+	replay_capture_write(REPLAY_PACKET, capture.session[fd], data, len);
+}
+
+/// Records the character data of an authenticated session.
+void replay_capture_auth(int fd, const uint8* data, int len)
+{
+	if( capture.fp == NULL || capture.session[fd] == 0 || capture.session[fd] == REPLAY_IGNORED )
+		return;
+	replay_capture_write(REPLAY_AUTH, capture.session[fd], data, len);
+}
+
+/// Records the end of a session.
+void replay_capture_close(int fd)
+{
+	if( capture.fp != NULL && capture.session[fd] != 0 && capture.session[fd] != REPLAY_IGNORED )
+		replay_capture_write(REPLAY_CLOSE, capture.session[fd], NULL, 0);
+	capture.session[fd] = 0;
+}
+
+
+/*==========================================
+ * Replay
+ *------------------------------------------*/
+
+/// Loads a capture file.
+static bool replay_load(const char* filename)
+{
+	FILE* fp;
+	long size;
+	long pos;
+	int max = 0, i;
+
+	fp = fopen(filename, "rb");
+	if( fp == NULL )
+	{
+		ShowError("replay_load: failed to open '%s'.\n", filename);
+		return false;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if( size < REPLAY_FILE_HEADER )
+	{
+		ShowError("replay_load: '%s' is not a capture file.\n", filename);
+		fclose(fp);
+		return false;
+	}
+	replay.buffer = (uint8*)aMalloc(size);
+	if( fread(replay.buffer, 1, size, fp) != (size_t)size )
+	{
+		ShowError("replay_load: failed to read '%s'.\n", filename);
+		fclose(fp);
+		return false;
+	}
+	fclose(fp);
+
+	if( memcmp(replay.buffer, REPLAY_MAGIC, 8) != 0 || RBUFL(replay.buffer,8) != REPLAY_VERSION )
+	{
+		ShowError("replay_load: '%s' is not a capture file of version %d.\n", filename, REPLAY_VERSION);
+		return false;
+	}
+	if( RBUFL(replay.buffer,12) != sizeof(struct mmo_charstatus) )
+	{
+		ShowError("replay_load: '%s' was recorded with a different character format (%u != %u).\n", filename, RBUFL(replay.buffer,12), (unsigned int)sizeof(struct mmo_charstatus));
+		return false;
+	}
+
+	for( pos = REPLAY_FILE_HEADER; pos + REPLAY_RECORD_HEADER <= size; )
+	{
+		const uint8* p = replay.buffer + pos;
+		struct replay_record* record;
+
+		if( pos + REPLAY_RECORD_HEADER + RBUFW(p,13) > size )
+		{
+			ShowWarning("replay_load: '%s' is truncated, ignoring the last record.\n", filename);
+			break;
+		}
+		if( replay.count == max )
+		{
+			max = max*2 + 1024;
+			RECREATE(replay.records, struct replay_record, max);
+		}
+		record = &replay.records[replay.count++];
+		record->type = RBUFB(p,0);
+		record->session = RBUFL(p,1);
+		record->time = (int64)RBUFL(p,5) | ((int64)RBUFL(p,9)<<32);
+		record->len = RBUFW(p,13);
+		record->data = p + REPLAY_RECORD_HEADER;
+		record->next_auth = -1;
+		pos += REPLAY_RECORD_HEADER + record->len;
+	}
+
+	// index the character data by account
+	for( i = replay.count - 1; i >= 0; --i )
+	{
+		struct replay_record* record = &replay.records[i];
+		if( record->type != REPLAY_AUTH || record->len < 8 )
+			continue;
+		record->next_auth = (int)(intptr_t)idb_get(replay.auths, RBUFL(record->data,0)) - 1;
+		idb_put(replay.auths, RBUFL(record->data,0), (void*)(intptr_t)(i + 1));
+	}
+	return true;
+}
+
+/// Receives the packets the server sends to a replayed client.
+static int replay_parse(int fd)
+{
+	if( session[fd]->flag.eof )
+	{
+		if( replay.session[fd] )
+		{
+			idb_remove(replay.sessions, replay.session[fd]);
+			idb_remove(replay.ports, session[fd]->local_port);
+		}
+		replay.session[fd] = 0;
+		do_close(fd);
+		return 0;
+	}
+	replay.bytes_sent += RFIFOREST(fd);
+	RFIFOSKIP(fd, RFIFOREST(fd));
+	return 0;
+}
+
+static void replay_record_exec(const struct replay_record* record)
+{
+	int fd = (int)(intptr_t)idb_get(replay.sessions, record->session);
+
+	switch( record->type )
+	{
+	case REPLAY_CONNECT:
+		fd = make_connection(REPLAY_ADDR, clif_getport());
+		if( fd == -1 )
+			break;
+		session[fd]->func_parse = replay_parse;
+		replay.session[fd] = record->session;
+		idb_put(replay.sessions, record->session, (void*)(intptr_t)fd);
+		idb_put(replay.ports, session[fd]->local_port, (void*)(intptr_t)fd);
+		break;
+	case REPLAY_PACKET:
+		if( fd == 0 || !session_isActive(fd) )
+			break;
+		WFIFOHEAD(fd, record->len);
+		memcpy(WFIFOP(fd,0), record->data, record->len);
+		WFIFOSET(fd, record->len);
+		replay.packets++;
+		replay.bytes_received += record->len;
+		break;
+	case REPLAY_CLOSE:
+		if( fd != 0 && session_isValid(fd) )
+			set_eof(fd);
+		break;
+	}
+}
+
+/// Sends the recorded packets that are due and measures the server ticks.
+/// The timer is armed again from the current tick on each call, so it runs
+/// once per iteration of the main loop (an interval timer would run many
+/// times in a row to catch up after a stall), and the time between two calls
+/// is the duration of a server tick.
+static int replay_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	int64 now = gettick_usec();
+	int64 elapsed = (now - replay.start)*replay.speed;
+
+	replay.tid = INVALID_TIMER;
+
+	if( replay.last_tick )
+	{
+		unsigned int usec = (unsigned int)cap_value(now - replay.last_tick, 0, UINT_MAX);
+		int bucket = 0;
+		while( bucket < REPLAY_TICK_BUCKETS-1 && (usec>>bucket) != 0 )
+			++bucket;
+		replay.tick_hist[bucket]++;
+		replay.tick_max = max(replay.tick_max, usec);
+		replay.ticks++;
+	}
+	replay.last_tick = now;
+
+	while( replay.pos < replay.count && replay.records[replay.pos].time <= elapsed )
+		replay_record_exec(&replay.records[replay.pos++]);
+
+	if( replay.pos == replay.count &&
+		(replay.sessions->size(replay.sessions) == 0 || elapsed > (replay.count ? replay.records[replay.count-1].time : 0) + REPLAY_LINGER*replay.speed) )
+	{// done
+		replay_report();
+		replay_stop();
+	}
+	else
+		replay.tid = add_timer(gettick()+1, replay_timer, 0, 0);
+	return 0;
+}
+
+/// Returns the upper bound of the tick duration of the given percentile, in microseconds.
+static unsigned int replay_tick_percentile(int percent)
+{
+	uint64 target = ((uint64)replay.ticks*percent + 99)/100;
+	uint64 sum = 0;
+	int i;
+
+	for( i = 0; i < REPLAY_TICK_BUCKETS-1; ++i )
+	{
+		sum += replay.tick_hist[i];
+		if( sum >= target )
+			return min(1u<<i, replay.tick_max);
+	}
+	return replay.tick_max;
+}
+
+/// Replays a capture file against this map-server.
+/// @param speed Replay speed multiplier (1 = recorded pace)
+bool replay_start(const char* filename, int speed)
+{
+	if( replay.records != NULL )
+	{
+		ShowWarning("replay_start: a replay is already running.\n");
+		return false;
+	}
+	if( !replay_load(filename) )
+	{
+		replay_stop();
+		return false;
+	}
+
+	safestrncpy(replay.filename, filename, sizeof(replay.filename));
+	replay.speed = max(speed, 1);
+	replay.pos = 0;
+	replay.last_tick = 0;
+	replay.ticks = 0;
+	replay.tick_max = 0;
+	memset(replay.tick_hist, 0, sizeof(replay.tick_hist));
+	replay.packets = 0;
+	replay.bytes_received = 0;
+	replay.bytes_sent = 0;
+	replay.start = gettick_usec();
+	replay.tid = add_timer(gettick()+1, replay_timer, 0, 0);
+	ShowStatus("Replaying '"CL_WHITE"%s"CL_RESET"' (%d records, speed x%d).\n", filename, replay.count, replay.speed);
+	return true;
+}
+
+/// Stops the replay and closes the replayed connections.
+void replay_stop(void)
+{
+	int fd;
+
+	if( replay.tid != INVALID_TIMER )
+	{
+		delete_timer(replay.tid, replay_timer);
+		replay.tid = INVALID_TIMER;
+	}
+	for( fd = 0; fd < FD_SETSIZE; ++fd )
+	{
+		if( replay.session[fd] && session_isValid(fd) )
+			set_eof(fd);
+		replay.session[fd] = 0;
+	}
+	db_clear(replay.sessions);
+	db_clear(replay.ports);
+	db_clear(replay.auths);
+	if( replay.records )
+		aFree(replay.records);
+	if( replay.buffer )
+		aFree(replay.buffer);
+	replay.records = NULL;
+	replay.buffer = NULL;
+	replay.count = 0;
+}
+
+/// Displays the statistics of the current replay.
+void replay_report(void)
+{
+	double seconds;
+
+	if( replay.records == NULL )
+	{
+		ShowInfo("No replay running.\n");
+		return;
+	}
+	seconds = (double)(gettick_usec() - replay.start)/1000000.;
+	ShowInfo("Replay of '%s' (speed x%d): %d/%d records, %.1f seconds\n", replay.filename, replay.speed, replay.pos, replay.count, seconds);
+	ShowMessage("  packets : %u sent to the server, %d sessions open\n", replay.packets, replay.sessions->size(replay.sessions));
+	ShowMessage("  ticks   : %u (%.1f ticks/sec)\n", replay.ticks, seconds > 0 ? replay.ticks/seconds : 0.);
+	ShowMessage("  tick us : p50 %u, p90 %u, p99 %u, max %u\n", replay_tick_percentile(50), replay_tick_percentile(90), replay_tick_percentile(99), replay.tick_max);
+	ShowMessage("  traffic : %.1f KB received by the server, %.1f KB sent by the server\n", replay.bytes_received/1024., replay.bytes_sent/1024.);
+}
+
+/// Returns the recorded character data of a replayed session, NULL if not replayed.
+/// Only the replay's own connections qualify: the client fd must come from the
+/// loopback interface (REPLAY_ADDR), from the local port of one of the replayed connections.
+/// The data is the 0x2afd packet from offset 4.
+const uint8* replay_authdata(int fd, int account_id, uint32 login_id1, int* len)
+{
+	int i, client_fd;
+
+	if( replay.records == NULL || !session_isValid(fd) || session[fd]->client_addr != REPLAY_ADDR )
+		return NULL;
+	client_fd = (int)(intptr_t)idb_get(replay.ports, session[fd]->client_port);
+	if( client_fd == 0 || !session_isValid(client_fd) || replay.session[client_fd] == 0 )
+		return NULL;
+	for( i = (int)(intptr_t)idb_get(replay.auths, account_id) - 1; i >= 0; i = replay.records[i].next_auth )
+	{
+		if( RBUFL(replay.records[i].data,4) == login_id1 )
+		{
+			*len = replay.records[i].len;
+			return replay.records[i].data;
+		}
+	}
+	return NULL;
+}
+
+int do_init_replay(void)
+{
+	memset(&capture, 0, sizeof(capture));
+	memset(&replay, 0, sizeof(replay));
+	replay.tid = INVALID_TIMER;
+	replay.sessions = idb_alloc(DB_OPT_BASE);
+	replay.ports = idb_alloc(DB_OPT_BASE);
+	replay.auths = idb_alloc(DB_OPT_BASE);
+	add_timer_func_list(replay_timer, "replay_timer");
+	return 0;
+}
+
+void do_final_replay(void)
+{
+	replay_capture_stop();
+	replay_stop();
+	db_destroy(replay.sessions);
+	db_destroy(replay.ports);
+	db_destroy(replay.auths);
+}
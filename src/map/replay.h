@@ -0,0 +1,36 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include "../common/cbasetypes.h"
+
+// Packet capture and replay.
+// A capture records the packets received from the clients, with their time,
+// and the character data sent by the char-server when each session was
+// authenticated. A replay connects to the map-server through the loopback
+// interface, one connection per recorded session, and sends the packets
+// again at the recorded pace. Replayed sessions are authenticated from the
+// capture, so no login/char-server login round trip is needed; only the
+// replay's own connections are authenticated this way. Their characters are
+// copies of live ones, so they are never saved to the char-server
+// (map_session_data::state.replay) and can't change map-server.
+
+// capture
+bool replay_capture_start(const char* filename);
+void replay_capture_stop(void);
+void replay_capture_packet(int fd, const uint8* data, int len);
+void replay_capture_auth(int fd, const uint8* data, int len);
+void replay_capture_close(int fd);
+
+// replay
+bool replay_start(const char* filename, int speed);
+void replay_stop(void);
+void replay_report(void);
+const uint8* replay_authdata(int fd, int account_id, uint32 login_id1, int* len);
+
+int do_init_replay(void);
+void do_final_replay(void);
+
+#endif /* _REPLAY_H_ */
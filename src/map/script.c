@@ -13,6 +13,7 @@
 #include "../common/lock.h"
 #include "../common/nullpo.h"
 #include "../common/showmsg.h"
+#include "../common/socket.h" // WBUF*()
 #include "../common/strlib.h"
 #include "../common/timer.h"
 #include "../common/utils.h"
@@ -285,6 +286,7 @@ extern int current_equip_item_index; //for New CARDS Scripts. It contains Invent
 int potion_flag=0; //For use on Alchemist improved potions/Potion Pitcher. [Skotlex]
 int potion_hp=0, potion_per_hp=0, potion_sp=0, potion_per_sp=0;
 int potion_target=0;
+bool script_group_local = false;
 
 
 c_op get_com(unsigned char *script,int *pos);
@@ -2068,12 +2070,24 @@ void script_error(const char* src, const char* file, int start_line, const char*
 /*==========================================
  * XNvg̉
  *------------------------------------------*/
+/// Adds the buildin functions and the constants, before the first script is parsed.
+static void parse_script_init(void)
+{
+	static bool first = true;
+
+	if( first )
+	{
+		add_buildin_func();
+		read_constdb();
+		first = false;
+	}
+}
+
 struct script_code* parse_script(const char *src,const char *file,int line,int options)
 {
 	const char *p,*tmpp;
 	int i;
 	struct script_code* code = NULL;
-	static int first=1;
 	char end;
 	bool unresolved_names = false;
 
@@ -2081,11 +2095,7 @@ struct script_code* parse_script(const char *src,const char *file,int line,int o
 		return NULL;// empty script
 
 	memset(&syntax,0,sizeof(syntax));
-	if(first){
-		add_buildin_func();
-		read_constdb();
-		first=0;
-	}
+	parse_script_init();
 
 	script_buf=(unsigned char *)aMalloc(SCRIPT_BLOCK_SIZE*sizeof(unsigned char));
 	script_pos=0;
@@ -2258,6 +2268,449 @@ struct script_code* parse_script(const char *src,const char *file,int line,int o
 	return code;
 }
 
+/*==========================================
+ * Script bytecode cache
+ *------------------------------------------*/
+
+// The compiled bytecode of the npc scripts is kept in a cache, keyed by a
+// hash of the script source, and saved to script_cache_file so unchanged
+// scripts don't have to be compiled again on the next start or reload.
+// With map_groups, the other groups use script_cache_file.<group>.
+// The str_data ids in the bytecode depend on the order in which the names
+// were added, so the cache stores the referenced names and the ids are
+// patched when the bytecode is reused.
+
+/// Increase when the bytecode or the cache file format changes.
+#define SCRIPT_CACHE_VERSION 1
+
+struct script_cache_entry {
+	char key[40]; // "<source hash>:<source length>:<options>"
+	uint32 hash[2]; // source hash
+	uint32 len; // source length
+	uint32 options; // parse_script options
+	bool used; // used since the cache was last saved
+	int script_size;
+	int name_count; // number of C_NAME references
+	int label_count; // number of labels (SCRIPT_USE_LABEL_DB)
+	int names_len;
+	unsigned char* script_buf;
+	int* name_pos; // position of each C_NAME reference in script_buf
+	int* label_pos; // position of each label
+	char* names; // name of each reference and label, '\0' separated
+	// the data follows the structure
+};
+
+// header of the cache file, followed by the entries
+struct script_cache_header {
+	char magic[8]; // "EASCACHE"
+	uint32 version; // SCRIPT_CACHE_VERSION
+	uint32 byteorder; // 0x01020304 in the byte order of the machine that wrote the file
+	uint32 engine; // fingerprint of the buildin functions, parameters and constants
+	uint32 count; // number of entries
+};
+
+// entry of the cache file, followed by script_size bytes of bytecode,
+// name_count+label_count positions and names_len bytes of names
+struct script_cache_record {
+	uint32 hash[2];
+	uint32 len;
+	uint32 options;
+	uint32 script_size;
+	uint32 name_count;
+	uint32 label_count;
+	uint32 names_len;
+};
+
+static struct {
+	DBMap* db; // key -> struct script_cache_entry*
+	bool loaded;
+	bool dirty; // entries were added since the cache was loaded/saved
+	uint32 engine;
+	int hits;
+	int misses;
+} script_cache;
+
+static char script_cache_file[256] = "db/script_cache.dat";
+
+/// 64-bit FNV-1a hash of the script source.
+static uint64 script_cache_hash(const char* src, size_t len)
+{
+	uint64 hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for( i = 0; i < len; ++i )
+	{
+		hash ^= (uint8)src[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/// Fingerprint of the buildin functions, parameters and constants known by
+/// the script engine. Changing any of them can change the bytecode of a script.
+/// The other names (variables, labels) don't matter, and neither does the order
+/// the names were added in, so the entries are hashed alone and summed.
+static uint32 script_cache_fingerprint(void)
+{
+	uint32 sum = 0;
+	int i;
+
+	for( i = LABEL_START; i < str_num; ++i )
+	{
+		uint32 hash = 2166136261U;
+		const char* p;
+
+		if( str_data[i].type != C_FUNC && str_data[i].type != C_PARAM && str_data[i].type != C_INT )
+			continue;
+		for( p = get_str(i); *p; ++p )
+			hash = (hash ^ (uint8)TOLOWER(*p)) * 16777619U;
+		hash = (hash ^ (uint32)str_data[i].type) * 16777619U;
+		hash = (hash ^ (uint32)str_data[i].val) * 16777619U;
+		sum += hash;
+	}
+	return sum ^ SCRIPT_CACHE_VERSION;
+}
+
+static void script_cache_makekey(struct script_cache_entry* entry, uint64 hash, size_t len, int options)
+{
+	entry->hash[0] = (uint32)(hash>>32);
+	entry->hash[1] = (uint32)hash;
+	entry->len = (uint32)len;
+	entry->options = (uint32)options;
+	sprintf(entry->key, "%08x%08x:%x:%x", entry->hash[0], entry->hash[1], entry->len, entry->options);
+}
+
+/// Allocates an entry with room for the data and sets up the data pointers.
+static struct script_cache_entry* script_cache_create(int script_size, int name_count, int label_count, int names_len)
+{
+	struct script_cache_entry* entry;
+	unsigned char* p;
+
+	p = (unsigned char*)aMalloc(sizeof(struct script_cache_entry) + (name_count+label_count)*sizeof(int) + script_size + names_len);
+	entry = (struct script_cache_entry*)p;
+	memset(entry, 0, sizeof(struct script_cache_entry));
+	entry->script_size = script_size;
+	entry->name_count = name_count;
+	entry->label_count = label_count;
+	entry->names_len = names_len;
+	p += sizeof(struct script_cache_entry);
+	entry->name_pos = (int*)p;
+	entry->label_pos = entry->name_pos + name_count;
+	p += (name_count+label_count)*sizeof(int);
+	entry->script_buf = p;
+	entry->names = (char*)(p + script_size);
+	return entry;
+}
+
+/// Loads the cache file. Discards it if it was made by a different script engine.
+static void script_cache_load(void)
+{
+	struct script_cache_header header;
+	struct script_cache_record rec;
+	FILE* fp;
+	int i;
+
+	script_cache.loaded = true;
+	script_cache.db = strdb_alloc(DB_OPT_RELEASE_DATA, 0);
+	script_cache.engine = script_cache_fingerprint();
+	if( map_group != 0 && strcmpi(script_cache_file, "none") != 0 )
+	{// each map group compiles the npcs of its own maps, and keeps them in its own file
+		char path[sizeof(script_cache_file)];
+		snprintf(path, sizeof(path), "%s.%d", script_cache_file, map_group);
+		safestrncpy(script_cache_file, path, sizeof(script_cache_file));
+	}
+	if( strcmpi(script_cache_file, "none") == 0 || (fp = fopen(script_cache_file, "rb")) == NULL )
+		return;
+
+	if( fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, "EASCACHE", 8) != 0 ||
+		header.version != SCRIPT_CACHE_VERSION || header.byteorder != 0x01020304 )
+	{
+		ShowWarning("script_cache_load: Ignoring invalid script cache '%s'.\n", script_cache_file);
+		fclose(fp);
+		return;
+	}
+	if( header.engine != script_cache.engine )
+	{
+		ShowInfo("script_cache_load: The script engine changed, discarding the script cache.\n");
+		fclose(fp);
+		script_cache.dirty = true;
+		return;
+	}
+
+	for( i = 0; i < (int)header.count; ++i )
+	{
+		struct script_cache_entry* entry;
+		size_t size;
+
+		if( fread(&rec, sizeof(rec), 1, fp) != 1 || rec.script_size == 0 || rec.script_size > 0x1000000 ||
+			rec.name_count > rec.script_size || rec.label_count > rec.script_size || rec.names_len > 0x1000000 )
+			break;
+		entry = script_cache_create(rec.script_size, rec.name_count, rec.label_count, rec.names_len);
+		size = (rec.name_count+rec.label_count)*sizeof(int) + rec.script_size + rec.names_len;
+		if( fread(entry->name_pos, 1, size, fp) != size ||
+			(rec.names_len > 0 && entry->names[rec.names_len-1] != '\0') )
+		{
+			aFree(entry);
+			break;
+		}
+		script_cache_makekey(entry, ((uint64)rec.hash[0]<<32)|rec.hash[1], rec.len, rec.options);
+		strdb_put(script_cache.db, entry->key, entry);
+	}
+	if( i < (int)header.count )
+	{
+		ShowWarning("script_cache_load: Script cache '%s' is truncated, loaded %d of %u entries.\n", script_cache_file, i, header.count);
+		script_cache.dirty = true;
+	}
+	fclose(fp);
+}
+
+/// Creates the script code of a cache entry, patching the name references.
+static struct script_code* script_cache_instantiate(struct script_cache_entry* entry, int options)
+{
+	struct script_code* code;
+	const char* name = entry->names;
+	int i;
+
+	CREATE(code, struct script_code, 1);
+	code->script_size = entry->script_size;
+	code->script_buf = (unsigned char*)aMalloc(entry->script_size);
+	code->script_vars = NULL;
+	memcpy(code->script_buf, entry->script_buf, entry->script_size);
+
+	for( i = 0; i < entry->name_count; ++i )
+	{
+		int l = add_str(name);
+		if( str_data[l].type == C_NOP )
+		{// unknown name, variable (same as parse_script)
+			str_data[l].type = C_NAME;
+			str_data[l].label = l;
+		}
+		SETVALUE(code->script_buf, entry->name_pos[i], l);
+		name += strlen(name) + 1;
+	}
+
+	if( options&SCRIPT_USE_LABEL_DB )
+	{
+		scriptlabel_db->clear(scriptlabel_db, NULL);
+		for( i = 0; i < entry->label_count; ++i )
+		{
+			strdb_put(scriptlabel_db, get_str(add_str(name)), (void*)(intptr)entry->label_pos[i]);
+			name += strlen(name) + 1;
+		}
+	}
+	return code;
+}
+
+/// Creates a cache entry for the compiled script code.
+static struct script_cache_entry* script_cache_record(struct script_cache_entry* search, struct script_code* code, int options)
+{
+	struct script_cache_entry* entry;
+	DBIterator* iter = NULL;
+	int name_count = 0, label_count = 0, names_len = 0;
+	int pos, n;
+	char* names;
+
+	// count the name references and labels
+	for( pos = 0; pos < code->script_size; )
+	{
+		switch( get_com(code->script_buf, &pos) )
+		{
+		case C_INT: get_num(code->script_buf, &pos); break;
+		case C_POS: pos += 3; break;
+		case C_NAME:
+			++name_count;
+			names_len += (int)strlen(get_str(GETVALUE(code->script_buf, pos))) + 1;
+			pos += 3;
+			break;
+		case C_STR: pos += (int)strlen((char*)code->script_buf + pos) + 1; break;
+		default: break;
+		}
+	}
+	if( options&SCRIPT_USE_LABEL_DB )
+	{
+		DBKey label;
+		iter = scriptlabel_db->iterator(scriptlabel_db);
+		for( iter->first(iter, &label); iter->exists(iter); iter->next(iter, &label) )
+		{
+			++label_count;
+			names_len += (int)strlen(label.str) + 1;
+		}
+	}
+
+	entry = script_cache_create(code->script_size, name_count, label_count, names_len);
+	memcpy(entry->key, search->key, sizeof(entry->key));
+	memcpy(entry->hash, search->hash, sizeof(entry->hash));
+	entry->len = search->len;
+	entry->options = search->options;
+	memcpy(entry->script_buf, code->script_buf, code->script_size);
+	names = entry->names;
+	for( pos = 0, n = 0; pos < code->script_size; )
+	{
+		switch( get_com(code->script_buf, &pos) )
+		{
+		case C_INT: get_num(code->script_buf, &pos); break;
+		case C_POS: pos += 3; break;
+		case C_NAME:
+			entry->name_pos[n++] = pos;
+			strcpy(names, get_str(GETVALUE(code->script_buf, pos)));
+			names += strlen(names) + 1;
+			pos += 3;
+			break;
+		case C_STR: pos += (int)strlen((char*)code->script_buf + pos) + 1; break;
+		default: break;
+		}
+	}
+	if( iter != NULL )
+	{
+		DBKey label;
+		void* data;
+		for( data = iter->first(iter, &label), n = 0; iter->exists(iter); data = iter->next(iter, &label), ++n )
+		{
+			entry->label_pos[n] = (int)(intptr)data;
+			strcpy(names, label.str);
+			names += strlen(names) + 1;
+		}
+		iter->destroy(iter);
+	}
+	return entry;
+}
+
+/// Parses a script using the bytecode cache.
+/// Same as parse_script, but len is the length of the script source, which
+/// must be known, and it doesn't report the parse warnings of cached scripts.
+struct script_code* parse_script_cached(const char* src, size_t len, const char* file, int line, int options)
+{
+	struct script_cache_entry search;
+	struct script_cache_entry* entry;
+	struct script_code* code;
+
+	if( src == NULL || strcmpi(script_cache_file, "none") == 0 )
+		return parse_script(src, file, line, options);
+
+	parse_script_init();
+	if( !script_cache.loaded )
+		script_cache_load();
+
+	script_cache_makekey(&search, script_cache_hash(src, len), len, options);
+	entry = (struct script_cache_entry*)strdb_get(script_cache.db, search.key);
+	if( entry != NULL )
+	{
+		++script_cache.hits;
+		entry->used = true;
+		return script_cache_instantiate(entry, options);
+	}
+
+	code = parse_script(src, file, line, options);
+	if( code != NULL )
+	{
+		++script_cache.misses;
+		entry = script_cache_record(&search, code, options);
+		entry->used = true;
+		strdb_put(script_cache.db, entry->key, entry);
+		script_cache.dirty = true;
+	}
+	return code;
+}
+
+static int script_cache_count_sub(DBKey key, void* data, va_list ap)
+{
+	struct script_cache_entry* entry = (struct script_cache_entry*)data;
+	DBMap* db = va_arg(ap, DBMap*);
+	bool* dirty = va_arg(ap, bool*);
+	bool prune = (bool)va_arg(ap, int);
+
+	if( !prune )
+		return 1;
+	if( !entry->used )
+	{// not used anymore
+		db->remove(db, key);
+		*dirty = true;
+		return 0;
+	}
+	entry->used = false;
+	return 1;
+}
+
+static int script_cache_save_sub(DBKey key, void* data, va_list ap)
+{
+	struct script_cache_entry* entry = (struct script_cache_entry*)data;
+	FILE* fp = va_arg(ap, FILE*);
+	struct script_cache_record rec;
+	size_t size;
+
+	rec.hash[0] = entry->hash[0];
+	rec.hash[1] = entry->hash[1];
+	rec.len = entry->len;
+	rec.options = entry->options;
+	rec.script_size = entry->script_size;
+	rec.name_count = entry->name_count;
+	rec.label_count = entry->label_count;
+	rec.names_len = entry->names_len;
+	size = (entry->name_count+entry->label_count)*sizeof(int) + entry->script_size + entry->names_len;
+	if( fwrite(&rec, sizeof(rec), 1, fp) != 1 || fwrite(entry->name_pos, 1, size, fp) != size )
+		return 1;// write error
+	return 0;
+}
+
+/// Saves the script cache. Called after the npc files are loaded.
+/// With prune, drops the entries that weren't used since it was last pruned
+/// (all the scripts were parsed, at startup). A reload parses only part of
+/// them, so it keeps the other entries.
+void script_cache_save(bool prune)
+{
+	struct script_cache_header header;
+	char tmppath[sizeof(script_cache_file)+4];
+	FILE* fp;
+	int count;
+	bool dirty = script_cache.dirty;
+
+	if( !script_cache.loaded )
+		return;
+	ShowInfo("Script cache: '"CL_WHITE"%d"CL_RESET"' scripts reused, '"CL_WHITE"%d"CL_RESET"' compiled.\n", script_cache.hits, script_cache.misses);
+	script_cache.hits = script_cache.misses = 0;
+
+	count = script_cache.db->foreach(script_cache.db, script_cache_count_sub, script_cache.db, &dirty, prune);
+	if( !dirty )
+		return;// nothing changed
+
+	// written to a temporary file and renamed, so a failed write keeps the previous cache
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", script_cache_file);
+	fp = fopen(tmppath, "wb");
+	if( fp == NULL )
+	{
+		ShowError("script_cache_save: Unable to write script cache '%s'.\n", tmppath);
+		return;
+	}
+	memcpy(header.magic, "EASCACHE", 8);
+	header.version = SCRIPT_CACHE_VERSION;
+	header.byteorder = 0x01020304;
+	header.engine = script_cache.engine;
+	header.count = count;
+	if( fwrite(&header, sizeof(header), 1, fp) != 1 || script_cache.db->foreach(script_cache.db, script_cache_save_sub, fp) != 0 )
+	{
+		ShowError("script_cache_save: Unable to write script cache '%s'.\n", tmppath);
+		fclose(fp);
+		remove(tmppath);
+		return;
+	}
+	if( fclose(fp) != 0 )
+	{
+		ShowError("script_cache_save: Unable to write script cache '%s'.\n", tmppath);
+		remove(tmppath);
+		return;
+	}
+#ifdef WIN32
+	remove(script_cache_file);// rename doesn't replace files on windows
+#endif
+	if( rename(tmppath, script_cache_file) != 0 )
+	{
+		ShowError("script_cache_save: Unable to replace script cache '%s'.\n", script_cache_file);
+		remove(tmppath);
+		return;
+	}
+	script_cache.dirty = false;
+}
+
 /// Returns the player attached to this script, identified by the rid.
 /// If there is no player attached, the script is terminated.
 TBL_PC *script_rid2sd(struct script_state *st)
@@ -2446,6 +2899,11 @@ static int set_reg(struct script_state* st, TBL_PC* sd, int num, const char* nam
 		case '@':
 			return pc_setregstr(sd, num, str);
 		case '$':
+			if( st != NULL && st->group_local )
+			{// the first map group shares its own change
+				mapreg_update(name, num>>24, 0, str);
+				return 1;
+			}
 			return mapreg_setregstr(num, str);
 		case '#':
 			return (name[1] == '#') ?
@@ -2497,6 +2955,11 @@ static int set_reg(struct script_state* st, TBL_PC* sd, int num, const char* nam
 		case '@':
 			return pc_setreg(sd, num, val);
 		case '$':
+			if( st != NULL && st->group_local )
+			{// the first map group shares its own change
+				mapreg_update(name, num>>24, val, NULL);
+				return 1;
+			}
 			return mapreg_setreg(num, val);
 		case '#':
 			return (name[1] == '#') ?
@@ -2777,9 +3240,97 @@ void script_free_vars(struct linkdb_node **node)
 	linkdb_final( node );
 }
 
+/// Writes the variables to buf, by name so they can be read by another map-server.
+/// <count>.W { <name length>.B <name> <index>.B <value>.L | <length>.W <string> }*
+/// Returns the length written, or -1 if they don't fit in size bytes.
+int script_vars_pack(struct linkdb_node* node, unsigned char* buf, int size)
+{
+	int len = 2, count = 0;
+
+	if( size < 2 )
+		return -1;
+	for( ; node != NULL; node = node->next )
+	{
+		int uid = (int)(intptr_t)node->key;
+		const char* name = get_str(uid&0x00ffffff);
+		int namelen = (int)strlen(name);
+
+		if( namelen > 255 || len + 2 + namelen + 4 > size )
+			return -1;
+		WBUFB(buf,len) = (uint8)namelen;
+		memcpy(WBUFP(buf,len+1), name, namelen);
+		WBUFB(buf,len+1+namelen) = (uint8)((unsigned int)uid>>24);
+		len += 2 + namelen;
+		if( is_string_variable(name) )
+		{
+			const char* str = (const char*)node->data;
+			int strsize = (int)strlen(str);
+			if( strsize > 0xffff || len + 2 + strsize > size )
+				return -1;
+			WBUFW(buf,len) = (uint16)strsize;
+			memcpy(WBUFP(buf,len+2), str, strsize);
+			len += 2 + strsize;
+		}
+		else
+		{
+			WBUFL(buf,len) = (uint32)(intptr_t)node->data;
+			len += 4;
+		}
+		count++;
+	}
+	WBUFW(buf,0) = count;
+	return len;
+}
+
+/// Replaces the variables with the ones written by script_vars_pack.
+/// Returns the length read, or -1 if the data is invalid.
+int script_vars_unpack(struct linkdb_node** node, const unsigned char* buf, int len)
+{
+	char name[256];
+	int i, count, pos = 2;
+
+	if( len < 2 )
+		return -1;
+	script_free_vars(node);
+	count = RBUFW(buf,0);
+	for( i = 0; i < count; ++i )
+	{
+		int namelen, uid;
+
+		if( pos + 1 > len || pos + 2 + (namelen = RBUFB(buf,pos)) > len || namelen == 0 )
+			return -1;
+		memcpy(name, RBUFP(buf,pos+1), namelen);
+		name[namelen] = '\0';
+		uid = add_str(name) | (RBUFB(buf,pos+1+namelen)<<24);
+		pos += 2 + namelen;
+		if( is_string_variable(name) )
+		{
+			int strsize;
+			char* str;
+			if( pos + 2 > len || pos + 2 + (strsize = RBUFW(buf,pos)) > len )
+				return -1;
+			str = (char*)aMalloc(strsize + 1);
+			memcpy(str, RBUFP(buf,pos+2), strsize);
+			str[strsize] = '\0';
+			linkdb_insert(node, (void*)(intptr_t)uid, str);
+			pos += 2 + strsize;
+		}
+		else
+		{
+			if( pos + 4 > len )
+				return -1;
+			linkdb_insert(node, (void*)(intptr_t)uid, (void*)(intptr_t)(int)RBUFL(buf,pos));
+			pos += 4;
+		}
+	}
+	return pos;
+}
+
 void script_free_code(struct script_code* code)
 {
 	script_free_vars( &code->script_vars );
+	if( code->bonus )
+		aFree( code->bonus );
 	aFree( code->script_buf );
 	aFree( code );
 }
@@ -2808,6 +3359,11 @@ struct script_state* script_alloc_state(struct script_code* script, int pos, int
 	st->rid = rid;
 	st->oid = oid;
 	st->sleep.timer = INVALID_TIMER;
+	if( script_group_local )
+	{// only the floating npcs run in every map group
+		struct npc_data* nd = map_id2nd(oid);
+		st->group_local = ( nd != NULL && nd->bl.m < 0 );
+	}
 	return st;
 }
 
@@ -3295,6 +3851,98 @@ void run_script(struct script_code *rootscript,int pos,int rid,int oid)
 	run_script_main(st);
 }
 
+/// Bonus command with constant arguments.
+struct script_bonus {
+	int argc;// number of values after the type (1-5)
+	int type;
+	int val[5];
+};
+
+int buildin_bonus(struct script_state* st);
+
+/// Compiles a script that only consists of bonus/bonus2/.../bonus5 commands
+/// with constant arguments to a list of bonuses.
+/// Returns false if the script does anything else.
+static bool script_compile_bonus(struct script_code* code)
+{
+	struct script_bonus bonus[32];
+	int count = 0, pos = 0;
+
+	while( pos < code->script_size )
+	{
+		int args[6], n = 0, id;
+		enum c_op c = get_com(code->script_buf, &pos);
+
+		if( c == C_NOP )
+			break;// end of script
+		if( c == C_EOL )
+			continue;
+		if( c != C_NAME || pos + 3 > code->script_size )
+			return false;
+		id = GETVALUE(code->script_buf, pos);
+		pos += 3;
+		if( str_data[id].type != C_FUNC || str_data[id].func != buildin_bonus )
+			return false;
+		if( get_com(code->script_buf, &pos) != C_ARG )
+			return false;
+		while( pos < code->script_size && (c = get_com(code->script_buf, &pos)) != C_FUNC )
+		{
+			if( c == C_INT && n < ARRAYLENGTH(args) )
+				args[n++] = get_num(code->script_buf, &pos);
+			else if( c == C_NEG && n > 0 )
+				args[n-1] = -args[n-1];
+			else
+				return false;// variables, strings, expressions, ...
+		}
+		if( c != C_FUNC || n < 2 || count >= ARRAYLENGTH(bonus) )
+			return false;
+		bonus[count].argc = n - 1;
+		bonus[count].type = args[0];
+		memcpy(bonus[count].val, args + 1, (n - 1)*sizeof(int));
+		++count;
+	}
+
+	if( count )
+	{
+		CREATE(code->bonus, struct script_bonus, count);
+		memcpy(code->bonus, bonus, count*sizeof(struct script_bonus));
+	}
+	code->bonus_count = count;
+	return true;
+}
+
+/// Runs the bonus script of an item for the player.
+/// Scripts with only constant bonuses are compiled the first time they run
+/// and call pc_bonus directly after that, the others go through run_script.
+void script_run_bonus(struct script_code* code, struct map_session_data* sd)
+{
+	int i;
+
+	if( code == NULL )
+		return;
+	if( code->bonus_state == 0 )
+		code->bonus_state = script_compile_bonus(code) ? 1 : 2;
+	if( code->bonus_state != 1 )
+	{
+		run_script(code, 0, sd->bl.id, 0);
+		return;
+	}
+
+	for( i = 0; i < code->bonus_count; ++i )
+	{
+		const struct script_bonus* b = &code->bonus[i];
+		switch( b->argc )
+		{
+		case 1: pc_bonus(sd, b->type, b->val[0]); break;
+		case 2: pc_bonus2(sd, b->type, b->val[0], b->val[1]); break;
+		case 3: pc_bonus3(sd, b->type, b->val[0], b->val[1], b->val[2]); break;
+		case 4: pc_bonus4(sd, b->type, b->val[0], b->val[1], b->val[2], b->val[3]); break;
+		case 5: pc_bonus5(sd, b->type, b->val[0], b->val[1], b->val[2], b->val[3], b->val[4]); break;
+		default: ShowDebug("script_run_bonus: unexpected number of arguments (%d)\n", b->argc + 1); break;
+		}
+	}
+}
+
 void script_stop_sleeptimers(int id)
 {
 	struct script_state* st;
@@ -3422,7 +4070,9 @@ void run_script_main(struct script_state *st)
 	TBL_PC *sd;
 	struct script_stack *stack=st->stack;
 	struct npc_data *nd;
+	bool group_local = script_group_local;
 
+	script_group_local = st->group_local; // inherited by the scripts it runs and the npc timers it starts
 	script_attach_state(st);
 
 	nd = map_id2nd(st->oid);
@@ -3561,6 +4211,7 @@ void run_script_main(struct script_state *st)
 		script_free_state(st);
 		st = NULL;
 	}
+	script_group_local = group_local;
 }
 
 int script_config_read(char *cfgName)
@@ -3601,6 +4252,9 @@ int script_config_read(char *cfgName)
 		else if(strcmpi(w1,"warn_func_mismatch_argtypes")==0) {
 			script_config.warn_func_mismatch_argtypes = config_switch(w2);
 		}
+		else if(strcmpi(w1,"script_cache_file")==0) {
+			safestrncpy(script_cache_file, w2, sizeof(script_cache_file));
+		}
 		else if(strcmpi(w1,"import")==0){
 			script_config_read(w2);
 		}
@@ -3785,6 +4439,8 @@ int do_final_script()
 
 	scriptlabel_db->destroy(scriptlabel_db,NULL);
 	userfunc_db->destroy(userfunc_db,do_final_userfunc_sub);
+	if( script_cache.db != NULL )
+		script_cache.db->destroy(script_cache.db, NULL);
 	autobonus_db->destroy(autobonus_db, do_final_autobonus_sub);
 	if(sleep_db) {
 		struct linkdb_node *n = (struct linkdb_node *)sleep_db;
@@ -8594,7 +9250,7 @@ BUILDIN_FUNC(announce)
 		else
 			clif_broadcast(bl, mes, (int)strlen(mes)+1, flag&0xf0, target);
 	}
-	else
+	else if( !st->group_local ) // the first map group announces it to all of them
 	{
 		if (fontColor)
 			intif_broadcast2(mes, (int)strlen(mes)+1, strtol(fontColor, (char **)NULL, 0), fontType, fontSize, fontAlign, fontY);
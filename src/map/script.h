@@ -9,6 +9,7 @@
 struct map_session_data;
 
 extern int potion_flag; //For use on Alchemist improved potions/Potion Pitcher. [Skotlex]
+extern bool script_group_local; // the running script is group local (see script_state::group_local)
 extern int potion_hp, potion_per_hp, potion_sp, potion_per_sp;
 extern int potion_target;
 
@@ -93,10 +94,15 @@ struct script_data {
 
 // Moved defsp from script_state to script_stack since
 // it must be saved when script state is RERUNLINE. [Eoe / jA 1094]
+struct script_bonus;
+
 struct script_code {
 	int script_size;
 	unsigned char* script_buf;
 	struct linkdb_node* script_vars;
+	struct script_bonus* bonus;// constant bonuses of the script, see script_run_bonus
+	int bonus_count;
+	unsigned char bonus_state;// 0 not compiled yet, 1 compiled, 2 not constant
 };
 
 struct script_stack {
@@ -124,6 +130,7 @@ struct script_state {
 		int tick,timer,charid;
 	} sleep;
 	int instance_id;
+	bool group_local; // run by a server event of a floating npc in a secondary map group, or by the scripts and npc timers of floating npcs it started; the first group shares its effects
 	//For backing up purposes
 	struct script_state *bk_st;
 	int bk_npcid;
@@ -149,8 +156,11 @@ const char* skip_space(const char* p);
 void script_error(const char* src, const char* file, int start_line, const char* error_msg, const char* error_pos);
 
 struct script_code* parse_script(const char* src,const char* file,int line,int options);
+struct script_code* parse_script_cached(const char* src, size_t len, const char* file, int line, int options);
+void script_cache_save(bool prune);
 void run_script_sub(struct script_code *rootscript,int pos,int rid,int oid, char* file, int lineno);
 void run_script(struct script_code*,int,int,int);
+void script_run_bonus(struct script_code* code, struct map_session_data* sd);
 
 int set_var(struct map_session_data *sd, char *name, void *val);
 int conv_num(struct script_state *st,struct script_data *data);
@@ -162,6 +172,8 @@ void script_stop_sleeptimers(int id);
 struct linkdb_node* script_erase_sleepdb(struct linkdb_node *n);
 void script_free_code(struct script_code* code);
 void script_free_vars(struct linkdb_node **node);
+int script_vars_pack(struct linkdb_node* node, unsigned char* buf, int size);
+int script_vars_unpack(struct linkdb_node** node, const unsigned char* buf, int len);
 struct script_state* script_alloc_state(struct script_code* script, int pos, int rid, int oid);
 void script_free_state(struct script_state* st);
 
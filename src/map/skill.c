@@ -11876,9 +11876,11 @@ int do_init_skill (void)
 	skill_readdb();
 
 	group_db = idb_alloc(DB_OPT_BASE);
-	skillunit_db = idb_alloc(DB_OPT_BASE);
+	skillunit_db = idb_alloc(DB_OPT_FLAT);
 	skill_unit_ers = ers_new(sizeof(struct skill_unit_group));
 	skill_timer_ers  = ers_new(sizeof(struct skill_timerskill));
+	ers_prewarm(skill_unit_ers, battle_config.ers_prewarm);
+	ers_prewarm(skill_timer_ers, battle_config.ers_prewarm);
 
 	add_timer_func_list(skill_unit_timer,"skill_unit_timer");
 	add_timer_func_list(skill_castend_id,"skill_castend_id");
@@ -683,6 +683,9 @@ int status_damage(struct block_list *src,struct block_list *target,int hp, int s
 		sp = 0;
 	}
 
+	if( target->prev != NULL && map[target->m].frozen )
+		return 0; // parked while the map is handed off, nothing dies or drops until it moved
+
 	if (target->type == BL_SKILL)
 		return skill_unit_ondamaged((struct skill_unit *)target, src, hp, gettick());
 
@@ -1701,7 +1704,8 @@ int status_calc_pc_(struct map_session_data* sd, bool first)
 		return -1;
 
 	// remember player-specific values that are currently being shown to the client (for refresh purposes)
-	memcpy(b_skill, &sd->status.skill, sizeof(b_skill));
+	if( sd->bl.prev ) // the skills are only compared when the client is refreshed
+		memcpy(b_skill, &sd->status.skill, sizeof(b_skill));
 	b_weight = sd->weight;
 	b_max_weight = sd->max_weight;
 
@@ -1774,6 +1778,7 @@ int status_calc_pc_(struct map_session_data* sd, bool first)
 
 	memset (&sd->right_weapon.overrefine, 0, sizeof(sd->right_weapon) - sizeof(sd->right_weapon.atkmods));
 	memset (&sd->left_weapon.overrefine, 0, sizeof(sd->left_weapon) - sizeof(sd->left_weapon.atkmods));
+	sd->cardfix_atk.valid = sd->cardfix_def.valid = false;
 
 	if (sd->special_state.intravision) //Clear status change.
 		clif_status_load(&sd->bl, SI_INTRAVISION, 0);
@@ -1928,10 +1933,10 @@ int status_calc_pc_(struct map_session_data* sd, bool first)
 			if(sd->inventory_data[index]->script) {
 				if (wd == &sd->left_weapon) {
 					sd->state.lr_flag = 1;
-					run_script(sd->inventory_data[index]->script,0,sd->bl.id,0);
+					script_run_bonus(sd->inventory_data[index]->script, sd);
 					sd->state.lr_flag = 0;
 				} else
-					run_script(sd->inventory_data[index]->script,0,sd->bl.id,0);
+					script_run_bonus(sd->inventory_data[index]->script, sd);
 				if (!calculating) //Abort, run_script retriggered this. [Skotlex]
 					return 1;
 			}
@@ -1950,7 +1955,7 @@ int status_calc_pc_(struct map_session_data* sd, bool first)
 		else if(sd->inventory_data[index]->type == IT_ARMOR) {
 			refinedef += sd->status.inventory[index].refine*refinebonus[0][0];
 			if(sd->inventory_data[index]->script) {
-				run_script(sd->inventory_data[index]->script,0,sd->bl.id,0);
+				script_run_bonus(sd->inventory_data[index]->script, sd);
 				if (!calculating) //Abort, run_script retriggered this. [Skotlex]
 					return 1;
 			}
@@ -1962,7 +1967,7 @@ int status_calc_pc_(struct map_session_data* sd, bool first)
 		if(sd->inventory_data[index]){		// Arrows
 			sd->arrow_atk += sd->inventory_data[index]->atk;
 			sd->state.lr_flag = 2;
-			run_script(sd->inventory_data[index]->script,0,sd->bl.id,0);
+			script_run_bonus(sd->inventory_data[index]->script, sd);
 			sd->state.lr_flag = 0;
 			if (!calculating) //Abort, run_script retriggered status_calc_pc. [Skotlex]
 				return 1;
@@ -2024,10 +2029,10 @@ int status_calc_pc_(struct map_session_data* sd, bool first)
 				if(i == EQI_HAND_L && sd->status.inventory[index].equip == EQP_HAND_L)
 				{	//Left hand status.
 					sd->state.lr_flag = 1;
-					run_script(data->script,0,sd->bl.id,0);
+					script_run_bonus(data->script, sd);
 					sd->state.lr_flag = 0;
 				} else
-					run_script(data->script,0,sd->bl.id,0);
+					script_run_bonus(data->script, sd);
 				if (!calculating) //Abort, run_script his function. [Skotlex]
 					return 1;
 			}
@@ -2038,7 +2043,7 @@ int status_calc_pc_(struct map_session_data* sd, bool first)
 	{
 		struct item_data *data = itemdb_exists(sc->data[SC_ITEMSCRIPT]->val1);
 		if( data && data->script )
-			run_script(data->script,0,sd->bl.id,0);
+			script_run_bonus(data->script, sd);
 	}
 
 	if( sd->pd )
@@ -2743,6 +2748,92 @@ void status_calc_regen_rate(struct block_list *bl, struct regen_data *regen, str
 	}
 }
 
+/// Stats that are calculated from another stat.
+/// The status changes that modify each stat are in StatusChangeFlagTable.
+static const struct {
+	enum scb_flag flag;// stat
+	int type;// object types (BL_*) the dependency applies to
+	int deps;// stats calculated from it (SCB_*)
+} status_dependency[] = {
+	{ SCB_STR, BL_ALL,             SCB_BATK },
+	{ SCB_STR, BL_HOM,             SCB_WATK },
+	{ SCB_AGI, BL_ALL,             SCB_FLEE },
+	{ SCB_AGI, BL_PC|BL_HOM,       SCB_ASPD|SCB_DSPD },
+	{ SCB_VIT, BL_ALL,             SCB_DEF2|SCB_MDEF2 },
+	{ SCB_VIT, BL_PC|BL_HOM|BL_MER, SCB_MAXHP },
+	{ SCB_VIT, BL_HOM,             SCB_DEF },
+	{ SCB_INT, BL_ALL,             SCB_MATK|SCB_MDEF2 },
+	{ SCB_INT, BL_PC|BL_HOM|BL_MER, SCB_MAXSP },
+	{ SCB_INT, BL_HOM,             SCB_MDEF },
+	{ SCB_DEX, BL_ALL,             SCB_BATK|SCB_HIT },
+	{ SCB_DEX, BL_PC|BL_HOM,       SCB_ASPD },
+	{ SCB_DEX, BL_HOM,             SCB_WATK },
+	{ SCB_LUK, BL_ALL,             SCB_BATK|SCB_CRI|SCB_FLEE2 },
+};
+
+/// How often each stat was recalculated, see status_calc_report.
+static struct {
+	unsigned int count[32];// per SCB_* bit
+	unsigned int skipped[32];// dependent stats not recalculated because the stat didn't change
+	unsigned int copies;// battle status copied from the base status (no status changes)
+	unsigned int start;
+} status_calc_stats;
+
+/// Adds the stats that have to be recalculated after the given stat was to flag.
+/// If its value didn't change (and the base status wasn't recalculated),
+/// nothing that depends on it has to be calculated again.
+static int status_calc_dependencies(struct block_list* bl, enum scb_flag stat, bool changed, int flag)
+{
+	int i, deps = 0;
+
+	for( i = 0; i < ARRAYLENGTH(status_dependency); ++i )
+		if( status_dependency[i].flag == stat && bl->type&status_dependency[i].type )
+			deps |= status_dependency[i].deps;
+	if( changed )
+		return flag|deps;
+
+	for( i = 0; i < 32; ++i )
+		if( deps&~flag&(1<<i) )
+			++status_calc_stats.skipped[i];
+	return flag;
+}
+
+static void status_calc_count(int flag)
+{
+	int i;
+	for( i = 0; i < 32; ++i )
+		if( flag&(1<<i) )
+			++status_calc_stats.count[i];
+}
+
+/// Shows how often each stat was recalculated since the last reset.
+void status_calc_report(bool reset)
+{
+	static const char* names[32] = {
+		"base", "maxhp", "maxsp", "str", "agi", "vit", "int", "dex", "luk", "batk", "watk", "matk", "hit", "flee", "def", "def2",
+		"mdef", "mdef2", "speed", "aspd", "dspd", "cri", "flee2", "atk_ele", "def_ele", "mode", "size", "race", "range", "regen", "dye", "",
+	};
+	double sec = DIFF_TICK(gettick(), status_calc_stats.start)/1000.;
+	int i;
+
+	if( reset )
+	{
+		memset(&status_calc_stats, 0, sizeof(status_calc_stats));
+		status_calc_stats.start = gettick();
+		ShowInfo("Status calculation counters reset.\n");
+		return;
+	}
+
+	ShowInfo("Status calculations (%.1f seconds recorded, %u copies of the base status):\n", sec, status_calc_stats.copies);
+	ShowMessage("  %-8s %10s %10s %10s\n", "stat", "count", "per sec", "skipped");
+	for( i = 0; i < 32; ++i )
+	{
+		if( !status_calc_stats.count[i] && !status_calc_stats.skipped[i] )
+			continue;
+		ShowMessage("  %-8s %10u %10.1f %10u\n", names[i], status_calc_stats.count[i], sec > 0 ? status_calc_stats.count[i]/sec : 0., status_calc_stats.skipped[i]);
+	}
+}
+
 /// Recalculates parts of an object's battle status according to the specified flags.
 /// @param flag bitfield of values from enum scb_flag
 void status_calc_bl_main(struct block_list *bl, /*enum scb_flag*/int flag)
@@ -2758,53 +2849,44 @@ void status_calc_bl_main(struct block_list *bl, /*enum scb_flag*/int flag)
 
 	if((!(bl->type&BL_REGEN)) && (!sc || !sc->count)) { //No difference.
 		status_cpy(status, b_status);
+		++status_calc_stats.copies;
 		return;
 	}
 
 	if(flag&SCB_STR) {
+		temp = status->str;
 		status->str = status_calc_str(bl, sc, b_status->str);
-		flag|=SCB_BATK;
-		if( bl->type&BL_HOM )
-			flag |= SCB_WATK;
+		flag = status_calc_dependencies(bl, SCB_STR, status->str != temp || flag&SCB_BASE, flag);
 	}
 
 	if(flag&SCB_AGI) {
+		temp = status->agi;
 		status->agi = status_calc_agi(bl, sc, b_status->agi);
-		flag|=SCB_FLEE;
-		if( bl->type&(BL_PC|BL_HOM) )
-			flag |= SCB_ASPD|SCB_DSPD;
+		flag = status_calc_dependencies(bl, SCB_AGI, status->agi != temp || flag&SCB_BASE, flag);
 	}
 
 	if(flag&SCB_VIT) {
+		temp = status->vit;
 		status->vit = status_calc_vit(bl, sc, b_status->vit);
-		flag|=SCB_DEF2|SCB_MDEF2;
-		if( bl->type&(BL_PC|BL_HOM|BL_MER) )
-			flag |= SCB_MAXHP;
-		if( bl->type&BL_HOM )
-			flag |= SCB_DEF;
+		flag = status_calc_dependencies(bl, SCB_VIT, status->vit != temp || flag&SCB_BASE, flag);
 	}
 
 	if(flag&SCB_INT) {
+		temp = status->int_;
 		status->int_ = status_calc_int(bl, sc, b_status->int_);
-		flag|=SCB_MATK|SCB_MDEF2;
-		if( bl->type&(BL_PC|BL_HOM|BL_MER) )
-			flag |= SCB_MAXSP;
-		if( bl->type&BL_HOM )
-			flag |= SCB_MDEF;
+		flag = status_calc_dependencies(bl, SCB_INT, status->int_ != temp || flag&SCB_BASE, flag);
 	}
 
 	if(flag&SCB_DEX) {
+		temp = status->dex;
 		status->dex = status_calc_dex(bl, sc, b_status->dex);
-		flag|=SCB_BATK|SCB_HIT;
-		if( bl->type&(BL_PC|BL_HOM) )
-			flag |= SCB_ASPD;
-		if( bl->type&BL_HOM )
-			flag |= SCB_WATK;
+		flag = status_calc_dependencies(bl, SCB_DEX, status->dex != temp || flag&SCB_BASE, flag);
 	}
 
 	if(flag&SCB_LUK) {
+		temp = status->luk;
 		status->luk = status_calc_luk(bl, sc, b_status->luk);
-		flag|=SCB_BATK|SCB_CRI|SCB_FLEE2;
+		flag = status_calc_dependencies(bl, SCB_LUK, status->luk != temp || flag&SCB_BASE, flag);
 	}
 
 	if(flag&SCB_BATK && b_status->batk) {
@@ -3094,6 +3176,8 @@ void status_calc_bl_main(struct block_list *bl, /*enum scb_flag*/int flag)
 
 	if(flag&SCB_REGEN && bl->type&BL_REGEN)
 		status_calc_regen_rate(bl, status_get_regen_data(bl), sc);
+
+	status_calc_count(flag);
 }
 
 /// Recalculates parts of an object's base status and battle status according to the specified flags.
@@ -7841,7 +7925,9 @@ int do_init_status(void)
 	status_readdb();
 	status_calc_sigma();
 	natural_heal_prev_tick = gettick();
+	status_calc_stats.start = natural_heal_prev_tick;
 	sc_data_ers = ers_new(sizeof(struct status_change_entry));
+	ers_prewarm(sc_data_ers, battle_config.ers_prewarm);
 	add_timer_interval(natural_heal_prev_tick + NATURAL_HEAL_INTERVAL, status_natural_heal_timer, 0, 0, NATURAL_HEAL_INTERVAL);
 	return 0;
 }
@@ -361,6 +361,9 @@ int storage_guild_storageopen(struct map_session_data* sd)
 
 	if(sd->state.storage_flag)
 		return 1; //Can't open both storages at a time.
+
+	if( sd->state.replay )
+		return 1; // replayed session, the guild storage is shared with the live characters
 	
 	if( !pc_can_give_items(pc_isGM(sd)) ) { //check is this GM level can open guild storage and store items [Lupus]
 		clif_displaymessage(sd->fd, msg_txt(246));
@@ -321,6 +321,8 @@ char input_nextstate()
 	return state;
 }
 
+int input_final(void);
+
 /// Returns if data is available from asynchronous input.
 /// If data is available, it's put in the local buffer.
 int input_hasdata()
@@ -328,6 +330,8 @@ int input_hasdata()
 	struct pollfd fds;
 	int hasData;
 
+	if( input_getstate() == INPUT_CLOSED )
+		return 0;
 	if( input_getstate() == INPUT_READY )
 	{// start getting data
 		input_setstate(INPUT_WAITING);
@@ -339,7 +343,12 @@ int input_hasdata()
 	hasData = ( poll(&fds,1,0) > 0 );
 	if( hasData )
 	{// read the data from the pipe
-		read(buf.data_pipe[PIPE_READ], &buf.len, sizeof(buf.len));
+		if( read(buf.data_pipe[PIPE_READ], &buf.len, sizeof(buf.len)) != sizeof(buf.len) )
+		{// the worker ended (end of input)
+			input_final();
+			buf.state = INPUT_CLOSED;
+			return 0;
+		}
 		read(buf.data_pipe[PIPE_READ], buf.arr, buf.len);
 		input_setstate(INPUT_READY);
 	}
@@ -405,7 +414,8 @@ WORKER_FUNC_START(getinput)
 	{// get input
 		input_setstate(INPUT_READING);
 		buf.arr[0] = '\0';
-		fgets(buf.arr, INPUT_BUFSIZE, stdin);
+		if( fgets(buf.arr, INPUT_BUFSIZE, stdin) == NULL )
+			break;// end of input, the main process sees the pipe close
 		buf.len = strlen(buf.arr);
 		input_setstate(INPUT_READY);
 	}
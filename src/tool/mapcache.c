@@ -6,6 +6,9 @@
 #include "../common/malloc.h"
 #include "../common/mmo.h"
 #include "../common/showmsg.h"
+#include "../common/strlib.h"
+#include "../common/thread.h"
+#include "../common/utils.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,10 +24,9 @@ char grf_list_file[256] = "conf/grf-files.txt";
 char map_list_file[256] = "db/map_index.txt";
 char map_cache_file[256] = "db/map_cache.dat";
 int rebuild = 0;
-
-FILE *map_cache_fp;
-
-unsigned long file_size;
+int threads = 4; // threads that convert and compress the maps
+#define MAX_THREADS 32
+#define MAP_BATCH 64 // maps read from the GRF files at the same time
 
 // Used internally, this structure contains the physical map cells
 struct map_data {
@@ -37,7 +39,7 @@ struct map_data {
 struct main_header {
 	uint32 file_size;
 	uint16 map_count;
-} header;
+};
 
 // This is the header appended before every compressed map cells info
 struct map_info {
@@ -102,44 +104,222 @@ float GetFloat(const unsigned char* buf)
 }
 
 
-// Reads a map from GRF's GAT and RSW files
-int read_map(char *name, struct map_data *m)
+// A map of the cache, with its compressed cells
+struct cache_entry {
+	char name[MAP_NAME_LENGTH];
+	int16 xs;
+	int16 ys;
+	int32 len;
+	unsigned char *data; // compressed cells
+	unsigned long hash; // fingerprint of the GAT and RSW files, 0 if unknown
+	unsigned long new_hash; // fingerprint of the changed files, 0 if the map didn't change
+	bool listed; // in the map list
+};
+
+struct cache_entry *cache = NULL;
+int cache_count = 0;
+int cache_max = 0;
+
+// A map being read from the GRF files, converted and compressed by the worker threads
+struct map_job {
+	struct cache_entry *entry;
+	unsigned char *gat;
+	unsigned char *rsw;
+	struct map_data m;
+	unsigned char *write_buf;
+	unsigned long len;
+};
+
+// Shared state of the worker threads
+struct map_batch {
+	struct map_job *jobs;
+	int count;
+	int next;
+	amutex *mutex;
+};
+
+
+// Finds a map in the cache
+struct cache_entry* find_map(const char *name)
+{
+	int i;
+
+	for(i = 0; i < cache_count; i++)
+		if(strcmp(name, cache[i].name) == 0)
+			return &cache[i];
+
+	return NULL;
+}
+
+// Adds an empty map to the cache
+struct cache_entry* add_map(const char *name)
+{
+	struct cache_entry *entry;
+
+	if(cache_count >= cache_max) {
+		cache_max = max(64, cache_max*2);
+		RECREATE(cache, struct cache_entry, cache_max);
+	}
+	entry = &cache[cache_count++];
+	memset(entry, 0, sizeof(*entry));
+	safestrncpy(entry->name, name, sizeof(entry->name));
+	return entry;
+}
+
+// Reads the maps of an existing map cache
+void load_cache(void)
+{
+	FILE *fp;
+	unsigned char buf[sizeof(struct main_header)];
+	int i, count;
+
+	fp = fopen(map_cache_file, "rb");
+	if(fp == NULL)
+		return;
+
+	if(fread(buf, sizeof(buf), 1, fp) != 1) {
+		fclose(fp);
+		return;
+	}
+	count = GetUShort(buf + 4);
+	for(i = 0; i < count; i++) {
+		struct map_info info;
+		struct cache_entry *entry;
+		char name[MAP_NAME_LENGTH];
+
+		if(fread(&info, sizeof(info), 1, fp) != 1)
+			break;
+		safestrncpy(name, info.name, sizeof(name));
+		entry = add_map(name);
+		entry->xs = (int16)GetUShort((unsigned char *)&info.xs);
+		entry->ys = (int16)GetUShort((unsigned char *)&info.ys);
+		entry->len = GetLong((unsigned char *)&info.len);
+		entry->data = (unsigned char *)aMalloc(entry->len);
+		if(fread(entry->data, 1, entry->len, fp) != (size_t)entry->len) {
+			ShowWarning("Map cache %s is truncated, dropping the map '%s'\n", map_cache_file, name);
+			aFree(entry->data);
+			cache_count--;
+			break;
+		}
+	}
+	fclose(fp);
+}
+
+// Reads the fingerprints of the maps' GAT and RSW files
+// (kept next to the map cache, which doesn't have room for them)
+void load_hashes(void)
+{
+	char filename[256+5];
+	char line[256];
+	FILE *fp;
+
+	safesnprintf(filename, sizeof(filename), "%s.hash", map_cache_file);
+	fp = fopen(filename, "r");
+	if(fp == NULL)
+		return;
+	while(fgets(line, sizeof(line), fp)) {
+		char name[MAP_NAME_LENGTH_EXT];
+		unsigned long hash;
+		struct cache_entry *entry;
+
+		if(sscanf(line, "%15s %lx", name, &hash) == 2 && (entry = find_map(name)) != NULL)
+			entry->hash = hash;
+	}
+	fclose(fp);
+}
+
+// Writes a file through a temporary file, so an interrupted write keeps the old one
+FILE* begin_write(const char *filename, char *tmpname, size_t size)
+{
+	safesnprintf(tmpname, size, "%s.tmp", filename);
+	return fopen(tmpname, "wb");
+}
+
+bool end_write(FILE *fp, const char *filename, const char *tmpname)
 {
-	char filename[256];
-	unsigned char *gat, *rsw;
+	if(ferror(fp)) {
+		fclose(fp);
+		remove(tmpname);
+		return false;
+	}
+	fclose(fp);
+#ifdef _WIN32
+	remove(filename); // rename doesn't replace files on windows
+#endif
+	if(rename(tmpname, filename) != 0) {
+		remove(tmpname);
+		return false;
+	}
+	return true;
+}
+
+// Writes the map cache and the fingerprints of its maps
+void save_cache(void)
+{
+	char tmpname[256+5];
+	char filename[256+5];
+	FILE *fp;
+	struct main_header h;
+	uint32 file_size = sizeof(struct main_header);
+	int i;
+
+	memset(&h, 0, sizeof(h));
+	fp = begin_write(map_cache_file, tmpname, sizeof(tmpname));
+	if(fp == NULL) {
+		ShowError("Failure when opening map cache file %s\n", tmpname);
+		exit(EXIT_FAILURE);
+	}
+	fwrite(&h, sizeof(h), 1, fp); // written again at the end
+	for(i = 0; i < cache_count; i++) {
+		struct map_info info;
+		memset(&info, 0, sizeof(info));
+		strncpy(info.name, cache[i].name, MAP_NAME_LENGTH);
+		info.xs = MakeShortLE(cache[i].xs);
+		info.ys = MakeShortLE(cache[i].ys);
+		info.len = MakeLongLE(cache[i].len);
+		fwrite(&info, sizeof(info), 1, fp);
+		fwrite(cache[i].data, 1, cache[i].len, fp);
+		file_size += sizeof(info) + cache[i].len;
+	}
+	h.file_size = MakeLongLE(file_size);
+	h.map_count = MakeShortLE((int16)cache_count);
+	fseek(fp, 0, SEEK_SET);
+	fwrite(&h, sizeof(h), 1, fp);
+	if(!end_write(fp, map_cache_file, tmpname)) {
+		ShowError("Failure when writing map cache file %s\n", map_cache_file);
+		exit(EXIT_FAILURE);
+	}
+
+	safesnprintf(filename, sizeof(filename), "%s.hash", map_cache_file);
+	fp = begin_write(filename, tmpname, sizeof(tmpname));
+	if(fp != NULL) {
+		for(i = 0; i < cache_count; i++)
+			if(cache[i].hash != 0)
+				fprintf(fp, "%s %08lx\n", cache[i].name, cache[i].hash);
+		if(end_write(fp, filename, tmpname))
+			return;
+	}
+	ShowWarning("Failure when writing %s, all maps will be cached again next time\n", filename);
+}
+
+// Converts the GAT and RSW files of a map into cells and compresses them (any thread)
+void convert_map(struct map_job *job)
+{
+	unsigned char *gat = job->gat;
+	struct map_data *m = &job->m;
 	int water_height;
 	size_t xy, off, num_cells;
 	float height;
 	uint32 type;
 
-	// Open map GAT
-	sprintf(filename,"data\\%s.gat", name);
-	gat = (unsigned char *)grfio_read(filename);
-	if (gat == NULL)
-		return 0;
-
-	// Open map RSW
-	sprintf(filename,"data\\%s.rsw", name);
-	rsw = (unsigned char *)grfio_read(filename);
-
 	// Read water height
-	if (rsw) { 
-		water_height = (int)GetFloat(rsw+166);
-		aFree(rsw);
-	} else
+	if (job->rsw)
+		water_height = (int)GetFloat(job->rsw+166);
+	else
 		water_height = NO_WATER;
 
-	// Read map size and allocate needed memory
-	m->xs = (int16)GetULong(gat+6);
-	m->ys = (int16)GetULong(gat+10);
-	if (m->xs <= 0 || m->ys <= 0) {
-		aFree(gat);
-		return 0;
-	}
-	num_cells = (size_t)m->xs*(size_t)m->ys;
-	m->cells = (unsigned char *)aMalloc(num_cells);
-
 	// Set cell properties
+	num_cells = (size_t)m->xs*(size_t)m->ys;
 	off = 14;
 	for (xy = 0; xy < num_cells; xy++)
 	{
@@ -155,60 +335,120 @@ int read_map(char *name, struct map_data *m)
 		m->cells[xy] = (unsigned char)type;
 	}
 
-	aFree(gat);
-
-	return 1;
+	// Compress the cells and get the compressed length
+	encode_zip(job->write_buf, &job->len, m->cells, (unsigned long)num_cells);
 }
 
-// Adds a map to the cache
-void cache_map(char *name, struct map_data *m)
+void convert_main(void *arg)
 {
-	struct map_info info;
-	unsigned long len;
-	unsigned char *write_buf;
+	struct map_batch *batch = (struct map_batch *)arg;
 
-	// Create an output buffer twice as big as the uncompressed map... this way we're sure it fits
-	len = (unsigned long)m->xs*(unsigned long)m->ys*2;
-	write_buf = (unsigned char *)aMalloc(len);
-	// Compress the cells and get the compressed length
-	encode_zip(write_buf, &len, m->cells, m->xs*m->ys);
+	for(;;) {
+		int i;
 
-	// Fill the map header
-	strncpy(info.name, name, MAP_NAME_LENGTH);
-	info.xs = MakeShortLE(m->xs);
-	info.ys = MakeShortLE(m->ys);
-	info.len = MakeLongLE(len);
+		amutex_lock(batch->mutex);
+		i = batch->next++;
+		amutex_unlock(batch->mutex);
 
-	// Append map header then compressed cells at the end of the file
-	fseek(map_cache_fp, header.file_size, SEEK_SET);
-	fwrite(&info, sizeof(struct map_info), 1, map_cache_fp);
-	fwrite(write_buf, 1, len, map_cache_fp);
-	header.file_size += sizeof(struct map_info) + len;
-	header.map_count++;
-
-	aFree(write_buf);
-	aFree(m->cells);
-
-	return;
+		if(i >= batch->count)
+			break;
+		if(batch->jobs[i].m.cells != NULL)
+			convert_map(&batch->jobs[i]);
+	}
 }
 
-// Checks whether a map is already is the cache
-int find_map(char *name)
+// Reads maps from GRF's GAT and RSW files and caches them, using several threads
+void cache_maps(struct cache_entry **entries, int count)
 {
-	int i;
-	struct map_info info;
-
-	fseek(map_cache_fp, sizeof(struct main_header), SEEK_SET);
+	struct map_batch batch;
+	athread *workers[MAX_THREADS];
+	const char **fnames;
+	char (*names)[256];
+	void **data;
+	int *size;
+	int i, nthreads = 0;
+
+	fnames = (const char **)aMalloc(count*2*sizeof(char*));
+	names = (char (*)[256])aMalloc(count*2*sizeof(*names));
+	data = (void **)aMalloc(count*2*sizeof(void*));
+	size = (int *)aCalloc(count*2, sizeof(int));
+	for(i = 0; i < count; i++) {
+		sprintf(names[i*2], "data\\%s.gat", entries[i]->name);
+		sprintf(names[i*2+1], "data\\%s.rsw", entries[i]->name);
+		fnames[i*2] = names[i*2];
+		fnames[i*2+1] = names[i*2+1];
+	}
+	grfio_reads_batch(fnames, count*2, data, size);
+
+	batch.jobs = (struct map_job *)aCalloc(count, sizeof(struct map_job));
+	batch.count = count;
+	batch.next = 0;
+	batch.mutex = amutex_create();
+	for(i = 0; i < count; i++) {
+		struct map_job *job = &batch.jobs[i];
+
+		job->entry = entries[i];
+		job->gat = (unsigned char *)data[i*2];
+		job->rsw = (unsigned char *)data[i*2+1];
+		if(job->rsw != NULL && size[i*2+1] < 170) {
+			aFree(job->rsw); // no water height
+			job->rsw = NULL;
+		}
+		if(job->gat == NULL || size[i*2] < 14)
+			continue;
 
-	for(i = 0; i < header.map_count; i++) {
-		fread(&info, sizeof(info), 1, map_cache_fp);
-		if(strcmp(name, info.name) == 0) // Map found
-			return 1;
-		else // Map not found, jump to the beginning of the next map info header
-			fseek(map_cache_fp, GetLong((unsigned char *)&(info.len)), SEEK_CUR);
+		// Read map size and allocate needed memory
+		job->m.xs = (int16)GetULong(job->gat+6);
+		job->m.ys = (int16)GetULong(job->gat+10);
+		if (job->m.xs <= 0 || job->m.ys <= 0 || (size_t)size[i*2] < 14 + (size_t)job->m.xs*(size_t)job->m.ys*20)
+			continue;
+		job->m.cells = (unsigned char *)aMalloc((size_t)job->m.xs*(size_t)job->m.ys);
+		// Create an output buffer twice as big as the uncompressed map... this way we're sure it fits
+		job->len = (unsigned long)job->m.xs*(unsigned long)job->m.ys*2 + 64;
+		job->write_buf = (unsigned char *)aMalloc(job->len);
 	}
 
-	return 0;
+	while(nthreads < threads && nthreads < count - 1) {
+		workers[nthreads] = athread_create(convert_main, &batch);
+		if(workers[nthreads] == NULL)
+			break;
+		nthreads++;
+	}
+	convert_main(&batch);
+	for(i = 0; i < nthreads; i++)
+		athread_join(workers[i]);
+	amutex_destroy(batch.mutex);
+
+	for(i = 0; i < count; i++) {
+		struct map_job *job = &batch.jobs[i];
+		struct cache_entry *entry = job->entry;
+
+		if(job->m.cells == NULL) {
+			if(entry->data != NULL)
+				ShowWarning("Map '"CL_WHITE"%s"CL_RESET"' can't be read, keeping the cached one.\n", entry->name);
+			else
+				ShowError("Map '"CL_WHITE"%s"CL_RESET"' not found!\n", entry->name);
+		} else {
+			if(entry->data != NULL)
+				aFree(entry->data);
+			entry->xs = job->m.xs;
+			entry->ys = job->m.ys;
+			entry->len = (int32)job->len;
+			entry->data = job->write_buf;
+			entry->hash = entry->new_hash;
+			ShowInfo("Map '"CL_WHITE"%s"CL_RESET"' successfully cached.\n", entry->name);
+			aFree(job->m.cells);
+		}
+		if(job->gat)
+			aFree(job->gat);
+		if(job->rsw)
+			aFree(job->rsw);
+	}
+	aFree(batch.jobs);
+	aFree(fnames);
+	aFree(names);
+	aFree(data);
+	aFree(size);
 }
 
 // Cuts the extension from a map name
@@ -240,6 +480,9 @@ void process_args(int argc, char *argv[])
 		} else if(strcmp(argv[i], "-cache") == 0) {
 			if(++i < argc)
 				strcpy(map_cache_file, argv[i]);
+		} else if(strcmp(argv[i], "-threads") == 0) {
+			if(++i < argc)
+				threads = cap_value(atoi(argv[i]), 0, MAX_THREADS);
 		} else if(strcmp(argv[i], "-rebuild") == 0)
 			rebuild = 1;
 	}
@@ -250,8 +493,10 @@ int do_init(int argc, char** argv)
 {
 	FILE *list;
 	char line[1024];
-	struct map_data map;
 	char name[MAP_NAME_LENGTH_EXT];
+	struct cache_entry **changed;
+	int changed_count = 0, unchanged_count = 0;
+	int i;
 
 	// Process the command-line arguments
 	process_args(argc, argv);
@@ -259,23 +504,13 @@ int do_init(int argc, char** argv)
 	ShowStatus("Initializing grfio with %s\n", grf_list_file);
 	grfio_init(grf_list_file);
 
-	// Attempt to open the map cache file and force rebuild if not found
+	// Read the existing map cache, the maps that didn't change are kept
 	ShowStatus("Opening map cache: %s\n", map_cache_file);
 	if(!rebuild) {
-		map_cache_fp = fopen(map_cache_file, "rb");
-		if(map_cache_fp == NULL) {
+		load_cache();
+		if(cache_count == 0)
 			ShowNotice("Existing map cache not found, forcing rebuild mode\n");
-			rebuild = 1;
-		} else
-			fclose(map_cache_fp);
-	}
-	if(rebuild)
-		map_cache_fp = fopen(map_cache_file, "w+b");
-	else
-		map_cache_fp = fopen(map_cache_file, "r+b");
-	if(map_cache_fp == NULL) {
-		ShowError("Failure when opening map cache file %s\n", map_cache_file);
-		exit(EXIT_FAILURE);
+		load_hashes();
 	}
 
 	// Open the map list
@@ -286,19 +521,13 @@ int do_init(int argc, char** argv)
 		exit(EXIT_FAILURE);
 	}
 
-	// Initialize the main header
-	if(rebuild) {
-		header.file_size = sizeof(struct main_header);
-		header.map_count = 0;
-	} else {
-		fread(&header, sizeof(struct main_header), 1, map_cache_fp);
-		header.file_size = GetULong((unsigned char *)&(header.file_size));
-		header.map_count = GetUShort((unsigned char *)&(header.map_count));
-	}
-
-	// Read and process the map list
+	// Read the map list and find the maps whose GAT or RSW file changed
+	changed = NULL;
 	while(fgets(line, sizeof(line), list))
 	{
+		struct cache_entry *entry;
+		unsigned long hash;
+
 		if(line[0] == '/' && line[1] == '/')
 			continue;
 
@@ -310,29 +539,81 @@ int do_init(int argc, char** argv)
 
 		name[MAP_NAME_LENGTH_EXT-1] = '\0';
 		remove_extension(name);
-		if(find_map(name))
-			ShowInfo("Map '"CL_WHITE"%s"CL_RESET"' already in cache.\n", name);
-		else if(read_map(name, &map)) {
-			cache_map(name, &map);
-			ShowInfo("Map '"CL_WHITE"%s"CL_RESET"' successfully cached.\n", name);
-		} else
-			ShowError("Map '"CL_WHITE"%s"CL_RESET"' not found!\n", name);
 
+		entry = find_map(name);
+		if(entry != NULL && entry->listed)
+			continue; // listed twice
+		sprintf(line, "data\\%s.gat", name);
+		hash = grfio_fingerprint(line);
+		if(hash != 0) {
+			sprintf(line, "data\\%s.rsw", name);
+			hash = hash*31 + grfio_fingerprint(line);
+		}
+
+		if(entry != NULL && (hash == 0 || hash == entry->hash)) {
+			// unchanged, or the GAT file is gone but the cache still has the map
+			ShowInfo("Map '"CL_WHITE"%s"CL_RESET"' already in cache.\n", name);
+			entry->listed = true;
+			unchanged_count++;
+			continue;
+		}
+		if(entry == NULL) {
+			if(hash == 0) {
+				ShowError("Map '"CL_WHITE"%s"CL_RESET"' not found!\n", name);
+				continue;
+			}
+			entry = add_map(name);
+		}
+		entry->listed = true;
+		entry->new_hash = hash;
+		changed_count++;
 	}
 
 	ShowStatus("Closing map list: %s\n", map_list_file);
 	fclose(list);
 
-	// Write the main header and close the map cache
+	// Cache the new and changed maps, a batch at a time
+	if(changed_count > 0) {
+		int count = 0;
+
+		changed = (struct cache_entry **)aMalloc(min(changed_count, MAP_BATCH)*sizeof(struct cache_entry *));
+		ShowStatus("Caching %d new or changed maps (%d unchanged)...\n", changed_count, unchanged_count);
+		for(i = 0; i < cache_count; i++) {
+			if(cache[i].new_hash == 0)
+				continue;
+			changed[count++] = &cache[i];
+			if(count == MAP_BATCH) {
+				cache_maps(changed, count);
+				count = 0;
+			}
+		}
+		if(count > 0)
+			cache_maps(changed, count);
+		aFree(changed);
+	}
+
+	// Drop the maps that couldn't be read
+	for(i = 0; i < cache_count; ) {
+		if(cache[i].data == NULL) {
+			memmove(&cache[i], &cache[i+1], (cache_count - i - 1)*sizeof(struct cache_entry));
+			cache_count--;
+		} else
+			i++;
+	}
+
+	// Write the map cache
 	ShowStatus("Closing map cache: %s\n", map_cache_file);
-	fseek(map_cache_fp, 0, SEEK_SET);
-	fwrite(&header, sizeof(struct main_header), 1, map_cache_fp);
-	fclose(map_cache_fp);
+	save_cache();
 
 	ShowStatus("Finalizing grfio\n");
 	grfio_final();
 
-	ShowInfo("%d maps now in cache\n", header.map_count);
+	ShowInfo("%d maps now in cache\n", cache_count);
+
+	for(i = 0; i < cache_count; i++)
+		aFree(cache[i].data);
+	if(cache)
+		aFree(cache);
 
 	return 0;
 }